@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "Arena.h"
+#include "Assert007.h"
+
+// Blocks are handed out in multiples of this, which also keeps them
+// aligned for pointers and 64-bit ints.
+#define ARENA_ALIGN 8
+// Blocks bigger than this get a chunk of their own and are never reused.
+#define ARENA_MAX_BLOCK 256
+#define ARENA_NUM_CLASSES (ARENA_MAX_BLOCK / ARENA_ALIGN)
+// Chunks start small, so an Arena per list stays cheap, and double up
+// to the max, so an Arena per index doesn't go back to malloc too often.
+#define ARENA_FIRST_CHUNK 4096
+#define ARENA_MAX_CHUNK (1 << 20)
+
+// Each chunk starts with a header linking it to the previous chunk.
+typedef struct arenaChunk {
+  struct arenaChunk *next;
+  size_t size;
+} ArenaChunk;
+
+// A freed block holds the pointer to the next free block of its size.
+typedef struct freeBlock {
+  struct freeBlock *next;
+} FreeBlock;
+
+struct arena {
+  ArenaChunk *chunks;    // most recent chunk first
+  char *cur;             // next free byte in the current chunk
+  char *end;             // end of the current chunk
+  size_t next_chunk_size;
+  size_t bytes_reserved;
+  FreeBlock *free_lists[ARENA_NUM_CLASSES];  // one per block size
+};
+
+static size_t RoundUpSize(size_t size) {
+  if (size == 0) {
+    size = 1;
+  }
+  return (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+// Mallocs a new chunk with room for at least size bytes after the
+// header and links it into the Arena.
+// Returns a pointer to the usable part of the chunk, or NULL.
+static char *AddChunk(Arena arena, size_t size) {
+  size_t header = RoundUpSize(sizeof(ArenaChunk));
+  ArenaChunk *chunk = (ArenaChunk*)malloc(header + size);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->next = arena->chunks;
+  chunk->size = header + size;
+  arena->chunks = chunk;
+  arena->bytes_reserved += chunk->size;
+  return (char*)chunk + header;
+}
+
+Arena CreateArena() {
+  Arena arena = (Arena)malloc(sizeof(struct arena));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->chunks = NULL;
+  arena->cur = NULL;
+  arena->end = NULL;
+  arena->next_chunk_size = ARENA_FIRST_CHUNK;
+  arena->bytes_reserved = 0;
+  for (int i = 0; i < ARENA_NUM_CLASSES; i++) {
+    arena->free_lists[i] = NULL;
+  }
+  return arena;
+}
+
+void DestroyArena(Arena arena) {
+  Assert007(arena != NULL);
+  ArenaChunk *chunk = arena->chunks;
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+
+void MergeArenas(Arena into, Arena from) {
+  Assert007(into != NULL);
+  Assert007(from != NULL);
+  // Splice from's chunks in after into's current one, so into keeps
+  // bump-allocating where it was. Blocks on from's free lists are just
+  // left unused.
+  ArenaChunk *last = from->chunks;
+  if (last != NULL) {
+    while (last->next != NULL) {
+      last = last->next;
+    }
+    if (into->chunks == NULL) {
+      into->chunks = from->chunks;
+    } else {
+      last->next = into->chunks->next;
+      into->chunks->next = from->chunks;
+    }
+  }
+  into->bytes_reserved += from->bytes_reserved;
+  free(from);
+}
+
+void *ArenaAlloc(Arena arena, size_t size) {
+  Assert007(arena != NULL);
+  size = RoundUpSize(size);
+
+  // Big blocks get their own chunk.
+  if (size > ARENA_MAX_BLOCK) {
+    return AddChunk(arena, size);
+  }
+
+  // Reuse a freed block of the same size if there is one.
+  int size_class = size / ARENA_ALIGN - 1;
+  FreeBlock *block = arena->free_lists[size_class];
+  if (block != NULL) {
+    arena->free_lists[size_class] = block->next;
+    return block;
+  }
+
+  // Otherwise bump-allocate, starting a new chunk if this one is full.
+  if (arena->cur == NULL || (size_t)(arena->end - arena->cur) < size) {
+    size_t chunk_size = arena->next_chunk_size;
+    char *start = AddChunk(arena, chunk_size);
+    if (start == NULL) {
+      return NULL;
+    }
+    arena->cur = start;
+    arena->end = start + chunk_size;
+    if (arena->next_chunk_size < ARENA_MAX_CHUNK) {
+      arena->next_chunk_size *= 2;
+    }
+  }
+  void *result = arena->cur;
+  arena->cur += size;
+  return result;
+}
+
+void ArenaFree(Arena arena, void *block, size_t size) {
+  Assert007(arena != NULL);
+  if (block == NULL) {
+    return;
+  }
+  size = RoundUpSize(size);
+  // Big blocks stay with their chunk until the Arena goes away.
+  if (size > ARENA_MAX_BLOCK) {
+    return;
+  }
+  int size_class = size / ARENA_ALIGN - 1;
+  FreeBlock *freed = (FreeBlock*)block;
+  freed->next = arena->free_lists[size_class];
+  arena->free_lists[size_class] = freed;
+}
+
+size_t ArenaBytesReserved(Arena arena) {
+  Assert007(arena != NULL);
+  return arena->bytes_reserved;
+}
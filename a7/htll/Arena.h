@@ -0,0 +1,62 @@
+// An arena allocator for the many small, same-sized structs that the
+// LinkedList and the indexes are built from.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// An Arena hands out small blocks of memory carved out of big chunks.
+// Blocks can be given back one at a time with ArenaFree, which keeps them
+// on a free list to be reused by the next ArenaAlloc of the same size,
+// but memory only goes back to the system when the whole Arena is
+// destroyed: one free() per chunk instead of one per block.
+//
+// An Arena is not thread-safe; callers sharing one must lock around it.
+typedef struct arena *Arena;
+
+// Creates an empty Arena.  No chunks are allocated until the first
+// ArenaAlloc.
+//
+// Returns the Arena, or NULL if it couldn't be malloc'd.
+Arena CreateArena();
+
+// Destroys an Arena, freeing every block that was ever allocated from
+// it in one go.  Nothing allocated from the Arena may be used afterwards.
+//
+// INPUT: the Arena to destroy.
+void DestroyArena(Arena arena);
+
+// Moves everything allocated from one Arena into another, and destroys
+// the emptied one. Blocks from either stay valid until the Arena they
+// ended up in is destroyed. Handy when threads build pieces of a
+// structure in Arenas of their own and then hand the whole thing over.
+//
+// INPUT: the Arena to move the memory into.
+// INPUT: the Arena to move it out of. Don't use it afterwards.
+void MergeArenas(Arena into, Arena from);
+
+// Allocates a block from the Arena.  The block is aligned for any of
+// the pointer or integer types the htll structs hold.
+//
+// INPUT: the Arena to allocate from.
+// INPUT: the size of the block, in bytes.
+//
+// Returns a pointer to the block, or NULL if out of memory.
+void *ArenaAlloc(Arena arena, size_t size);
+
+// Gives a block back to the Arena so it can be reused.
+//
+// INPUT: the Arena the block came from.
+// INPUT: the block.
+// INPUT: the size it was allocated with.
+void ArenaFree(Arena arena, void *block, size_t size);
+
+// Gets how many bytes the Arena has taken from the system.
+//
+// INPUT: the Arena.
+//
+// Returns the total size of its chunks.
+size_t ArenaBytesReserved(Arena arena);
+
+#endif  // ARENA_H
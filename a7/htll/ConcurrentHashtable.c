@@ -0,0 +1,163 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ConcurrentHashtable.h"
+#include "Assert007.h"
+
+#define CHT_DEFAULT_STRIPES 64
+#define CHT_CACHE_LINE 64
+
+// Each stripe gets a cache line of its own, so threads locking
+// neighbouring stripes don't keep stealing the line from each other.
+typedef struct chtStripe {
+  pthread_rwlock_t lock;
+  Hashtable ht;
+} __attribute__((aligned(CHT_CACHE_LINE))) ChtStripe;
+
+struct concurrentHashtable {
+  int num_stripes;   // always a power of two
+  int stripe_shift;  // 64 - log2(num_stripes)
+  ChtStripe *stripes;
+};
+
+// Picks a key's stripe from the top bits of a mix of the key.  The
+// Hashtable in the stripe picks the bucket from the low bits of the
+// same mix, so the keys in one stripe still spread over all of its
+// buckets.
+static ChtStripe *StripeFor(ConcurrentHashtable cht, uint64_t key) {
+  if (cht->num_stripes == 1) {
+    return &cht->stripes[0];
+  }
+  uint64_t hash = key;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return &cht->stripes[hash >> cht->stripe_shift];
+}
+
+ConcurrentHashtable CreateConcurrentHashtable(int num_buckets,
+                                              int num_stripes) {
+  if (num_buckets <= 0 || num_stripes < 0) {
+    return NULL;
+  }
+  if (num_stripes == 0) {
+    num_stripes = CHT_DEFAULT_STRIPES;
+  }
+
+  ConcurrentHashtable cht =
+      (ConcurrentHashtable)malloc(sizeof(struct concurrentHashtable));
+  if (cht == NULL) {
+    return NULL;
+  }
+  cht->num_stripes = 1;
+  cht->stripe_shift = 64;
+  while (cht->num_stripes < num_stripes) {
+    cht->num_stripes <<= 1;
+    cht->stripe_shift--;
+  }
+  if (posix_memalign((void**)&cht->stripes, CHT_CACHE_LINE,
+                     cht->num_stripes * sizeof(ChtStripe)) != 0) {
+    free(cht);
+    return NULL;
+  }
+
+  int stripe_buckets = num_buckets / cht->num_stripes;
+  if (stripe_buckets < 1) {
+    stripe_buckets = 1;
+  }
+  for (int i = 0; i < cht->num_stripes; i++) {
+    ChtStripe *stripe = &cht->stripes[i];
+    stripe->ht = CreateHashtable(stripe_buckets);
+    if (stripe->ht == NULL) {
+      for (int j = 0; j < i; j++) {
+        pthread_rwlock_destroy(&cht->stripes[j].lock);
+        DestroyHashtable(cht->stripes[j].ht, NULL);
+      }
+      free(cht->stripes);
+      free(cht);
+      return NULL;
+    }
+    // A resize then only holds up the one put that moves a few buckets,
+    // not every thread waiting on the stripe.
+    SetHashtableIncrementalRehash(stripe->ht, 1);
+    pthread_rwlock_init(&stripe->lock, NULL);
+  }
+  return cht;
+}
+
+void DestroyConcurrentHashtable(ConcurrentHashtable cht,
+                                ValueFreeFnPtr value_free_function) {
+  Assert007(cht != NULL);
+  for (int i = 0; i < cht->num_stripes; i++) {
+    pthread_rwlock_destroy(&cht->stripes[i].lock);
+    DestroyHashtable(cht->stripes[i].ht, value_free_function);
+  }
+  free(cht->stripes);
+  free(cht);
+}
+
+int PutInConcurrentHashtable(ConcurrentHashtable cht, HTKeyValue kvp,
+                             HTKeyValue *old_kvp) {
+  Assert007(cht != NULL);
+  ChtStripe *stripe = StripeFor(cht, kvp.key);
+  pthread_rwlock_wrlock(&stripe->lock);
+  int result = PutInHashtable(stripe->ht, kvp, old_kvp);
+  pthread_rwlock_unlock(&stripe->lock);
+  return result;
+}
+
+int LookupInConcurrentHashtable(ConcurrentHashtable cht, uint64_t key,
+                                HTKeyValue *result) {
+  Assert007(cht != NULL);
+  ChtStripe *stripe = StripeFor(cht, key);
+  pthread_rwlock_rdlock(&stripe->lock);
+  int found = LookupInHashtable(stripe->ht, key, result);
+  pthread_rwlock_unlock(&stripe->lock);
+  return found;
+}
+
+int LookupOrPutInConcurrentHashtable(ConcurrentHashtable cht, uint64_t key,
+                                     ValueMakeFnPtr make_value, void *arg,
+                                     HTKeyValue *result) {
+  Assert007(cht != NULL);
+  ChtStripe *stripe = StripeFor(cht, key);
+
+  // Most calls find the key, and can share the stripe to do it.
+  pthread_rwlock_rdlock(&stripe->lock);
+  int found = LookupInHashtable(stripe->ht, key, result);
+  pthread_rwlock_unlock(&stripe->lock);
+  if (found == 0) {
+    return 2;
+  }
+
+  // Another thread may put the key in before we get the write lock, so
+  // look again under it.
+  pthread_rwlock_wrlock(&stripe->lock);
+  int put = LookupOrPutInHashtable(stripe->ht, key, make_value, arg, result);
+  pthread_rwlock_unlock(&stripe->lock);
+  return put;
+}
+
+int RemoveFromConcurrentHashtable(ConcurrentHashtable cht, uint64_t key,
+                                  HTKeyValue *junk_kvp) {
+  Assert007(cht != NULL);
+  ChtStripe *stripe = StripeFor(cht, key);
+  pthread_rwlock_wrlock(&stripe->lock);
+  int result = RemoveFromHashtable(stripe->ht, key, junk_kvp);
+  pthread_rwlock_unlock(&stripe->lock);
+  return result;
+}
+
+int NumElemsInConcurrentHashtable(ConcurrentHashtable cht) {
+  Assert007(cht != NULL);
+  int count = 0;
+  for (int i = 0; i < cht->num_stripes; i++) {
+    pthread_rwlock_rdlock(&cht->stripes[i].lock);
+    count += NumElemsInHashtable(cht->stripes[i].ht);
+    pthread_rwlock_unlock(&cht->stripes[i].lock);
+  }
+  return count;
+}
@@ -0,0 +1,64 @@
+// A Hashtable that many threads can put into and look up in at once.
+
+#ifndef CONCURRENT_HASHTABLE_H
+#define CONCURRENT_HASHTABLE_H
+
+#include <stdint.h>
+
+#include "Hashtable.h"
+
+// A ConcurrentHashtable splits its keys over a number of stripes, each
+// an ordinary Hashtable behind a reader-writer lock of its own.  Threads
+// working on keys in different stripes never wait for each other, and
+// any number of lookups can share a stripe.
+//
+// The table only protects itself: a value found in it can still be
+// removed and freed by another thread, so values that get removed while
+// others may be reading them need protecting by the caller.
+typedef struct concurrentHashtable *ConcurrentHashtable;
+
+// Allocates and returns a new ConcurrentHashtable.
+//
+// INPUT:
+//   num_buckets: how many buckets to start with, across all the stripes.
+//   num_stripes: how many stripes (and locks) to split the keys over.
+//     This is rounded up to a power of two; 0 picks a default of 64.
+//     More stripes than threads keeps threads from meeting on one lock.
+//
+// Returns NULL if the table couldn't be malloc'd, or the table.
+ConcurrentHashtable CreateConcurrentHashtable(int num_buckets,
+                                              int num_stripes);
+
+// Destroys and frees the table.  No other thread may be using it.
+//
+// INPUT:
+//   cht: the table to free.
+//   value_free_function: called once on each value in the table.
+void DestroyConcurrentHashtable(ConcurrentHashtable cht,
+                                ValueFreeFnPtr value_free_function);
+
+// Same as PutInHashtable.
+int PutInConcurrentHashtable(ConcurrentHashtable cht, HTKeyValue kvp,
+                             HTKeyValue *old_kvp);
+
+// Same as LookupInHashtable.  Only takes the stripe's read lock.
+int LookupInConcurrentHashtable(ConcurrentHashtable cht, uint64_t key,
+                                HTKeyValue *result);
+
+// Same as LookupOrPutInHashtable, and atomic: when several threads race
+// to put the same missing key, make_value is called by exactly one of
+// them and all of them get its value back.  make_value runs with the
+// stripe locked, so it mustn't use this table.
+int LookupOrPutInConcurrentHashtable(ConcurrentHashtable cht, uint64_t key,
+                                     ValueMakeFnPtr make_value, void *arg,
+                                     HTKeyValue *result);
+
+// Same as RemoveFromHashtable.
+int RemoveFromConcurrentHashtable(ConcurrentHashtable cht, uint64_t key,
+                                  HTKeyValue *junk_kvp);
+
+// Gets the number of elements in the table.  While other threads are
+// putting or removing, it's only a snapshot of each stripe in turn.
+int NumElemsInConcurrentHashtable(ConcurrentHashtable cht);
+
+#endif  // CONCURRENT_HASHTABLE_H
@@ -10,15 +10,131 @@
 #include "LinkedList.h"
 #include "Assert007.h"
 
-// a free function that does nothing
-static void NullFree(void *freeme) { }
+// By default, double once the table is more than 7/8 full.  Robin Hood
+// probing keeps the probe sequences short even at this load.
+#define HT_DEFAULT_GROWTH_FACTOR 2
+#define HT_DEFAULT_MAX_LOAD 0.875
+// Past this, probe runs get long and a full table can't terminate a probe.
+#define HT_MAX_MAX_LOAD 0.95
+#define HT_MIN_BUCKETS 8
+// The most buckets a table can have: the biggest power of two no more
+// than INT_MAX / 2, so a table and the one it's rehashing into can
+// still be counted, and iterated over, with an int.
+#define HT_MAX_BUCKETS (1 << 29)
+// How many old buckets each put or remove migrates while rehashing.
+// With a growth factor of at least 2 the migration always finishes long
+// before the new table fills up.
+#define HT_REHASH_STEPS 16
+
+// Rounds n up to the next power of two (at least HT_MIN_BUCKETS).
+// Returns -1 if that's more than HT_MAX_BUCKETS.
+static int RoundUpBuckets(int n) {
+  if (n > HT_MAX_BUCKETS) {
+    return -1;
+  }
+  int buckets = HT_MIN_BUCKETS;
+  while (buckets < n) {
+    buckets <<= 1;
+  }
+  return buckets;
+}
+
+// Recomputes how many elements the table can hold before it resizes.
+static void UpdateResizeThreshold(Hashtable ht) {
+  ht->resize_threshold = (int)(ht->num_buckets * ht->max_load);
+  if (ht->resize_threshold >= ht->num_buckets) {
+    ht->resize_threshold = ht->num_buckets - 1;
+  }
+}
+
+// Mix every bit of the key into the low bits (MurmurHash3's 64-bit
+// finalizer) and keep those. Keeping the top bits of a single multiply
+// instead made a table's iteration order sorted by the home bucket any
+// other table would pick, so copying one table into another piled
+// every key into the same few runs.
+static int HomeBucket(int num_buckets, uint64_t key) {
+  uint64_t hash = key;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return (int)(hash & (uint64_t)(num_buckets - 1));
+}
+
+// Places a key/value pair into a bucket array that is known not to
+// contain the key, stealing from the rich (pairs close to home) to give
+// to the poor (pairs far from home) on the way.
+static void PlaceInBuckets(HTBucket *buckets, int num_buckets,
+                           uint64_t key, void *value) {
+  int mask = num_buckets - 1;
+  HTBucket cur;
+  cur.key = key;
+  cur.value = value;
+  cur.dist = 1;
+  cur.moved = 0;
+
+  int i = HomeBucket(num_buckets, key);
+  while (buckets[i].dist != 0) {
+    if (buckets[i].dist < cur.dist) {
+      HTBucket tmp = buckets[i];
+      buckets[i] = cur;
+      cur = tmp;
+    }
+    i = (i + 1) & mask;
+    cur.dist++;
+  }
+  buckets[i] = cur;
+}
+
+// Finds the bucket holding key in a bucket array.  Pairs marked as
+// moved still hold their place in the probe run but never match.
+// Returns the bucket number, or -1 if the key is not there.
+static int FindBucket(HTBucket *buckets, int num_buckets, uint64_t key) {
+  int mask = num_buckets - 1;
+  int i = HomeBucket(num_buckets, key);
+  uint32_t dist = 1;
+
+  // A pair further from home than the bucket we are looking at would
+  // have displaced it, so we can stop as soon as we pass that point.
+  while (buckets[i].dist >= dist) {
+    if (buckets[i].key == key && buckets[i].moved == 0) {
+      return i;
+    }
+    i = (i + 1) & mask;
+    dist++;
+  }
+  return -1;
+}
+
+// Removes the pair in the given bucket, shifting the rest of its probe
+// run back one step so no tombstone is left behind.
+static void DeleteBucket(Hashtable ht, int i) {
+  int mask = ht->num_buckets - 1;
+  int next = (i + 1) & mask;
+
+  while (ht->buckets[next].dist > 1) {
+    ht->buckets[i] = ht->buckets[next];
+    ht->buckets[i].dist--;
+    i = next;
+    next = (next + 1) & mask;
+  }
+  ht->buckets[i].dist = 0;
+  ht->buckets[i].value = NULL;
+  ht->num_elements--;
+}
 
-static void FreeKVP(void *freeme) {
-  free(freeme);
+// Looks for a key that hasn't been migrated yet in the old buckets.
+// Returns the bucket number in old_buckets, or -1.
+static int FindOldBucket(Hashtable ht, uint64_t key) {
+  if (ht->old_buckets == NULL) {
+    return -1;
+  }
+  return FindBucket(ht->old_buckets, ht->old_num_buckets, key);
 }
 
 Hashtable CreateHashtable(int num_buckets) {
-  if (num_buckets == 0)
+  if (num_buckets == 0 || RoundUpBuckets(num_buckets) < 0)
     return NULL;
 
   Hashtable ht = (Hashtable)malloc(sizeof(struct hashtableInfo));
@@ -27,53 +143,41 @@ Hashtable CreateHashtable(int num_buckets) {
     return NULL;
   }
 
-  ht->num_buckets = num_buckets;
+  ht->num_buckets = RoundUpBuckets(num_buckets);
   ht->num_elements = 0;
+  ht->growth_factor = HT_DEFAULT_GROWTH_FACTOR;
+  ht->max_load = HT_DEFAULT_MAX_LOAD;
+  UpdateResizeThreshold(ht);
+  ht->incremental = 0;
+  ht->old_buckets = NULL;
+  ht->old_num_buckets = 0;
+  ht->rehash_index = 0;
   ht->buckets =
-      (LinkedList*)malloc(num_buckets * sizeof(LinkedList));
+      (HTBucket*)calloc(ht->num_buckets, sizeof(HTBucket));
 
   if (ht->buckets == NULL) {
     free(ht);
     return NULL;
   }
-
-  for (int i=  0; i < num_buckets; i++) {
-    ht->buckets[i] = CreateLinkedList();
-    if (ht->buckets[i] == NULL) {
-      // Need to free everything and then return NULL
-      for (int j = 0; j < i; j++) {
-        DestroyLinkedList(ht->buckets[j], NULL);
-      }
-      free(ht);
-      return NULL;
-    }
-  }
   return ht;
 }
 
 
 void DestroyHashtable(Hashtable ht, ValueFreeFnPtr valueFreeFunction) {
-  // Go through each bucket, freeing each bucket
+  // Free the values in each occupied bucket
   for (int i = 0; i < ht->num_buckets; i++) {
-    LinkedList bucketlist = ht->buckets[i];
-    HTKeyValuePtr nextKV;
-
-    // Free the values in the list; then free the list
-    if (NumElementsInLinkedList(bucketlist) > 0) {
-      LLIter list_iter = CreateLLIter(bucketlist);
-
-      LLIterGetPayload(list_iter, (void**)&nextKV);
-      valueFreeFunction(nextKV->value);
-
-      // Now loop through the rest
-      while (LLIterHasNext(list_iter) == 1) {
-        LLIterNext(list_iter);
-        LLIterGetPayload(list_iter, (void**)&nextKV);
-        valueFreeFunction(nextKV->value);
+    if (ht->buckets[i].dist != 0) {
+      valueFreeFunction(ht->buckets[i].value);
+    }
+  }
+  // ... and in any that haven't been migrated yet.
+  if (ht->old_buckets != NULL) {
+    for (int i = ht->rehash_index; i < ht->old_num_buckets; i++) {
+      if (ht->old_buckets[i].dist != 0 && ht->old_buckets[i].moved == 0) {
+        valueFreeFunction(ht->old_buckets[i].value);
       }
-      DestroyLLIter(list_iter);
     }
-    DestroyLinkedList(bucketlist, FreeKVP);
+    free(ht->old_buckets);
   }
 
   // free the bucket array within the table record,
@@ -82,148 +186,145 @@ void DestroyHashtable(Hashtable ht, ValueFreeFnPtr valueFreeFunction) {
   free(ht);
 }
 
-// Looks for a key in a given linked list. Copies the HTKeyValue
-// in the payload if there is one, or makes it NULL if not. Optionally
-// removes the matched LL node using the dummy free function at the top
-// of this file.
-// INPUT
-//   list: a linked list (ht bucket)
-//   key: an integer key to look for
-//   old_kvp: an HTKeyValue pointer to put the old kvp into when found
-//   remove: an int indicating if a found kvp's node should be deleted
-//     1 - delete, 0 - don't delete
-// Returns 0 if find was successful, -1 if key was not found, 1 if node was
-//   deleted.
-int FindInList(LinkedList list, uint64_t key, HTKeyValue *old_kvp, int remove) {
-  Assert007(list != NULL);
-  old_kvp->key = key;
-
-  // If list is empty, nothing found
-  if (NumElementsInLinkedList(list) == 0) {
-    old_kvp->value = NULL;
-    return -1;
-  }
-
-  // If at least one element, try to find matching key
-  LLIter iter = CreateLLIter(list);
-  HTKeyValue* kvpTemp;
-  int moved = 0;
-  while (moved == 0) {
-    LLIterGetPayload(iter, (void**)&kvpTemp);
-    // Test for key match
-    if (kvpTemp->key == key) {
-      old_kvp->value = kvpTemp->value;
-      // Delete node if needed
-      if (remove == 1) {
-        LLIterDelete(iter, (LLPayloadFreeFnPtr)&FreeKVP);
-      }
-      // Delete iter if not already gone
-      DestroyLLIter(iter);
-      iter = NULL;
-      return remove;  // given int is same as return
-    }
-    moved = LLIterNext(iter);
-  }
-
-  // Nothing was found if this point reached
-  DestroyLLIter(iter);
-  iter = NULL;
-  old_kvp->value = NULL;
-  return -1;
-}
-
 int PutInHashtable(Hashtable ht,
                    HTKeyValue kvp,
                    HTKeyValue *old_key_value) {
   Assert007(ht != NULL);
 
-  int insert_bucket;
-  LinkedList insert_chain;
-
+  RehashStep(ht, HT_REHASH_STEPS);
   ResizeHashtable(ht);
 
-  // calculate which bucket we're inserting into,
-  // get the list
-  insert_bucket = HashKeyToBucketNum(ht, kvp.key);
-  insert_chain = ht->buckets[insert_bucket];
-
-  // STEP 1: Finish the implementation of the put.
-  // This is a fairly complex task, so you might decide you want
-  // to define/implement a helper function hat helps you find
-  // and optionally remove a key within a chain, rather than putting
-  // all that logic inside here. You might also find that your helper(s)
-  // can be reused in step 2 and 3.
-
-  // Make payload for HT
-  HTKeyValue* kvpPayload = (HTKeyValue*)malloc(sizeof(HTKeyValue));
-  if (kvpPayload == NULL) {  // malloc failure, no more memory
-    free(kvpPayload);
+  old_key_value->key = kvp.key;
+  old_key_value->value = NULL;
+
+  // If the key is already here, swap in the new value in place.
+  int found = FindBucket(ht->buckets, ht->num_buckets, kvp.key);
+  if (found >= 0) {
+    old_key_value->value = ht->buckets[found].value;
+    ht->buckets[found].value = kvp.value;
+    return 2;
+  }
+
+  // ResizeHashtable leaves room unless it ran out of memory, or the
+  // table is as big as it gets.
+  if (ht->num_elements >= ht->num_buckets - 1) {
     return 1;
   }
-  kvpPayload->key = kvp.key;
-  kvpPayload->value = kvp.value;
 
-  // Test if key exists already and delete if there.
-  // FindInList tests for an empty list, so I don't need to here.
-  // It also copies the found HTKeyValue into the provided pointer..
-  int found = FindInList(insert_chain, kvp.key, old_key_value, 1);
-  InsertLinkedList(insert_chain, (void*)kvpPayload);
-  // Return depending on result of "search and destroy"
-  if (found == -1) {  // key not found
-    return 0;
-  } else {            // key found and node deleted
-    return 2;
+  // A key that hasn't been migrated yet moves over with its new value.
+  int result = 0;
+  found = FindOldBucket(ht, kvp.key);
+  if (found >= 0) {
+    old_key_value->value = ht->old_buckets[found].value;
+    ht->old_buckets[found].moved = 1;
+    ht->num_elements--;
+    result = 2;
   }
+
+  PlaceInBuckets(ht->buckets, ht->num_buckets, kvp.key, kvp.value);
+  ht->num_elements++;
+  return result;
 }
 
 int HashKeyToBucketNum(Hashtable ht, uint64_t key) {
-  return key % ht->num_buckets;
+  return HomeBucket(ht->num_buckets, key);
 }
 
 // -1 if not found; 0 if success
 int LookupInHashtable(Hashtable ht, uint64_t key, HTKeyValue *result) {
   Assert007(ht != NULL);
 
-  // STEP 2: Implement lookup
-  int insert_bucket;
-  LinkedList insert_chain;
+  result->key = key;
+  int found = FindBucket(ht->buckets, ht->num_buckets, key);
+  if (found >= 0) {
+    result->value = ht->buckets[found].value;
+    return 0;
+  }
+  found = FindOldBucket(ht, key);
+  if (found >= 0) {
+    result->value = ht->old_buckets[found].value;
+    return 0;
+  }
+  result->value = NULL;
+  return -1;
+}
 
-  // calculate which bucket we're inserting into,
-  // get the list
-  insert_bucket = HashKeyToBucketNum(ht, key);
-  insert_chain = ht->buckets[insert_bucket];
+int LookupOrPutInHashtable(Hashtable ht, uint64_t key,
+                           ValueMakeFnPtr make_value, void *arg,
+                           HTKeyValue *result) {
+  Assert007(ht != NULL);
 
-  return FindInList(insert_chain, key, result, 0);  // don't delete
-}
+  if (LookupInHashtable(ht, key, result) == 0) {
+    return 2;
+  }
 
+  RehashStep(ht, HT_REHASH_STEPS);
+  ResizeHashtable(ht);
+  if (ht->num_elements >= ht->num_buckets - 1) {
+    return 1;
+  }
+  result->value = make_value(key, arg);
+  if (result->value == NULL) {
+    return 1;
+  }
+  PlaceInBuckets(ht->buckets, ht->num_buckets, key, result->value);
+  ht->num_elements++;
+  return 0;
+}
 
 int NumElemsInHashtable(Hashtable ht) {
-  int res = 0;
-  for (int i = 0; i < ht->num_buckets; i++) {
-    res += NumElementsInLinkedList(ht->buckets[i]);
+  return ht->num_elements;
+}
+
+double LoadFactorOfHashtable(Hashtable ht) {
+  return (double)ht->num_elements / ht->num_buckets;
+}
+
+int SetHashtableResizePolicy(Hashtable ht, int growth_factor,
+                             double max_load) {
+  Assert007(ht != NULL);
+  // A bigger factor would take even the smallest table past the most
+  // buckets it can have in one resize.
+  if (growth_factor < 2 || growth_factor > HT_MAX_BUCKETS / HT_MIN_BUCKETS ||
+      max_load <= 0.0 || max_load > HT_MAX_MAX_LOAD) {
+    return -1;
+  }
+  ht->growth_factor = growth_factor;
+  ht->max_load = max_load;
+  UpdateResizeThreshold(ht);
+  return 0;
+}
+
+void SetHashtableIncrementalRehash(Hashtable ht, int incremental) {
+  Assert007(ht != NULL);
+  ht->incremental = incremental;
+  if (incremental == 0 && ht->old_buckets != NULL) {
+    RehashStep(ht, ht->old_num_buckets);
   }
-  return res;
 }
 
 
 int RemoveFromHashtable(Hashtable ht, uint64_t key, HTKeyValuePtr junkKVP) {
-  // STEP 3: Implement Remove
   Assert007(ht != NULL);
 
-  int insert_bucket;
-  LinkedList insert_chain;
-
-  // calculate which bucket we're inserting into,
-  // get the list
-  insert_bucket = HashKeyToBucketNum(ht, key);
-  insert_chain = ht->buckets[insert_bucket];
+  RehashStep(ht, HT_REHASH_STEPS);
 
-  int found = FindInList(insert_chain, key, junkKVP, 1);  // delete
-  if (found == 1 && junkKVP != NULL) {
+  junkKVP->key = key;
+  int found = FindBucket(ht->buckets, ht->num_buckets, key);
+  if (found >= 0) {
+    junkKVP->value = ht->buckets[found].value;
+    DeleteBucket(ht, found);
+    return 0;
+  }
+  found = FindOldBucket(ht, key);
+  if (found >= 0) {
+    junkKVP->value = ht->old_buckets[found].value;
+    ht->old_buckets[found].moved = 1;
+    ht->num_elements--;
     return 0;
-  } else {
-    return -1;
   }
+  junkKVP->value = NULL;
+  return -1;
 }
 
 uint64_t FNVHash64(unsigned char *buffer, unsigned int len) {
@@ -264,65 +365,73 @@ uint64_t FNVHashInt64(uint64_t makehash) {
 void ResizeHashtable(Hashtable ht) {
   Assert007(ht != NULL);
 
-  // Resize if the load factor is > 3.
-  if (ht->num_elements < 3 * ht->num_buckets)
+  // Resize if one more element would go over the max load factor.
+  if (ht->num_elements < ht->resize_threshold)
     return;
 
-  // This is the resize case.  Allocate a new hashtable,
-  // iterate over the old hashtable, do the surgery on
-  // the old hashtable record and free up the new hashtable
-  // record.
-  Hashtable newht = CreateHashtable(ht->num_buckets * 9);
+  // Only one rehash at a time; finish off the one in progress.
+  if (ht->old_buckets != NULL) {
+    RehashStep(ht, ht->old_num_buckets);
+  }
+
+  // This is the resize case.  Allocate a bigger bucket array and
+  // migrate every pair into it; no per-pair allocation is needed.  A
+  // table that would grow past HT_MAX_BUCKETS grows to it instead, and
+  // one that's already that big stays as it is.
+  int new_num_buckets = HT_MAX_BUCKETS;
+  if (ht->num_buckets <= HT_MAX_BUCKETS / ht->growth_factor) {
+    new_num_buckets = RoundUpBuckets(ht->num_buckets * ht->growth_factor);
+  }
+  if (new_num_buckets <= ht->num_buckets)
+    return;
+  HTBucket *new_buckets =
+      (HTBucket*)calloc(new_num_buckets, sizeof(HTBucket));
   // Give up if out of memory.
-  if (newht == NULL)
+  if (new_buckets == NULL)
     return;
 
-  // Loop through the old ht with an iterator,
-  // inserting into the new HT.
-  HTIter it = CreateHashtableIterator(ht);
-  if (it == NULL) {
-    // Give up if out of memory.
-    DestroyHashtable(newht, &NullFree);
-    return;
-  }
+  ht->old_buckets = ht->buckets;
+  ht->old_num_buckets = ht->num_buckets;
+  ht->rehash_index = 0;
+  ht->buckets = new_buckets;
+  ht->num_buckets = new_num_buckets;
+  UpdateResizeThreshold(ht);
 
-  HTKeyValue item;
-  HTIteratorGet(it, &item);
-  HTKeyValue old_kv;
+  // In incremental mode, later puts and removes do the migrating.
+  if (ht->incremental == 0) {
+    RehashStep(ht, ht->old_num_buckets);
+  }
+  return;
+}
 
-  if (PutInHashtable(newht, item, &old_kv) == 1) {
-    // failure, free up everything, return.
-    DestroyHashtableIterator(it);
-    DestroyHashtable(newht, &NullFree);
+void RehashStep(Hashtable ht, int num_steps) {
+  if (ht->old_buckets == NULL) {
     return;
   }
 
-  while (HTIteratorHasMore(it) != 0) {
-    HTIteratorNext(it);
-
-    HTKeyValue item;
-    HTIteratorGet(it, &item);
-    HTKeyValue old_kv;
+  int end = ht->rehash_index + num_steps;
+  if (end > ht->old_num_buckets) {
+    end = ht->old_num_buckets;
+  }
 
-    if (PutInHashtable(newht, item, &old_kv) == 1) {
-      // failure, free up everything, return.
-      DestroyHashtableIterator(it);
-      DestroyHashtable(newht, &NullFree);
-      return;
+  // Migrated pairs are only marked, not removed, so the probe runs of
+  // the pairs still waiting in old_buckets stay intact.
+  for (int i = ht->rehash_index; i < end; i++) {
+    HTBucket *bucket = &ht->old_buckets[i];
+    if (bucket->dist != 0 && bucket->moved == 0) {
+      PlaceInBuckets(ht->buckets, ht->num_buckets,
+                     bucket->key, bucket->value);
+      bucket->moved = 1;
     }
   }
-  // Worked!  Free the iterator.
-  DestroyHashtableIterator(it);
-  // Sneaky: swap the structures, then free the new table,
-  // and we're done.
-  {
-    struct hashtableInfo tmp;
-    tmp = *ht;
-    *ht = *newht;
-    *newht = tmp;
-    DestroyHashtable(newht, &NullFree);
+  ht->rehash_index = end;
+
+  if (ht->rehash_index == ht->old_num_buckets) {
+    free(ht->old_buckets);
+    ht->old_buckets = NULL;
+    ht->old_num_buckets = 0;
+    ht->rehash_index = 0;
   }
-  return;
 }
 
 
@@ -330,6 +439,30 @@ void ResizeHashtable(Hashtable ht) {
 // Hashtable Iterator
 // ==========================
 
+// Returns the bucket an iterator position refers to.
+static HTBucket *IterBucket(Hashtable ht, int which) {
+  if (which < ht->num_buckets) {
+    return &ht->buckets[which];
+  }
+  return &ht->old_buckets[which - ht->num_buckets];
+}
+
+// Returns the first occupied position at or after start,
+// or -1 if there is none.
+static int NextOccupiedBucket(Hashtable ht, int start) {
+  int end = ht->num_buckets;
+  if (ht->old_buckets != NULL) {
+    end += ht->old_num_buckets;
+  }
+  for (int i = start; i < end; i++) {
+    HTBucket *bucket = IterBucket(ht, i);
+    if (bucket->dist != 0 && bucket->moved == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
 // Returns NULL on failure, non-NULL on success.
 HTIter CreateHashtableIterator(Hashtable table) {
   if (NumElemsInHashtable(table) == 0) {
@@ -340,94 +473,44 @@ HTIter CreateHashtableIterator(Hashtable table) {
     return NULL;  // Couldn't malloc
   }
   iter->ht = table;
-  iter->which_bucket = 0;
-  while (NumElementsInLinkedList(iter->ht->buckets[iter->which_bucket]) == 0) {
-    iter->which_bucket++;
-  }
-  iter->bucket_iter = CreateLLIter(iter->ht->buckets[iter->which_bucket]);
+  iter->which_bucket = NextOccupiedBucket(table, 0);
+  iter->next_bucket = NextOccupiedBucket(table, iter->which_bucket + 1);
 
   return iter;
 }
 
 void DestroyHashtableIterator(HTIter iter) {
-  // Destroy the list iter
-  free(iter->bucket_iter);
   iter->ht = NULL;
   free(iter);
 }
 
-// Moves to the next element; does not return.
+// Moves to the next element; returns 1 if there was none.
 int HTIteratorNext(HTIter iter) {
-  // Step 4: Implement HTIteratorNext
   Assert007(iter != NULL);
-  LLIter iterLL = iter->bucket_iter;
-
-  // Case: There are more elements in this bucket
-  if (LLIterHasNext(iterLL) == 1) {
-    LLIterNext(iterLL);
-    return 0;
 
-  // Case: iter on last element in bucket
-  } else {
-    // Check subsequent buckets lengths
-    int i = iter->which_bucket + 1;
-    while (i < (iter->ht->num_buckets)) {
-      // If a bucket has at least 1 element, make an iter for that bucket
-      if ((iter->ht->buckets[i] != NULL) &&
-         (NumElementsInLinkedList(iter->ht->buckets[i]) > 0)) {
-        iter->bucket_iter = CreateLLIter(iter->ht->buckets[i]);
-        iter->which_bucket = i;
-
-        // Destroy previous iter
-        int success = DestroyLLIter(iterLL);
-        if (success != 0) {
-          return 1;
-        }
-        iterLL = NULL;
-
-        return 0;
-      }
-      i++;
-    }
-    // If no other elements, return 1
+  // Case: iter on last element in the table
+  if (iter->next_bucket < 0) {
     return 1;
   }
+
+  iter->which_bucket = iter->next_bucket;
+  iter->next_bucket = NextOccupiedBucket(iter->ht, iter->which_bucket + 1);
+  return 0;
 }
 
 int HTIteratorGet(HTIter iter, HTKeyValuePtr dest) {
   Assert007(iter != NULL);
-  // Step 6 -- implement HTIteratorGet.
-  LLIter iterLL = iter->bucket_iter;
-  void* temp;
 
-  int result = LLIterGetPayload(iterLL, (void**)&temp);
-  if (result == 0) {  // success
-    HTKeyValuePtr tempKV = (HTKeyValuePtr)temp;
-    dest->key = tempKV->key;
-    dest->value = tempKV->value;
+  HTBucket *bucket = IterBucket(iter->ht, iter->which_bucket);
+  if (bucket->dist == 0 || bucket->moved != 0) {
+    return 1;
   }
-  return result;
+  dest->key = bucket->key;
+  dest->value = bucket->value;
+  return 0;
 }
 
 //  0 if there are no more elements.
 int HTIteratorHasMore(HTIter iter) {
-  if (iter->bucket_iter == NULL) {
-    return 0;
-  }
-
-  if (LLIterHasNext(iter->bucket_iter) == 1)
-    return 1;
-
-  // No more in this iter; are there more buckets?
-  int i = iter->which_bucket + 1;
-  while (i < (iter->ht->num_buckets)) {
-    // Make sure one of them has elements in it
-    if ((iter->ht->buckets[i] != NULL) &&
-        (NumElementsInLinkedList(iter->ht->buckets[i]) > 0)) {
-      return 1;
-    }
-    i++;
-  }
-
-  return 0;
+  return iter->next_bucket >= 0;
 }
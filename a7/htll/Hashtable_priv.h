@@ -9,10 +9,13 @@
 
 
 // This is the struct we use to represent an iterator.
+// While the table is rehashing, the iterator walks buckets first and
+// then the pairs left in old_buckets; bucket numbers past num_buckets
+// refer to old_buckets.
 typedef struct ht_itrec {
   Hashtable  ht;          // the HT we're pointing into
   int   which_bucket;  // which bucket are we in?
-  LLIter bucket_iter;   // iterator for the bucket, or NULL
+  int   next_bucket;   // next occupied bucket, or -1 if none
 } HTIterRecord;
 
 
@@ -20,6 +23,10 @@ typedef struct ht_itrec {
 
 void ResizeHashtable(Hashtable ht);
 
+// Migrates up to num_steps buckets from old_buckets into buckets, and
+// frees old_buckets once they have all been migrated.
+void RehashStep(Hashtable ht, int num_steps);
+
 int HashKeyToBucketNum(Hashtable ht, uint64_t key); 
 
 //typedef struct hashtableInfo HashtableInfo;
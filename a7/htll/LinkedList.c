@@ -35,10 +35,52 @@ LinkedList CreateLinkedList() {
     list->num_elements = 0;
     list->head = NULL;
     list->tail = NULL;
+    list->arena = NULL;
 
     return list;
 }
 
+LinkedList CreateLinkedListInArena(Arena arena) {
+    Assert007(arena != NULL);
+    LinkedList list = (LinkedList)ArenaAlloc(arena, sizeof(LinkedListHead));
+    if (list == NULL) {
+        // out of memory
+        return (LinkedList) NULL;
+    }
+
+    list->num_elements = 0;
+    list->head = NULL;
+    list->tail = NULL;
+    list->arena = arena;
+
+    return list;
+}
+
+// Makes a node for the given list, from the list's arena if it has one.
+static LinkedListNodePtr NewNode(LinkedList list, void *data) {
+    if (list->arena == NULL) {
+        return CreateLinkedListNode(data);
+    }
+    LinkedListNodePtr node =
+        (LinkedListNodePtr)ArenaAlloc(list->arena, sizeof(LinkedListNode));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->payload = data;
+    node->next = NULL;
+    node->prev = NULL;
+    return node;
+}
+
+// Frees a node that was made by NewNode for the given list.
+static void FreeNode(LinkedList list, LinkedListNodePtr node) {
+    if (list->arena == NULL) {
+        DestroyLinkedListNode(node);
+    } else {
+        ArenaFree(list->arena, node, sizeof(LinkedListNode));
+    }
+}
+
 int DestroyLinkedList(LinkedList list,
                       LLPayloadFreeFnPtr payload_free_function) {
     Assert007(list != NULL);
@@ -51,11 +93,15 @@ int DestroyLinkedList(LinkedList list,
         payload_free_function(node->payload);
         LinkedListNodePtr toFree = node;
         node = node->next;
-        DestroyLinkedListNode(toFree);
+        FreeNode(list, toFree);
     }
     list->head = NULL;
     list->tail = NULL;
-    free(list);
+    if (list->arena == NULL) {
+        free(list);
+    } else {
+        ArenaFree(list->arena, list, sizeof(LinkedListHead));
+    }
     return 0;
 }
 
@@ -89,7 +135,7 @@ int DestroyLinkedListNode(LinkedListNode *node) {
 int InsertLinkedList(LinkedList list, void *data) {
     Assert007(list != NULL);
     Assert007(data != NULL);
-    LinkedListNodePtr new_node = CreateLinkedListNode(data);
+    LinkedListNodePtr new_node = NewNode(list, data);
 
     if (new_node == NULL) {
         return 1;
@@ -127,7 +173,7 @@ int AppendLinkedList(LinkedList list, void *data) {
     // InsertLinkedList, but add to the end instead of the beginning.
     Assert007(list != NULL);
     Assert007(data != NULL);
-    LinkedListNodePtr new_node = CreateLinkedListNode(data);
+    LinkedListNodePtr new_node = NewNode(list, data);
 
     if (new_node == NULL) {
         return 1;
@@ -182,7 +228,7 @@ int PopLinkedList(LinkedList list, void **data) {
         list->head = NULL;
         list->tail = NULL;
         list->num_elements--;
-        free(head);
+        FreeNode(list, head);
         return 0;
     }
 
@@ -198,7 +244,7 @@ int PopLinkedList(LinkedList list, void **data) {
         list->head = head->next;
         head->next->prev = NULL;
         list->num_elements--;
-        free(head);
+        FreeNode(list, head);
         return 0;
     }
 
@@ -228,7 +274,7 @@ int SliceLinkedList(LinkedList list, void **data) {
         list->head = NULL;
         list->tail = NULL;
         list->num_elements--;
-        free(tail);
+        FreeNode(list, tail);
         return 0;
     }
 
@@ -245,7 +291,7 @@ int SliceLinkedList(LinkedList list, void **data) {
         list->tail = tail->prev;
         tail->prev->next = NULL;
         list->num_elements--;
-        free(tail);
+        FreeNode(list, tail);
         return 0;
     }
 
@@ -285,6 +331,7 @@ void SortLinkedList(LinkedList list,
             curnode = curnode->next;
         }
     } while (swapped);
+}
 
 void PrintLinkedList(LinkedList list) {
     printf("List has %lu elements. \n", list->num_elements);
@@ -359,7 +406,7 @@ int LLIterInsertBefore(LLIter iter, void* payload) {
         return InsertLinkedList(iter->list, payload);
     }
 
-    LinkedListNodePtr new_node = CreateLinkedListNode(payload);
+    LinkedListNodePtr new_node = NewNode(iter->list, payload);
     if (new_node == NULL) return 1;
 
     new_node->next = iter->cur_node;
@@ -405,7 +452,7 @@ int LLIterDelete(LLIter iter, LLPayloadFreeFnPtr payload_free_function) {
         list->num_elements--;
         // Destroy list elements
         payload_free_function(node->payload);
-        DestroyLinkedListNode(node);
+        FreeNode(list, node);
         DestroyLLIter(iter);
         return 1;
     }
@@ -415,13 +462,13 @@ int LLIterDelete(LLIter iter, LLPayloadFreeFnPtr payload_free_function) {
         LinkedListNodePtr node = list->head;
         // Adjust List
         list->head = node->next;
-        node->prev = NULL;
+        list->head->prev = NULL;
         list->num_elements--;
         // Move up iterator
         LLIterNext(iter);
         // Destroy list elements
         payload_free_function(node->payload);
-        DestroyLinkedListNode(node);
+        FreeNode(list, node);
         return 0;
     }
 
@@ -436,7 +483,7 @@ int LLIterDelete(LLIter iter, LLPayloadFreeFnPtr payload_free_function) {
         LLIterPrev(iter);
         // Destroy list elements
         payload_free_function(node->payload);
-        DestroyLinkedListNode(node);
+        FreeNode(list, node);
         return 0;
     }
 
@@ -451,6 +498,6 @@ int LLIterDelete(LLIter iter, LLPayloadFreeFnPtr payload_free_function) {
     LLIterNext(iter);
     // Delete list elements
     payload_free_function(node->payload);
-    DestroyLinkedListNode(node);
+    FreeNode(list, node);
     return 0;
 }
@@ -16,6 +16,8 @@
 #ifndef LINKEDLIST_H
 #define LINKEDLIST_H
 
+#include "Arena.h"
+
 // A LinkedList is a pointer to a ll_head struct.
 // To hide the implementation of LinkedList, we declare the "struct ll_head"
 // structure here, but we *define* the structure in the internal header
@@ -48,6 +50,17 @@ typedef struct ll_iter *LLIter;
 // Returns a LinkedList; NULL if there's an error. 
 LinkedList CreateLinkedList();
 
+// Creates a LinkedList whose head and nodes are allocated from
+// the given Arena instead of malloc. DestroyLinkedList() gives
+// them back to the Arena; if the customer is going to destroy
+// the Arena anyway, they can skip DestroyLinkedList() and let
+// DestroyArena() free every list in it at once.
+//
+// INPUT: The Arena to allocate from.
+//
+// Returns a LinkedList; NULL if there's an error.
+LinkedList CreateLinkedListInArena(Arena arena);
+
 // Destroys a LinkedList.
 // All structs associated with a LinkedList will be
 // released and freed. Payload_free_function will 
@@ -0,0 +1,144 @@
+// Compares the ConcurrentHashtable against a Hashtable behind one mutex,
+// with several threads looking up or putting keys in the same table.
+//
+// Usage: ./bench_cht [max_threads] [num_keys] [ops_per_thread]
+//
+// Each thread does LookupOrPut on keys picked at random from num_keys
+// FNV-hashed numbers, the way indexing threads look up title words:
+// mostly hits, with a miss the first time any word is seen.  Both tables
+// are timed with 1, 2, 4, ... threads up to max_threads.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ConcurrentHashtable.h"
+#include "Hashtable.h"
+
+#define DEFAULT_MAX_THREADS 8
+#define DEFAULT_NUM_KEYS 100000
+#define DEFAULT_OPS 1000000
+
+// a free function that does nothing
+static void NullFree(void *freeme) { }
+
+static void *MakeValue(uint64_t key, void *arg) {
+  return arg;
+}
+
+static double WallSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+  uint64_t *keys;
+  int num_keys;
+  int num_ops;
+  unsigned int seed;
+  Hashtable ht;               // used with lock, if cht is NULL
+  pthread_mutex_t *lock;
+  ConcurrentHashtable cht;
+} BenchArgs;
+
+static void *BenchWorker(void *arg) {
+  BenchArgs *args = (BenchArgs*)arg;
+  HTKeyValue result;
+  for (int i = 0; i < args->num_ops; i++) {
+    uint64_t key = args->keys[rand_r(&args->seed) % args->num_keys];
+    if (args->cht != NULL) {
+      LookupOrPutInConcurrentHashtable(args->cht, key, &MakeValue, args,
+                                       &result);
+    } else {
+      pthread_mutex_lock(args->lock);
+      LookupOrPutInHashtable(args->ht, key, &MakeValue, args, &result);
+      pthread_mutex_unlock(args->lock);
+    }
+  }
+  return NULL;
+}
+
+// Runs num_threads workers on a fresh table and returns the wall time.
+static double RunBench(uint64_t *keys, int num_keys, int num_ops,
+                       int num_threads, int concurrent) {
+  pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+  BenchArgs *args = (BenchArgs*)malloc(num_threads * sizeof(BenchArgs));
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  Hashtable ht = NULL;
+  ConcurrentHashtable cht = NULL;
+  if (concurrent) {
+    cht = CreateConcurrentHashtable(128, 0);
+  } else {
+    ht = CreateHashtable(128);
+  }
+
+  double start = WallSeconds();
+  for (int i = 0; i < num_threads; i++) {
+    args[i].keys = keys;
+    args[i].num_keys = num_keys;
+    args[i].num_ops = num_ops;
+    args[i].seed = i + 1;
+    args[i].ht = ht;
+    args[i].lock = &lock;
+    args[i].cht = cht;
+    pthread_create(&threads[i], NULL, &BenchWorker, &args[i]);
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double seconds = WallSeconds() - start;
+
+  if (concurrent) {
+    DestroyConcurrentHashtable(cht, &NullFree);
+  } else {
+    DestroyHashtable(ht, &NullFree);
+  }
+  free(args);
+  free(threads);
+  return seconds;
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = DEFAULT_MAX_THREADS;
+  int num_keys = DEFAULT_NUM_KEYS;
+  int num_ops = DEFAULT_OPS;
+  if (argc > 1) {
+    max_threads = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    num_keys = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    num_ops = atoi(argv[3]);
+  }
+  printf("%d keys, %d ops per thread\n", num_keys, num_ops);
+
+  uint64_t *keys = (uint64_t*)malloc(num_keys * sizeof(uint64_t));
+  if (keys == NULL) {
+    printf("Couldn't malloc for keys\n");
+    return 1;
+  }
+  for (int i = 0; i < num_keys; i++) {
+    keys[i] = FNVHashInt64(i);
+  }
+
+  printf("threads   one mutex (Mops/s)   striped (Mops/s)\n");
+  for (int n = 1; ; n *= 2) {
+    if (n > max_threads) {
+      n = max_threads;
+    }
+    double total_ops = (double)n * num_ops / 1e6;
+    double locked = RunBench(keys, num_keys, num_ops, n, 0);
+    double striped = RunBench(keys, num_keys, num_ops, n, 1);
+    printf("%7d   %18.2f   %16.2f\n", n,
+           total_ops / locked, total_ops / striped);
+    if (n == max_threads) {
+      break;
+    }
+  }
+
+  free(keys);
+  return 0;
+}
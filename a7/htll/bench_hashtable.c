@@ -0,0 +1,173 @@
+// Times the basic Hashtable operations on a large number of keys.
+//
+// Usage: ./bench_ht [num_keys] [initial_buckets]
+//
+// The keys are FNV hashes of the numbers 0..num_keys-1, which is how
+// the movie indexes build their keys from title words.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Hashtable.h"
+
+#define DEFAULT_NUM_KEYS 200000
+#define DEFAULT_BUCKETS 128
+
+// a free function that does nothing
+static void NullFree(void *freeme) { }
+
+// Prints the current resident memory of this process, in kB.
+static void PrintMemory() {
+  char buffer[1024] = "";
+  int cur_real_mem = 0;
+
+  FILE* file = fopen("/proc/self/status", "r");
+  if (file == NULL) {
+    return;
+  }
+  while (fscanf(file, " %1023s", buffer) == 1) {
+    if (strcmp(buffer, "VmRSS:") == 0) {
+      fscanf(file, " %d", &cur_real_mem);
+    }
+  }
+  fclose(file);
+  printf("  Cur Real Mem: %d kB\n", cur_real_mem);
+}
+
+static double Seconds(clock_t start, clock_t end) {
+  return ((double) (end - start)) / CLOCKS_PER_SEC;
+}
+
+static int CompareLongs(const void *a, const void *b) {
+  long x = *(const long*)a;
+  long y = *(const long*)b;
+  return (x > y) - (x < y);
+}
+
+static long Nanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Times every put into a fresh table and prints the latency percentiles.
+static void BenchInsertLatency(uint64_t *keys, int num_keys,
+                               int num_buckets, int incremental) {
+  long *latencies = (long*)malloc(num_keys * sizeof(long));
+  if (latencies == NULL) {
+    printf("Couldn't malloc for latencies\n");
+    return;
+  }
+
+  Hashtable ht = CreateHashtable(num_buckets);
+  SetHashtableIncrementalRehash(ht, incremental);
+  HTKeyValue kv, old_kv;
+  for (int i = 0; i < num_keys; i++) {
+    kv.key = keys[i];
+    kv.value = &keys[i];
+    long start = Nanos();
+    PutInHashtable(ht, kv, &old_kv);
+    latencies[i] = Nanos() - start;
+  }
+  DestroyHashtable(ht, &NullFree);
+
+  qsort(latencies, num_keys, sizeof(long), &CompareLongs);
+  printf("%s rehash put latency (ns): p50 %ld  p99 %ld  p999 %ld  max %ld\n",
+         incremental ? "incremental" : "full       ",
+         latencies[num_keys / 2],
+         latencies[(int)(num_keys * 0.99)],
+         latencies[(int)(num_keys * 0.999)],
+         latencies[num_keys - 1]);
+  free(latencies);
+}
+
+int main(int argc, char *argv[]) {
+  int num_keys = DEFAULT_NUM_KEYS;
+  int num_buckets = DEFAULT_BUCKETS;
+  if (argc > 1) {
+    num_keys = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    num_buckets = atoi(argv[2]);
+  }
+  printf("%d keys, %d initial buckets\n", num_keys, num_buckets);
+
+  uint64_t *keys = (uint64_t*)malloc(num_keys * sizeof(uint64_t));
+  if (keys == NULL) {
+    printf("Couldn't malloc for keys\n");
+    return 1;
+  }
+  for (int i = 0; i < num_keys; i++) {
+    keys[i] = FNVHashInt64(i);
+  }
+
+  Hashtable ht = CreateHashtable(num_buckets);
+  HTKeyValue kv, old_kv;
+  clock_t start, end;
+
+  start = clock();
+  for (int i = 0; i < num_keys; i++) {
+    kv.key = keys[i];
+    kv.value = &keys[i];
+    PutInHashtable(ht, kv, &old_kv);
+  }
+  end = clock();
+  printf("put:           %f s\n", Seconds(start, end));
+  PrintMemory();
+
+  int hits = 0;
+  start = clock();
+  for (int i = 0; i < num_keys; i++) {
+    if (LookupInHashtable(ht, keys[i], &kv) == 0) {
+      hits++;
+    }
+  }
+  end = clock();
+  printf("lookup (hit):  %f s (%d found)\n", Seconds(start, end), hits);
+
+  int misses = 0;
+  start = clock();
+  for (int i = 0; i < num_keys; i++) {
+    if (LookupInHashtable(ht, FNVHashInt64(num_keys + i), &kv) != 0) {
+      misses++;
+    }
+  }
+  end = clock();
+  printf("lookup (miss): %f s (%d missed)\n", Seconds(start, end), misses);
+
+  int count = 0;
+  start = clock();
+  HTIter iter = CreateHashtableIterator(ht);
+  if (iter != NULL) {
+    count++;
+    while (HTIteratorHasMore(iter)) {
+      HTIteratorNext(iter);
+      HTIteratorGet(iter, &kv);
+      count++;
+    }
+    DestroyHashtableIterator(iter);
+  }
+  end = clock();
+  printf("iterate:       %f s (%d elements)\n", Seconds(start, end), count);
+
+  start = clock();
+  for (int i = 0; i < num_keys; i += 2) {
+    RemoveFromHashtable(ht, keys[i], &old_kv);
+  }
+  end = clock();
+  printf("remove half:   %f s (%d left)\n",
+         Seconds(start, end), NumElemsInHashtable(ht));
+
+  start = clock();
+  DestroyHashtable(ht, &NullFree);
+  end = clock();
+  printf("destroy:       %f s\n", Seconds(start, end));
+
+  BenchInsertLatency(keys, num_keys, num_buckets, 0);
+  BenchInsertLatency(keys, num_keys, num_buckets, 1);
+
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Tests for the Arena allocator and for LinkedLists that live in one.
+#include "gtest/gtest.h"
+extern "C" {
+    #include "Arena.h"
+    #include "LinkedList.h"
+    #include "LinkedList_priv.h"
+}
+
+void NoFree(void *payload) { }
+
+TEST(Arena, CreateDestroy) {
+  Arena arena = CreateArena();
+  ASSERT_FALSE(arena == NULL);
+  EXPECT_EQ(0u, ArenaBytesReserved(arena));
+  DestroyArena(arena);
+}
+
+TEST(Arena, AllocAndReuse) {
+  Arena arena = CreateArena();
+
+  int *a = (int*)ArenaAlloc(arena, sizeof(int));
+  int *b = (int*)ArenaAlloc(arena, sizeof(int));
+  ASSERT_FALSE(a == NULL);
+  ASSERT_FALSE(b == NULL);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(0u, (uintptr_t)b % 8);
+  *a = 1;
+  *b = 2;
+  EXPECT_EQ(1, *a);
+  EXPECT_EQ(2, *b);
+
+  // A freed block comes back for the next alloc of the same size.
+  ArenaFree(arena, a, sizeof(int));
+  int *c = (int*)ArenaAlloc(arena, sizeof(int));
+  EXPECT_EQ(a, c);
+
+  // Lots of small blocks and a big one all get freed with the arena.
+  for (int i = 0; i < 100000; i++) {
+    ASSERT_FALSE(ArenaAlloc(arena, 24) == NULL);
+  }
+  char *big = (char*)ArenaAlloc(arena, 10000);
+  ASSERT_FALSE(big == NULL);
+  memset(big, 'x', 10000);
+  EXPECT_GE(ArenaBytesReserved(arena), 100000u * 24 + 10000);
+
+  DestroyArena(arena);
+}
+
+TEST(Arena, LinkedListInArena) {
+  Arena arena = CreateArena();
+  LinkedList list = CreateLinkedListInArena(arena);
+  ASSERT_FALSE(list == NULL);
+  EXPECT_EQ(arena, list->arena);
+
+  int nums[4] = {1, 2, 3, 4};
+  EXPECT_EQ(0, InsertLinkedList(list, &nums[1]));
+  EXPECT_EQ(0, InsertLinkedList(list, &nums[0]));
+  EXPECT_EQ(0, AppendLinkedList(list, &nums[2]));
+  EXPECT_EQ(0, AppendLinkedList(list, &nums[3]));
+  EXPECT_EQ(4u, NumElementsInLinkedList(list));
+
+  void *payload;
+  EXPECT_EQ(0, PopLinkedList(list, &payload));
+  EXPECT_EQ(&nums[0], payload);
+  EXPECT_EQ(0, SliceLinkedList(list, &payload));
+  EXPECT_EQ(&nums[3], payload);
+
+  // Deleting the head through an iterator leaves a proper head behind.
+  LLIter iter = CreateLLIter(list);
+  EXPECT_EQ(0, LLIterDelete(iter, &NoFree));
+  EXPECT_TRUE(list->head->prev == NULL);
+  EXPECT_EQ(&nums[2], list->head->payload);
+  DestroyLLIter(iter);
+
+  EXPECT_EQ(0, DestroyLinkedList(list, &NoFree));
+
+  // A list that is never destroyed goes away with the arena.
+  list = CreateLinkedListInArena(arena);
+  for (int i = 0; i < 1000; i++) {
+    AppendLinkedList(list, &nums[i % 4]);
+  }
+  EXPECT_EQ(1000u, NumElementsInLinkedList(list));
+  DestroyArena(arena);
+}
+
+TEST(Arena, MergeArenas) {
+  Arena into = CreateArena();
+  Arena from = CreateArena();
+
+  int *a = (int*)ArenaAlloc(into, sizeof(int));
+  int *b = (int*)ArenaAlloc(from, sizeof(int));
+  char *big = (char*)ArenaAlloc(from, 1000);
+  *a = 1;
+  *b = 2;
+  memset(big, 'x', 1000);
+  size_t reserved = ArenaBytesReserved(into) + ArenaBytesReserved(from);
+
+  MergeArenas(into, from);
+  EXPECT_EQ(reserved, ArenaBytesReserved(into));
+  EXPECT_EQ(1, *a);
+  EXPECT_EQ(2, *b);
+  EXPECT_EQ('x', big[999]);
+
+  // into carries on allocating from its own chunk.
+  int *c = (int*)ArenaAlloc(into, sizeof(int));
+  EXPECT_EQ(a + 2, c);
+
+  // Merging into an empty arena works too.
+  Arena empty = CreateArena();
+  MergeArenas(empty, into);
+  EXPECT_EQ(reserved, ArenaBytesReserved(empty));
+  DestroyArena(empty);
+}
@@ -0,0 +1,150 @@
+// Tests for the ConcurrentHashtable, on one thread and on many.
+#include <pthread.h>
+
+#include "gtest/gtest.h"
+extern "C" {
+    #include "ConcurrentHashtable.h"
+    #include "Hashtable.h"
+}
+
+static void NoFreeValue(void *value) { }
+
+// Makes a value that records which key it was made for, and counts
+// how many the calling thread made.
+static void *MakeKeyCopy(uint64_t key, void *made) {
+  uint64_t *copy = (uint64_t*)malloc(sizeof(uint64_t));
+  *copy = key;
+  (*(int*)made)++;
+  return copy;
+}
+
+static void *MakeNothing(uint64_t key, void *arg) {
+  return NULL;
+}
+
+TEST(ConcurrentHashtable, CreateDestroy) {
+  EXPECT_TRUE(CreateConcurrentHashtable(0, 4) == NULL);
+  ConcurrentHashtable cht = CreateConcurrentHashtable(16, 0);
+  ASSERT_FALSE(cht == NULL);
+  EXPECT_EQ(0, NumElemsInConcurrentHashtable(cht));
+  DestroyConcurrentHashtable(cht, &NoFreeValue);
+}
+
+TEST(ConcurrentHashtable, SingleThread) {
+  ConcurrentHashtable cht = CreateConcurrentHashtable(8, 3);
+  int values[3] = {1, 2, 3};
+  HTKeyValue kvp, old_kvp, result;
+
+  for (int i = 0; i < 3; i++) {
+    kvp.key = FNVHashInt64(i);
+    kvp.value = &values[i];
+    EXPECT_EQ(0, PutInConcurrentHashtable(cht, kvp, &old_kvp));
+  }
+  EXPECT_EQ(3, NumElemsInConcurrentHashtable(cht));
+
+  kvp.key = FNVHashInt64(1);
+  kvp.value = &values[0];
+  EXPECT_EQ(2, PutInConcurrentHashtable(cht, kvp, &old_kvp));
+  EXPECT_EQ(&values[1], old_kvp.value);
+
+  EXPECT_EQ(0, LookupInConcurrentHashtable(cht, FNVHashInt64(1), &result));
+  EXPECT_EQ(&values[0], result.value);
+  EXPECT_EQ(-1, LookupInConcurrentHashtable(cht, FNVHashInt64(5), &result));
+
+  EXPECT_EQ(2, LookupOrPutInConcurrentHashtable(cht, FNVHashInt64(2),
+                                                &MakeNothing, NULL, &result));
+  EXPECT_EQ(&values[2], result.value);
+
+  EXPECT_EQ(0, RemoveFromConcurrentHashtable(cht, FNVHashInt64(0),
+                                             &old_kvp));
+  EXPECT_EQ(&values[0], old_kvp.value);
+  EXPECT_EQ(-1, RemoveFromConcurrentHashtable(cht, FNVHashInt64(0),
+                                              &old_kvp));
+  EXPECT_EQ(2, NumElemsInConcurrentHashtable(cht));
+
+  DestroyConcurrentHashtable(cht, &NoFreeValue);
+}
+
+#define STRESS_THREADS 8
+#define STRESS_KEYS 20000
+
+typedef struct {
+  ConcurrentHashtable cht;
+  int thread;
+  int made;           // how many values this thread made
+  int wrong;          // how many lookups saw a value for another key
+  void **seen;        // the value this thread got back for each key
+} StressArgs;
+
+// Every thread tries to put every key, starting at a different place so
+// they race on different keys at once.  Along the way each puts, finds
+// and removes keys of its own, so stripes are written to all the time.
+static void *StressWorker(void *arg) {
+  StressArgs *args = (StressArgs*)arg;
+  HTKeyValue result, junk;
+  int start = args->thread * (STRESS_KEYS / STRESS_THREADS);
+
+  for (int n = 0; n < STRESS_KEYS; n++) {
+    int i = (start + n) % STRESS_KEYS;
+    uint64_t key = FNVHashInt64(i);
+    int put = LookupOrPutInConcurrentHashtable(args->cht, key, &MakeKeyCopy,
+                                               &args->made, &result);
+    if (put != 0 && put != 2) {
+      args->wrong++;
+    }
+    if (*(uint64_t*)result.value != key) {
+      args->wrong++;
+    }
+    args->seen[i] = result.value;
+
+    // Keys past STRESS_KEYS belong to this thread alone.
+    uint64_t own = FNVHashInt64(STRESS_KEYS * (args->thread + 1) + n);
+    HTKeyValue kvp = {own, args};
+    PutInConcurrentHashtable(args->cht, kvp, &junk);
+    if (LookupInConcurrentHashtable(args->cht, own, &result) != 0 ||
+        result.value != args) {
+      args->wrong++;
+    }
+    if (RemoveFromConcurrentHashtable(args->cht, own, &junk) != 0) {
+      args->wrong++;
+    }
+  }
+  return NULL;
+}
+
+TEST(ConcurrentHashtable, StressLookupOrPut) {
+  ConcurrentHashtable cht = CreateConcurrentHashtable(16, 16);
+  pthread_t threads[STRESS_THREADS];
+  StressArgs args[STRESS_THREADS];
+  int made = 0;
+
+  for (int t = 0; t < STRESS_THREADS; t++) {
+    args[t].cht = cht;
+    args[t].thread = t;
+    args[t].made = 0;
+    args[t].wrong = 0;
+    args[t].seen = (void**)malloc(STRESS_KEYS * sizeof(void*));
+    ASSERT_EQ(0, pthread_create(&threads[t], NULL, &StressWorker, &args[t]));
+  }
+  for (int t = 0; t < STRESS_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+    EXPECT_EQ(0, args[t].wrong);
+    made += args[t].made;
+  }
+
+  // Each key got exactly one value, and every thread was given that one.
+  EXPECT_EQ(STRESS_KEYS, made);
+  EXPECT_EQ(STRESS_KEYS, NumElemsInConcurrentHashtable(cht));
+  HTKeyValue result;
+  for (int i = 0; i < STRESS_KEYS; i++) {
+    ASSERT_EQ(0, LookupInConcurrentHashtable(cht, FNVHashInt64(i), &result));
+    for (int t = 0; t < STRESS_THREADS; t++) {
+      ASSERT_EQ(result.value, args[t].seen[i]);
+    }
+  }
+
+  for (int t = 0; t < STRESS_THREADS; t++) {
+    free(args[t].seen);
+  }
+  DestroyConcurrentHashtable(cht, &free);
+}
@@ -3,6 +3,8 @@
 // Adrienne Slaughter
 //
 // Assignment 7
+#include <climits>
+
 #include "gtest/gtest.h"
 extern "C" {
     #include "Hashtable.h"
@@ -41,6 +43,8 @@ void DestroyMyThing(MyThing* thing) {
   thing = NULL;
 }
 
+void NullFree(void* thing) { }
+
 void DestroyThing(void* thing) {
   free(thing);
   thing = NULL;
@@ -53,6 +57,9 @@ TEST(Hashtable, Create) {
   EXPECT_EQ(NumElemsInHashtable(ht), 0);
   DestroyHashtable(ht, NULL);
   
+  // Too many buckets to count with an int once it's rounded up.
+  EXPECT_TRUE(CreateHashtable(INT_MAX) == NULL);
+  EXPECT_TRUE(CreateHashtable((1 << 29) + 1) == NULL);
 }
 
 TEST(Hashtable, AddOneRemoveOne) {
@@ -343,6 +350,154 @@ TEST(Hashtable, Resize) {
     DestroyHashtable(ht, &DestroyThing);
 }
 
+TEST(Hashtable, ManyPutsAndRemoves) {
+  const unsigned int num_items = 5000;
+  Hashtable ht = CreateHashtable(8);
+  HTKeyValue kv, old_kv;
+
+  for (unsigned int i = 0; i < num_items; i++) {
+    kv.key = FNVHashInt64(i);
+    kv.value = NULL;
+    ASSERT_EQ(0, PutInHashtable(ht, kv, &old_kv));
+  }
+  ASSERT_EQ(num_items, (unsigned)NumElemsInHashtable(ht));
+  // The table grew to keep the load factor down.
+  ASSERT_LT(num_items, (unsigned)ht->num_buckets);
+
+  // Removing every other key shifts the remaining probe runs back;
+  // every key that's left must still be found.
+  for (unsigned int i = 0; i < num_items; i += 2) {
+    ASSERT_EQ(0, RemoveFromHashtable(ht, FNVHashInt64(i), &old_kv));
+  }
+  ASSERT_EQ(num_items / 2, (unsigned)NumElemsInHashtable(ht));
+  for (unsigned int i = 0; i < num_items; i++) {
+    int expected = (i % 2 == 0) ? -1 : 0;
+    ASSERT_EQ(expected, LookupInHashtable(ht, FNVHashInt64(i), &kv));
+  }
+
+  DestroyHashtable(ht, &NullFree);
+}
+
+TEST(Hashtable, ResizePolicy) {
+  Hashtable ht = CreateHashtable(8);
+  HTKeyValue kv, old_kv;
+
+  // Out of range policies are rejected.
+  ASSERT_EQ(-1, SetHashtableResizePolicy(ht, 1, 0.5));
+  ASSERT_EQ(-1, SetHashtableResizePolicy(ht, 2, 0.0));
+  ASSERT_EQ(-1, SetHashtableResizePolicy(ht, 2, 1.0));
+  // So are growth factors that could overflow the bucket count.
+  ASSERT_EQ(-1, SetHashtableResizePolicy(ht, 1 << 27, 0.5));
+  ASSERT_EQ(-1, SetHashtableResizePolicy(ht, INT_MAX, 0.5));
+
+  ASSERT_EQ(0, SetHashtableResizePolicy(ht, 4, 0.5));
+  for (unsigned int i = 0; i < 1000; i++) {
+    kv.key = i;
+    kv.value = NULL;
+    ASSERT_EQ(0, PutInHashtable(ht, kv, &old_kv));
+    ASSERT_LE(LoadFactorOfHashtable(ht), 0.5);
+  }
+  // Growing by 4 from 8 buckets goes 8, 32, 128, 512, 2048.
+  ASSERT_EQ(2048, ht->num_buckets);
+  ASSERT_EQ(1000, NumElemsInHashtable(ht));
+
+  DestroyHashtable(ht, &NullFree);
+}
+
+TEST(Hashtable, IncrementalRehash) {
+  const int num_items = 3000;
+  Hashtable ht = CreateHashtable(8);
+  SetHashtableIncrementalRehash(ht, 1);
+  HTKeyValue kv, old_kv;
+  int saw_rehash = 0;
+
+  for (int i = 0; i < num_items; i++) {
+    kv.key = FNVHashInt64(i);
+    kv.value = NULL;
+    ASSERT_EQ(0, PutInHashtable(ht, kv, &old_kv));
+    if (ht->old_buckets != NULL) {
+      saw_rehash = 1;
+    }
+    // Everything put so far is findable, whichever table it is in.
+    ASSERT_EQ(0, LookupInHashtable(ht, FNVHashInt64(i / 2), &kv));
+  }
+  ASSERT_EQ(1, saw_rehash);
+  ASSERT_EQ(num_items, NumElemsInHashtable(ht));
+
+  // Replacing and removing work on pairs that haven't migrated yet.
+  for (int i = 0; i < num_items; i += 3) {
+    kv.key = FNVHashInt64(i);
+    kv.value = &saw_rehash;
+    ASSERT_EQ(2, PutInHashtable(ht, kv, &old_kv));
+    ASSERT_EQ(0, RemoveFromHashtable(ht, FNVHashInt64(i + 1), &old_kv));
+  }
+  int expected = num_items - num_items / 3;
+  ASSERT_EQ(expected, NumElemsInHashtable(ht));
+
+  // The iterator sees each remaining pair exactly once.
+  int count = 0;
+  HTIter iter = CreateHashtableIterator(ht);
+  do {
+    ASSERT_EQ(0, HTIteratorGet(iter, &kv));
+    count++;
+  } while (HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  ASSERT_EQ(expected, count);
+
+  // Turning it off finishes the migration.
+  SetHashtableIncrementalRehash(ht, 0);
+  ASSERT_TRUE(ht->old_buckets == NULL);
+  ASSERT_EQ(expected, NumElemsInHashtable(ht));
+
+  DestroyHashtable(ht, &NullFree);
+}
+
+// Makes a value holding a copy of the key, and counts how many it made.
+static void *MakeKeyCopy(uint64_t key, void *made) {
+  uint64_t *copy = (uint64_t*)malloc(sizeof(uint64_t));
+  *copy = key;
+  if (made != NULL) {
+    (*(int*)made)++;
+  }
+  return copy;
+}
+
+static void *MakeNothing(uint64_t key, void *arg) {
+  return NULL;
+}
+
+TEST(Hashtable, LookupOrPut) {
+  Hashtable ht = CreateHashtable(2);
+  HTKeyValue result;
+  int made = 0;
+
+  EXPECT_EQ(0, LookupOrPutInHashtable(ht, 7, &MakeKeyCopy, &made, &result));
+  EXPECT_EQ(7u, result.key);
+  EXPECT_EQ(7u, *(uint64_t*)result.value);
+  void *first = result.value;
+
+  EXPECT_EQ(2, LookupOrPutInHashtable(ht, 7, &MakeKeyCopy, &made, &result));
+  EXPECT_EQ(first, result.value);
+  EXPECT_EQ(1, made);
+
+  // A failed make leaves nothing behind.
+  EXPECT_EQ(1, LookupOrPutInHashtable(ht, 8, &MakeNothing, NULL, &result));
+  EXPECT_EQ(-1, LookupInHashtable(ht, 8, &result));
+
+  // Enough new keys to go through a few resizes, incremental ones too.
+  SetHashtableIncrementalRehash(ht, 1);
+  for (uint64_t i = 100; i < 1100; i++) {
+    ASSERT_EQ(0, LookupOrPutInHashtable(ht, FNVHashInt64(i), &MakeKeyCopy,
+                                        NULL, &result));
+  }
+  EXPECT_EQ(1001, NumElemsInHashtable(ht));
+  for (uint64_t i = 100; i < 1100; i++) {
+    ASSERT_EQ(0, LookupInHashtable(ht, FNVHashInt64(i), &result));
+    EXPECT_EQ(FNVHashInt64(i), *(uint64_t*)result.value);
+  }
+  DestroyHashtable(ht, &free);
+}
+
 TEST(HashtableIter, CreateDestroy) {
   // First create a hashtable that's empty
   Hashtable ht = CreateHashtable(5);
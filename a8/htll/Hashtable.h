@@ -12,10 +12,30 @@
 
 //typedef LinkedList *LinkedList_ht;
 
+// The table is open-addressed: every key/value pair lives directly in
+// the bucket array, and collisions are resolved by Robin Hood linear
+// probing.  dist is how far a pair sits from its home bucket, plus one,
+// so a dist of 0 marks an empty bucket.  moved is only ever set in the
+// old bucket array of an incremental rehash, for pairs that have since
+// been migrated or removed.
+typedef struct htBucket {
+	uint64_t key;
+	void *value;
+	uint32_t dist;
+	uint32_t moved;
+} HTBucket;
+
 struct hashtableInfo {
-	int num_buckets;
-	int num_elements;
-	LinkedList* buckets;
+	int num_buckets;   // always a power of two
+	int num_elements;  // across both bucket arrays while rehashing
+	HTBucket* buckets;
+	int growth_factor;     // how many times bigger the table gets on resize
+	double max_load;       // the load factor that triggers a resize
+	int resize_threshold;  // num_elements that triggers the next resize
+	int incremental;       // 1 if resizes migrate a few buckets per call
+	HTBucket* old_buckets; // buckets still being migrated, or NULL
+	int old_num_buckets;
+	int rehash_index;      // next bucket in old_buckets to migrate
 };
 
 typedef struct hashtableInfo* Hashtable;
@@ -44,15 +64,22 @@ typedef struct {
 // ValueFreeFnPtr takes in a void* as a parameter, and returns void.
 typedef void(*ValueFreeFnPtr)(void *value);
 
+// LookupOrPutInHashtable calls one of these to make the value for a key
+// that isn't in the table yet.  It gets the key and whatever arg the
+// caller passed along, and returns the new value or NULL on failure.
+typedef void *(*ValueMakeFnPtr)(uint64_t key, void *arg);
+
 // =====================
 
 // Allocates and returns a new Hashtable.
 //
 // INPUT:
 //   numBuckets: The number of buckets this hashtable will start with.
+//     This is rounded up to the next power of two.  It can't be more
+//     than 2^29; a table never grows past that either.
 //
 // Returns NULL if the hashtable was unable to be malloc'd, or
-// the hashtable.
+// numBuckets is too big, or the hashtable.
 Hashtable CreateHashtable(int num_buckets);
 
 // Destroys and Frees the hashtable.
@@ -91,6 +118,26 @@ int PutInHashtable(Hashtable ht, HTKeyValue kvp, HTKeyValue *old_kvp);
 // Returns -1 if the key was not found.
 int LookupInHashtable(Hashtable ht, uint64_t key, HTKeyValue *result);
 
+// Looks up the given key, and puts in a new value for it if it isn't
+// there, all in one call.  This replaces the usual LookupInHashtable,
+// then PutInHashtable if it missed; make_value is only called on a miss.
+//
+// INPUT:
+//   ht: the hashtable to look in
+//   key: the key to look up
+//   make_value: called as make_value(key, arg) to make the value to put
+//     in if the key is missing.
+//   arg: passed through to make_value
+//   result: set to the key and the value that is in the table after
+//     the call, whether it was found or just made.
+//
+// Returns 0 if a new value was made and put in.
+// Returns 1 on failure (no more memory, or make_value returned NULL).
+// Returns 2 if the key was already in the hashtable.
+int LookupOrPutInHashtable(Hashtable ht, uint64_t key,
+                           ValueMakeFnPtr make_value, void *arg,
+                           HTKeyValue *result);
+
 // Replaces the value of a given key in the hashtable.
 //
 // INPUT:
@@ -125,6 +172,44 @@ int NumElemsInHashtable(Hashtable ht);
 // Returns -1 if the key was not found in the hashtable.
 int RemoveFromHashtable(Hashtable ht, uint64_t key, HTKeyValue *junk_kvp);
 
+// Gets the load factor (elements per bucket) of the hashtable.
+//
+// INPUT:
+//   ht: the Hashtable
+//
+// Returns num_elements / num_buckets.
+double LoadFactorOfHashtable(Hashtable ht);
+
+// Sets when and how much the hashtable grows.  The defaults are a
+// growth factor of 2 and a max load of 0.875.
+//
+// INPUT:
+//   ht: the Hashtable
+//   growth_factor: the table is this many times bigger after a resize.
+//     Must be at least 2 and at most 2^26; the new size is rounded up
+//     to a power of two, and held to 2^29 buckets.
+//   max_load: the table resizes once an insert would push the load
+//     factor above this.  Must be greater than 0 and at most 0.95.
+//
+// Returns 0 if the policy was set.
+// Returns -1 if either value is out of range (and nothing changes).
+int SetHashtableResizePolicy(Hashtable ht, int growth_factor,
+                             double max_load);
+
+// Turns incremental rehashing on or off.  It is off by default.
+//
+// With it off, a resize moves every pair into the bigger table before
+// the triggering put returns.  With it on, the two tables live side by
+// side and each put or remove migrates a few buckets, so no single call
+// pays for the whole table.  Lookups check both tables but never
+// migrate, so concurrent readers of an unchanging table stay safe.
+//
+// INPUT:
+//   ht: the Hashtable
+//   incremental: 1 to turn it on, 0 to turn it off.  Turning it off
+//     finishes any rehash that is in progress.
+void SetHashtableIncrementalRehash(Hashtable ht, int incremental);
+
 // Computes an int from a string, to be used for a key in a HTKeyValue.
 //
 // INPUT:
@@ -19,10 +19,13 @@
 #include "DocIdMap.h"
 #include "FileParser.h"
 #include "FileCrawler.h"
+#include "IndexPipeline.h"
+#include "WallClock.h"
 #include "MovieIndex.h"
 #include "Movie.h"
 #include "QueryProcessor.h"
 #include "MovieReport.h"
+#include "RowParser.h"
 
 
 DocIdMap docs;
@@ -31,26 +34,20 @@ Index movie_index;
 
 
 /**
- * Open the specified file, read the specified row into the
- * provided pointer to the movie.
+ * Read the specified row of the specified file into the
+ * provided pointer to the movie, straight from where the
+ * index recorded that the row starts.
  */
-int CreateMovieFromFileRow(char *file, long rowId, Movie** movie) {
-  FILE *fp;
-
+int CreateMovieFromFileRow(uint64_t docId, long rowId, Movie** movie) {
   char buffer[1000];
 
-  fp = fopen(file, "r");
-
-  int i=0;
-  while (i <= rowId) {
-    fgets(buffer, 1000, fp);
-    i++;
+  if (CopyRowFromTable(docIndex->rows, docId, rowId,
+                       buffer, sizeof(buffer)) < 0) {
+    *movie = NULL;
+    return -1;
   }
-  // taking \n out of the row
-  buffer[strlen(buffer)-1] = ' ';
   // Create movie from row
   *movie = CreateMovieFromRow(buffer);
-  fclose(fp);
   return 0;
 }
 
@@ -88,14 +85,12 @@ void runQueryBenchmark1(char *term, char* genre) {
       return;
     }
     int result;
-    char *filename;
 
     // Get the last
     SearchResultGet(results, sr);
-    filename = GetFileFromId(docs, sr->doc_id);
 
     Movie *movie;
-    CreateMovieFromFileRow(filename, sr->row_id, &movie);
+    CreateMovieFromFileRow(sr->doc_id, sr->row_id, &movie);
     for (int i = 0; i < NUM_GENRES; i++) {
       if (movie->genres[i] != NULL && strcmp(movie->genres[i], genre) == 0) {
         printf("genre: %s\n", movie->genres[i]);
@@ -112,10 +107,9 @@ void runQueryBenchmark1(char *term, char* genre) {
         break;
       }
       SearchResultGet(results, sr);
-      char *filename = GetFileFromId(docs, sr->doc_id);
 
       Movie *movie;
-      CreateMovieFromFileRow(filename, sr->row_id, &movie);
+      CreateMovieFromFileRow(sr->doc_id, sr->row_id, &movie);
       for (int i = 0; i < NUM_GENRES; i++) {
         if (movie->genres[i] != NULL && strcmp(movie->genres[i], genre) == 0) {
           printf("genre: %s\n", movie->genres[i]);
@@ -175,14 +169,218 @@ void BenchmarkSetOfMovies(DocIdMap docs) {
   DestroyHashtableIterator(iter);
 }
 
+// Adds up the sizes of all the files in the map.
+static long CorpusBytes(DocIdMap docs) {
+  long bytes = 0;
+  HTIter iter = CreateHashtableIterator(docs);
+  if (iter == NULL) {
+    return 0;
+  }
+  HTKeyValue kv;
+  do {
+    HTIteratorGet(iter, &kv);
+    struct stat file_stat;
+    if (stat((char*)kv.value, &file_stat) == 0) {
+      bytes += file_stat.st_size;
+    }
+  } while (HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return bytes;
+}
+
 void BenchmarkMovieSet(DocIdMap docs) {
   // Create the index
   docIndex = CreateIndex();
 
   // Index the files
   printf("Parsing and indexing files...\n");
+  double start = WallSeconds();
   ParseTheFiles_MT(docs, docIndex);
+  double seconds = WallSeconds() - start;
   printf("%d entries in the index.\n", NumElemsInHashtable(docIndex->ht));
+  double megabytes = CorpusBytes(docs) / (1024.0 * 1024.0);
+  printf("Indexed %.1f MB in %f s wall clock: %.1f MB/s\n",
+         megabytes, seconds, megabytes / seconds);
+}
+
+// Times putting num_files made-up filenames into a fresh DocIdMap,
+// doubling the count each round. With a constant-time element count
+// and a table that grows, each round should take about twice as long
+// as the one before; quadratic behavior shows up as 4x.
+void BenchmarkDocIdMap(int num_files) {
+  char name[32];
+  for (int n = num_files / 8; n <= num_files; n *= 2) {
+    DocIdMap map = CreateDocIdMap();
+    clock_t start = clock();
+    for (int i = 0; i < n; i++) {
+      snprintf(name, sizeof(name), "file%d", i);
+      char *filename = (char*)malloc(strlen(name) + 1);
+      strcpy(filename, name);
+      PutFileInMap(filename, map);
+    }
+    clock_t end = clock();
+    printf("%8d files: %f seconds\n",
+           NumElemsInHashtable(map),
+           ((double) (end - start)) / CLOCKS_PER_SEC);
+    DestroyDocIdMap(map);
+    if (n == 0) {
+      break;
+    }
+  }
+}
+
+// Splits every row of every file with each delimiter scanner the CPU
+// has, without indexing anything, to time the parser on its own.
+void BenchmarkRowScanning(DocIdMap docs) {
+  const char *scanners[] = {"scalar", "sse2", "avx2"};
+  const char *best = DelimiterScannerName();
+  double megabytes = CorpusBytes(docs) / (1024.0 * 1024.0);
+
+  for (int i = 0; i < 3; i++) {
+    if (SelectDelimiterScanner(scanners[i]) != 0) {
+      continue;
+    }
+    long rows = 0;
+    long words = 0;
+    double start = WallSeconds();
+    HTIter iter = CreateHashtableIterator(docs);
+    HTKeyValue kv;
+    do {
+      HTIteratorGet(iter, &kv);
+      MappedFile mapped;
+      if (MapFile((char*)kv.value, &mapped) != 0) {
+        continue;
+      }
+      RowParser parser;
+      FieldView row;
+      MovieRowIndex pieces;
+      InitRowParser(&parser, &mapped, 0, -1);
+      while (NextMovieRow(&parser, &row, &pieces)) {
+        rows++;
+        words += pieces.num_title_words;
+      }
+      UnmapFile(&mapped);
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+    double seconds = WallSeconds() - start;
+    printf("%-6s  %ld rows, %ld title words: %f s, %.1f MB/s\n",
+           scanners[i], rows, words, seconds, megabytes / seconds);
+  }
+  SelectDelimiterScanner(best);
+}
+
+// Builds the OffsetIndex with 1, 2, 4, ... up to max_threads workers,
+// both with every worker adding under one lock and with a shard per
+// worker merged at the end. Times are wall clock; clock() adds up
+// the CPU time of every thread, which hides any speedup.
+void BenchmarkIndexScaling(DocIdMap docs, int max_threads) {
+  printf("threads    locked (s)   sharded (s)\n");
+  for (int n = 1; n <= max_threads; n *= 2) {
+    if (n * 2 > max_threads && n < max_threads) {
+      // Make sure max_threads itself gets a row.
+      n = max_threads;
+    }
+    Index index = CreateIndex();
+    double start = WallSeconds();
+    ParseTheFiles_Pool(docs, index, n);
+    double locked = WallSeconds() - start;
+    DestroyOffsetIndex(index);
+
+    index = CreateIndex();
+    start = WallSeconds();
+    ParseTheFiles_Sharded(docs, index, n);
+    double sharded = WallSeconds() - start;
+    DestroyOffsetIndex(index);
+
+    printf("%7d %13f %13f\n", n, locked, sharded);
+  }
+}
+
+// Crawls dir with 1, 2, 4, ... up to max_threads threads, then builds
+// the OffsetIndex after crawling, and while crawling.
+void BenchmarkCrawlScaling(const char *dir, int max_threads) {
+  printf("threads     crawl (s)  then parse (s)  overlapped (s)\n");
+  for (int n = 1; n <= max_threads; n *= 2) {
+    if (n * 2 > max_threads && n < max_threads) {
+      n = max_threads;
+    }
+    DocIdMap map = CreateDocIdMap();
+    double start = WallSeconds();
+    CrawlFilesToMap_Parallel(dir, map, n);
+    double crawl = WallSeconds() - start;
+    Index index = CreateIndex();
+    ParseTheFiles_Sharded(map, index, n);
+    double then_parse = WallSeconds() - start;
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(map);
+
+    map = CreateDocIdMap();
+    index = CreateIndex();
+    start = WallSeconds();
+    CrawlAndParseFiles(dir, map, index, n);
+    double overlapped = WallSeconds() - start;
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(map);
+
+    printf("%7d %13f %15f %15f\n", n, crawl, then_parse, overlapped);
+  }
+}
+
+// Builds the OffsetIndex through the pipeline, and prints what each
+// stage did.
+void BenchmarkPipeline(const char *dir) {
+  DocIdMap map = CreateDocIdMap();
+  Index index = CreateIndex();
+  PipelineStats stats;
+  BuildIndexPipelined(dir, map, index, NULL, &stats);
+  PrintPipelineStats(&stats);
+  DestroyOffsetIndex(index);
+  DestroyDocIdMap(map);
+}
+
+// Reads back the row of every result for a term, the way a server
+// answering the query would: one result at a time, then as a batch.
+void BenchmarkRowFetch(char *term) {
+  char row[1000];
+  struct searchResult sr;
+  long rows = 0;
+  long bytes = 0;
+  double start = WallSeconds();
+  SearchResultIter results = FindMovies(docIndex, term);
+  if (results != NULL) {
+    while (1) {
+      SearchResultGet(results, &sr);
+      if (CopyRowFromIndex(docIndex, &sr, row, sizeof(row)) == 0) {
+        rows++;
+        bytes += strlen(row);
+      }
+      if (SearchResultIterHasMore(results) == 0) {
+        break;
+      }
+      SearchResultNext(results);
+    }
+    DestroySearchResultIter(results);
+  }
+  double seconds = WallSeconds() - start;
+  printf("Read %ld rows (%ld bytes) in %f s\n", rows, bytes, seconds);
+
+  // And all at once, a file at a time.
+  rows = 0;
+  bytes = 0;
+  start = WallSeconds();
+  MovieSet set = GetMovieSet(docIndex, term);
+  SearchResultBatch batch = set == NULL ? NULL :
+      FetchMovieSetRows(docIndex, set);
+  if (batch != NULL) {
+    for (int i = 0; i < batch->num_results; i++) {
+      rows++;
+      bytes += batch->results[i].row.len;
+    }
+    DestroySearchResultBatch(batch);
+  }
+  seconds = WallSeconds() - start;
+  printf("Read %ld rows (%ld bytes) as a batch in %f s\n",
+         rows, bytes, seconds);
 }
 
 void WriteFile(FILE *file) {
@@ -236,15 +434,24 @@ void getMemory() {
 
 int main(int argc, char *argv[]) {
   // Check arguments
-  if (argc != 2) {
+  if (argc < 2 || argc > 4) {
     printf("Wrong number of arguments.\n");
-    printf("usage: main <directory_to_crawl>\n");
+    printf("usage: main <directory_to_crawl> [num_docs] [max_threads]\n");
     return 0;
   }
   pid_t pid = getpid();
   printf("Process ID: %d\n", pid);
   getMemory();
 
+  if (argc >= 3 && atoi(argv[2]) > 0) {
+    // =======================
+    // Benchmark DocIdMap scaling
+    printf("\n\nFilling a DocIdMap with up to %s files\n", argv[2]);
+    BenchmarkDocIdMap(atoi(argv[2]));
+    getMemory();
+    // =======================
+  }
+
   // Create a DocIdMap
   docs = CreateDocIdMap();
   CrawlFilesToMap(argv[1], docs);
@@ -253,6 +460,36 @@ int main(int argc, char *argv[]) {
 
   getMemory();
 
+  // =======================
+  // Benchmark splitting rows
+  printf("\n\nSplitting every row of %.1f MB\n",
+         CorpusBytes(docs) / (1024.0 * 1024.0));
+  BenchmarkRowScanning(docs);
+  // =======================
+
+  if (argc == 4) {
+    // =======================
+    // Benchmark indexing with more and more threads
+    printf("\n\nBuilding the OffsetIndex with up to %s threads\n", argv[3]);
+    BenchmarkIndexScaling(docs, atoi(argv[3]));
+    getMemory();
+    // =======================
+
+    // =======================
+    // Benchmark crawling with more and more threads
+    printf("\n\nCrawling with up to %s threads\n", argv[3]);
+    BenchmarkCrawlScaling(argv[1], atoi(argv[3]));
+    getMemory();
+    // =======================
+
+    // =======================
+    // Benchmark the indexing pipeline, with each stage as it comes
+    printf("\n\nCrawling and indexing through the pipeline\n");
+    BenchmarkPipeline(argv[1]);
+    getMemory();
+    // =======================
+  }
+
   clock_t start2, end2;
   double cpu_time_used;
 
@@ -306,7 +543,26 @@ int main(int argc, char *argv[]) {
   // ======================
 
 
+  // ======================
+  // Benchmark reading back every result of a common term
+  puts("\n\nReading every row with \"the\" in the title");
+  BenchmarkRowFetch("the");
+  puts("Again, with the files already mapped");
+  BenchmarkRowFetch("the");
+  // ======================
+
+  // ======================
+  // Benchmark tearing down the OffsetIndex
+  puts("\n\nDestroying the OffsetIndex");
+  start2 = clock();
   DestroyOffsetIndex(docIndex);
+  end2 = clock();
+  cpu_time_used = ((double) (end2 - start2)) / CLOCKS_PER_SEC;
+  printf("Took %f seconds to execute. \n", cpu_time_used);
+  printf("Memory usage: \n");
+  getMemory();
+  // ======================
+
   DestroyTypeIndex(movie_index);
   DestroyDocIdMap(docs);
   printf("\n\nDestroyed All Indexes\n");
@@ -0,0 +1,655 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BooleanQuery.h"
+#include "MovieIndex.h"
+#include "MovieSet.h"
+#include "PostingList.h"
+#include "htll/Hashtable.h"
+
+// What NextMatch gives when there are no more rows.
+#define ROW_END UINT32_MAX
+
+typedef enum {
+  TOKEN_WORD,
+  TOKEN_AND,
+  TOKEN_OR,
+  TOKEN_NOT,
+  TOKEN_OPEN,
+  TOKEN_CLOSE,
+  TOKEN_PHRASE,  // the words between a pair of double quotes
+  TOKEN_BAD,  // a double quote with no pair
+  TOKEN_END
+} TokenType;
+
+typedef struct {
+  const char *next;  // where the token after this one starts
+  TokenType type;
+  const char *start;  // the token
+  int len;
+  int depth;  // how many parentheses are open
+} Parser;
+
+// Reads the next token.
+static void Advance(Parser *parser) {
+  const char *next = parser->next;
+  while (isspace((unsigned char)*next)) {
+    next++;
+  }
+  parser->start = next;
+  if (*next == '\0') {
+    parser->type = TOKEN_END;
+    parser->len = 0;
+    parser->next = next;
+    return;
+  }
+  if (*next == '(' || *next == ')') {
+    parser->type = *next == '(' ? TOKEN_OPEN : TOKEN_CLOSE;
+    parser->len = 1;
+    parser->next = next + 1;
+    return;
+  }
+  if (*next == '"') {
+    const char *close = strchr(next + 1, '"');
+    if (close == NULL) {
+      parser->type = TOKEN_BAD;
+      parser->len = 0;
+      parser->next = next;
+      return;
+    }
+    parser->type = TOKEN_PHRASE;
+    parser->start = next + 1;
+    parser->len = close - parser->start;
+    parser->next = close + 1;
+    return;
+  }
+  while (*next != '\0' && !isspace((unsigned char)*next) &&
+         *next != '(' && *next != ')' && *next != '"') {
+    next++;
+  }
+  parser->len = next - parser->start;
+  parser->next = next;
+  if (parser->len == 3 && strncmp(parser->start, "AND", 3) == 0) {
+    parser->type = TOKEN_AND;
+  } else if (parser->len == 2 && strncmp(parser->start, "OR", 2) == 0) {
+    parser->type = TOKEN_OR;
+  } else if (parser->len == 3 && strncmp(parser->start, "NOT", 3) == 0) {
+    parser->type = TOKEN_NOT;
+  } else {
+    parser->type = TOKEN_WORD;
+  }
+}
+
+static QueryNode CreateQueryNode(QueryNodeType type) {
+  QueryNode node = (QueryNode)calloc(1, sizeof(struct queryNode));
+  if (node == NULL) {
+    printf("Couldn't malloc for a query node\n");
+    return NULL;
+  }
+  node->type = type;
+  return node;
+}
+
+static int AddChild(QueryNode node, QueryNode child) {
+  QueryNode *children = (QueryNode*)realloc(
+      node->children, (node->num_children + 1) * sizeof(QueryNode));
+  if (children == NULL) {
+    printf("Couldn't malloc for a query node\n");
+    return -1;
+  }
+  children[node->num_children++] = child;
+  node->children = children;
+  return 0;
+}
+
+void DestroyQuery(QueryNode query) {
+  if (query == NULL) {
+    return;
+  }
+  for (int i = 0; i < query->num_children; i++) {
+    DestroyQuery(query->children[i]);
+  }
+  free(query->children);
+  free(query->term);
+  free(query);
+}
+
+// Joins two nodes with an AND or OR, flattening runs of the same one,
+// so "a b c" is one AND of three words. Takes both nodes over.
+static QueryNode Join(QueryNodeType type, QueryNode left, QueryNode right) {
+  QueryNode node = left;
+  if (left->type != type) {
+    node = CreateQueryNode(type);
+    if (node == NULL || AddChild(node, left) != 0) {
+      DestroyQuery(node);
+      DestroyQuery(left);
+      DestroyQuery(right);
+      return NULL;
+    }
+  }
+  if (right->type == type) {
+    for (int i = 0; i < right->num_children; i++) {
+      if (AddChild(node, right->children[i]) != 0) {
+        // The rest are still right's.
+        right->num_children -= i;
+        memmove(right->children, right->children + i,
+                right->num_children * sizeof(QueryNode));
+        DestroyQuery(right);
+        DestroyQuery(node);
+        return NULL;
+      }
+    }
+    right->num_children = 0;
+    DestroyQuery(right);
+  } else if (AddChild(node, right) != 0) {
+    DestroyQuery(right);
+    DestroyQuery(node);
+    return NULL;
+  }
+  return node;
+}
+
+static QueryNode ParseOr(Parser *parser);
+
+static QueryNode CreateTermNode(const char *word, int len) {
+  QueryNode node = CreateQueryNode(QUERY_TERM);
+  if (node == NULL) {
+    return NULL;
+  }
+  node->term = strndup(word, len);
+  if (node->term == NULL) {
+    DestroyQuery(node);
+    return NULL;
+  }
+  return node;
+}
+
+// Makes a phrase of the words of the current token.
+static QueryNode ParsePhrase(Parser *parser) {
+  QueryNode node = CreateQueryNode(QUERY_PHRASE);
+  const char *c = parser->start;
+  const char *end = parser->start + parser->len;
+  while (node != NULL) {
+    while (c < end && isspace((unsigned char)*c)) {
+      c++;
+    }
+    const char *word = c;
+    while (c < end && !isspace((unsigned char)*c)) {
+      c++;
+    }
+    if (c == word) {
+      break;
+    }
+    QueryNode child = CreateTermNode(word, c - word);
+    if (child == NULL || AddChild(node, child) != 0) {
+      DestroyQuery(child);
+      DestroyQuery(node);
+      return NULL;
+    }
+  }
+  if (node == NULL || node->num_children == 0) {
+    DestroyQuery(node);
+    return NULL;
+  }
+  Advance(parser);
+  if (node->num_children == 1) {
+    // Just a word, then.
+    QueryNode child = node->children[0];
+    node->num_children = 0;
+    DestroyQuery(node);
+    return child;
+  }
+  return node;
+}
+
+// unary := NOT unary | ( or ) | "words" | word
+static QueryNode ParseUnary(Parser *parser) {
+  if (parser->type == TOKEN_NOT) {
+    Advance(parser);
+    QueryNode child = ParseUnary(parser);
+    if (child == NULL) {
+      return NULL;
+    }
+    QueryNode node = CreateQueryNode(QUERY_NOT);
+    if (node == NULL || AddChild(node, child) != 0) {
+      DestroyQuery(node);
+      DestroyQuery(child);
+      return NULL;
+    }
+    return node;
+  }
+  if (parser->type == TOKEN_OPEN) {
+    if (++parser->depth > QUERY_MAX_DEPTH) {
+      return NULL;
+    }
+    Advance(parser);
+    QueryNode node = ParseOr(parser);
+    if (node == NULL) {
+      return NULL;
+    }
+    if (parser->type != TOKEN_CLOSE) {
+      DestroyQuery(node);
+      return NULL;
+    }
+    parser->depth--;
+    Advance(parser);
+    return node;
+  }
+  if (parser->type == TOKEN_PHRASE) {
+    return ParsePhrase(parser);
+  }
+  if (parser->type != TOKEN_WORD) {
+    return NULL;
+  }
+  QueryNode node = CreateTermNode(parser->start, parser->len);
+  if (node != NULL) {
+    Advance(parser);
+  }
+  return node;
+}
+
+// and := unary ([AND] unary)*
+static QueryNode ParseAnd(Parser *parser) {
+  QueryNode node = ParseUnary(parser);
+  while (node != NULL && parser->type != TOKEN_END &&
+         parser->type != TOKEN_CLOSE && parser->type != TOKEN_OR) {
+    if (parser->type == TOKEN_AND) {
+      Advance(parser);
+    }
+    QueryNode right = ParseUnary(parser);
+    if (right == NULL) {
+      DestroyQuery(node);
+      return NULL;
+    }
+    node = Join(QUERY_AND, node, right);
+  }
+  return node;
+}
+
+// or := and (OR and)*
+static QueryNode ParseOr(Parser *parser) {
+  QueryNode node = ParseAnd(parser);
+  while (node != NULL && parser->type == TOKEN_OR) {
+    Advance(parser);
+    QueryNode right = ParseAnd(parser);
+    if (right == NULL) {
+      DestroyQuery(node);
+      return NULL;
+    }
+    node = Join(QUERY_OR, node, right);
+  }
+  return node;
+}
+
+QueryNode ParseQuery(const char *query) {
+  Parser parser = {query, TOKEN_END, query, 0, 0};
+  Advance(&parser);
+  QueryNode node = ParseOr(&parser);
+  if (node != NULL && parser.type != TOKEN_END) {
+    DestroyQuery(node);
+    return NULL;
+  }
+  return node;
+}
+
+// Puts an AND's NOTs last, and the rest in order of how many rows they
+// can match.
+static int CompareChildren(const void *a, const void *b) {
+  QueryNode x = *(QueryNode const*)a;
+  QueryNode y = *(QueryNode const*)b;
+  int x_not = x->type == QUERY_NOT;
+  int y_not = y->type == QUERY_NOT;
+  if (x_not != y_not) {
+    return x_not - y_not;
+  }
+  return (x->num_rows > y->num_rows) - (x->num_rows < y->num_rows);
+}
+
+// Looks up every word's MovieSet, and works out how many rows each
+// node can match at most.
+static void Bind(Index index, QueryNode node) {
+  for (int i = 0; i < node->num_children; i++) {
+    Bind(index, node->children[i]);
+  }
+  switch (node->type) {
+    case QUERY_TERM:
+      node->set = GetMovieSet(index, node->term);
+      node->num_rows = node->set == NULL ? 0 : NumMoviesInSet(node->set);
+      break;
+    case QUERY_NOT:
+      node->num_rows = 0;
+      break;
+    case QUERY_PHRASE:
+      node->num_rows = node->children[0]->num_rows;
+      for (int i = 1; i < node->num_children; i++) {
+        if (node->children[i]->num_rows < node->num_rows) {
+          node->num_rows = node->children[i]->num_rows;
+        }
+      }
+      break;
+    case QUERY_OR:
+      node->num_rows = 0;
+      for (int i = 0; i < node->num_children; i++) {
+        node->num_rows += node->children[i]->num_rows;
+      }
+      break;
+    case QUERY_AND:
+      qsort(node->children, node->num_children, sizeof(QueryNode),
+            &CompareChildren);
+      node->num_required = 0;
+      while (node->num_required < node->num_children &&
+             node->children[node->num_required]->type != QUERY_NOT) {
+        node->num_required++;
+      }
+      node->num_rows = node->num_required > 0 ?
+          node->children[0]->num_rows : 0;
+      break;
+  }
+}
+
+typedef struct {
+  uint64_t *ids;
+  int num_ids;
+  int capacity;
+} DocList;
+
+// Adds the files a node could match rows in to docs: for an AND, only
+// the files of its rarest word (or subquery).
+static int AddCandidateDocs(QueryNode node, DocList *docs) {
+  if (node->num_rows == 0) {
+    return 0;
+  }
+  if (node->type == QUERY_AND) {
+    return AddCandidateDocs(node->children[0], docs);
+  }
+  if (node->type == QUERY_PHRASE) {
+    // The rarest word; the phrase's rows are a subset of its.
+    for (int i = 0; i < node->num_children; i++) {
+      if (node->children[i]->num_rows == node->num_rows) {
+        return AddCandidateDocs(node->children[i], docs);
+      }
+    }
+  }
+  if (node->type == QUERY_OR) {
+    for (int i = 0; i < node->num_children; i++) {
+      if (AddCandidateDocs(node->children[i], docs) != 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+  HTIter iter = CreateHashtableIterator(node->set->doc_index);
+  if (iter == NULL) {
+    return 0;
+  }
+  HTKeyValue kvp;
+  do {
+    if (docs->num_ids == docs->capacity) {
+      int capacity = docs->capacity ? 2 * docs->capacity : 16;
+      uint64_t *ids = (uint64_t*)realloc(docs->ids,
+                                         capacity * sizeof(uint64_t));
+      if (ids == NULL) {
+        DestroyHashtableIterator(iter);
+        return -1;
+      }
+      docs->ids = ids;
+      docs->capacity = capacity;
+    }
+    HTIteratorGet(iter, &kvp);
+    docs->ids[docs->num_ids++] = kvp.key;
+  } while (HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return 0;
+}
+
+static int CompareDocIds(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Points every word of a query at its rows in one file.
+static void OpenDoc(QueryNode node, uint64_t doc_id) {
+  for (int i = 0; i < node->num_children; i++) {
+    OpenDoc(node->children[i], doc_id);
+  }
+  if (node->type == QUERY_PHRASE) {
+    node->match = ROW_END;
+  }
+  if (node->type != QUERY_TERM) {
+    return;
+  }
+  HTKeyValue kvp;
+  node->done = node->set == NULL ||
+      LookupInHashtable(node->set->doc_index, doc_id, &kvp) != 0;
+  if (!node->done) {
+    PostingListIterInit(&node->rows, (PostingList)kvp.value);
+  }
+  node->has_positions = !node->done && node->set->doc_positions != NULL &&
+      LookupInHashtable(node->set->doc_positions, doc_id, &kvp) == 0;
+  if (node->has_positions) {
+    PostingListIterInit(&node->positions, (PostingList)kvp.value);
+  }
+}
+
+// Gets which positions a phrase's word is at in a row, as a bit per
+// position. Rows have to keep going up.
+static uint64_t PositionsInRow(QueryNode word, uint32_t row) {
+  if (!word->has_positions ||
+      PostingListIterSkipTo(&word->positions,
+                            row << TITLE_POSITION_BITS) != 0) {
+    return 0;
+  }
+  uint64_t positions = 0;
+  uint32_t entry = PostingListIterGet(&word->positions);
+  while (entry >> TITLE_POSITION_BITS == row) {
+    positions |= (uint64_t)1 << (entry & TITLE_MAX_POSITION);
+    if (PostingListIterNext(&word->positions) != 0) {
+      break;
+    }
+    entry = PostingListIterGet(&word->positions);
+  }
+  return positions;
+}
+
+// Whether a row that has all of a phrase's words has them in order,
+// next to each other.
+static int PhraseInRow(QueryNode phrase, uint32_t row) {
+  for (int i = 0; i < phrase->num_children; i++) {
+    if (phrase->children[i]->set->doc_positions == NULL) {
+      // No positions were kept, so having the words has to do.
+      return 1;
+    }
+  }
+  if (row > TITLE_MAX_POSITION_ROW) {
+    return 0;
+  }
+  // Where a phrase could start: wherever its first word is, and the
+  // word after that is one further on, and so on.
+  uint64_t starts = ~(uint64_t)0;
+  for (int i = 0; i < phrase->num_children; i++) {
+    starts &= PositionsInRow(phrase->children[i], row) >> i;
+  }
+  return starts != 0;
+}
+
+/**
+ * Finds the first row, at or after target, in the file the query was
+ * last opened on, that the node matches, or ROW_END if there isn't one.
+ * Targets have to keep going up.
+ */
+static uint32_t NextMatch(QueryNode node, uint32_t target) {
+  switch (node->type) {
+    case QUERY_TERM:
+      if (node->done) {
+        return ROW_END;
+      }
+      if (PostingListIterSkipTo(&node->rows, target) != 0) {
+        node->done = 1;
+        return ROW_END;
+      }
+      return PostingListIterGet(&node->rows);
+    case QUERY_OR: {
+      uint32_t first = ROW_END;
+      for (int i = 0; i < node->num_children; i++) {
+        uint32_t row = NextMatch(node->children[i], target);
+        if (row < first) {
+          first = row;
+        }
+      }
+      return first;
+    }
+    case QUERY_AND: {
+      if (node->num_required == 0) {
+        return ROW_END;
+      }
+      // Leapfrog: the rarest child proposes a row, and every other one
+      // skips ahead to it; one that overshoots proposes the next.
+      uint32_t row = NextMatch(node->children[0], target);
+      while (row != ROW_END) {
+        int i;
+        for (i = 1; i < node->num_required; i++) {
+          uint32_t other = NextMatch(node->children[i], row);
+          if (other != row) {
+            row = other == ROW_END ? ROW_END :
+                NextMatch(node->children[0], other);
+            break;
+          }
+        }
+        if (i < node->num_required) {
+          continue;
+        }
+        for (i = node->num_required; i < node->num_children; i++) {
+          if (NextMatch(node->children[i]->children[0], row) == row) {
+            break;
+          }
+        }
+        if (i == node->num_children) {
+          return row;
+        }
+        row = NextMatch(node->children[0], row + 1);
+      }
+      return ROW_END;
+    }
+    case QUERY_PHRASE: {
+      if (node->match != ROW_END && node->match >= target) {
+        return node->match;
+      }
+      // All the words have to be in the row before their positions
+      // are worth looking at.
+      uint32_t row = target;
+      int i = 0;
+      while (i < node->num_children) {
+        uint32_t found = NextMatch(node->children[i], row);
+        if (found == ROW_END) {
+          node->match = ROW_END;
+          return ROW_END;
+        }
+        if (found != row) {
+          row = found;
+          i = 0;
+          continue;
+        }
+        if (++i == node->num_children) {
+          if (PhraseInRow(node, row)) {
+            node->match = row;
+            return row;
+          }
+          row++;
+          i = 0;
+        }
+      }
+      return ROW_END;
+    }
+    case QUERY_NOT:
+      return ROW_END;
+  }
+  return ROW_END;
+}
+
+MovieSet RunBooleanQuery(Index index, QueryNode query, char *desc) {
+  Bind(index, query);
+  if (query->num_rows == 0) {
+    return NULL;
+  }
+  DocList docs = {NULL, 0, 0};
+  if (AddCandidateDocs(query, &docs) != 0) {
+    printf("Couldn't malloc for a query's files\n");
+    free(docs.ids);
+    return NULL;
+  }
+  // A doc can be a candidate more than once under an OR.
+  qsort(docs.ids, docs.num_ids, sizeof(uint64_t), &CompareDocIds);
+
+  MovieSet set = CreateMovieSet(desc);
+  int num_rows = 0;
+  for (int i = 0; set != NULL && i < docs.num_ids; i++) {
+    if (i > 0 && docs.ids[i] == docs.ids[i - 1]) {
+      continue;
+    }
+    OpenDoc(query, docs.ids[i]);
+    uint32_t row = NextMatch(query, 0);
+    while (row != ROW_END) {
+      if (AddMovieToSet(set, docs.ids[i], row) != 0) {
+        DestroyMovieSet(set);
+        set = NULL;
+        break;
+      }
+      num_rows++;
+      row = NextMatch(query, row + 1);
+    }
+  }
+  free(docs.ids);
+  if (set != NULL && num_rows == 0) {
+    DestroyMovieSet(set);
+    set = NULL;
+  }
+  return set;
+}
+
+MovieSet FindQueryMovies(Index index, const char *query, int *owned) {
+  *owned = 0;
+  // A single word is looked up as it is, parentheses and all.
+  const char *c = query;
+  while (*c != '\0' && !isspace((unsigned char)*c)) {
+    c++;
+  }
+  if (*c == '\0') {
+    return *query == '\0' ? NULL : GetMovieSet(index, query);
+  }
+
+  QueryNode parsed = ParseQuery(query);
+  if (parsed == NULL) {
+    printf("Couldn't parse query: %s\n", query);
+    return NULL;
+  }
+  MovieSet set;
+  if (parsed->type == QUERY_TERM) {
+    set = GetMovieSet(index, parsed->term);
+  } else {
+    set = RunBooleanQuery(index, parsed, (char*)query);
+    *owned = set != NULL;
+  }
+  DestroyQuery(parsed);
+  return set;
+}
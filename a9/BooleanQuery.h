@@ -0,0 +1,140 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOOLEANQUERY_H
+#define BOOLEANQUERY_H
+
+#include <stdint.h>
+
+#include "MovieIndex.h"
+#include "MovieSet.h"
+#include "PostingList.h"
+
+/**
+ * Queries can nest parentheses this deep.
+ */
+#define QUERY_MAX_DEPTH 32
+
+/**
+ * What a QueryNode does.
+ */
+typedef enum {
+  QUERY_TERM, /*!< Matches the movies with a word in their title */
+  QUERY_AND, /*!< Matches the movies all its children match */
+  QUERY_OR, /*!< Matches the movies any of its children match */
+  QUERY_NOT, /*!< Matches nothing by itself; takes movies out of an AND */
+  QUERY_PHRASE /*!< Matches the movies with its words, in order, next to
+                 each other in their title; its children are the words */
+} QueryNodeType;
+
+/**
+ * A parsed query. As well as what the query says, each node keeps
+ * where it's at while the query runs, so a parsed query can only be
+ * run by one thread at a time.
+ */
+typedef struct queryNode {
+  QueryNodeType type;
+  char *term; /*!< The word, for a QUERY_TERM */
+  struct queryNode **children;
+  int num_children;
+
+  MovieSet set; /*!< A QUERY_TERM's MovieSet, or NULL if nothing has it */
+  long num_rows; /*!< At most how many rows the node can match */
+  /**
+   * An AND's children that aren't NOTs come first, the fewest rows
+   * first; this is how many there are.
+   */
+  int num_required;
+  PostingListIter rows; /*!< A QUERY_TERM's place in the current file */
+  int done; /*!< 1 if a QUERY_TERM has no more rows in the current file */
+  /**
+   * A QUERY_TERM's place in the current file's positions, if the
+   * index keeps them and it's in a phrase.
+   */
+  PostingListIter positions;
+  int has_positions; /*!< 1 if positions is set */
+  /**
+   * The row a QUERY_PHRASE last found in the current file, since its
+   * words' positions can't be gone back over.
+   */
+  uint32_t match;
+} *QueryNode;
+
+/**
+ * Parses a query. A query is words, which all have to be in a title,
+ * unless they're joined by OR:
+ *
+ *     seattle sleepless
+ *     seattle AND sleepless
+ *     seattle OR portland
+ *     (seattle OR portland) AND NOT sleepless
+ *     "sleepless in seattle" OR "the godfather"
+ *
+ * AND binds tighter than OR, and NOT only narrows down the words it's
+ * ANDed with, so a query that's all NOTs matches nothing. AND, OR and
+ * NOT have to be in capitals to be operators. Words in double quotes
+ * are a phrase, and have to be next to each other, in that order.
+ *
+ * Phrases are checked with the positions the index kept for each word
+ * (see Index.keep_positions), without reading any rows. If the index
+ * didn't keep them, a phrase only needs all its words in the title.
+ *
+ * \param query the query.
+ *
+ * \return the parsed query, or NULL if it's empty, doesn't parse, or
+ *         nests too deep.
+ */
+QueryNode ParseQuery(const char *query);
+
+/**
+ * Destroys a parsed query, and all its nodes.
+ */
+void DestroyQuery(QueryNode query);
+
+/**
+ * Runs a parsed query against an index.
+ *
+ * It only looks at the files the rarest word of each AND is in, and in
+ * each one steps through the rarest word's rows, skipping every other
+ * word's rows ahead to them. So an AND costs about as much as its
+ * rarest word, however common the others are.
+ *
+ * \param index the offset index.
+ * \param query the parsed query.
+ * \param desc what to call the MovieSet.
+ *
+ * \return a new MovieSet holding the rows that match, to be destroyed
+ *         with DestroyMovieSet, or NULL if nothing matches.
+ */
+MovieSet RunBooleanQuery(Index index, QueryNode query, char *desc);
+
+/**
+ * Parses and runs a query.
+ *
+ * \param index the offset index.
+ * \param query the query.
+ * \param owned set to 1 if the MovieSet returned was made for the query
+ *        and has to be destroyed with DestroyMovieSet, or 0 if it's
+ *        the index's own, which is what a query of one word gives.
+ *
+ * \return the movies that match, or NULL if none do or the query
+ *         doesn't parse.
+ */
+MovieSet FindQueryMovies(Index index, const char *query, int *owned);
+
+#endif  // BOOLEANQUERY_H
@@ -21,13 +21,21 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "FileCrawler.h"
 #include "DocIdMap.h"
 #include "LinkedList.h"
+#include "htll/Hashtable.h"
 
 
-void CrawlFilesToMap(const char *dir, DocIdMap map) {
+// Called with each file a crawl finds: its path, which it's given to
+// keep or free, and what stat says about it.
+typedef void (*FoundFileFn)(char *path, const struct stat *s, void *arg);
+
+// Crawls a directory tree, in name order, calling found on every file.
+static void CrawlDir(const char *dir, FoundFileFn found, void *arg) {
   struct stat s;
 
   struct dirent **namelist;
@@ -61,14 +69,14 @@ void CrawlFilesToMap(const char *dir, DocIdMap map) {
       if (0 == stat(directory, &s)) {
         if (S_ISDIR(s.st_mode)) {
           strcat(directory, "/");
-          CrawlFilesToMap(directory, map);
+          CrawlDir(directory, found, arg);
           free(directory);
         } else {
-          printf("adding file to map: %s\n", directory);
-          PutFileInMap(directory, map);
+          found(directory, &s, arg);
         }
       } else {
         printf("no stat; %s\n", directory);
+        free(directory);
       }
       free(namelist[i]);
       i++;
@@ -76,3 +84,428 @@ void CrawlFilesToMap(const char *dir, DocIdMap map) {
   }
   free(namelist);
 }
+
+static void AddFoundFile(char *path, const struct stat *s, void *map) {
+  printf("adding file to map: %s\n", path);
+  PutFileInMap(path, (DocIdMap)map);
+}
+
+void CrawlFilesToMap(const char *dir, DocIdMap map) {
+  CrawlDir(dir, &AddFoundFile, map);
+}
+
+// How many directories can wait to be crawled. A thread that finds
+// another when it's full crawls it there and then.
+#define CRAWL_QUEUE_DIRS 1024
+
+// A crawl on several threads.
+struct crawl {
+  CrawlFileFn found;
+  void *arg;
+  char *dirs[CRAWL_QUEUE_DIRS];  // waiting to be crawled, as a ring
+  int head;
+  int num_dirs;
+  int busy;  // threads crawling a directory
+  pthread_mutex_t lock;
+  pthread_cond_t changed;  // a directory was queued, or the crawl is done
+};
+
+// Joins a directory and a name in it, with a '/' after a directory.
+static char *JoinPath(const char *dir, const char *name, int is_dir) {
+  size_t dir_len = strlen(dir);
+  size_t name_len = strlen(name);
+  char *path = (char*)malloc(dir_len + name_len + 2);
+  if (path == NULL) {
+    return NULL;
+  }
+  memcpy(path, dir, dir_len);
+  memcpy(path + dir_len, name, name_len);
+  if (is_dir) {
+    path[dir_len + name_len++] = '/';
+  }
+  path[dir_len + name_len] = '\0';
+  return path;
+}
+
+// Queues a directory to be crawled; returns 0 if there's no room.
+static int QueueDir(struct crawl *crawl, char *dir) {
+  int queued = 0;
+  pthread_mutex_lock(&crawl->lock);
+  if (crawl->num_dirs < CRAWL_QUEUE_DIRS) {
+    crawl->dirs[(crawl->head + crawl->num_dirs++) % CRAWL_QUEUE_DIRS] = dir;
+    pthread_cond_signal(&crawl->changed);
+    queued = 1;
+  }
+  pthread_mutex_unlock(&crawl->lock);
+  return queued;
+}
+
+// Crawls the files in one directory, queuing the directories in it, and
+// frees dir. The directory entry's type is used where there is one, so
+// only links, and files on filesystems that don't say, are stat'd.
+static void CrawlOneDir(struct crawl *crawl, char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    perror("opendir");
+    printf("dir: %s\n", dir);
+    free(dir);
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    int is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+      struct stat s;
+      char *path = JoinPath(dir, entry->d_name, 0);
+      if (path == NULL) {
+        continue;
+      }
+      int result = stat(path, &s);
+      free(path);
+      if (result != 0) {
+        printf("no stat; %s%s\n", dir, entry->d_name);
+        continue;
+      }
+      is_dir = S_ISDIR(s.st_mode);
+    }
+    char *path = JoinPath(dir, entry->d_name, is_dir);
+    if (path == NULL) {
+      printf("Couldn't malloc for filecrawler.directory\n");
+      continue;
+    }
+    if (!is_dir) {
+      crawl->found(path, crawl->arg);
+    } else if (!QueueDir(crawl, path)) {
+      CrawlOneDir(crawl, path);
+    }
+  }
+  closedir(d);
+  free(dir);
+}
+
+static void *CrawlWorker(void *arg) {
+  struct crawl *crawl = (struct crawl*)arg;
+  pthread_mutex_lock(&crawl->lock);
+  while (1) {
+    while (crawl->num_dirs == 0 && crawl->busy > 0) {
+      pthread_cond_wait(&crawl->changed, &crawl->lock);
+    }
+    if (crawl->num_dirs == 0) {
+      // Nothing queued, and nobody crawling who could queue more.
+      break;
+    }
+    char *dir = crawl->dirs[crawl->head];
+    crawl->head = (crawl->head + 1) % CRAWL_QUEUE_DIRS;
+    crawl->num_dirs--;
+    crawl->busy++;
+    pthread_mutex_unlock(&crawl->lock);
+
+    CrawlOneDir(crawl, dir);
+
+    pthread_mutex_lock(&crawl->lock);
+    crawl->busy--;
+    if (crawl->busy == 0 && crawl->num_dirs == 0) {
+      pthread_cond_broadcast(&crawl->changed);
+    }
+  }
+  pthread_mutex_unlock(&crawl->lock);
+  return NULL;
+}
+
+int CrawlFiles(const char *dir, int num_threads, CrawlFileFn found,
+               void *arg) {
+  if (num_threads <= 0) {
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) {
+      num_threads = 1;
+    }
+  }
+  struct crawl *crawl = (struct crawl*)malloc(sizeof(struct crawl));
+  pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+  char *first = strdup(dir);
+  if (crawl == NULL || threads == NULL || first == NULL) {
+    printf("Couldn't malloc for the crawl\n");
+    free(crawl);
+    free(threads);
+    free(first);
+    return -1;
+  }
+  crawl->found = found;
+  crawl->arg = arg;
+  crawl->head = 0;
+  crawl->num_dirs = 1;
+  crawl->dirs[0] = first;
+  crawl->busy = 0;
+  pthread_mutex_init(&crawl->lock, NULL);
+  pthread_cond_init(&crawl->changed, NULL);
+
+  int started = 0;
+  for (; started < num_threads - 1; started++) {
+    if (pthread_create(&threads[started], NULL, &CrawlWorker, crawl) != 0) {
+      break;
+    }
+  }
+  CrawlWorker(crawl);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&crawl->changed);
+  pthread_mutex_destroy(&crawl->lock);
+  free(crawl);
+  free(threads);
+  return 0;
+}
+
+// The paths a crawl to a map has found so far.
+struct foundPaths {
+  char **paths;
+  int num_paths;
+  int capacity;
+  pthread_mutex_t lock;
+};
+
+static void CollectPath(char *path, void *arg) {
+  struct foundPaths *found = (struct foundPaths*)arg;
+  pthread_mutex_lock(&found->lock);
+  if (found->num_paths == found->capacity) {
+    int capacity = found->capacity * 2 + 64;
+    char **paths = (char**)realloc(found->paths, capacity * sizeof(char*));
+    if (paths == NULL) {
+      pthread_mutex_unlock(&found->lock);
+      printf("Couldn't malloc for the crawl\n");
+      free(path);
+      return;
+    }
+    found->paths = paths;
+    found->capacity = capacity;
+  }
+  found->paths[found->num_paths++] = path;
+  pthread_mutex_unlock(&found->lock);
+}
+
+// Orders paths as CrawlDir finds them: by name in each directory, with
+// everything in a directory where the directory's name goes.
+static int ComparePaths(const void *a, const void *b) {
+  const unsigned char *p = *(const unsigned char* const*)a;
+  const unsigned char *q = *(const unsigned char* const*)b;
+  while (*p != '\0' && *p == *q) {
+    p++;
+    q++;
+  }
+  // A name that ends first comes first, as it does for strcmp.
+  int c = *p == '/' ? 0 : *p;
+  int d = *q == '/' ? 0 : *q;
+  return c - d;
+}
+
+void CrawlFilesToMap_Parallel(const char *dir, DocIdMap map,
+                              int num_threads) {
+  struct foundPaths found = {NULL, 0, 0};
+  pthread_mutex_init(&found.lock, NULL);
+  CrawlFiles(dir, num_threads, &CollectPath, &found);
+  pthread_mutex_destroy(&found.lock);
+
+  qsort(found.paths, found.num_paths, sizeof(char*), &ComparePaths);
+  for (int i = 0; i < found.num_paths; i++) {
+    PutFileInMap(found.paths[i], map);
+  }
+  free(found.paths);
+}
+
+// Finds a file's FileState in a CrawlState. Files go under a hash of
+// their path, or the next free key after it if another path has that
+// hash already, so the paths are compared as the keys are tried.
+//
+// Returns the FileState, or NULL if the file isn't there, with key set
+// to where it would go.
+static FileState *FindFileState(CrawlState state, const char *path,
+                                uint64_t *key) {
+  *key = FNVHash64((unsigned char*)path, strlen(path));
+  HTKeyValue kvp;
+  while (LookupInHashtable(state, *key, &kvp) == 0) {
+    FileState *file = (FileState*)kvp.value;
+    if (strcmp(file->path, path) == 0) {
+      return file;
+    }
+    (*key)++;
+  }
+  return NULL;
+}
+
+// Records what stat says about a file in its FileState.
+static void SetFileState(FileState *state, const struct stat *s) {
+  state->size = s->st_size;
+  state->mtime_sec = s->st_mtim.tv_sec;
+  state->mtime_nsec = s->st_mtim.tv_nsec;
+  state->inode = s->st_ino;
+}
+
+static int SameFileState(const FileState *file, const FileState *now) {
+  return file->size == now->size && file->mtime_sec == now->mtime_sec &&
+      file->mtime_nsec == now->mtime_nsec && file->inode == now->inode;
+}
+
+static void DestroyFileState(void *state) {
+  free(((FileState*)state)->path);
+  free(state);
+}
+
+// Puts a FileState in a CrawlState, if its path isn't there already.
+// The state takes the FileState either way.
+static int AddFileState(CrawlState state, FileState *file) {
+  uint64_t key;
+  if (FindFileState(state, file->path, &key) != NULL) {
+    DestroyFileState(file);
+    return 0;
+  }
+  HTKeyValue kvp = {key, file};
+  HTKeyValue old_kvp;
+  if (PutInHashtable(state, kvp, &old_kvp) == 1) {
+    DestroyFileState(file);
+    return -1;
+  }
+  return 0;
+}
+
+CrawlState CreateCrawlState(DocIdMap docs, RowTable rows) {
+  CrawlState state = CreateHashtable(64);
+  if (state == NULL) {
+    return NULL;
+  }
+  HTIter iter = CreateHashtableIterator(docs);
+  if (iter == NULL) {
+    return state;
+  }
+  do {
+    HTKeyValue kvp;
+    HTIteratorGet(iter, &kvp);
+    FileState *file = (FileState*)calloc(1, sizeof(FileState));
+    SavedRows saved;
+    if (file == NULL || (file->path = strdup((char*)kvp.value)) == NULL) {
+      free(file);
+      continue;
+    }
+    file->doc_id = kvp.key;
+    // A file whose rows were never read will look changed next time.
+    if (rows != NULL && GetSavedRows(rows, kvp.key, &saved) == 0) {
+      file->size = saved.stat.size;
+      file->mtime_sec = saved.stat.mtime_sec;
+      file->mtime_nsec = saved.stat.mtime_nsec;
+      file->inode = saved.stat.inode;
+    }
+    AddFileState(state, file);
+  } while (HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return state;
+}
+
+void DestroyCrawlState(CrawlState state) {
+  DestroyHashtable(state, &DestroyFileState);
+}
+
+// What a crawl for changes is working out.
+struct changes {
+  CrawlState state;
+  CrawlState next;
+  uint64_t *next_doc_id;
+  DocIdMap changed;
+  Hashtable removed;
+  int num_changes;
+  int failed;  // 1 if anything couldn't be allocated
+};
+
+// Puts a file that's new, or has changed, in changed under a new id.
+static int AddChangedFile(struct changes *changes, FileState *file) {
+  char *path = strdup(file->path);
+  if (path == NULL) {
+    return -1;
+  }
+  HTKeyValue kvp = {(*changes->next_doc_id)++, path};
+  HTKeyValue old_kvp;
+  if (PutInHashtable(changes->changed, kvp, &old_kvp) == 1) {
+    free(path);
+    return -1;
+  }
+  file->doc_id = kvp.key;
+  changes->num_changes++;
+  return 0;
+}
+
+static int RemoveFile(struct changes *changes, uint64_t doc_id) {
+  HTKeyValue kvp = {doc_id, NULL};
+  HTKeyValue old_kvp;
+  return PutInHashtable(changes->removed, kvp, &old_kvp) == 1 ? -1 : 0;
+}
+
+static void CheckFoundFile(char *path, const struct stat *s, void *arg) {
+  struct changes *changes = (struct changes*)arg;
+  FileState *file = (FileState*)calloc(1, sizeof(FileState));
+  if (file == NULL) {
+    free(path);
+    changes->failed = 1;
+    return;
+  }
+  file->path = path;
+  SetFileState(file, s);
+
+  uint64_t key;
+  FileState *old = FindFileState(changes->state, path, &key);
+  int result = 0;
+  if (old != NULL && SameFileState(old, file)) {
+    file->doc_id = old->doc_id;
+  } else {
+    if (old != NULL) {
+      result = RemoveFile(changes, old->doc_id);
+    }
+    if (result == 0) {
+      result = AddChangedFile(changes, file);
+    }
+  }
+  if (result != 0 || AddFileState(changes->next, file) != 0) {
+    changes->failed = 1;
+  }
+}
+
+int CrawlChangedFiles(const char *dir, CrawlState state, uint64_t *next_doc_id,
+                      DocIdMap changed, Hashtable removed, CrawlState *next) {
+  struct changes changes = {state, CreateHashtable(64), next_doc_id,
+                            changed, removed, 0, 0};
+  *next = NULL;
+  if (changes.next == NULL) {
+    return -1;
+  }
+
+  CrawlDir(dir, &CheckFoundFile, &changes);
+
+  // Whatever wasn't found again has gone.
+  int num_gone = 0;
+  HTIter iter = CreateHashtableIterator(state);
+  while (iter != NULL && !changes.failed) {
+    HTKeyValue kvp;
+    HTIteratorGet(iter, &kvp);
+    FileState *file = (FileState*)kvp.value;
+    uint64_t key;
+    if (FindFileState(changes.next, file->path, &key) == NULL) {
+      if (RemoveFile(&changes, file->doc_id) != 0) {
+        changes.failed = 1;
+      }
+      num_gone++;
+    }
+    if (HTIteratorNext(iter) != 0) {
+      break;
+    }
+  }
+  if (iter != NULL) {
+    DestroyHashtableIterator(iter);
+  }
+  if (changes.failed) {
+    DestroyCrawlState(changes.next);
+    return -1;
+  }
+  *next = changes.next;
+  return changes.num_changes + num_gone;
+}
@@ -22,23 +22,24 @@
 #include <sys/time.h>
 #include <time.h>
 #include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "MovieIndex.h"
 #include "FileParser.h"
 #include "Movie.h"
 #include "DocIdMap.h"
 #include "MovieSet.h"
+#include "RowParser.h"
+#include "RowTable.h"
+#include "RankedQuery.h"
+#include "FileCrawler.h"
 
 //  Only for NullFree; TODO(adrienne): NullFree should live somewhere else.
 
 #define BUFFER_SIZE 1000
 
-struct indexMTArgs {
-  char *file;
-  uint64_t doc_id;
-  Index index;
-};
-
 pthread_mutex_t m_add = PTHREAD_MUTEX_INITIALIZER;
 
 //=======================
@@ -48,7 +49,6 @@ pthread_mutex_t m_add = PTHREAD_MUTEX_INITIALIZER;
 
 void IndexTheFile(char *file, uint64_t docId, Index index);
 
-void IndexTheFile_MT(void* arguments);
 
 
 /**
@@ -56,7 +56,14 @@ void IndexTheFile_MT(void* arguments);
  * Builds an OffsetIndex
  */
 int ParseTheFiles(DocIdMap docs, Index index) {
+  if (index->rows == NULL) {
+    index->rows = CreateRowTable(docs);
+  }
   HTIter iter = CreateHashtableIterator(docs);
+  if (iter == NULL) {
+    // No files to parse
+    return ComputeBlockBounds(index);
+  }
   HTKeyValue kv;
 
   while (1) {
@@ -71,154 +78,609 @@ int ParseTheFiles(DocIdMap docs, Index index) {
 
   DestroyHashtableIterator(iter);
 
-  return 0;
+  return ComputeBlockBounds(index);
+}
+
+// Indexes the rows of a mapped file from byte start up to byte end
+// (or the end of the file if end is -1), numbering them from first_row.
+// Titles go into the index straight from the mapping, with no copying.
+// Records where each movie row starts in rows, if it isn't NULL.
+// Holds lock, if it isn't NULL, while adding to the index.
+static void IndexTheRows(MappedFile *mapped, uint64_t doc_id, Index index,
+                         long start, long end, int first_row,
+                         RowTable rows, pthread_mutex_t *lock) {
+  RowParser parser;
+  FieldView line;
+  MovieRowIndex pieces;
+  int row = first_row;
+
+  if (rows != NULL && SetFileStat(rows, doc_id, &mapped->stat) != 0) {
+    fprintf(stderr, "Didn't record the file's stat.\n");
+  }
+  InitRowParser(&parser, mapped, start, end);
+  while (NextMovieRow(&parser, &line, &pieces)) {
+    if (!pieces.is_movie) {
+      continue;
+    }
+    if (rows != NULL &&
+        AddRowOffset(rows, doc_id, line.start - mapped->data,
+                     &pieces) != 0) {
+      fprintf(stderr, "Didn't record the row's offset.\n");
+    }
+    if (lock != NULL) {
+      pthread_mutex_lock(lock);
+    }
+    int result;
+    if (pieces.num_title_words >= 0) {
+      result = AddTitleWordViewsToIndex(index, pieces.title_words,
+                                        pieces.num_title_words, doc_id, row);
+    } else {
+      // Too many words to split up front; let the index split them.
+      result = AddTitleWordsToIndex(index,
+                                    pieces.fields[MOVIE_ROW_TITLE].start,
+                                    pieces.fields[MOVIE_ROW_TITLE].len,
+                                    doc_id, row);
+    }
+    if (lock != NULL) {
+      pthread_mutex_unlock(lock);
+    }
+
+    if (result < 0) {
+      fprintf(stderr, "Didn't add MovieToIndex.\n");
+    }
+    row++;
+  }
 }
 
 // Builds an OffsetIndex
 void IndexTheFile(char *file, uint64_t doc_id, Index index) {
-  FILE *cfPtr;
+  MappedFile mapped;
 
   printf("file: %s\n", file);
 
-  if ((cfPtr = fopen(file, "r")) == NULL) {
+  if (MapFile(file, &mapped) != 0) {
     printf("File could not be opened\n");
     return;
-  } else {
-    char buffer[BUFFER_SIZE];
-    int row = 0;
+  }
+  IndexTheRows(&mapped, doc_id, index, 0, -1, 0, index->rows, NULL);
+  UnmapFile(&mapped);
+}
+
+// ======================
+// The indexing thread pool.
+//
+// Each worker has its own deque of tasks. It takes work from the back
+// of its own deque, and when that runs dry it steals from the front of
+// the others', so a thread that drew small files keeps busy helping the
+// threads that drew big ones instead of waiting on them.
+//
+// Workers either all add to one index under m_add, or each add to a
+// shard of their own with no locking at all, to be merged at the end.
+//
+// A task is a whole file, or a byte range of one. A whole file over
+// PARSE_CHUNK_BYTES is first split: the worker reads through it
+// counting rows, and pushes one task per chunk, each knowing the row
+// it starts at, for the others to steal. Since it sees every row, it
+// records their offsets too, and the chunks don't.
+
+// Files bigger than this are split into chunks about this size.
+#define PARSE_CHUNK_BYTES (1 << 20)
+
+struct parseTask {
+  char *file;
+  uint64_t doc_id;
+  long start;  // byte offset the task starts at
+  long end;  // byte offset it ends at, or -1 for the end of the file
+  int first_row;  // the row id of the first row in the task
+};
+
+struct taskDeque {
+  struct parseTask *tasks;
+  int head;  // thieves take from here
+  int tail;  // the owner pushes and takes from here
+  int capacity;
+  pthread_mutex_t lock;
+};
 
-    while (fgets(buffer, BUFFER_SIZE, cfPtr) != NULL) {
-      Movie *movie = CreateMovieFromRow(buffer);
-      if (movie == NULL) {
-        continue;
+struct workerArgs {
+  struct parsePool *pool;
+  int id;
+};
+
+struct parsePool {
+  Index index;
+  Index *shards;  // one per worker, or NULL to share index
+  RowTable rows;  // where movie rows start; each file has one writer
+  int num_threads;
+  struct taskDeque *deques;
+  int outstanding;  // tasks pushed but not yet finished
+  int pushed;  // how many tasks have been pushed, ever
+  pthread_mutex_t outstanding_lock;  // guards outstanding and pushed
+  // Signalled when a task is pushed, and broadcast when outstanding
+  // gets to 0, for workers that have run out of tasks to wait on.
+  pthread_cond_t work_cond;
+  struct workerArgs *args;
+  pthread_t *threads;
+  int num_started;  // how many of the workers' threads started
+};
+
+static void FinishTask(struct parsePool *pool) {
+  pthread_mutex_lock(&pool->outstanding_lock);
+  if (--pool->outstanding == 0) {
+    pthread_cond_broadcast(&pool->work_cond);
+  }
+  pthread_mutex_unlock(&pool->outstanding_lock);
+}
+
+static int PushTask(struct parsePool *pool, int which,
+                    struct parseTask *task) {
+  struct taskDeque *deque = &pool->deques[which];
+  pthread_mutex_lock(&pool->outstanding_lock);
+  pool->outstanding++;
+  pthread_mutex_unlock(&pool->outstanding_lock);
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail == deque->capacity) {
+    // Slide down over the stolen tasks, or grow if there were none.
+    if (deque->head > 0) {
+      memmove(deque->tasks, deque->tasks + deque->head,
+              (deque->tail - deque->head) * sizeof(struct parseTask));
+      deque->tail -= deque->head;
+      deque->head = 0;
+    } else {
+      int capacity = deque->capacity * 2;
+      struct parseTask *tasks = (struct parseTask*)realloc(
+          deque->tasks, capacity * sizeof(struct parseTask));
+      if (tasks == NULL) {
+        pthread_mutex_unlock(&deque->lock);
+        printf("Couldn't grow a parse task queue\n");
+        FinishTask(pool);
+        return -1;
       }
-      int result = AddMovieTitleToIndex(index, movie, doc_id, row);
-      if (result < 0) {
-        fprintf(stderr, "Didn't add MovieToIndex.\n");
+      deque->tasks = tasks;
+      deque->capacity = capacity;
+    }
+  }
+  deque->tasks[deque->tail++] = *task;
+  pthread_mutex_unlock(&deque->lock);
+
+  pthread_mutex_lock(&pool->outstanding_lock);
+  pool->pushed++;
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->outstanding_lock);
+  return 0;
+}
+
+// Takes the newest task off a worker's own deque.
+static int PopTask(struct taskDeque *deque, struct parseTask *task) {
+  int found = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail > deque->head) {
+    *task = deque->tasks[--deque->tail];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// Takes the oldest task off another worker's deque.
+static int StealTask(struct taskDeque *deque, struct parseTask *task) {
+  int found = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail > deque->head) {
+    *task = deque->tasks[deque->head++];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// Walks through a big file the way IndexTheRows will, and pushes a
+// task for each chunk. Chunks start where a row starts, so each one
+// sees the same rows, with the same ids, as one pass over the file.
+static void SplitFile(struct parsePool *pool, int which,
+                      struct parseTask *file_task) {
+  MappedFile mapped;
+  if (MapFile(file_task->file, &mapped) != 0) {
+    printf("File could not be opened\n");
+    return;
+  }
+  RowParser parser;
+  FieldView line;
+  MovieRowIndex pieces;
+  struct parseTask chunk = *file_task;
+  chunk.start = 0;
+  chunk.first_row = 0;
+  int row = 0;
+  long pos = 0;
+
+  if (pool->rows != NULL &&
+      SetFileStat(pool->rows, file_task->doc_id, &mapped.stat) != 0) {
+    fprintf(stderr, "Didn't record the file's stat.\n");
+  }
+  InitRowParser(&parser, &mapped, 0, -1);
+  while (NextMovieRow(&parser, &line, &pieces)) {
+    if (pieces.is_movie) {
+      if (pool->rows != NULL &&
+          AddRowOffset(pool->rows, file_task->doc_id,
+                       line.start - mapped.data, &pieces) != 0) {
+        fprintf(stderr, "Didn't record the row's offset.\n");
       }
       row++;
-      DestroyMovie(movie);  // Done with this now
     }
-    fclose(cfPtr);
+    pos = RowParserOffset(&parser);
+    if (pos - chunk.start >= PARSE_CHUNK_BYTES) {
+      chunk.end = pos;
+      PushTask(pool, which, &chunk);
+      chunk.start = pos;
+      chunk.first_row = row;
+    }
+  }
+  UnmapFile(&mapped);
+  if (pos > chunk.start) {
+    chunk.end = -1;
+    PushTask(pool, which, &chunk);
   }
 }
 
-/**
- * Parses the files that are in the provided DocIdMap,
- * utilizing multithreading.
- * Builds an OffsetIndex.
- */
-int ParseTheFiles_MT(DocIdMap docs, Index index) {
-  HTIter iter = CreateHashtableIterator(docs);
-  HTKeyValue kv;
+// Indexes one task's range of a file.
+static void IndexTheRange(char *file, uint64_t doc_id, Index index,
+                          long start, long end, int first_row,
+                          RowTable rows, pthread_mutex_t *lock) {
+  MappedFile mapped;
+  if (MapFile(file, &mapped) != 0) {
+    printf("File could not be opened\n");
+    return;
+  }
+  IndexTheRows(&mapped, doc_id, index, start, end, first_row, rows, lock);
+  UnmapFile(&mapped);
+}
 
-  // Multithreading vars
-  pthread_t p1, p2, p3, p4, p5;
+// Indexes a chunk of a big file into an index of its own, and merges
+// that into the worker's shard, or the shared index. The chunks of a
+// file are run in any order, some at once, so adding their rows
+// straight to the file's posting lists would keep putting rows before
+// ones already there, re-encoding the lists every time; merging them
+// goes through each list once.
+static void IndexTheChunk(struct parsePool *pool, int which,
+                          struct parseTask *task) {
+  Index target = pool->shards != NULL ? pool->shards[which] : pool->index;
+  pthread_mutex_t *lock = pool->shards != NULL ? NULL : &m_add;
+  Index chunk = CreateIndex();
+  if (chunk == NULL) {
+    // Slower, but it still gets indexed.
+    IndexTheRange(task->file, task->doc_id, target, task->start,
+                  task->end, task->first_row, NULL, lock);
+    return;
+  }
+  chunk->keep_positions = target->keep_positions;
+  // A chunk's rows were recorded when its file was split.
+  IndexTheRange(task->file, task->doc_id, chunk, task->start, task->end,
+                task->first_row, NULL, NULL);
+  if (lock != NULL) {
+    pthread_mutex_lock(lock);
+  }
+  if (MergeIndexShards(target, &chunk, 1, 1) != 0) {
+    fprintf(stderr, "Didn't merge a chunk into the index.\n");
+  }
+  if (lock != NULL) {
+    pthread_mutex_unlock(lock);
+  }
+}
 
-  struct indexMTArgs args[5];
-  while (1) {
-    // Iterate using 5 threads
-    // First thread
-    HTIteratorGet(iter, &kv);
-    args[0].file = kv.value;
-    args[0].doc_id = kv.key;
-    args[0].index = index;
-    pthread_create(&p1, NULL, (void*)IndexTheFile_MT, (void*)&args[0]);
+static void RunTask(struct parsePool *pool, int which,
+                    struct parseTask *task) {
+  if (task->start != 0 || task->end >= 0) {
+    IndexTheChunk(pool, which, task);
+    return;
+  }
+  struct stat file_stat;
+  if (stat(task->file, &file_stat) == 0 &&
+      file_stat.st_size > PARSE_CHUNK_BYTES) {
+    SplitFile(pool, which, task);
+    return;
+  }
+  if (pool->shards != NULL) {
+    IndexTheRange(task->file, task->doc_id, pool->shards[which],
+                  task->start, task->end, task->first_row, pool->rows, NULL);
+  } else {
+    IndexTheRange(task->file, task->doc_id, pool->index,
+                  task->start, task->end, task->first_row, pool->rows,
+                  &m_add);
+  }
+}
 
-    // Second thread
-    if (HTIteratorHasMore(iter) != 0) {
-      HTIteratorNext(iter);
-      HTIteratorGet(iter, &kv);
-      args[1].file = kv.value;
-      args[1].doc_id = kv.key;
-      args[1].index = index;
-      pthread_create(&p2, NULL, (void*)IndexTheFile_MT, (void*)&args[1]);
+static void *ParseWorker(void *arguments) {
+  struct workerArgs *args = (struct workerArgs*)arguments;
+  struct parsePool *pool = args->pool;
+  struct parseTask task;
+
+  pthread_mutex_lock(&pool->outstanding_lock);
+  while (pool->outstanding > 0) {
+    int pushed = pool->pushed;
+    pthread_mutex_unlock(&pool->outstanding_lock);
+    int found = PopTask(&pool->deques[args->id], &task);
+    // Out of our own work; look for some to steal.
+    for (int i = 1; !found && i < pool->num_threads; i++) {
+      found = StealTask(&pool->deques[(args->id + i) % pool->num_threads],
+                        &task);
     }
-
-    // Third thread
-    if (HTIteratorHasMore(iter) != 0) {
-      HTIteratorNext(iter);
-      HTIteratorGet(iter, &kv);
-      args[2].file = kv.value;
-      args[2].doc_id = kv.key;
-      args[2].index = index;
-      pthread_create(&p3, NULL, (void*)IndexTheFile_MT, (void*)&args[2]);
+    if (found) {
+      RunTask(pool, args->id, &task);
+      FinishTask(pool);
     }
-
-    // Fourth thread
-    if (HTIteratorHasMore(iter) != 0) {
-      HTIteratorNext(iter);
-      HTIteratorGet(iter, &kv);
-      args[3].file = kv.value;
-      args[3].doc_id = kv.key;
-      args[3].index = index;
-      pthread_create(&p4, NULL, (void*)IndexTheFile_MT, (void*)&args[3]);
+    pthread_mutex_lock(&pool->outstanding_lock);
+    // Someone is still splitting or indexing, so what's left may be
+    // theirs: wait for them to push it, or to finish. A task pushed
+    // since we looked changes pushed, so it isn't missed.
+    while (!found && pool->outstanding > 0 && pool->pushed == pushed) {
+      pthread_cond_wait(&pool->work_cond, &pool->outstanding_lock);
     }
+  }
+  pthread_mutex_unlock(&pool->outstanding_lock);
+  return NULL;
+}
 
-    // Last thread
-    if (HTIteratorHasMore(iter) != 0) {
-      HTIteratorNext(iter);
-      HTIteratorGet(iter, &kv);
-      args[4].file = kv.value;
-      args[4].doc_id = kv.key;
-      args[4].index = index;
-      pthread_create(&p5, NULL, (void*)IndexTheFile_MT, (void*)&args[4]);
+static int NumThreads(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) {
+      num_threads = 1;
     }
+  }
+  return num_threads;
+}
 
-    // Wait for the threads before moving on
-    pthread_join(p1, NULL);
-    pthread_join(p2, NULL);
-    pthread_join(p3, NULL);
-    pthread_join(p4, NULL);
-    pthread_join(p5, NULL);
+// Sets up a pool, adding to index under m_add, or to shards[worker]
+// if shards isn't NULL, with its workers not started yet.
+static int InitParsePool(struct parsePool *pool, Index index,
+                         Index *shards, int num_threads) {
+  pool->index = index;
+  pool->shards = shards;
+  pool->rows = index->rows;
+  pool->num_threads = num_threads;
+  pool->outstanding = 0;
+  pool->pushed = 0;
+  pool->deques = (struct taskDeque*)malloc(num_threads *
+                                           sizeof(struct taskDeque));
+  pool->args = (struct workerArgs*)malloc(
+      num_threads * sizeof(struct workerArgs));
+  pool->threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+  if (pool->deques == NULL || pool->args == NULL || pool->threads == NULL) {
+    printf("Couldn't malloc for the parse pool\n");
+    free(pool->deques);
+    free(pool->args);
+    free(pool->threads);
+    return -1;
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pool->deques[i].capacity = 16;
+    pool->deques[i].tasks = (struct parseTask*)malloc(
+        pool->deques[i].capacity * sizeof(struct parseTask));
+    if (pool->deques[i].tasks == NULL) {
+      printf("Couldn't malloc for the parse pool\n");
+      for (int j = 0; j < i; j++) {
+        free(pool->deques[j].tasks);
+        pthread_mutex_destroy(&pool->deques[j].lock);
+      }
+      free(pool->deques);
+      free(pool->args);
+      free(pool->threads);
+      return -1;
+    }
+    pool->deques[i].head = 0;
+    pool->deques[i].tail = 0;
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  }
+  pthread_mutex_init(&pool->outstanding_lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pool->num_started = 0;
+  return 0;
+}
 
-    if (HTIteratorHasMore(iter) == 0) {
+// Starts the workers' threads. If one can't be started, the rest
+// aren't tried; the ones that did start steal the others' tasks.
+static void StartParseWorkers(struct parsePool *pool) {
+  for (int i = 0; i < pool->num_threads; i++) {
+    pool->args[i].pool = pool;
+    pool->args[i].id = i;
+    if (pthread_create(&pool->threads[pool->num_started], NULL,
+                       &ParseWorker, &pool->args[i]) != 0) {
+      printf("Couldn't start a parse worker\n");
       break;
-    } else {
-      HTIteratorNext(iter);
     }
+    pool->num_started++;
+  }
+}
+
+// Waits for the workers to run out of tasks, and frees the pool. If
+// none of them could be started, the first one's work, and everyone
+// else's with it, is done on this thread instead.
+static void FinishParsePool(struct parsePool *pool) {
+  if (pool->num_started == 0) {
+    ParseWorker(&pool->args[0]);
+  }
+  for (int i = 0; i < pool->num_started; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  for (int i = 0; i < pool->num_threads; i++) {
+    free(pool->deques[i].tasks);
+    pthread_mutex_destroy(&pool->deques[i].lock);
+  }
+  pthread_mutex_destroy(&pool->outstanding_lock);
+  pthread_cond_destroy(&pool->work_cond);
+  free(pool->deques);
+  free(pool->args);
+  free(pool->threads);
+}
+
+// Runs the pool over the files, adding to index under m_add,
+// or to shards[worker] if shards isn't NULL.
+static int RunParsePool(DocIdMap docs, Index index, Index *shards,
+                        int num_threads) {
+  HTIter iter = CreateHashtableIterator(docs);
+  if (iter == NULL) {
+    // No files to parse
+    return 0;
+  }
+
+  if (index->rows == NULL) {
+    index->rows = CreateRowTable(docs);
+  }
+  struct parsePool pool;
+  if (InitParsePool(&pool, index, shards, num_threads) != 0) {
+    DestroyHashtableIterator(iter);
+    return -1;
   }
 
+  // Deal the files out round-robin; stealing evens out the rest.
+  HTKeyValue kv;
+  int which = 0;
+  do {
+    HTIteratorGet(iter, &kv);
+    struct parseTask task = {kv.value, kv.key, 0, -1, 0};
+    PushTask(&pool, which, &task);
+    which = (which + 1) % num_threads;
+  } while (HTIteratorNext(iter) == 0);
   DestroyHashtableIterator(iter);
-  pthread_mutex_destroy(&m_add);
+
+  StartParseWorkers(&pool);
+  FinishParsePool(&pool);
   return 0;
 }
 
-// Builds an OffsetIndex using multithreading
-void IndexTheFile_MT(void* arguments) {
-  FILE *cfPtr;
-  // Unpack the arguments
-  struct indexMTArgs* args = (struct indexMTArgs*) arguments;
-  char* file = args->file;
-  uint64_t doc_id = args->doc_id;
-  Index index = args->index;
+/**
+ * Parses the files that are in the provided DocIdMap,
+ * utilizing a pool of num_threads worker threads.
+ * Builds an OffsetIndex.
+ */
+int ParseTheFiles_Pool(DocIdMap docs, Index index, int num_threads) {
+  int result = RunParsePool(docs, index, NULL, NumThreads(num_threads));
+  if (ComputeBlockBounds(index) != 0) {
+    result = -1;
+  }
+  return result;
+}
+
+// Makes a shard of index for each of num_threads workers.
+//
+// Returns the shards, or NULL if out of memory.
+static Index *CreateShards(Index index, int num_threads) {
+  Index *shards = (Index*)malloc(num_threads * sizeof(Index));
+  if (shards == NULL) {
+    printf("Couldn't malloc for the index shards\n");
+    return NULL;
+  }
+  for (int i = 0; i < num_threads; i++) {
+    shards[i] = CreateIndex();
+    if (shards[i] == NULL) {
+      printf("Couldn't malloc for the index shards\n");
+      for (int j = 0; j < i; j++) {
+        DestroyOffsetIndex(shards[j]);
+      }
+      free(shards);
+      return NULL;
+    }
+    shards[i]->keep_positions = index->keep_positions;
+  }
+  return shards;
+}
 
-  cfPtr = fopen(file, "r");
+/**
+ * Parses the files that are in the provided DocIdMap,
+ * with each worker thread building its own shard of the index,
+ * then merges the shards into index.
+ * Builds an OffsetIndex.
+ */
+int ParseTheFiles_Sharded(DocIdMap docs, Index index, int num_threads) {
+  num_threads = NumThreads(num_threads);
+  Index *shards = CreateShards(index, num_threads);
+  if (shards == NULL) {
+    return -1;
+  }
 
-  if (cfPtr == NULL) {
-    printf("File could not be opened\n");
+  int result = RunParsePool(docs, index, shards, num_threads);
+  if (MergeIndexShards(index, shards, num_threads, num_threads) != 0 ||
+      ComputeBlockBounds(index) != 0) {
+    result = -1;
+  }
+  free(shards);
+  return result;
+}
+
+// What the crawl that feeds a parse pool shares between its threads.
+struct crawlToPool {
+  struct parsePool *pool;
+  DocIdMap docs;
+  int which;  // the worker to give the next file to
+  pthread_mutex_t lock;  // held to add a file to docs
+};
+
+// Gives a file the crawl found an id, and hands it to a worker.
+static void ParseFoundFile(char *path, void *arg) {
+  struct crawlToPool *crawl = (struct crawlToPool*)arg;
+  pthread_mutex_lock(&crawl->lock);
+  uint64_t doc_id = NumElemsInHashtable(crawl->docs) + 1;
+  PutFileInMap(path, crawl->docs);
+  int which = crawl->which;
+  crawl->which = (which + 1) % crawl->pool->num_threads;
+  pthread_mutex_unlock(&crawl->lock);
+
+  if (AddFileToRowTable(crawl->pool->rows, doc_id, path) != 0) {
+    fprintf(stderr, "Couldn't add %s to the row table.\n", path);
     return;
-  } else {
-    char buffer[BUFFER_SIZE];
-    int row = 0;
+  }
+  struct parseTask task = {path, doc_id, 0, -1, 0};
+  PushTask(crawl->pool, which, &task);
+}
 
-    while (fgets(buffer, BUFFER_SIZE, cfPtr) != NULL) {
-      Movie *movie = CreateMovieFromRow(buffer);
-      if (movie == NULL) {
-        continue;
-      }
-      pthread_mutex_lock(&m_add);
-      int result = AddMovieTitleToIndex(index, movie, doc_id, row);
-      pthread_mutex_unlock(&m_add);
+int CrawlAndParseFiles(const char *dir, DocIdMap docs, Index index,
+                       int num_threads) {
+  num_threads = NumThreads(num_threads);
+  Index *shards = CreateShards(index, num_threads);
+  if (shards == NULL) {
+    return -1;
+  }
+  if (index->rows == NULL) {
+    index->rows = CreateRowTable(docs);
+  }
 
-      if (result < 0) {
-        fprintf(stderr, "Didn't add MovieToIndex.\n");
-      }
-      row++;
-      DestroyMovie(movie);  // Done with this now
+  struct parsePool pool;
+  if (index->rows == NULL ||
+      InitParsePool(&pool, index, shards, num_threads) != 0) {
+    for (int i = 0; i < num_threads; i++) {
+      DestroyOffsetIndex(shards[i]);
     }
-    fclose(cfPtr);
+    free(shards);
+    return -1;
+  }
+  struct crawlToPool crawl = {&pool, docs, 0};
+  pthread_mutex_init(&crawl.lock, NULL);
+
+  // The crawl counts as a task until it's done, so workers that run out
+  // of files wait for more instead of stopping.
+  pool.outstanding = 1;
+  StartParseWorkers(&pool);
+  int result = CrawlFiles(dir, num_threads, &ParseFoundFile, &crawl);
+  FinishTask(&pool);
+  FinishParsePool(&pool);
+  pthread_mutex_destroy(&crawl.lock);
+
+  if (MergeIndexShards(index, shards, num_threads, num_threads) != 0 ||
+      ComputeBlockBounds(index) != 0) {
+    result = -1;
   }
+  free(shards);
+  return result;
+}
+
+/**
+ * Parses the files that are in the provided DocIdMap,
+ * utilizing multithreading, with a thread per core.
+ * Builds an OffsetIndex.
+ */
+int ParseTheFiles_MT(DocIdMap docs, Index index) {
+  return ParseTheFiles_Sharded(docs, index, 0);
 }
 
 // Takes a linkedlist of movies, and builds a hashtable based on the given field
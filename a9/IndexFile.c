@@ -0,0 +1,565 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "IndexFile.h"
+#include "MovieSet.h"
+#include "PostingList.h"
+#include "RowTable.h"
+#include "htll/Hashtable.h"
+
+// Kernels before 4.17 don't know this flag, and take the address as a
+// hint instead; either way, where the image lands is checked.
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define INDEX_FILE_MAGIC "MOVIEIDX"
+
+// What an index file keeps about each file the index was built from,
+// to tell whether it has changed since.
+typedef struct savedFile {
+  const char *path;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode;  // 0 if the file was never read
+} SavedFile;
+
+// The start of an index file. Offsets are from the start of the image.
+typedef struct indexFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t layout;  // see Layout
+  uint64_t base;  // where the image's pointers expect it to be mapped
+  uint64_t image_size;
+  uint64_t image_checksum;
+  uint64_t num_pointers;  // how many pointers the image holds
+  uint64_t pointers_checksum;  // of the list of where they are
+  uint64_t terms;  // the term Hashtable
+  uint64_t files;  // the SavedFile of each doc id
+  uint64_t rows;  // the SavedRows of each doc id
+  uint64_t num_docs;
+  uint32_t keep_positions;
+  uint32_t unused;
+  uint64_t header_checksum;  // of everything before it
+} IndexFileHeader;
+
+// FNV-1a, but a word at a time instead of a byte, so checking an index
+// file takes about as long as reading it.
+static uint64_t Checksum(const void *data, uint64_t len) {
+  const unsigned char *bytes = (const unsigned char*)data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  uint64_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ULL;
+  }
+  for (; i < len; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Sums up the layout of everything the image holds, so a file saved by
+// a build that lays them out differently isn't loaded.
+static uint32_t Layout() {
+  uint64_t sizes[] = {
+    sizeof(void*), sizeof(long), sizeof(struct hashtableInfo),
+    sizeof(HTBucket), sizeof(struct movieSet), sizeof(struct postingList),
+    sizeof(PostingSkip), sizeof(RowStats), sizeof(SavedRows),
+    sizeof(SavedFile), POSTING_INLINE_BYTES, POSTING_SKIP_ROWS,
+    TITLE_POSITION_BITS
+  };
+  return (uint32_t)Checksum(sizes, sizeof(sizes));
+}
+
+// ==========================
+// Writing
+// ==========================
+
+// Builds an image in memory. Everything in it is placed by its offset
+// from the start, since the buffer moves as it grows; offset 0 is never
+// handed out, so it can stand for NULL.
+typedef struct imageWriter {
+  char *data;
+  uint64_t len;
+  uint64_t capacity;
+  uint64_t *pointers;  // where in the image there are pointers
+  uint64_t num_pointers;
+  uint64_t pointers_capacity;
+  int failed;
+} ImageWriter;
+
+// Makes room for size bytes, zeroed and 8-byte aligned.
+// Returns where they are, or 0 if out of memory.
+static uint64_t Reserve(ImageWriter *w, uint64_t size) {
+  if (w->failed) {
+    return 0;
+  }
+  size = (size + 7) & ~(uint64_t)7;
+  if (w->len + size > w->capacity) {
+    uint64_t capacity = w->capacity == 0 ? 1 << 20 : w->capacity * 2;
+    while (capacity < w->len + size) {
+      capacity *= 2;
+    }
+    char *data = (char*)realloc(w->data, capacity);
+    if (data == NULL) {
+      w->failed = 1;
+      return 0;
+    }
+    w->data = data;
+    w->capacity = capacity;
+  }
+  uint64_t at = w->len;
+  memset(w->data + at, 0, size);
+  w->len += size;
+  return at;
+}
+
+static uint64_t PutBytes(ImageWriter *w, const void *bytes, uint64_t len) {
+  uint64_t at = Reserve(w, len);
+  if (at != 0) {
+    memcpy(w->data + at, bytes, len);
+  }
+  return at;
+}
+
+// Sets the pointer at offset at to point to offset target, or to NULL
+// if target is 0, as it will be once the image is mapped.
+static void PutPointer(ImageWriter *w, uint64_t at, uint64_t target) {
+  if (w->failed) {
+    return;
+  }
+  uint64_t address = 0;
+  if (target != 0) {
+    if (w->num_pointers == w->pointers_capacity) {
+      uint64_t capacity = w->pointers_capacity == 0 ?
+          1024 : w->pointers_capacity * 2;
+      uint64_t *pointers = (uint64_t*)realloc(
+          w->pointers, capacity * sizeof(uint64_t));
+      if (pointers == NULL) {
+        w->failed = 1;
+        return;
+      }
+      w->pointers = pointers;
+      w->pointers_capacity = capacity;
+    }
+    w->pointers[w->num_pointers++] = at;
+    address = INDEX_FILE_BASE + target;
+  }
+  memcpy(w->data + at, &address, sizeof(address));
+}
+
+static uint64_t PutString(ImageWriter *w, const char *str) {
+  return str == NULL ? 0 : PutBytes(w, str, strlen(str) + 1);
+}
+
+// Saves a Hashtable value, returning where it went.
+typedef uint64_t (*PutValueFn)(ImageWriter *w, void *value);
+
+static uint64_t PutBuckets(ImageWriter *w, HTBucket *buckets,
+                           int num_buckets, PutValueFn put_value) {
+  uint64_t at = PutBytes(w, buckets, num_buckets * sizeof(HTBucket));
+  for (int i = 0; at != 0 && i < num_buckets; i++) {
+    uint64_t value = 0;
+    if (buckets[i].dist != 0 && buckets[i].moved == 0) {
+      value = put_value(w, buckets[i].value);
+    }
+    PutPointer(w, at + i * sizeof(HTBucket) + offsetof(HTBucket, value),
+               value);
+  }
+  return at;
+}
+
+// Saves a Hashtable as it is, halfway through a rehash or not, since
+// lookups and iterators only read it.
+static uint64_t PutHashtable(ImageWriter *w, Hashtable ht,
+                             PutValueFn put_value) {
+  if (ht == NULL) {
+    return 0;
+  }
+  uint64_t at = PutBytes(w, ht, sizeof(struct hashtableInfo));
+  uint64_t buckets = PutBuckets(w, ht->buckets, ht->num_buckets, put_value);
+  uint64_t old_buckets = 0;
+  if (ht->old_buckets != NULL) {
+    old_buckets = PutBuckets(w, ht->old_buckets, ht->old_num_buckets,
+                             put_value);
+  }
+  PutPointer(w, at + offsetof(struct hashtableInfo, buckets), buckets);
+  PutPointer(w, at + offsetof(struct hashtableInfo, old_buckets),
+             old_buckets);
+  return at;
+}
+
+static uint64_t PutPostingList(ImageWriter *w, void *value) {
+  PostingList list = (PostingList)value;
+  uint64_t at = PutBytes(w, list, sizeof(struct postingList));
+  if (list->capacity > POSTING_INLINE_BYTES) {
+    // Only what's used; nothing is ever added to a saved list.
+    uint64_t data = PutBytes(w, list->bytes.data, list->len);
+    PutPointer(w, at + offsetof(struct postingList, bytes.data), data);
+  }
+  uint64_t skips = 0;
+  if (list->skips != NULL) {
+    skips = PutBytes(w, list->skips,
+                     NumSkipsInPostingList(list) * sizeof(PostingSkip));
+  }
+  PutPointer(w, at + offsetof(struct postingList, skips), skips);
+  return at;
+}
+
+static uint64_t PutMovieSet(ImageWriter *w, void *value) {
+  MovieSet set = (MovieSet)value;
+  uint64_t at = PutBytes(w, set, sizeof(struct movieSet));
+  uint64_t desc = PutString(w, set->desc);
+  uint64_t doc_index = PutHashtable(w, set->doc_index, &PutPostingList);
+  uint64_t doc_positions = PutHashtable(w, set->doc_positions,
+                                        &PutPostingList);
+  PutPointer(w, at + offsetof(struct movieSet, desc), desc);
+  PutPointer(w, at + offsetof(struct movieSet, doc_index), doc_index);
+  PutPointer(w, at + offsetof(struct movieSet, arena), 0);
+  PutPointer(w, at + offsetof(struct movieSet, doc_positions),
+             doc_positions);
+  return at;
+}
+
+// Saves the SavedFile and SavedRows of one file, into the arrays at
+// files and rows. The file is saved as it was when its rows were read,
+// not as it is now, so a change made since then is still caught when
+// the index is loaded.
+static int PutFile(ImageWriter *w, RowTable table, uint64_t doc_id,
+                   const char *path, uint64_t files, uint64_t rows) {
+  SavedRows saved;
+  if (GetSavedRows(table, doc_id, &saved) != 0) {
+    memset(&saved, 0, sizeof(saved));
+  }
+  uint64_t file_at = files + doc_id * sizeof(SavedFile);
+  uint64_t path_at = PutString(w, path);
+  if (w->failed) {
+    return -1;
+  }
+  SavedFile file = {NULL, saved.stat.size, saved.stat.mtime_sec,
+                    saved.stat.mtime_nsec, saved.stat.inode};
+  memcpy(w->data + file_at, &file, sizeof(file));
+  PutPointer(w, file_at + offsetof(SavedFile, path), path_at);
+
+  if (saved.num_rows == 0) {
+    return 0;
+  }
+  uint64_t rows_at = rows + doc_id * sizeof(SavedRows);
+  uint64_t offsets = PutBytes(w, saved.offsets,
+                              saved.num_rows * sizeof(long));
+  uint64_t stats = PutBytes(w, saved.stats,
+                            saved.num_rows * sizeof(RowStats));
+  if (w->failed) {
+    return -1;
+  }
+  memcpy(w->data + rows_at, &saved, sizeof(saved));
+  PutPointer(w, rows_at + offsetof(SavedRows, offsets), offsets);
+  PutPointer(w, rows_at + offsetof(SavedRows, stats), stats);
+  return 0;
+}
+
+static int WriteFully(int fd, const void *data, uint64_t len) {
+  const char *bytes = (const char*)data;
+  while (len > 0) {
+    ssize_t written = write(fd, bytes, len);
+    if (written < 0) {
+      return -1;
+    }
+    bytes += written;
+    len -= written;
+  }
+  return 0;
+}
+
+static int WriteImage(const char *path, IndexFileHeader *header,
+                      ImageWriter *w) {
+  char *tmp_path = (char*)malloc(strlen(path) + 32);
+  if (tmp_path == NULL) {
+    return -1;
+  }
+  sprintf(tmp_path, "%s.tmp.%d", path, (int)getpid());
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Couldn't create %s\n", tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+  char *header_page = (char*)calloc(1, INDEX_FILE_HEADER_SIZE);
+  int result = header_page == NULL ? -1 : 0;
+  if (result == 0) {
+    memcpy(header_page, header, sizeof(*header));
+    result = WriteFully(fd, header_page, INDEX_FILE_HEADER_SIZE);
+  }
+  if (result == 0) {
+    result = WriteFully(fd, w->data, w->len);
+  }
+  if (result == 0) {
+    result = WriteFully(fd, w->pointers,
+                        w->num_pointers * sizeof(uint64_t));
+  }
+  // Make sure it's all on disk before it takes the old file's place.
+  if (result == 0) {
+    result = fsync(fd);
+  }
+  if (close(fd) != 0) {
+    result = -1;
+  }
+  if (result == 0) {
+    result = rename(tmp_path, path);
+  }
+  if (result != 0) {
+    printf("Couldn't write %s\n", path);
+    unlink(tmp_path);
+  }
+  free(header_page);
+  free(tmp_path);
+  return result;
+}
+
+int WriteIndexFile(Index index, DocIdMap docs, const char *path) {
+  if (index->rows == NULL || index->mapping != NULL) {
+    return -1;
+  }
+  uint64_t num_docs = 0;
+  HTKeyValue kvp;
+  HTIter iter = CreateHashtableIterator(docs);
+  if (iter != NULL) {
+    do {
+      HTIteratorGet(iter, &kvp);
+      if (kvp.key + 1 > num_docs) {
+        num_docs = kvp.key + 1;
+      }
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+
+  ImageWriter w = {NULL, 0, 0, NULL, 0, 0, 0};
+  Reserve(&w, sizeof(uint64_t));  // So nothing is at offset 0
+  uint64_t files = Reserve(&w, num_docs * sizeof(SavedFile));
+  uint64_t rows = Reserve(&w, num_docs * sizeof(SavedRows));
+  int result = 0;
+  iter = CreateHashtableIterator(docs);
+  if (iter != NULL) {
+    do {
+      HTIteratorGet(iter, &kvp);
+      result = PutFile(&w, index->rows, kvp.key, (char*)kvp.value,
+                       files, rows);
+    } while (result == 0 && HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+  uint64_t terms = PutHashtable(&w, index->ht, &PutMovieSet);
+  if (w.failed) {
+    printf("Couldn't allocate to save the index\n");
+    result = -1;
+  }
+
+  if (result == 0) {
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.version = INDEX_FILE_VERSION;
+    header.layout = Layout();
+    header.base = INDEX_FILE_BASE;
+    header.image_size = w.len;
+    header.image_checksum = Checksum(w.data, w.len);
+    header.num_pointers = w.num_pointers;
+    header.pointers_checksum = Checksum(w.pointers,
+                                        w.num_pointers * sizeof(uint64_t));
+    header.terms = terms;
+    header.files = files;
+    header.rows = rows;
+    header.num_docs = num_docs;
+    header.keep_positions = index->keep_positions;
+    header.header_checksum = Checksum(
+        &header, offsetof(IndexFileHeader, header_checksum));
+    result = WriteImage(path, &header, &w);
+  }
+  free(w.data);
+  free(w.pointers);
+  return result;
+}
+
+// ==========================
+// Loading
+// ==========================
+
+static int HeaderIsValid(const IndexFileHeader *header, off_t file_size) {
+  if (memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != INDEX_FILE_VERSION ||
+      header->layout != Layout() ||
+      header->header_checksum !=
+      Checksum(header, offsetof(IndexFileHeader, header_checksum))) {
+    return 0;
+  }
+  uint64_t size = header->image_size;
+  uint64_t max_pointers = (UINT64_MAX - size) / sizeof(uint64_t) / 2;
+  return header->base % INDEX_FILE_HEADER_SIZE == 0 && size > 0 &&
+      header->num_pointers < max_pointers &&
+      INDEX_FILE_HEADER_SIZE + size + header->num_pointers *
+      sizeof(uint64_t) <= (uint64_t)file_size &&
+      header->terms < size && header->num_docs < size &&
+      header->files + header->num_docs * sizeof(SavedFile) <= size &&
+      header->rows + header->num_docs * sizeof(SavedRows) <= size;
+}
+
+// Maps the image privately, wherever it fits, and moves every pointer
+// in it over by however far that is from where it was meant to be.
+static char *MapMovedImage(int fd, const IndexFileHeader *header) {
+  uint64_t len = header->image_size;
+  char *image = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                            fd, INDEX_FILE_HEADER_SIZE);
+  if (image == MAP_FAILED) {
+    return NULL;
+  }
+  uint64_t pointers_len = header->num_pointers * sizeof(uint64_t);
+  uint64_t *pointers = (uint64_t*)malloc(pointers_len + 1);
+  int result = pointers == NULL ? -1 : 0;
+  if (result == 0 &&
+      (pread(fd, pointers, pointers_len, INDEX_FILE_HEADER_SIZE + len) !=
+       (ssize_t)pointers_len ||
+       Checksum(pointers, pointers_len) != header->pointers_checksum ||
+       Checksum(image, len) != header->image_checksum)) {
+    result = -1;
+  }
+  uint64_t delta = (uint64_t)(uintptr_t)image - header->base;
+  for (uint64_t i = 0; result == 0 && i < header->num_pointers; i++) {
+    if (pointers[i] > len - sizeof(uint64_t)) {
+      result = -1;
+      break;
+    }
+    uint64_t address;
+    memcpy(&address, image + pointers[i], sizeof(address));
+    address += delta;
+    memcpy(image + pointers[i], &address, sizeof(address));
+  }
+  free(pointers);
+  if (result != 0 || mprotect(image, len, PROT_READ) != 0) {
+    munmap(image, len);
+    return NULL;
+  }
+  return image;
+}
+
+// Maps the image where its pointers expect it, shared with every other
+// process that has it mapped, or else moved.
+static char *MapImage(int fd, const IndexFileHeader *header) {
+  uint64_t len = header->image_size;
+  char *base = (char*)(uintptr_t)header->base;
+  char *image = (char*)mmap(base, len, PROT_READ,
+                            MAP_SHARED | MAP_FIXED_NOREPLACE, fd,
+                            INDEX_FILE_HEADER_SIZE);
+  if (image == base) {
+    if (Checksum(image, len) != header->image_checksum) {
+      munmap(image, len);
+      return NULL;
+    }
+    return image;
+  }
+  if (image != MAP_FAILED) {
+    munmap(image, len);
+  }
+  return MapMovedImage(fd, header);
+}
+
+// Checks that none of the files an index was built from have changed,
+// and makes a DocIdMap of them.
+static DocIdMap CheckSavedFiles(const SavedFile *files, uint64_t num_docs) {
+  DocIdMap docs = CreateDocIdMap();
+  for (uint64_t i = 0; docs != NULL && i < num_docs; i++) {
+    if (files[i].path == NULL) {
+      continue;
+    }
+    struct stat st;
+    if (stat(files[i].path, &st) != 0 || st.st_size != files[i].size ||
+        st.st_mtim.tv_sec != files[i].mtime_sec ||
+        st.st_mtim.tv_nsec != files[i].mtime_nsec ||
+        st.st_ino != files[i].inode) {
+      printf("%s has changed since the index was saved\n", files[i].path);
+      DestroyDocIdMap(docs);
+      return NULL;
+    }
+    HTKeyValue kvp = {i, strdup(files[i].path)};
+    HTKeyValue old_kvp;
+    if (kvp.value == NULL || PutInHashtable(docs, kvp, &old_kvp) != 0) {
+      free(kvp.value);
+      DestroyDocIdMap(docs);
+      return NULL;
+    }
+  }
+  return docs;
+}
+
+Index LoadIndexFile(const char *path, DocIdMap *docs) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Couldn't open %s\n", path);
+    return NULL;
+  }
+  IndexFileHeader header;
+  struct stat st;
+  char *image = NULL;
+  if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      fstat(fd, &st) == 0 && HeaderIsValid(&header, st.st_size)) {
+    image = MapImage(fd, &header);
+  }
+  close(fd);
+  if (image == NULL) {
+    printf("%s isn't an index file that can be loaded\n", path);
+    return NULL;
+  }
+
+  DocIdMap map = CheckSavedFiles((const SavedFile*)(image + header.files),
+                                 header.num_docs);
+  Index index = map == NULL ? NULL : (Index)malloc(sizeof(struct index));
+  if (index == NULL) {
+    if (map != NULL) {
+      DestroyDocIdMap(map);
+    }
+    munmap(image, header.image_size);
+    return NULL;
+  }
+  index->ht = (Hashtable)(image + header.terms);
+  index->movies = NULL;
+  index->arena = NULL;
+  index->rows = CreateSavedRowTable(
+      map, (const SavedRows*)(image + header.rows), header.num_docs);
+  index->keep_positions = header.keep_positions;
+  index->mapping = image;
+  index->mapping_len = header.image_size;
+  index->find_term = NULL;
+  if (index->rows == NULL) {
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(map);
+    return NULL;
+  }
+  *docs = map;
+  return index;
+}
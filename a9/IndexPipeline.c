@@ -0,0 +1,847 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "IndexPipeline.h"
+#include "WallClock.h"
+#include "FileCrawler.h"
+#include "MovieIndex.h"
+#include "RowParser.h"
+#include "RowTable.h"
+#include "RankedQuery.h"
+#include "DocIdMap.h"
+#include "htll/Hashtable.h"
+
+
+// How many rows are passed from the parser to the tokenizers at once.
+#define PIPELINE_BATCH_ROWS 256
+
+// Queues hold this many items, by default.
+#define PIPELINE_QUEUE_CAPACITY 64
+
+enum {
+  CRAWL_STAGE,
+  READ_STAGE,
+  PARSE_STAGE,
+  TOKENIZE_STAGE,
+  INSERT_STAGE
+};
+
+static const char *stageNames[PIPELINE_STAGES] = {
+  "crawl", "read", "parse", "tokenize", "insert"
+};
+
+// ======================
+// Bounded queues between the stages.
+//
+// A queue is closed once every thread that adds to it has finished;
+// after that, taking from it when it's empty gets NULL.
+
+struct pipeQueue {
+  void **items;  // a ring
+  int capacity;
+  int head;
+  int count;
+  int producers;  // threads still adding to it
+  long pushes;
+  long depth_sum;  // how many items there were after each push
+  int max_depth;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
+
+// Sets up a queue; it has to be destroyed even if this fails.
+static int InitQueue(struct pipeQueue *queue, int capacity, int producers) {
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  queue->items = (void**)malloc(capacity * sizeof(void*));
+  if (queue->items == NULL) {
+    return -1;
+  }
+  queue->capacity = capacity;
+  queue->head = 0;
+  queue->count = 0;
+  queue->producers = producers;
+  queue->pushes = 0;
+  queue->depth_sum = 0;
+  queue->max_depth = 0;
+  return 0;
+}
+
+static void DestroyQueue(struct pipeQueue *queue) {
+  pthread_cond_destroy(&queue->not_full);
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_mutex_destroy(&queue->lock);
+  free(queue->items);
+}
+
+// Adds an item, waiting while the queue is full. The time spent
+// waiting is added to *waited.
+static void PushItem(struct pipeQueue *queue, void *item, double *waited) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count == queue->capacity) {
+    double start = WallSeconds();
+    while (queue->count == queue->capacity) {
+      pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    *waited += WallSeconds() - start;
+  }
+  queue->items[(queue->head + queue->count++) % queue->capacity] = item;
+  queue->pushes++;
+  queue->depth_sum += queue->count;
+  if (queue->count > queue->max_depth) {
+    queue->max_depth = queue->count;
+  }
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+// Takes the oldest item, waiting while the queue is empty, or returns
+// NULL if it's empty and closed. The time spent waiting is added to
+// *waited.
+static void *PopItem(struct pipeQueue *queue, double *waited) {
+  void *item = NULL;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count == 0 && queue->producers > 0) {
+    double start = WallSeconds();
+    while (queue->count == 0 && queue->producers > 0) {
+      pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    *waited += WallSeconds() - start;
+  }
+  if (queue->count > 0) {
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return item;
+}
+
+// One of the threads adding to the queue has finished.
+static void CloseQueue(struct pipeQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  if (--queue->producers == 0) {
+    pthread_cond_broadcast(&queue->not_empty);
+  }
+  pthread_mutex_unlock(&queue->lock);
+}
+
+// Adds a queue's depths to the stats of the stage it feeds.
+static void AddQueueStats(StageStats *stats, struct pipeQueue *queue,
+                          long *pushes, long *depth_sum) {
+  stats->queue_capacity = queue->capacity;
+  if (queue->max_depth > stats->max_depth) {
+    stats->max_depth = queue->max_depth;
+  }
+  *pushes += queue->pushes;
+  *depth_sum += queue->depth_sum;
+  stats->mean_depth = *pushes == 0 ? 0 : (double)*depth_sum / *pushes;
+}
+
+// ======================
+// What flows through the pipeline.
+
+// A file, from when it's crawled until the last batch of its rows has
+// been tokenized, when it's unmapped.
+struct pipeFile {
+  char *path;  // belongs to the DocIdMap
+  uint64_t doc_id;
+  MappedFile mapped;
+  int refs;  // the parser's, and one for each batch not yet tokenized
+  int next_batch;  // the batch to hand to the inserters next
+};
+
+// Rows of a file, from the parser to the tokenizers.
+struct rowBatch {
+  struct pipeFile *file;
+  int number;  // which of the file's batches it is
+  int first_row;  // the row id of titles[0]
+  int num_rows;
+  FieldView titles[PIPELINE_BATCH_ROWS];
+};
+
+struct batchTerm {
+  uint64_t key;
+  int word;  // where the word starts in chars
+  int position;
+  int row;
+};
+
+// The words of a batch of rows that go to one inserter.
+struct termBatch {
+  uint64_t doc_id;
+  struct batchTerm *terms;
+  int num_terms;
+  int terms_capacity;
+  char *chars;  // the words, lowercase and NUL-terminated
+  int chars_len;
+  int chars_capacity;
+};
+
+static void ReleaseFile(struct pipeFile *file) {
+  if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    UnmapFile(&file->mapped);
+    free(file);
+  }
+}
+
+static void DestroyTermBatch(struct termBatch *batch) {
+  if (batch != NULL) {
+    free(batch->terms);
+    free(batch->chars);
+    free(batch);
+  }
+}
+
+// Adds a lowercase word to a batch; returns -1 if out of memory.
+static int AddBatchTerm(struct termBatch *batch, const char *word, int len,
+                        uint64_t key, int position, int row) {
+  if (batch->num_terms == batch->terms_capacity) {
+    int capacity = batch->terms_capacity * 2 + 64;
+    struct batchTerm *terms = (struct batchTerm*)realloc(
+        batch->terms, capacity * sizeof(struct batchTerm));
+    if (terms == NULL) {
+      return -1;
+    }
+    batch->terms = terms;
+    batch->terms_capacity = capacity;
+  }
+  if (batch->chars_len + len + 1 > batch->chars_capacity) {
+    int capacity = batch->chars_capacity * 2 + len + 1024;
+    char *chars = (char*)realloc(batch->chars, capacity);
+    if (chars == NULL) {
+      return -1;
+    }
+    batch->chars = chars;
+    batch->chars_capacity = capacity;
+  }
+  struct batchTerm *term = &batch->terms[batch->num_terms++];
+  term->key = key;
+  term->word = batch->chars_len;
+  term->position = position;
+  term->row = row;
+  memcpy(batch->chars + batch->chars_len, word, len);
+  batch->chars_len += len;
+  batch->chars[batch->chars_len++] = '\0';
+  return 0;
+}
+
+// ======================
+// The stages.
+
+struct pipeline {
+  DocIdMap docs;
+  RowTable rows;
+  Index *shards;  // one per inserter
+  int num_shards;
+  struct pipeQueue files;  // crawled, to be read
+  struct pipeQueue mapped;  // read, to be parsed
+  struct pipeQueue parsed;  // batches of rows, to be tokenized
+  struct pipeQueue *terms;  // batches of words, one queue per inserter
+  pthread_mutex_t lock;  // held to give a file an id, and to add up stats
+  pthread_mutex_t order_lock;  // held to move a file's next_batch on
+  pthread_cond_t order_changed;
+  StageStats stats[PIPELINE_STAGES];
+};
+
+struct stageThread {
+  struct pipeline *pipe;
+  int id;
+};
+
+// Adds what one of a stage's threads did to the stage's stats.
+static void AddStageStats(struct pipeline *pipe, int stage,
+                          const StageStats *done, double seconds) {
+  StageStats *stats = &pipe->stats[stage];
+  pthread_mutex_lock(&pipe->lock);
+  stats->items += done->items;
+  stats->bytes += done->bytes;
+  stats->busy_seconds += seconds - done->wait_in_seconds -
+      done->wait_out_seconds;
+  stats->wait_in_seconds += done->wait_in_seconds;
+  stats->wait_out_seconds += done->wait_out_seconds;
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+// Gives a file the crawl found an id, and queues it to be read.
+static void QueueFoundFile(char *path, void *arg) {
+  struct pipeline *pipe = (struct pipeline*)arg;
+  struct pipeFile *file = (struct pipeFile*)calloc(1,
+                                                   sizeof(struct pipeFile));
+  if (file == NULL) {
+    printf("Couldn't malloc for a file to index: %s\n", path);
+    free(path);
+    return;
+  }
+  pthread_mutex_lock(&pipe->lock);
+  file->doc_id = NumElemsInHashtable(pipe->docs) + 1;
+  PutFileInMap(path, pipe->docs);
+  pipe->stats[CRAWL_STAGE].items++;
+  pthread_mutex_unlock(&pipe->lock);
+
+  file->path = path;
+  file->refs = 1;
+  if (AddFileToRowTable(pipe->rows, file->doc_id, path) != 0) {
+    fprintf(stderr, "Couldn't add %s to the row table.\n", path);
+    free(file);
+    return;
+  }
+  double waited = 0;
+  PushItem(&pipe->files, file, &waited);
+  pthread_mutex_lock(&pipe->lock);
+  pipe->stats[CRAWL_STAGE].wait_out_seconds += waited;
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+struct crawlArgs {
+  struct pipeline *pipe;
+  const char *dir;
+  int num_threads;
+};
+
+static void *CrawlStage(void *arg) {
+  struct crawlArgs *args = (struct crawlArgs*)arg;
+  struct pipeline *pipe = args->pipe;
+  double start = WallSeconds();
+  CrawlFiles(args->dir, args->num_threads, &QueueFoundFile, pipe);
+  CloseQueue(&pipe->files);
+  // The crawl's threads are all working, or waiting to push, until
+  // it's done.
+  StageStats *stats = &pipe->stats[CRAWL_STAGE];
+  stats->busy_seconds = (WallSeconds() - start) * args->num_threads -
+      stats->wait_out_seconds;
+  return NULL;
+}
+
+// Maps each file, and reads it in, so the parser doesn't wait on disk.
+static void *ReadStage(void *arg) {
+  struct pipeline *pipe = ((struct stageThread*)arg)->pipe;
+  StageStats done = {0};
+  double start = WallSeconds();
+  struct pipeFile *file;
+  while ((file = (struct pipeFile*)PopItem(&pipe->files,
+                                           &done.wait_in_seconds)) != NULL) {
+    if (MapFile(file->path, &file->mapped) != 0) {
+      printf("File could not be opened\n");
+      ReleaseFile(file);
+      continue;
+    }
+    if (SetFileStat(pipe->rows, file->doc_id, &file->mapped.stat) != 0) {
+      fprintf(stderr, "Didn't record the file's stat.\n");
+    }
+    if (file->mapped.data == NULL) {
+      // An empty file has no rows.
+      ReleaseFile(file);
+      continue;
+    }
+    madvise((void*)file->mapped.data, file->mapped.size, MADV_WILLNEED);
+    volatile char touch = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    for (long i = 0; i < file->mapped.size; i += page) {
+      touch += file->mapped.data[i];
+    }
+    done.items++;
+    done.bytes += file->mapped.size;
+    PushItem(&pipe->mapped, file, &done.wait_out_seconds);
+  }
+  CloseQueue(&pipe->mapped);
+  AddStageStats(pipe, READ_STAGE, &done, WallSeconds() - start);
+  return NULL;
+}
+
+// Queues a batch of rows to be tokenized, and starts the next one.
+static struct rowBatch *PushRowBatch(struct pipeline *pipe,
+                                     struct rowBatch *batch,
+                                     StageStats *done) {
+  struct rowBatch *next = (struct rowBatch*)malloc(sizeof(struct rowBatch));
+  if (next != NULL) {
+    next->file = batch->file;
+    next->number = batch->number + 1;
+    next->first_row = batch->first_row + batch->num_rows;
+    next->num_rows = 0;
+  }
+  // A tokenizer can have the batch as soon as it's pushed.
+  __atomic_add_fetch(&batch->file->refs, 1, __ATOMIC_RELAXED);
+  PushItem(&pipe->parsed, batch, &done->wait_out_seconds);
+  return next;
+}
+
+// Finds the movie rows of each file, records where they are, and
+// passes their titles on in batches.
+static void *ParseStage(void *arg) {
+  struct pipeline *pipe = ((struct stageThread*)arg)->pipe;
+  StageStats done = {0};
+  double start = WallSeconds();
+  struct pipeFile *file;
+  while ((file = (struct pipeFile*)PopItem(&pipe->mapped,
+                                           &done.wait_in_seconds)) != NULL) {
+    struct rowBatch *batch = (struct rowBatch*)malloc(
+        sizeof(struct rowBatch));
+    if (batch == NULL) {
+      printf("Couldn't malloc to parse %s\n", file->path);
+      ReleaseFile(file);
+      continue;
+    }
+    batch->file = file;
+    batch->number = 0;
+    batch->first_row = 0;
+    batch->num_rows = 0;
+
+    RowParser parser;
+    FieldView line;
+    MovieRowIndex pieces;
+    InitRowParser(&parser, &file->mapped, 0, -1);
+    while (batch != NULL && NextMovieRow(&parser, &line, &pieces)) {
+      if (!pieces.is_movie) {
+        continue;
+      }
+      if (AddRowOffset(pipe->rows, file->doc_id,
+                       line.start - file->mapped.data, &pieces) != 0) {
+        fprintf(stderr, "Didn't record the row's offset.\n");
+      }
+      batch->titles[batch->num_rows++] = pieces.fields[MOVIE_ROW_TITLE];
+      if (batch->num_rows == PIPELINE_BATCH_ROWS) {
+        batch = PushRowBatch(pipe, batch, &done);
+      }
+    }
+    if (batch == NULL) {
+      printf("Couldn't malloc to parse %s\n", file->path);
+    } else if (batch->num_rows > 0) {
+      __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+      PushItem(&pipe->parsed, batch, &done.wait_out_seconds);
+    } else {
+      free(batch);
+    }
+    done.items++;
+    done.bytes += file->mapped.size;
+    ReleaseFile(file);
+  }
+  CloseQueue(&pipe->parsed);
+  AddStageStats(pipe, PARSE_STAGE, &done, WallSeconds() - start);
+  return NULL;
+}
+
+// Longer words than this are lowercased into a malloc'd copy instead.
+#define WORD_BUFFER_SIZE 256
+
+// Splits a title into words, as AddTitleWordsToIndex does, and adds
+// them to the batches of the inserters they go to.
+static int TokenizeTitle(FieldView title, int row, struct termBatch **out,
+                         int num_out, uint64_t doc_id) {
+  // A title of "-" means there isn't one.
+  if (title.len == 1 && title.start[0] == '-') {
+    return 0;
+  }
+  const char *end = title.start + title.len;
+  const char *c = title.start;
+  int position = 0;
+  char buffer[WORD_BUFFER_SIZE];
+  while (c < end) {
+    while (c < end && *c == ' ') {
+      c++;
+    }
+    const char *word_start = c;
+    while (c < end && *c != ' ') {
+      c++;
+    }
+    int len = c - word_start;
+    if (len == 0) {
+      break;
+    }
+    char *word = len < WORD_BUFFER_SIZE ? buffer : (char*)malloc(len);
+    if (word == NULL) {
+      return -1;
+    }
+    for (int i = 0; i < len; i++) {
+      word[i] = tolower(word_start[i]);
+    }
+    uint64_t key = FNVHash64((unsigned char*)word, (unsigned int)len);
+    int which = key % num_out;
+    if (out[which] == NULL) {
+      out[which] = (struct termBatch*)calloc(1, sizeof(struct termBatch));
+      if (out[which] != NULL) {
+        out[which]->doc_id = doc_id;
+      }
+    }
+    int result = out[which] == NULL ? -1 :
+        AddBatchTerm(out[which], word, len, key, position++, row);
+    if (word != buffer) {
+      free(word);
+    }
+    if (result != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Splits titles into words, and hands them to the inserters, a file's
+// batches in the order they were parsed.
+static void *TokenizeStage(void *arg) {
+  struct pipeline *pipe = ((struct stageThread*)arg)->pipe;
+  StageStats done = {0};
+  double start = WallSeconds();
+  struct termBatch **out = (struct termBatch**)calloc(
+      pipe->num_shards, sizeof(struct termBatch*));
+  struct rowBatch *batch;
+  while ((batch = (struct rowBatch*)PopItem(&pipe->parsed,
+                                            &done.wait_in_seconds)) != NULL) {
+    struct pipeFile *file = batch->file;
+    for (int i = 0; out != NULL && i < batch->num_rows; i++) {
+      if (TokenizeTitle(batch->titles[i], batch->first_row + i, out,
+                        pipe->num_shards, file->doc_id) != 0) {
+        fprintf(stderr, "Didn't split a title into words.\n");
+      }
+    }
+
+    // Wait for the file's batches before this one to be handed over.
+    pthread_mutex_lock(&pipe->order_lock);
+    if (file->next_batch != batch->number) {
+      double waited = WallSeconds();
+      while (file->next_batch != batch->number) {
+        pthread_cond_wait(&pipe->order_changed, &pipe->order_lock);
+      }
+      done.wait_out_seconds += WallSeconds() - waited;
+    }
+    pthread_mutex_unlock(&pipe->order_lock);
+    for (int i = 0; out != NULL && i < pipe->num_shards; i++) {
+      if (out[i] != NULL) {
+        PushItem(&pipe->terms[i], out[i], &done.wait_out_seconds);
+        out[i] = NULL;
+      }
+    }
+    pthread_mutex_lock(&pipe->order_lock);
+    file->next_batch++;
+    pthread_cond_broadcast(&pipe->order_changed);
+    pthread_mutex_unlock(&pipe->order_lock);
+
+    done.items++;
+    ReleaseFile(file);
+    free(batch);
+  }
+  for (int i = 0; i < pipe->num_shards; i++) {
+    CloseQueue(&pipe->terms[i]);
+  }
+  free(out);
+  AddStageStats(pipe, TOKENIZE_STAGE, &done, WallSeconds() - start);
+  return NULL;
+}
+
+// Adds words to the inserter's own shard of the index.
+static void *InsertStage(void *arg) {
+  struct stageThread *thread = (struct stageThread*)arg;
+  struct pipeline *pipe = thread->pipe;
+  Index shard = pipe->shards[thread->id];
+  StageStats done = {0};
+  double start = WallSeconds();
+  struct termBatch *batch;
+  while ((batch = (struct termBatch*)PopItem(&pipe->terms[thread->id],
+                                             &done.wait_in_seconds))
+         != NULL) {
+    for (int i = 0; i < batch->num_terms; i++) {
+      struct batchTerm *term = &batch->terms[i];
+      if (AddTermToIndex(shard, batch->chars + term->word, term->key,
+                         term->position, batch->doc_id, term->row) != 0) {
+        fprintf(stderr, "Didn't add MovieToIndex.\n");
+      }
+    }
+    done.items++;
+    DestroyTermBatch(batch);
+  }
+  AddStageStats(pipe, INSERT_STAGE, &done, WallSeconds() - start);
+  return NULL;
+}
+
+// ======================
+
+static void DefaultConfig(PipelineConfig *config) {
+  int cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores <= 0) {
+    cores = 1;
+  }
+  config->crawl_threads = 1;
+  config->read_threads = 1;
+  config->parse_threads = cores / 4 > 1 ? cores / 4 : 1;
+  config->tokenize_threads = cores / 2 > 1 ? cores / 2 : 1;
+  config->insert_threads = cores / 4 > 1 ? cores / 4 : 1;
+  config->queue_capacity = PIPELINE_QUEUE_CAPACITY;
+}
+
+// Takes the sizes given, and the defaults for the ones that aren't.
+static void SizeStages(const PipelineConfig *given, PipelineConfig *config) {
+  DefaultConfig(config);
+  if (given == NULL) {
+    return;
+  }
+  if (given->crawl_threads > 0) {
+    config->crawl_threads = given->crawl_threads;
+  }
+  if (given->read_threads > 0) {
+    config->read_threads = given->read_threads;
+  }
+  if (given->parse_threads > 0) {
+    config->parse_threads = given->parse_threads;
+  }
+  if (given->tokenize_threads > 0) {
+    config->tokenize_threads = given->tokenize_threads;
+  }
+  if (given->insert_threads > 0) {
+    config->insert_threads = given->insert_threads;
+  }
+  if (given->queue_capacity > 0) {
+    config->queue_capacity = given->queue_capacity;
+  }
+}
+
+int ParsePipelineConfig(const char *spec, PipelineConfig *config) {
+  PipelineConfig parsed = {0};
+  int end = 0;
+  int n = sscanf(spec, "%d,%d,%d,%d,%d%n,%d%n", &parsed.crawl_threads,
+                 &parsed.read_threads, &parsed.parse_threads,
+                 &parsed.tokenize_threads, &parsed.insert_threads, &end,
+                 &parsed.queue_capacity, &end);
+  if (n < 5 || spec[end] != '\0') {
+    return -1;
+  }
+  *config = parsed;
+  return 0;
+}
+
+// Starts num_threads threads of a stage, from threads[*started] on,
+// counting the ones that start in *started. If one can't be started,
+// or failed is 1 because a stage started before couldn't be, none of
+// the rest are: each thread that isn't started closes the queues it
+// would have added to, the num_out of them from out, so that the
+// threads that did start still run out of work and stop.
+//
+// Returns 0 if every thread was started, -1 if not.
+static int StartStage(pthread_t *threads, struct stageThread *args,
+                      int *started, int num_threads, struct pipeline *pipe,
+                      void *(*run)(void*), struct pipeQueue *out,
+                      int num_out, int failed) {
+  int result = failed ? -1 : 0;
+  for (int i = 0; i < num_threads; i++) {
+    args[*started].pipe = pipe;
+    args[*started].id = i;
+    if (result == 0 &&
+        pthread_create(&threads[*started], NULL, run, &args[*started]) == 0) {
+      (*started)++;
+      continue;
+    }
+    result = -1;
+    for (int j = 0; j < num_out; j++) {
+      CloseQueue(&out[j]);
+    }
+  }
+  return result;
+}
+
+static void DestroyPipeline(struct pipeline *pipe) {
+  for (int i = 0; i < pipe->num_shards; i++) {
+    if (pipe->shards[i] != NULL) {
+      DestroyOffsetIndex(pipe->shards[i]);
+    }
+    DestroyQueue(&pipe->terms[i]);
+  }
+  DestroyQueue(&pipe->parsed);
+  DestroyQueue(&pipe->mapped);
+  DestroyQueue(&pipe->files);
+  pthread_cond_destroy(&pipe->order_changed);
+  pthread_mutex_destroy(&pipe->order_lock);
+  pthread_mutex_destroy(&pipe->lock);
+  free(pipe->terms);
+  free(pipe->shards);
+  free(pipe);
+}
+
+// Makes a pipeline's queues and shards, with no threads started.
+static struct pipeline *CreatePipeline(const PipelineConfig *config,
+                                       DocIdMap docs, Index index) {
+  struct pipeline *pipe = (struct pipeline*)calloc(1,
+                                                   sizeof(struct pipeline));
+  if (pipe == NULL) {
+    return NULL;
+  }
+  int num_shards = config->insert_threads;
+  pipe->shards = (Index*)calloc(num_shards, sizeof(Index));
+  pipe->terms = (struct pipeQueue*)calloc(num_shards,
+                                          sizeof(struct pipeQueue));
+  if (pipe->shards == NULL || pipe->terms == NULL) {
+    free(pipe->shards);
+    free(pipe->terms);
+    free(pipe);
+    return NULL;
+  }
+  pipe->docs = docs;
+  pipe->rows = index->rows;
+  pipe->num_shards = num_shards;
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_mutex_init(&pipe->order_lock, NULL);
+  pthread_cond_init(&pipe->order_changed, NULL);
+
+  int capacity = config->queue_capacity;
+  int result = InitQueue(&pipe->files, capacity, 1);
+  result |= InitQueue(&pipe->mapped, capacity, config->read_threads);
+  result |= InitQueue(&pipe->parsed, capacity, config->parse_threads);
+  for (int i = 0; i < num_shards; i++) {
+    result |= InitQueue(&pipe->terms[i], capacity, config->tokenize_threads);
+    pipe->shards[i] = CreateIndex();
+    if (pipe->shards[i] == NULL) {
+      result = -1;
+      continue;
+    }
+    pipe->shards[i]->keep_positions = index->keep_positions;
+  }
+  if (result != 0) {
+    DestroyPipeline(pipe);
+    return NULL;
+  }
+  return pipe;
+}
+
+// Fills in stats from what the pipeline's stages did.
+static void GetPipelineStats(struct pipeline *pipe,
+                             const PipelineConfig *config,
+                             PipelineStats *stats) {
+  int sizes[PIPELINE_STAGES] = {
+    config->crawl_threads, config->read_threads, config->parse_threads,
+    config->tokenize_threads, config->insert_threads
+  };
+  struct pipeQueue *inputs[PIPELINE_STAGES] = {
+    NULL, &pipe->files, &pipe->mapped, &pipe->parsed, NULL
+  };
+  memcpy(stats->stages, pipe->stats, sizeof(pipe->stats));
+  for (int i = 0; i < PIPELINE_STAGES; i++) {
+    stats->stages[i].name = stageNames[i];
+    stats->stages[i].threads = sizes[i];
+    long pushes = 0;
+    long depth_sum = 0;
+    if (inputs[i] != NULL) {
+      AddQueueStats(&stats->stages[i], inputs[i], &pushes, &depth_sum);
+    }
+    for (int j = 0; i == INSERT_STAGE && j < pipe->num_shards; j++) {
+      AddQueueStats(&stats->stages[i], &pipe->terms[j], &pushes,
+                    &depth_sum);
+    }
+  }
+}
+
+int BuildIndexPipelined(const char *dir, DocIdMap docs, Index index,
+                        const PipelineConfig *given, PipelineStats *stats) {
+  double start = WallSeconds();
+  PipelineConfig config;
+  SizeStages(given, &config);
+
+  if (index->rows == NULL) {
+    index->rows = CreateRowTable(docs);
+  }
+  int num_threads = config.read_threads + config.parse_threads +
+      config.tokenize_threads + config.insert_threads;
+  pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+  struct stageThread *args = (struct stageThread*)malloc(
+      num_threads * sizeof(struct stageThread));
+  struct pipeline *pipe = index->rows == NULL ? NULL :
+      CreatePipeline(&config, docs, index);
+  if (pipe == NULL || threads == NULL || args == NULL) {
+    printf("Couldn't malloc for the indexing pipeline\n");
+    if (pipe != NULL) {
+      DestroyPipeline(pipe);
+    }
+    free(threads);
+    free(args);
+    return -1;
+  }
+
+  // Each stage is started before the one that feeds it, and the crawl
+  // runs on this thread. If a stage can't be started, nothing that
+  // feeds it is, and the stages already running are left to drain.
+  int started = 0;
+  int failed = StartStage(threads, args, &started, config.insert_threads,
+                          pipe, &InsertStage, NULL, 0, 0);
+  failed = StartStage(threads, args, &started, config.tokenize_threads,
+                      pipe, &TokenizeStage, pipe->terms, pipe->num_shards,
+                      failed);
+  failed = StartStage(threads, args, &started, config.parse_threads, pipe,
+                      &ParseStage, &pipe->parsed, 1, failed);
+  failed = StartStage(threads, args, &started, config.read_threads, pipe,
+                      &ReadStage, &pipe->mapped, 1, failed);
+  if (failed) {
+    printf("Couldn't start the indexing pipeline's threads\n");
+    CloseQueue(&pipe->files);
+  } else {
+    struct crawlArgs crawl = {pipe, dir, config.crawl_threads};
+    CrawlStage(&crawl);
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  free(args);
+
+  // The shards have no terms in common, so this just moves them over.
+  int result = -1;
+  if (!failed) {
+    result = MergeIndexShards(index, pipe->shards, pipe->num_shards,
+                              pipe->num_shards);
+    for (int i = 0; i < pipe->num_shards; i++) {
+      pipe->shards[i] = NULL;
+    }
+  }
+  if (result != 0 || ComputeBlockBounds(index) != 0) {
+    result = -1;
+  }
+  if (stats != NULL) {
+    GetPipelineStats(pipe, &config, stats);
+    stats->seconds = WallSeconds() - start;
+  }
+  DestroyPipeline(pipe);
+  return result;
+}
+
+void PrintPipelineStats(const PipelineStats *stats) {
+  printf("stage     threads    items     MB   busy (s)   items/s"
+         "  wait in (s)  wait out (s)  queue  max  mean\n");
+  for (int i = 0; i < PIPELINE_STAGES; i++) {
+    const StageStats *stage = &stats->stages[i];
+    // How fast the stage goes with all its threads busy.
+    double busy = stage->busy_seconds / stage->threads;
+    printf("%-9s %7d %8ld %6.1f %10.3f %9.0f %12.3f %13.3f",
+           stage->name, stage->threads, stage->items,
+           stage->bytes / (1024.0 * 1024.0), stage->busy_seconds,
+           busy > 0 ? stage->items / busy : 0,
+           stage->wait_in_seconds, stage->wait_out_seconds);
+    if (stage->queue_capacity > 0) {
+      printf(" %6d %4d %5.1f\n", stage->queue_capacity, stage->max_depth,
+             stage->mean_depth);
+    } else {
+      printf("\n");
+    }
+  }
+  printf("%.3f seconds in all\n", stats->seconds);
+}
@@ -0,0 +1,955 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LiveIndex.h"
+#include "FileCrawler.h"
+#include "FileParser.h"
+#include "IndexFile.h"
+#include "MovieSet.h"
+#include "PostingList.h"
+#include "RowTable.h"
+#include "htll/ConcurrentHashtable.h"
+#include "htll/Hashtable.h"
+
+// Segments are merged once there are this many of about the same size.
+#define LIVE_MERGE_FACTOR 4
+
+// Segments with fewer rows than this times LIVE_MERGE_FACTOR are all in
+// the smallest size tier; each tier up holds segments LIVE_MERGE_FACTOR
+// times bigger.
+#define LIVE_MERGE_MIN_ROWS 1024
+
+// An index built from some of the files, and those files. It never
+// changes once it's made.
+typedef struct segment {
+  Index index;
+  DocIdMap docs;
+  long num_rows;  // in all its files, whether they're still in or not
+  long num_title_words;  // and the words in their titles
+  int refs;  // how many versions have it
+} Segment;
+
+// What queries run against: the segments, less the files that have
+// changed or gone since they were indexed. Nothing is copied out of
+// the segments to make one; each term is looked up in every segment as
+// it's asked for.
+typedef struct indexVersion {
+  // Has to come first: queries are handed a pointer to it.
+  struct index index;
+  // The ids of the segments' files that have changed or gone, as keys.
+  Hashtable removed;
+  // The MovieSet found for each term that isn't just one segment's set
+  // as it is, by key, as they're asked for.
+  ConcurrentHashtable terms;
+  // The MovieSets made for terms, from index.arena. Guarded by
+  // made_lock, as the arena is.
+  MovieSet *made;
+  int num_made;
+  int made_capacity;
+  pthread_mutex_t made_lock;
+  Segment **segments;
+  int num_segments;
+  int refs;  // how many queries have it, plus one while it's current
+} IndexVersion;
+
+struct liveIndex {
+  char *dir;
+  CrawlState crawl;
+  uint64_t next_doc_id;
+  IndexVersion *current;
+  pthread_mutex_t lock;  // guards current and every version's refs
+  // Held while a new version is worked out, so there's one at a time.
+  pthread_mutex_t update_lock;
+  // Signalled, under update_lock, when there may be segments to merge.
+  pthread_cond_t merge_cond;
+  pthread_t merge_thread;
+  int merging;  // 1 if the merge thread has been started
+  int stopping;  // 1 once the merge thread has been asked to stop
+};
+
+// Stands for a term that none of a version's files have, in its terms.
+static struct movieSet no_term;
+
+static uint64_t MaxDocId(DocIdMap docs) {
+  uint64_t max_id = 0;
+  HTIter iter = CreateHashtableIterator(docs);
+  if (iter == NULL) {
+    return 0;
+  }
+  do {
+    HTKeyValue kvp;
+    HTIteratorGet(iter, &kvp);
+    if (kvp.key > max_id) {
+      max_id = kvp.key;
+    }
+  } while (HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return max_id;
+}
+
+static int HasDoc(Hashtable docs, uint64_t doc_id) {
+  HTKeyValue kvp;
+  return LookupInHashtable(docs, doc_id, &kvp) == 0;
+}
+
+// Counts the rows of a segment's files that haven't been removed, and
+// the words in their titles, from what the segment has in all.
+static void CountLiveRows(Segment *segment, Hashtable removed,
+                          long *num_rows, long *num_words) {
+  *num_rows = segment->num_rows;
+  *num_words = segment->num_title_words;
+  HTIter iter = CreateHashtableIterator(removed);
+  while (iter != NULL) {
+    HTKeyValue kvp;
+    SavedRows saved;
+    HTIteratorGet(iter, &kvp);
+    if (HasDoc(segment->docs, kvp.key) &&
+        GetSavedRows(segment->index->rows, kvp.key, &saved) == 0) {
+      *num_rows -= saved.num_rows;
+      *num_words -= saved.num_title_words;
+    }
+    if (HTIteratorNext(iter) != 0) {
+      DestroyHashtableIterator(iter);
+      break;
+    }
+  }
+}
+
+static Segment *CreateSegment(Index index, DocIdMap docs) {
+  Segment *segment = (Segment*)malloc(sizeof(Segment));
+  if (segment != NULL) {
+    segment->index = index;
+    segment->docs = docs;
+    segment->refs = 0;
+    CountTitleWords(index->rows, &segment->num_rows,
+                    &segment->num_title_words);
+  }
+  return segment;
+}
+
+static void DestroySegment(Segment *segment) {
+  DestroyOffsetIndex(segment->index);
+  DestroyDocIdMap(segment->docs);
+  free(segment);
+}
+
+static void HoldSegment(Segment *segment) {
+  __atomic_add_fetch(&segment->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void ReleaseSegment(Segment *segment) {
+  if (__atomic_sub_fetch(&segment->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    DestroySegment(segment);
+  }
+}
+
+static void DestroyVersion(IndexVersion *version) {
+  if (version->terms != NULL) {
+    DestroyConcurrentHashtable(version->terms, &NullFree);
+  }
+  // The MovieSets made for terms are in the arena, but their doc
+  // tables aren't; their PostingLists are the segments'.
+  for (int i = 0; i < version->num_made; i++) {
+    DestroyHashtable(version->made[i]->doc_index, &NullFree);
+    if (version->made[i]->doc_positions != NULL) {
+      DestroyHashtable(version->made[i]->doc_positions, &NullFree);
+    }
+  }
+  free(version->made);
+  pthread_mutex_destroy(&version->made_lock);
+  if (version->index.rows != NULL) {
+    DestroyRowTable(version->index.rows);
+  }
+  if (version->index.arena != NULL) {
+    DestroyArena(version->index.arena);
+  }
+  if (version->removed != NULL) {
+    DestroyHashtable(version->removed, &NullFree);
+  }
+  for (int i = 0; i < version->num_segments; i++) {
+    ReleaseSegment(version->segments[i]);
+  }
+  free(version->segments);
+  free(version);
+}
+
+// Puts the entries of from whose doc ids aren't in left_out, or all of
+// them if left_out is NULL, into *into, making it first if it's NULL.
+// The values are strings to copy if copy_strings is 1, and are shared
+// if it's 0.
+static int CopyEntries(Hashtable *into, Hashtable from, Hashtable left_out,
+                       int copy_strings) {
+  HTIter iter = from == NULL ? NULL : CreateHashtableIterator(from);
+  if (iter == NULL) {
+    return 0;
+  }
+  if (*into == NULL && (*into = CreateHashtable(16)) == NULL) {
+    DestroyHashtableIterator(iter);
+    return -1;
+  }
+  int result = 0;
+  do {
+    HTKeyValue kvp;
+    HTKeyValue old_kvp;
+    HTIteratorGet(iter, &kvp);
+    if (left_out != NULL && HasDoc(left_out, kvp.key)) {
+      continue;
+    }
+    if (copy_strings) {
+      kvp.value = strdup((char*)kvp.value);
+    }
+    if (kvp.value == NULL || PutInHashtable(*into, kvp, &old_kvp) == 1) {
+      result = -1;
+    }
+  } while (result == 0 && HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return result;
+}
+
+// Whether any of a MovieSet's files are in docs, if in is 1, or aren't,
+// if in is 0.
+static int HasDocIn(MovieSet set, Hashtable docs, int in) {
+  if (in && NumElemsInHashtable(docs) == 0) {
+    return 0;
+  }
+  HTIter iter = CreateHashtableIterator(set->doc_index);
+  if (iter == NULL) {
+    return 0;
+  }
+  int found = 0;
+  do {
+    HTKeyValue kvp;
+    HTIteratorGet(iter, &kvp);
+    found = HasDoc(docs, kvp.key) == in;
+  } while (!found && HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return found;
+}
+
+// Makes an empty MovieSet of a version's own, like set.
+static MovieSet MakeVersionSet(IndexVersion *version, MovieSet set) {
+  pthread_mutex_lock(&version->made_lock);
+  MovieSet made = NULL;
+  if (version->num_made == version->made_capacity) {
+    int capacity = version->made_capacity == 0 ?
+        16 : version->made_capacity * 2;
+    MovieSet *sets = (MovieSet*)realloc(version->made,
+                                        capacity * sizeof(MovieSet));
+    if (sets != NULL) {
+      version->made = sets;
+      version->made_capacity = capacity;
+    }
+  }
+  if (version->num_made < version->made_capacity) {
+    made = CreateMovieSetInArena(set->desc, version->index.arena);
+    if (made != NULL && made->doc_index != NULL) {
+      version->made[version->num_made++] = made;
+    } else {
+      made = NULL;
+    }
+  }
+  pthread_mutex_unlock(&version->made_lock);
+  return made;
+}
+
+// Works out the MovieSet of a term in a version from the segments'
+// sets for it, leaving out the files that have been removed. A term
+// that's in just one segment, with none of its files removed, is that
+// segment's set as it is. Called by the version's terms, with the
+// term's stripe locked.
+static void *MakeVersionTerm(uint64_t key, void *arg) {
+  IndexVersion *version = (IndexVersion*)arg;
+  MovieSet first = NULL;
+  int num_sets = 0;
+  int shared = 1;
+  for (int i = 0; i < version->num_segments; i++) {
+    HTKeyValue kvp;
+    if (LookupInHashtable(version->segments[i]->index->ht, key,
+                          &kvp) == 0) {
+      if (first == NULL) {
+        first = (MovieSet)kvp.value;
+      }
+      num_sets++;
+      shared = shared && !HasDocIn((MovieSet)kvp.value, version->removed, 1);
+    }
+  }
+  if (first == NULL) {
+    return &no_term;
+  }
+  if (num_sets == 1 && shared) {
+    return first;
+  }
+
+  MovieSet merged = MakeVersionSet(version, first);
+  if (merged == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < version->num_segments; i++) {
+    HTKeyValue kvp;
+    if (LookupInHashtable(version->segments[i]->index->ht, key,
+                          &kvp) != 0) {
+      continue;
+    }
+    MovieSet set = (MovieSet)kvp.value;
+    if (CopyEntries(&merged->doc_index, set->doc_index, version->removed,
+                    0) != 0 ||
+        CopyEntries(&merged->doc_positions, set->doc_positions,
+                    version->removed, 0) != 0) {
+      return NULL;
+    }
+  }
+  return NumElemsInHashtable(merged->doc_index) > 0 ? merged : &no_term;
+}
+
+// Finds the MovieSet of a term in a version; the version's find_term.
+static MovieSet FindVersionTerm(Index index, uint64_t key) {
+  IndexVersion *version = (IndexVersion*)index;
+  if (NumElemsInHashtable(version->removed) == 0) {
+    // With nothing removed, a term that's in just one segment is that
+    // segment's set, which is quicker to look up again than remember.
+    MovieSet found = NULL;
+    int num_found = 0;
+    for (int i = 0; i < version->num_segments && num_found < 2; i++) {
+      HTKeyValue kvp;
+      if (LookupInHashtable(version->segments[i]->index->ht, key,
+                            &kvp) == 0) {
+        found = (MovieSet)kvp.value;
+        num_found++;
+      }
+    }
+    if (num_found < 2) {
+      return found;
+    }
+  }
+  HTKeyValue kvp;
+  if (LookupOrPutInConcurrentHashtable(version->terms, key, &MakeVersionTerm,
+                                       version, &kvp) == 1) {
+    return NULL;
+  }
+  return kvp.value == &no_term ? NULL : (MovieSet)kvp.value;
+}
+
+// Whether a segment is worth keeping in a version: it has files that
+// haven't been removed, or it has no files at all.
+static int SegmentIsLive(Segment *segment, Hashtable removed) {
+  int num_removed = 0;
+  HTIter iter = CreateHashtableIterator(removed);
+  while (iter != NULL) {
+    HTKeyValue kvp;
+    HTIteratorGet(iter, &kvp);
+    num_removed += HasDoc(segment->docs, kvp.key);
+    if (HTIteratorNext(iter) != 0) {
+      DestroyHashtableIterator(iter);
+      break;
+    }
+  }
+  return num_removed == 0 ||
+      num_removed < NumElemsInHashtable(segment->docs);
+}
+
+// Finds the segment a file was indexed in.
+static Segment *FindSegment(Segment **segments, int num_segments,
+                            uint64_t doc_id) {
+  for (int i = 0; i < num_segments; i++) {
+    if (HasDoc(segments[i]->docs, doc_id)) {
+      return segments[i];
+    }
+  }
+  return NULL;
+}
+
+// Makes the removed files of the version after old: old's, and the ids
+// in removed, if it isn't NULL. Those that aren't in any segment of the
+// next version are let go of by BuildVersion.
+static Hashtable NextRemoved(IndexVersion *old, Hashtable removed) {
+  Hashtable next = CreateHashtable(16);
+  Hashtable from[2] = {old->removed, removed};
+  for (int i = 0; next != NULL && i < 2; i++) {
+    HTIter iter = from[i] == NULL ? NULL : CreateHashtableIterator(from[i]);
+    while (iter != NULL) {
+      HTKeyValue kvp;
+      HTKeyValue old_kvp;
+      HTIteratorGet(iter, &kvp);
+      kvp.value = NULL;
+      if (PutInHashtable(next, kvp, &old_kvp) == 1) {
+        DestroyHashtable(next, &NullFree);
+        next = NULL;
+      }
+      if (next == NULL || HTIteratorNext(iter) != 0) {
+        DestroyHashtableIterator(iter);
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+// Lets go of the removed files that aren't in any of a version's
+// segments any more.
+static int PruneRemoved(IndexVersion *version) {
+  int num_removed = NumElemsInHashtable(version->removed);
+  uint64_t *gone = (uint64_t*)malloc((num_removed + 1) * sizeof(uint64_t));
+  if (gone == NULL) {
+    return -1;
+  }
+  int num_gone = 0;
+  HTIter iter = CreateHashtableIterator(version->removed);
+  while (iter != NULL) {
+    HTKeyValue kvp;
+    HTIteratorGet(iter, &kvp);
+    if (FindSegment(version->segments, version->num_segments,
+                    kvp.key) == NULL) {
+      gone[num_gone++] = kvp.key;
+    }
+    if (HTIteratorNext(iter) != 0) {
+      DestroyHashtableIterator(iter);
+      break;
+    }
+  }
+  for (int i = 0; i < num_gone; i++) {
+    HTKeyValue kvp;
+    RemoveFromHashtable(version->removed, gone[i], &kvp);
+  }
+  free(gone);
+  return 0;
+}
+
+// Builds a version out of those of the segments that still have files
+// that aren't in removed. It takes removed over, even if it fails.
+//
+// Nothing in the segments is looked at but the removed files, so this
+// takes about as long however big the index is.
+static IndexVersion *BuildVersion(Segment **segments, int num_segments,
+                                  Hashtable removed, int keep_positions) {
+  IndexVersion *version = (IndexVersion*)calloc(1, sizeof(IndexVersion));
+  if (version == NULL) {
+    DestroyHashtable(removed, &NullFree);
+    return NULL;
+  }
+  pthread_mutex_init(&version->made_lock, NULL);
+  version->refs = 1;
+  version->removed = removed;
+  version->index.keep_positions = keep_positions;
+  version->index.find_term = &FindVersionTerm;
+  version->index.arena = CreateArena();
+  version->terms = CreateConcurrentHashtable(64, 0);
+  version->segments = (Segment**)malloc(
+      (num_segments + 1) * sizeof(Segment*));
+  RowTable *tables = (RowTable*)malloc((num_segments + 1) * sizeof(RowTable));
+  if (version->index.arena == NULL || version->terms == NULL ||
+      version->segments == NULL || tables == NULL) {
+    free(tables);
+    DestroyVersion(version);
+    return NULL;
+  }
+
+  // Segments whose files have all gone are let go of.
+  long num_rows = 0;
+  long num_words = 0;
+  for (int i = 0; i < num_segments; i++) {
+    if (SegmentIsLive(segments[i], removed)) {
+      long rows, words;
+      CountLiveRows(segments[i], removed, &rows, &words);
+      num_rows += rows;
+      num_words += words;
+      HoldSegment(segments[i]);
+      tables[version->num_segments] = segments[i]->index->rows;
+      version->segments[version->num_segments++] = segments[i];
+    }
+  }
+  version->index.rows = JoinRowTables(tables, version->num_segments,
+                                      num_rows, num_words);
+  free(tables);
+  if (version->index.rows == NULL || PruneRemoved(version) != 0) {
+    DestroyVersion(version);
+    return NULL;
+  }
+  return version;
+}
+
+// Makes version the current one. The old one goes once the queries
+// that have it are done.
+static void SwapVersion(LiveIndex live, IndexVersion *version) {
+  pthread_mutex_lock(&live->lock);
+  IndexVersion *old = live->current;
+  live->current = version;
+  int last = --old->refs == 0;
+  pthread_mutex_unlock(&live->lock);
+  if (last) {
+    DestroyVersion(old);
+  }
+}
+
+static void *MakeMovieSet(uint64_t key, void *arg) {
+  MovieSet from = (MovieSet)((void**)arg)[0];
+  return CreateMovieSetInArena(from->desc, (Arena)((void**)arg)[1]);
+}
+
+// Puts copies of the PostingLists of from whose doc ids are in docs into
+// *into, making it first if it's NULL.
+static int CopyLists(Hashtable *into, Hashtable from, DocIdMap docs,
+                     Arena arena) {
+  HTIter iter = from == NULL ? NULL : CreateHashtableIterator(from);
+  if (iter == NULL) {
+    return 0;
+  }
+  if (*into == NULL && (*into = CreateHashtable(16)) == NULL) {
+    DestroyHashtableIterator(iter);
+    return -1;
+  }
+  int result = 0;
+  do {
+    HTKeyValue kvp;
+    HTKeyValue old_kvp;
+    HTIteratorGet(iter, &kvp);
+    if (!HasDoc(docs, kvp.key)) {
+      continue;
+    }
+    kvp.value = CopyPostingList((PostingList)kvp.value, arena);
+    if (kvp.value == NULL || PutInHashtable(*into, kvp, &old_kvp) == 1) {
+      result = -1;
+    }
+  } while (result == 0 && HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return result;
+}
+
+// Copies the lists of a segment's MovieSet for the files in docs into
+// the index's set for the same term.
+static int CopyLiveLists(Index index, uint64_t key, MovieSet from,
+                         DocIdMap docs) {
+  if (!HasDocIn(from, docs, 1)) {
+    return 0;
+  }
+  HTKeyValue kvp;
+  void *args[2] = {from, index->arena};
+  if (LookupOrPutInHashtable(index->ht, key, &MakeMovieSet, args,
+                             &kvp) == 1) {
+    return -1;
+  }
+  MovieSet set = (MovieSet)kvp.value;
+  if (CopyLists(&set->doc_index, from->doc_index, docs, index->arena) != 0 ||
+      CopyLists(&set->doc_positions, from->doc_positions, docs,
+                index->arena) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// Copies the live rows and postings of some segments into a new one.
+static Segment *MergeSegments(Segment **sources, int num_sources,
+                              IndexVersion *version) {
+  Index index = CreateIndex();
+  DocIdMap docs = CreateDocIdMap();
+  if (index == NULL || docs == NULL) {
+    if (index != NULL) {
+      DestroyOffsetIndex(index);
+    }
+    if (docs != NULL) {
+      DestroyDocIdMap(docs);
+    }
+    return NULL;
+  }
+  index->keep_positions = version->index.keep_positions;
+  int result = 0;
+  for (int i = 0; result == 0 && i < num_sources; i++) {
+    result = CopyEntries(&docs, sources[i]->docs, version->removed, 1);
+  }
+
+  index->rows = result == 0 ? CreateRowTable(docs) : NULL;
+  HTIter iter = index->rows == NULL ? NULL : CreateHashtableIterator(docs);
+  while (iter != NULL && result == 0) {
+    HTKeyValue kvp;
+    SavedRows saved;
+    HTIteratorGet(iter, &kvp);
+    Segment *segment = FindSegment(sources, num_sources, kvp.key);
+    if (GetSavedRows(segment->index->rows, kvp.key, &saved) != 0 ||
+        CopySavedRows(index->rows, kvp.key, &saved) != 0) {
+      result = -1;
+    }
+    if (HTIteratorNext(iter) != 0) {
+      break;
+    }
+  }
+  if (iter != NULL) {
+    DestroyHashtableIterator(iter);
+  }
+  if (index->rows == NULL) {
+    result = -1;
+  }
+
+  // Every file is in one segment, so its PostingLists are just copied
+  // over; there's nothing to merge inside a list.
+  for (int i = 0; result == 0 && i < num_sources; i++) {
+    iter = CreateHashtableIterator(sources[i]->index->ht);
+    while (iter != NULL && result == 0) {
+      HTKeyValue kvp;
+      HTIteratorGet(iter, &kvp);
+      result = CopyLiveLists(index, kvp.key, (MovieSet)kvp.value, docs);
+      if (HTIteratorNext(iter) != 0) {
+        break;
+      }
+    }
+    if (iter != NULL) {
+      DestroyHashtableIterator(iter);
+    }
+  }
+
+  Segment *segment = result == 0 ? CreateSegment(index, docs) : NULL;
+  if (segment == NULL) {
+    printf("Couldn't allocate to merge segments\n");
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+  }
+  return segment;
+}
+
+static int HasSegment(Segment **segments, int num_segments,
+                      Segment *segment) {
+  for (int i = 0; i < num_segments; i++) {
+    if (segments[i] == segment) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// The size tier of a segment of so many rows.
+static int MergeTier(long num_rows) {
+  int tier = 0;
+  for (long size = num_rows / LIVE_MERGE_MIN_ROWS; size >= LIVE_MERGE_FACTOR;
+       size /= LIVE_MERGE_FACTOR) {
+    tier++;
+  }
+  return tier;
+}
+
+// Picks segments of a version to merge: the segments of the smallest
+// tier that has LIVE_MERGE_FACTOR of them, or else a segment that's
+// mostly files that have gone, on its own, to leave them out.
+static int PickMerge(IndexVersion *version, Segment **sources) {
+  int num_segments = version->num_segments;
+  int *tiers = (int*)malloc((num_segments + 1) * sizeof(int));
+  if (tiers == NULL) {
+    return 0;
+  }
+  int pick = -1;
+  int num_sources = 0;
+  for (int i = 0; i < num_segments; i++) {
+    long live_rows, live_words;
+    CountLiveRows(version->segments[i], version->removed, &live_rows,
+                  &live_words);
+    tiers[i] = MergeTier(live_rows);
+    if (num_sources == 0 && 2 * live_rows < version->segments[i]->num_rows) {
+      sources[num_sources++] = version->segments[i];
+    }
+  }
+  for (int i = 0; i < num_segments; i++) {
+    int count = 0;
+    for (int j = 0; j < num_segments; j++) {
+      count += tiers[j] == tiers[i];
+    }
+    if (count >= LIVE_MERGE_FACTOR && (pick < 0 || tiers[i] < pick)) {
+      pick = tiers[i];
+    }
+  }
+  if (pick >= 0) {
+    num_sources = 0;
+    for (int i = 0; i < num_segments; i++) {
+      if (tiers[i] == pick) {
+        sources[num_sources++] = version->segments[i];
+      }
+    }
+  }
+  free(tiers);
+  return num_sources;
+}
+
+// Merges one lot of segments, if any are due, and swaps in a version
+// with the merged segment instead. It's called with update_lock held,
+// but lets go of it while the segment is made, so updates can go on.
+//
+// Returns how many segments were merged, or -1 if out of memory.
+static int MergeOnce(LiveIndex live) {
+  IndexVersion *version = live->current;
+  Segment **sources = (Segment**)malloc(
+      (version->num_segments + 1) * sizeof(Segment*));
+  int num_sources = sources == NULL ? 0 : PickMerge(version, sources);
+  if (num_sources == 0) {
+    free(sources);
+    return 0;
+  }
+  pthread_mutex_lock(&live->lock);
+  version->refs++;
+  pthread_mutex_unlock(&live->lock);
+
+  pthread_mutex_unlock(&live->update_lock);
+  Segment *merged = MergeSegments(sources, num_sources, version);
+  pthread_mutex_lock(&live->update_lock);
+
+  // The version may have moved on meanwhile. Files that have gone since
+  // are just left out of it, but if a segment has gone altogether, the
+  // merge is thrown away.
+  IndexVersion *current = live->current;
+  Segment **segments = (Segment**)malloc(
+      (current->num_segments + 1) * sizeof(Segment*));
+  int num_segments = 0;
+  int result = merged == NULL || segments == NULL ? -1 : num_sources;
+  for (int i = 0; result > 0 && i < num_sources; i++) {
+    if (!HasSegment(current->segments, current->num_segments, sources[i])) {
+      result = 0;
+    }
+  }
+  if (result > 0) {
+    for (int i = 0; i < current->num_segments; i++) {
+      if (!HasSegment(sources, num_sources, current->segments[i])) {
+        segments[num_segments++] = current->segments[i];
+      }
+    }
+    segments[num_segments++] = merged;
+    Hashtable removed = NextRemoved(current, NULL);
+    IndexVersion *next = removed == NULL ? NULL :
+        BuildVersion(segments, num_segments, removed,
+                     current->index.keep_positions);
+    if (next == NULL) {
+      result = -1;
+    } else {
+      SwapVersion(live, next);
+    }
+  }
+  if (merged != NULL && merged->refs == 0) {
+    DestroySegment(merged);
+  }
+  free(segments);
+  free(sources);
+  ReleaseIndex(live, &version->index);
+  return result;
+}
+
+static void *MergeThread(void *arg) {
+  LiveIndex live = (LiveIndex)arg;
+  pthread_mutex_lock(&live->update_lock);
+  while (!live->stopping) {
+    if (MergeOnce(live) <= 0 && !live->stopping) {
+      pthread_cond_wait(&live->merge_cond, &live->update_lock);
+    }
+  }
+  pthread_mutex_unlock(&live->update_lock);
+  return NULL;
+}
+
+LiveIndex CreateLiveIndex(const char *dir, Index index, DocIdMap docs) {
+  LiveIndex live = (LiveIndex)malloc(sizeof(struct liveIndex));
+  if (live == NULL) {
+    return NULL;
+  }
+  live->dir = strdup(dir);
+  live->crawl = CreateCrawlState(docs, index->rows);
+  live->next_doc_id = MaxDocId(docs) + 1;
+  Segment *segment = CreateSegment(index, docs);
+  Hashtable removed = segment == NULL ? NULL : CreateHashtable(16);
+  live->current = NULL;
+  if (removed != NULL) {
+    // Held here too, so that if the version can't be made, index and
+    // docs are still the caller's.
+    HoldSegment(segment);
+    live->current = BuildVersion(&segment, 1, removed, index->keep_positions);
+    segment->refs--;
+  }
+  if (live->dir == NULL || live->crawl == NULL || live->current == NULL) {
+    free(live->dir);
+    if (live->crawl != NULL) {
+      DestroyCrawlState(live->crawl);
+    }
+    free(segment);
+    free(live);
+    return NULL;
+  }
+  pthread_mutex_init(&live->lock, NULL);
+  pthread_mutex_init(&live->update_lock, NULL);
+  pthread_cond_init(&live->merge_cond, NULL);
+  live->merging = 0;
+  live->stopping = 0;
+  return live;
+}
+
+int StartMerging(LiveIndex live) {
+  if (live->merging) {
+    return 0;
+  }
+  if (pthread_create(&live->merge_thread, NULL, &MergeThread, live) != 0) {
+    return -1;
+  }
+  live->merging = 1;
+  return 0;
+}
+
+void DestroyLiveIndex(LiveIndex live) {
+  if (live->merging) {
+    pthread_mutex_lock(&live->update_lock);
+    live->stopping = 1;
+    pthread_cond_signal(&live->merge_cond);
+    pthread_mutex_unlock(&live->update_lock);
+    pthread_join(live->merge_thread, NULL);
+  }
+  DestroyVersion(live->current);
+  DestroyCrawlState(live->crawl);
+  pthread_cond_destroy(&live->merge_cond);
+  pthread_mutex_destroy(&live->lock);
+  pthread_mutex_destroy(&live->update_lock);
+  free(live->dir);
+  free(live);
+}
+
+Index AcquireIndex(LiveIndex live) {
+  pthread_mutex_lock(&live->lock);
+  IndexVersion *version = live->current;
+  version->refs++;
+  pthread_mutex_unlock(&live->lock);
+  return &version->index;
+}
+
+void ReleaseIndex(LiveIndex live, Index index) {
+  IndexVersion *version = (IndexVersion*)index;
+  pthread_mutex_lock(&live->lock);
+  int last = --version->refs == 0;
+  pthread_mutex_unlock(&live->lock);
+  if (last) {
+    DestroyVersion(version);
+  }
+}
+
+int UpdateLiveIndex(LiveIndex live) {
+  pthread_mutex_lock(&live->update_lock);
+  DocIdMap changed = CreateDocIdMap();
+  Hashtable removed = CreateHashtable(16);
+  // What the crawl finds is only kept once the version with it is in.
+  CrawlState crawl = NULL;
+  uint64_t next_doc_id = live->next_doc_id;
+  int num_changes = -1;
+  if (changed != NULL && removed != NULL) {
+    num_changes = CrawlChangedFiles(live->dir, live->crawl, &next_doc_id,
+                                    changed, removed, &crawl);
+  }
+
+  // Index the new and changed files on their own.
+  Segment *added = NULL;
+  if (num_changes > 0 && NumElemsInHashtable(changed) > 0) {
+    Index index = CreateIndex();
+    if (index != NULL) {
+      index->keep_positions = live->current->index.keep_positions;
+      if (ParseTheFiles(changed, index) == 0) {
+        added = CreateSegment(index, changed);
+      }
+    }
+    if (added != NULL) {
+      changed = NULL;
+    } else {
+      // Leave the crawl as it was, so the next update tries again.
+      printf("Couldn't index the changed files\n");
+      if (index != NULL) {
+        DestroyOffsetIndex(index);
+      }
+      num_changes = -1;
+    }
+  }
+
+  if (num_changes > 0) {
+    // Only this thread changes current while it has update_lock, so it
+    // can't go away.
+    IndexVersion *old = live->current;
+    Segment **segments = (Segment**)malloc(
+        (old->num_segments + 1) * sizeof(Segment*));
+    Hashtable next_removed = NextRemoved(old, removed);
+    IndexVersion *next = NULL;
+    if (segments != NULL && next_removed != NULL) {
+      memcpy(segments, old->segments, old->num_segments * sizeof(Segment*));
+      int num_segments = old->num_segments;
+      if (added != NULL) {
+        segments[num_segments++] = added;
+      }
+      next = BuildVersion(segments, num_segments, next_removed,
+                          old->index.keep_positions);
+    } else if (next_removed != NULL) {
+      DestroyHashtable(next_removed, &NullFree);
+    }
+    free(segments);
+    if (next == NULL) {
+      printf("Couldn't allocate to update the index\n");
+      num_changes = -1;
+    } else {
+      SwapVersion(live, next);
+      pthread_cond_signal(&live->merge_cond);
+    }
+  }
+  if (added != NULL && added->refs == 0) {
+    DestroySegment(added);
+  }
+  if (num_changes >= 0) {
+    DestroyCrawlState(live->crawl);
+    live->crawl = crawl;
+    live->next_doc_id = next_doc_id;
+  } else if (crawl != NULL) {
+    DestroyCrawlState(crawl);
+  }
+
+  if (changed != NULL) {
+    DestroyDocIdMap(changed);
+  }
+  if (removed != NULL) {
+    DestroyHashtable(removed, &NullFree);
+  }
+  pthread_mutex_unlock(&live->update_lock);
+  return num_changes;
+}
+
+int MergeLiveIndex(LiveIndex live) {
+  pthread_mutex_lock(&live->update_lock);
+  int result = MergeOnce(live);
+  pthread_mutex_unlock(&live->update_lock);
+  return result;
+}
+
+int NumSegmentsInLiveIndex(LiveIndex live) {
+  Index index = AcquireIndex(live);
+  int num_segments = ((IndexVersion*)index)->num_segments;
+  ReleaseIndex(live, index);
+  return num_segments;
+}
+
+int SaveLiveIndex(LiveIndex live, const char *path) {
+  // A version has no term table of its own to write, so its segments
+  // are put together into one first.
+  Index index = AcquireIndex(live);
+  IndexVersion *version = (IndexVersion*)index;
+  Segment *whole = MergeSegments(version->segments, version->num_segments,
+                                 version);
+  int result = -1;
+  if (whole != NULL) {
+    result = WriteIndexFile(whole->index, whole->docs, path);
+    DestroySegment(whole);
+  }
+  ReleaseIndex(live, index);
+  return result;
+}
@@ -22,6 +22,7 @@
 
 
 #include "Movie.h"
+#include "RowParser.h"
 
 Movie* CreateMovie() {
   Movie *mov = (Movie*)malloc(sizeof(Movie));
@@ -59,59 +60,53 @@ void DestroyMovieWrapper(void *movie) {
 }
 
 
-char* CheckAndAllocateString(char* token) {
-  if (strcmp("-", token) == 0) {
+// Copies a field out of the row, or returns NULL if it's "-".
+static char* CheckAndAllocateString(FieldView field) {
+  if (field.len == 1 && field.start[0] == '-') {
     return NULL;
-  } else {
-    // TODO(adrienne): get rid of whitespace.
-    char *out = (char *) malloc((strlen(token) + 1) * sizeof(char));
-    strcpy(out, token);
-    return out;
   }
+  // TODO(adrienne): get rid of whitespace.
+  char *out = (char *) malloc((field.len + 1) * sizeof(char));
+  memcpy(out, field.start, field.len);
+  out[field.len] = '\0';
+  return out;
 }
 
-int CheckInt(char* token) {
-  if (strcmp("-", token) == 0) {
+// Reads a number field, or returns -1 if it's "-". Fields are followed
+// by a delimiter, which stops atoi.
+static int CheckInt(FieldView field) {
+  if (field.len == 1 && field.start[0] == '-') {
     return -1;
-  } else {
-    return atoi(token);
   }
+  return atoi(field.start);
 }
 
 Movie* CreateMovieFromRow(char *data_row) {
-  int num_fields = 9;
-
-  char *token[num_fields];
-  char *rest = data_row;
-
-  for (int i = 0; i < num_fields; i++) {
-    token[i] = strtok_r(rest, "|", &rest);
-    if (token[i] == NULL) {
-      return NULL;
-    }
+  // Split the row the same way the indexer does, in one pass.
+  MappedFile row_data = {data_row, (long)strlen(data_row)};
+  RowParser parser;
+  FieldView row;
+  MovieRowIndex pieces;
+  InitRowParser(&parser, &row_data, 0, -1);
+  if (!NextMovieRow(&parser, &row, &pieces) || !pieces.is_movie) {
+    return NULL;
   }
+
   Movie* mov = CreateMovie();
   if (mov == NULL) {
     printf("Couldn't create a Movie.\n");
     return NULL;
   }
-  mov->id = CheckAndAllocateString(token[0]);
-  mov->type = CheckAndAllocateString(token[1]);
-  mov->title = CheckAndAllocateString(token[2]);
-  mov->isAdult = CheckInt(token[4]);
-  mov->year = CheckInt(token[5]);
-  mov->runtime = CheckInt(token[7]);
-
-  char *g_token;
-
-  if (token[8][0] != '-') {
-    for (int i = 0; i < NUM_GENRES; i++) {
-      g_token = strtok_r(token[8], ",", &token[8]);
-      if (g_token != NULL) {
-        mov->genres[i] = CheckAndAllocateString(g_token);
-      } else {
-        break;
-      }
+  mov->id = CheckAndAllocateString(pieces.fields[0]);
+  mov->type = CheckAndAllocateString(pieces.fields[1]);
+  mov->title = CheckAndAllocateString(pieces.fields[MOVIE_ROW_TITLE]);
+  mov->isAdult = CheckInt(pieces.fields[4]);
+  mov->year = CheckInt(pieces.fields[5]);
+  mov->runtime = CheckInt(pieces.fields[7]);
+
+  if (pieces.fields[MOVIE_ROW_GENRES].start[0] != '-') {
+    for (int i = 0; i < pieces.num_genres && i < NUM_GENRES; i++) {
+      mov->genres[i] = CheckAndAllocateString(pieces.genres[i]);
     }
   }
 
@@ -22,10 +22,12 @@
 #include <string.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <sys/mman.h>
 
 #include "MovieIndex.h"
 #include "htll/LinkedList.h"
 #include "htll/Hashtable.h"
+#include "htll/Arena.h"
 #include "Movie.h"
 #include "MovieSet.h"
 
@@ -46,22 +48,188 @@ void toLower(char *str, int len) {
 
 Index CreateIndex() {
   Index ind = (Index)malloc(sizeof(struct index));
+  if (ind == NULL) {
+    printf("Couldn't malloc for an index\n");
+    return NULL;
+  }
   ind->ht = CreateHashtable(128);
+  ind->arena = CreateArena();
+  if (ind->ht == NULL || ind->arena == NULL) {
+    printf("Couldn't malloc for an index\n");
+    if (ind->ht != NULL) {
+      DestroyHashtable(ind->ht, &NullFree);
+    }
+    if (ind->arena != NULL) {
+      DestroyArena(ind->arena);
+    }
+    free(ind);
+    return NULL;
+  }
+  // The title index gets big; spread its resizes over later inserts
+  // instead of stalling one insert for the whole rehash.
+  SetHashtableIncrementalRehash(ind->ht, 1);
   ind->movies = NULL;  // TO BE NULL until it's populated/used.
+  ind->rows = NULL;
+  ind->keep_positions = 0;
+  ind->mapping = NULL;
+  ind->mapping_len = 0;
+  ind->find_term = NULL;
   return ind;
 }
 
 int DestroyIndex(Index index, void (*destroyValue)(void *mov_set)) {
+  if (index->mapping != NULL) {
+    // Everything but the RowTable is in the index file.
+    if (index->rows != NULL) {
+      DestroyRowTable(index->rows);
+    }
+    munmap(index->mapping, index->mapping_len);
+    free(index);
+    return 0;
+  }
   DestroyHashtable(index->ht, destroyValue);
 
   if (index->movies != NULL) {
     DestroyLinkedList(index->movies, DestroyMovieWrapper);
   } else {
   }
+  // Frees the MovieSets of an offset index all at once
+  DestroyArena(index->arena);
+  if (index->rows != NULL) {
+    DestroyRowTable(index->rows);
+  }
   free(index);
   return 0;
   }
 
+// What one merge thread works on: the terms whose hash falls in
+// its partition, across all the shards.
+struct mergeArgs {
+  Index *shards;
+  int num_shards;
+  int partition;
+  int num_partitions;
+  Hashtable merged;  // the merged MovieSets of this partition
+  Arena arena;  // for the offset lists this thread has to merge
+  Arena index_arena;  // the arena the merged sets will belong to
+  int result;
+  int threaded;  // 1 if it's merged on a thread of its own
+};
+
+static void *MergePartition(void *arguments) {
+  struct mergeArgs *args = (struct mergeArgs*)arguments;
+  HTKeyValue kvp, found, old_kvp;
+  args->result = 0;
+
+  for (int i = 0; i < args->num_shards; i++) {
+    HTIter iter = CreateHashtableIterator(args->shards[i]->ht);
+    if (iter == NULL) {
+      continue;
+    }
+    do {
+      HTIteratorGet(iter, &kvp);
+      if (kvp.key % args->num_partitions != args->partition) {
+        continue;
+      }
+      // The first shard to have a term lends the merged index its set.
+      if (LookupInHashtable(args->merged, kvp.key, &found) == 0) {
+        if (MergeMovieSets((MovieSet)found.value, (MovieSet)kvp.value,
+                           args->arena) != 0) {
+          args->result = -1;
+        }
+      } else {
+        PutInHashtable(args->merged, kvp, &old_kvp);
+      }
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+
+  // From here on the sets grow from the index's arena.
+  HTIter iter = CreateHashtableIterator(args->merged);
+  if (iter != NULL) {
+    do {
+      HTIteratorGet(iter, &kvp);
+      ((MovieSet)kvp.value)->arena = args->index_arena;
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+  return NULL;
+}
+
+int MergeIndexShards(Index index, Index *shards, int num_shards,
+                     int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = 1;
+  }
+  struct mergeArgs *args =
+    (struct mergeArgs*)malloc(num_threads * sizeof(struct mergeArgs));
+  pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+  if (args == NULL || threads == NULL) {
+    printf("Couldn't malloc to merge index shards\n");
+    free(args);
+    free(threads);
+    return -1;
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    args[i].shards = shards;
+    args[i].num_shards = num_shards;
+    args[i].partition = i;
+    args[i].num_partitions = num_threads;
+    args[i].merged = CreateHashtable(128);
+    args[i].arena = CreateArena();
+    args[i].index_arena = index->arena;
+    args[i].threaded = pthread_create(&threads[i], NULL, &MergePartition,
+                                      &args[i]) == 0;
+  }
+  int result = 0;
+  for (int i = 0; i < num_threads; i++) {
+    // A partition that couldn't have a thread is merged on this one.
+    if (args[i].threaded) {
+      pthread_join(threads[i], NULL);
+    } else {
+      MergePartition(&args[i]);
+    }
+    if (args[i].result != 0) {
+      result = -1;
+    }
+  }
+
+  // The partitions don't share any terms, so this is just moving
+  // sets over, unless the index already had some of the terms.
+  HTKeyValue kvp, found, old_kvp;
+  for (int i = 0; i < num_threads; i++) {
+    HTIter iter = CreateHashtableIterator(args[i].merged);
+    if (iter != NULL) {
+      do {
+        HTIteratorGet(iter, &kvp);
+        if (LookupInHashtable(index->ht, kvp.key, &found) == 0) {
+          if (MergeMovieSets((MovieSet)found.value, (MovieSet)kvp.value,
+                             index->arena) != 0) {
+            result = -1;
+          }
+        } else {
+          PutInHashtable(index->ht, kvp, &old_kvp);
+        }
+      } while (HTIteratorNext(iter) == 0);
+      DestroyHashtableIterator(iter);
+    }
+    DestroyHashtable(args[i].merged, &NullFree);
+    MergeArenas(index->arena, args[i].arena);
+  }
+
+  // The sets are the index's now; keep their memory and drop the rest.
+  for (int i = 0; i < num_shards; i++) {
+    DestroyHashtable(shards[i]->ht, &NullFree);
+    MergeArenas(index->arena, shards[i]->arena);
+    free(shards[i]);
+  }
+
+  free(args);
+  free(threads);
+  return result;
+}
+
 // Destroy index that has an offsetlist as a value
 int DestroyOffsetIndex(Index index) {
     return DestroyIndex(index, DestroyMovieSetWrapper);
@@ -73,48 +241,121 @@ int DestroyTypeIndex(Index index) {
 }
 
 
-// Assumes Index is a hashtable with key=title word,
-// and value=hashtable with key doc id and value linked list of rows
-int AddMovieTitleToIndex(Index index,
-                         Movie *movie,
-                         uint64_t doc_id,
-                         int row_id) {
-  // Put in the index
-  HTKeyValue kvp;
+// What MakeMovieSet needs to make the MovieSet for a new title word.
+struct newSetArgs {
+  char *desc;
+  Arena arena;
+};
 
-  int numFields = 1000;
+static void *MakeMovieSet(uint64_t key, void *arg) {
+  struct newSetArgs *args = (struct newSetArgs*)arg;
+  return CreateMovieSetInArena(args->desc, args->arena);
+}
 
-  char *token[numFields];
-  char *rest = movie->title;
+// Longer words than this are lowercased into a malloc'd copy instead.
+#define WORD_BUFFER_SIZE 256
+
+// Adds one title word, which isn't NUL-terminated, to the index.
+// position is which word of the title it is.
+static int AddWordToIndex(Index index, const char *word_start, int word_len,
+                          int position, uint64_t doc_id, int row_id) {
+  // Title words are indexed lowercase.
+  char buffer[WORD_BUFFER_SIZE];
+  char *word = buffer;
+  if (word_len >= WORD_BUFFER_SIZE) {
+    word = (char*)malloc(word_len + 1);
+    if (word == NULL) {
+      printf("Couldn't malloc for a long title word\n");
+      return -1;
+    }
+  }
+  for (int i = 0; i < word_len; i++) {
+    word[i] = tolower(word_start[i]);
+  }
+  word[word_len] = '\0';
+
+  int result = AddTermToIndex(index, word,
+                              FNVHash64((unsigned char*)word,
+                                        (unsigned int)word_len),
+                              position, doc_id, row_id);
+  if (word != buffer) {
+    free(word);
+  }
+  return result;
+}
 
-  int i = 0;
-  token[i] = strtok_r(rest, " ", &rest);
-  while (token[i] != NULL) {
-    toLower(token[i], strlen(token[i]));
-    i++;
-    token[i] = strtok_r(rest, " ", &rest);
+int AddTermToIndex(Index index, const char *word, uint64_t key,
+                   int position, uint64_t doc_id, int row_id) {
+  // Get this word's MovieSet, making it if this is the first time
+  // the word has been seen.
+  HTKeyValue kvp;
+  struct newSetArgs args = {(char*)word, index->arena};
+  if (LookupOrPutInHashtable(index->ht, key, &MakeMovieSet, &args,
+                             &kvp) == 1) {
+    return -1;
   }
 
-  for (int j = 0; j < i; j++) {
-    // If this key is already in the hashtable, get the MovieSet.
-    // Otherwise, create a MovieSet and put it in.
-    int result = LookupInHashtable(index->ht,
-                          FNVHash64((unsigned char*)token[j],
-                                    (unsigned int)strlen(token[j])), &kvp);
-    HTKeyValue old_kvp;
+  if (index->keep_positions) {
+    return AddMovieWordToSet((MovieSet)kvp.value, doc_id, row_id, position);
+  }
+  AddMovieToSet((MovieSet)kvp.value, doc_id, row_id);
+  return 0;
+}
 
-    if (result < 0) {
-      kvp.value = CreateMovieSet(token[j]);
-      kvp.key = FNVHash64((unsigned char*)token[j], strlen(token[j]));
-      PutInHashtable(index->ht, kvp, &old_kvp);
-    }
+int AddTitleWordsToIndex(Index index, const char *title, int len,
+                         uint64_t doc_id, int row_id) {
+  // A title of "-" means there isn't one.
+  if (len == 1 && title[0] == '-') {
+    return 0;
+  }
 
-    AddMovieToSet((MovieSet)kvp.value, doc_id, row_id);
+  const char *end = title + len;
+  const char *c = title;
+  int position = 0;
+  while (c < end) {
+    while (c < end && *c == ' ') {
+      c++;
+    }
+    const char *word_start = c;
+    while (c < end && *c != ' ') {
+      c++;
+    }
+    if (c == word_start) {
+      break;
+    }
+    if (AddWordToIndex(index, word_start, c - word_start, position++,
+                       doc_id, row_id) != 0) {
+      return -1;
+    }
   }
 
   return 0;
 }
 
+int AddTitleWordViewsToIndex(Index index, const FieldView *words,
+                             int num_words, uint64_t doc_id, int row_id) {
+  for (int i = 0; i < num_words; i++) {
+    if (AddWordToIndex(index, words[i].start, words[i].len, i,
+                       doc_id, row_id) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Assumes Index is a hashtable with key=title word,
+// and value=hashtable with key doc id and value linked list of rows
+int AddMovieTitleToIndex(Index index,
+                         Movie *movie,
+                         uint64_t doc_id,
+                         int row_id) {
+  if (movie->title == NULL) {
+    return 0;
+  }
+  return AddTitleWordsToIndex(index, movie->title, strlen(movie->title),
+                              doc_id, row_id);
+}
+
 
 // Adds the movie to the index all by genre
 int AddMovieToIndex_Genre(Index index, Movie *movie) {
@@ -215,11 +456,14 @@ MovieSet GetMovieSet(Index index, const char *term) {
   char lower[strlen(term)+1];
   strcpy(lower, term);
   toLower(lower, strlen(lower));
-  int result = LookupInHashtable(index->ht,
-                                 FNVHash64((unsigned char*)lower,
-                                           (unsigned int)strlen(lower)),
-                                 &kvp);
-  if (result < 0) {
+  uint64_t key = FNVHash64((unsigned char*)lower,
+                           (unsigned int)strlen(lower));
+  if (index->find_term != NULL) {
+    kvp.value = index->find_term(index, key);
+  } else if (LookupInHashtable(index->ht, key, &kvp) < 0) {
+    kvp.value = NULL;
+  }
+  if (kvp.value == NULL) {
     printf("term couldn't be found: %s \n", term);
     return NULL;
   }
@@ -23,6 +23,8 @@
 #include "htll/LinkedList.h"
 #include "Movie.h"
 #include "MovieSet.h"
+#include "RowParser.h"
+#include "RowTable.h"
 
 
 /**
@@ -42,6 +44,36 @@ typedef struct index {
    *
    */
   LinkedList movies;
+  /**
+   * The MovieSets of an offset index, and all their offset lists and
+   * row ids, are allocated from here so they can be freed in one go.
+   */
+  Arena arena;
+  /**
+   * Where each movie row of an offset index's files starts, so results
+   * can be read back without scanning the files. The parser makes it;
+   * it's NULL until then, and for other indexes.
+   */
+  RowTable rows;
+  /**
+   * Whether a title index keeps where each word is in the title too,
+   * in its MovieSets' doc_positions, so phrases can be matched. Off
+   * unless it's set before the index is built.
+   */
+  int keep_positions;
+  /**
+   * The index file an index was loaded from (see LoadIndexFile), which
+   * its term table and MovieSets are read straight out of, or NULL if
+   * it was built in memory. A loaded index can't be added to.
+   */
+  void *mapping;
+  size_t mapping_len; /*!< How many bytes of the file are mapped */
+  /**
+   * For an index that's put together from others at query time, as a
+   * version of a LiveIndex is (see LiveIndex.h), finds the MovieSet of
+   * a word's key across them; ht isn't used. NULL for any other index.
+   */
+  MovieSet (*find_term)(struct index *index, uint64_t key);
 } *Index;
 
 /**
@@ -72,6 +104,54 @@ int AddMovieToIndex(Index index, Movie *movie, enum IndexField field);
  */
 int AddMovieTitleToIndex(Index index, Movie *movie, uint64_t docId, int row);
 
+/**
+ * Same as AddMovieTitleToIndex, but takes the title straight from the
+ * row it was read from, with no Movie and no copying: title doesn't
+ * need to be NUL-terminated, and isn't changed.
+ *
+ *  \param index the index to add the movie to.
+ *  \param title the title's first character.
+ *  \param len how many characters the title has.
+ *  \param doc_id the id of the file the movie is in.
+ *  \param row the movie's row id in that file.
+ *
+ *  \return 0 if successful, -1 if out of memory.
+ */
+int AddTitleWordsToIndex(Index index, const char *title, int len,
+                         uint64_t doc_id, int row);
+
+/**
+ * Same as AddTitleWordsToIndex, but for a title that has already been
+ * split into words, as NextMovieRow does.
+ *
+ *  \param index the index to add the movie to.
+ *  \param words the title's words.
+ *  \param num_words how many words there are.
+ *  \param doc_id the id of the file the movie is in.
+ *  \param row the movie's row id in that file.
+ *
+ *  \return 0 if successful, -1 if out of memory.
+ */
+int AddTitleWordViewsToIndex(Index index, const FieldView *words,
+                             int num_words, uint64_t doc_id, int row);
+
+/**
+ * Adds one title word that's already lowercase, with its hash, as
+ * the other Add functions key words by. For a caller that splits and
+ * hashes titles itself.
+ *
+ *  \param index the index to add the movie to.
+ *  \param word the lowercase word, NUL-terminated.
+ *  \param key FNVHash64 of the word's characters.
+ *  \param position which word of the title it is.
+ *  \param doc_id the id of the file the movie is in.
+ *  \param row the movie's row id in that file.
+ *
+ *  \return 0 if successful, -1 if out of memory.
+ */
+int AddTermToIndex(Index index, const char *word, uint64_t key,
+                   int position, uint64_t doc_id, int row);
+
 
 
 /**
@@ -102,10 +182,28 @@ int DestroyTypeIndex(Index index);
  */
 int DestroyOffsetIndex(Index index);
 
+/**
+ * Merges shards of an offset index, built separately by different
+ * threads over different files, into one index. The terms are split
+ * into num_threads partitions by hash, and each partition is merged
+ * by its own thread. The shards' MovieSets and memory are taken over
+ * by the index, and the shards are freed.
+ *
+ * \param index the offset index to merge into.
+ * \param shards the offset indexes to merge.
+ * \param num_shards how many shards there are.
+ * \param num_threads how many threads to merge with.
+ *
+ * \return 0 if successful.
+ */
+int MergeIndexShards(Index index, Index *shards, int num_shards,
+                     int num_threads);
+
 /**
  * Creates a new Index. Allocates all the memory
  *  necessary for this index.
  *
+ * \return the index, or NULL if out of memory.
  */
 Index CreateIndex();
 
@@ -22,6 +22,8 @@
 
 #include "MovieSet.h"
 #include "htll/Hashtable.h"
+#include "htll/Arena.h"
+#include "PostingList.h"
 
 
 void NullFree(void *freeme) { }
@@ -41,23 +43,73 @@ int AddMovieToSet(MovieSet set,  uint64_t docId, int rowId) {
   // Otherwise, create a new entry for this docId in docInd.
   if (result < 0) {
     kvp.key = docId;
-    kvp.value = CreateLinkedList();
+    kvp.value = CreatePostingList(set->arena);
+    if (kvp.value == NULL) {
+      // Out of mem
+      printf("Out of memory adding movie to set: %s\n", set->desc);
+      return -1;
+    }
     PutInHashtable(docInd, kvp, &old_kvp);
   }
 
-  // add rowId to the linked list.
-  void *val = malloc(sizeof(int));
-
-  if (val == NULL) {
-    // Out of mem
+  // add rowId to the posting list.
+  result = AddToPostingList((PostingList)kvp.value, set->arena, rowId);
+  if (result != 0) {
     printf("Out of memory adding movie to set: %s\n", set->desc);
+  }
+
+  return result;
+}
+
+int AddMovieWordToSet(MovieSet set, uint64_t docId, int rowId,
+                      int position) {
+  if (AddMovieToSet(set, docId, rowId) != 0) {
     return -1;
   }
+  if (position < 0 || position > TITLE_MAX_POSITION ||
+      (uint32_t)rowId > TITLE_MAX_POSITION_ROW) {
+    return 0;
+  }
+  if (set->doc_positions == NULL) {
+    set->doc_positions = CreateHashtable(16);
+    if (set->doc_positions == NULL) {
+      printf("Out of memory adding positions to set: %s\n", set->desc);
+      return -1;
+    }
+  }
 
-  *((int*)val) = rowId;
-  result = InsertLinkedList((LinkedList)kvp.value, val);
+  HTKeyValue kvp;
+  HTKeyValue old_kvp;
+  if (LookupInHashtable(set->doc_positions, docId, &kvp) < 0) {
+    kvp.key = docId;
+    kvp.value = CreatePostingList(set->arena);
+    if (kvp.value == NULL) {
+      printf("Out of memory adding positions to set: %s\n", set->desc);
+      return -1;
+    }
+    PutInHashtable(set->doc_positions, kvp, &old_kvp);
+  }
+  uint32_t entry = (uint32_t)rowId << TITLE_POSITION_BITS | position;
+  if (AddToPostingList((PostingList)kvp.value, set->arena, entry) != 0) {
+    printf("Out of memory adding positions to set: %s\n", set->desc);
+    return -1;
+  }
+  return 0;
+}
 
-  return result;
+int NumMoviesInSet(MovieSet set) {
+  int count = 0;
+  HTIter iter = CreateHashtableIterator(set->doc_index);
+  if (iter == NULL) {
+    return 0;
+  }
+  HTKeyValue kvp;
+  do {
+    HTIteratorGet(iter, &kvp);
+    count += NumRowsInPostingList((PostingList)kvp.value);
+  } while (HTIteratorNext(iter) == 0);
+  DestroyHashtableIterator(iter);
+  return count;
 }
 
 int MovieSetContainsDoc(MovieSet set, uint64_t docId) {
@@ -65,15 +117,16 @@ int MovieSetContainsDoc(MovieSet set, uint64_t docId) {
   return LookupInHashtable(set->doc_index, docId, &kvp);
 }
 
-void PrintOffsetList(LinkedList list) {
+void PrintOffsetList(PostingList list) {
   printf("Printing offset list\n");
-  LLIter iter = CreateLLIter(list);
-  int* payload;
-  while (LLIterHasNext(iter) != 0) {
-    LLIterGetPayload(iter, (void**)&payload);
-    printf("%d\t", *((int*)payload));
-    LLIterNext(iter);
+  if (NumRowsInPostingList(list) == 0) {
+    return;
   }
+  PostingListIter iter;
+  PostingListIterInit(&iter, list);
+  do {
+    printf("%u\t", PostingListIterGet(&iter));
+  } while (PostingListIterNext(&iter) == 0);
 }
 
 
@@ -91,6 +144,27 @@ MovieSet CreateMovieSet(char *desc) {
   }
   strcpy(set->desc, desc);
   set->doc_index = CreateHashtable(16);
+  set->arena = NULL;
+  set->doc_positions = NULL;
+  return set;
+}
+
+MovieSet CreateMovieSetInArena(char *desc, Arena arena) {
+  MovieSet set = (MovieSet)ArenaAlloc(arena, sizeof(struct movieSet));
+  if (set == NULL) {
+    // Out of memory
+    printf("Couldn't allocate movieSet %s\n", desc);
+    return NULL;
+  }
+  set->desc = (char*)ArenaAlloc(arena, strlen(desc) *  sizeof(char) + 1);
+  if (set->desc == NULL) {
+    printf("Couldn't allocate movieSet->desc");
+    return NULL;
+  }
+  strcpy(set->desc, desc);
+  set->doc_index = CreateHashtable(16);
+  set->arena = arena;
+  set->doc_positions = NULL;
   return set;
 }
 
@@ -125,16 +199,82 @@ int AddMovieToSetOfMovies(SetOfMovies set, Movie *movie) {
 }
 
 
+// Moves the lists of one doc_index (or doc_positions) into another,
+// merging the lists of docs that are in both.
+static int MergeDocLists(Hashtable into_docs, MovieSet into,
+                         Hashtable from_docs, MovieSet from, Arena arena) {
+  HTIter iter = CreateHashtableIterator(from_docs);
+  if (iter != NULL) {
+    HTKeyValue kvp, old_kvp;
+    do {
+      HTIteratorGet(iter, &kvp);
+      HTKeyValue into_kvp;
+      if (LookupInHashtable(into_docs, kvp.key, &into_kvp) == 0) {
+        // Both sets saw this doc; its rows came from different chunks.
+        PostingList from_list = (PostingList)kvp.value;
+        kvp.value = MergePostingLists((PostingList)into_kvp.value,
+                                      from_list, arena);
+        if (kvp.value == NULL) {
+          printf("Out of memory merging movie set: %s\n", into->desc);
+          DestroyHashtableIterator(iter);
+          return -1;
+        }
+        // Lists in an arena go with it; malloc'd ones are freed now.
+        if (into->arena == NULL) {
+          DestroyPostingList((PostingList)into_kvp.value, NULL);
+        }
+        if (from->arena == NULL) {
+          DestroyPostingList(from_list, NULL);
+        }
+      }
+      PutInHashtable(into_docs, kvp, &old_kvp);
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+  // The lists now belong to into; only the table itself goes.
+  DestroyHashtable(from_docs, &NullFree);
+  return 0;
+}
+
+int MergeMovieSets(MovieSet into, MovieSet from, Arena arena) {
+  if (MergeDocLists(into->doc_index, into, from->doc_index, from,
+                    arena) != 0) {
+    return -1;
+  }
+  from->doc_index = NULL;
+  if (from->doc_positions == NULL) {
+    return 0;
+  }
+  if (into->doc_positions == NULL) {
+    into->doc_positions = from->doc_positions;
+  } else if (MergeDocLists(into->doc_positions, into, from->doc_positions,
+                           from, arena) != 0) {
+    return -1;
+  }
+  from->doc_positions = NULL;
+  return 0;
+}
+
 void DestroyOffsetList(void *val) {
-  LinkedList list = (LinkedList)val;
-  DestroyLinkedList(list, &SimpleFree);
+  DestroyPostingList((PostingList)val, NULL);
 }
 
 void DestroyMovieSet(MovieSet set) {
+  // Everything but the doc_index itself goes away with the arena
+  if (set->arena != NULL) {
+    DestroyHashtable(set->doc_index, &NullFree);
+    if (set->doc_positions != NULL) {
+      DestroyHashtable(set->doc_positions, &NullFree);
+    }
+    return;
+  }
   // Free desc
   free(set->desc);
   // Free doc_index
   DestroyHashtable(set->doc_index, &DestroyOffsetList);
+  if (set->doc_positions != NULL) {
+    DestroyHashtable(set->doc_positions, &DestroyOffsetList);
+  }
   // Free set
   free(set);
 }
@@ -0,0 +1,402 @@
+/*
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PostingList.h"
+#include "Assert007.h"
+
+// A uint32_t takes at most this many bytes as a varint.
+#define MAX_VARINT_BYTES 5
+
+static unsigned char *Data(PostingList list) {
+  if (list->capacity <= POSTING_INLINE_BYTES) {
+    return list->bytes.inline_data;
+  }
+  return list->bytes.data;
+}
+
+// A list in an arena keeps its data there too, so the whole index can
+// be dropped with the arena. The few lists that outgrow the arena's
+// reusable block sizes leave their old buffers behind until then.
+static unsigned char *AllocData(Arena arena, uint32_t size) {
+  if (arena != NULL) {
+    return (unsigned char*)ArenaAlloc(arena, size);
+  }
+  return (unsigned char*)malloc(size);
+}
+
+static void FreeData(Arena arena, unsigned char *data, uint32_t size) {
+  if (arena != NULL) {
+    ArenaFree(arena, data, size);
+  } else {
+    free(data);
+  }
+}
+
+// Makes sure there's room for a varint at the end of the data.
+static int Reserve(PostingList list, Arena arena) {
+  if (list->len + MAX_VARINT_BYTES <= list->capacity) {
+    return 0;
+  }
+  uint32_t new_capacity = list->capacity * 2;
+  unsigned char *new_data = AllocData(arena, new_capacity);
+  if (new_data == NULL) {
+    printf("Couldn't allocate to grow a posting list\n");
+    return -1;
+  }
+  memcpy(new_data, Data(list), list->len);
+  if (list->capacity > POSTING_INLINE_BYTES) {
+    FreeData(arena, list->bytes.data, list->capacity);
+  }
+  list->bytes.data = new_data;
+  list->capacity = new_capacity;
+  return 0;
+}
+
+// Writes value as a varint at the end of the data.
+static void PutVarint(PostingList list, uint32_t value) {
+  unsigned char *data = Data(list);
+  while (value >= 0x80) {
+    data[list->len++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  data[list->len++] = (unsigned char)value;
+}
+
+// Reads the varint at *pos, and moves *pos past it.
+static uint32_t GetVarint(const unsigned char *data, uint32_t *pos) {
+  uint32_t value = 0;
+  int shift = 0;
+  unsigned char byte;
+  do {
+    byte = data[(*pos)++];
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+// How many entries a list's skip table has.
+static uint32_t NumSkips(PostingList list) {
+  return list->num_rows == 0 ? 0 : (list->num_rows - 1) / POSTING_SKIP_ROWS;
+}
+
+uint32_t NumSkipsInPostingList(PostingList list) {
+  return NumSkips(list);
+}
+
+// How many entries there's room for in a skip table of num_skips;
+// tables start with 4 and double.
+static uint32_t SkipCapacity(uint32_t num_skips) {
+  uint32_t capacity = 4;
+  while (capacity < num_skips) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+static void FreeSkips(PostingList list, Arena arena) {
+  if (list->skips != NULL) {
+    FreeData(arena, (unsigned char*)list->skips,
+             SkipCapacity(NumSkips(list)) * sizeof(PostingSkip));
+    list->skips = NULL;
+  }
+}
+
+// Adds the row just appended to the skip table.
+static int AddSkip(PostingList list, Arena arena) {
+  uint32_t num_skips = NumSkips(list) - 1;  // before this one
+  if (num_skips == 0 || (num_skips >= 4 &&
+                         (num_skips & (num_skips - 1)) == 0)) {
+    uint32_t capacity = num_skips == 0 ? SkipCapacity(1) : 2 * num_skips;
+    PostingSkip *skips = (PostingSkip*)AllocData(
+        arena, capacity * sizeof(PostingSkip));
+    if (skips == NULL) {
+      printf("Couldn't allocate to grow a posting list's skips\n");
+      return -1;
+    }
+    if (num_skips > 0) {
+      memcpy(skips, list->skips, num_skips * sizeof(PostingSkip));
+      FreeData(arena, (unsigned char*)list->skips,
+               num_skips * sizeof(PostingSkip));
+    }
+    list->skips = skips;
+  }
+  PostingSkip *skip = &list->skips[num_skips];
+  skip->row = list->last_row;
+  skip->index = list->num_rows - 1;
+  skip->next_byte = list->len;
+  skip->block_words = 0;
+  return 0;
+}
+
+static int AppendRow(PostingList list, Arena arena, uint32_t row) {
+  if (Reserve(list, arena) != 0) {
+    return -1;
+  }
+  uint32_t old_len = list->len;
+  uint32_t old_last_row = list->last_row;
+  PutVarint(list, list->num_rows == 0 ? row : row - list->last_row);
+  list->last_row = row;
+  list->num_rows++;
+  if (list->num_rows > 1 && (list->num_rows - 1) % POSTING_SKIP_ROWS == 0 &&
+      AddSkip(list, arena) != 0) {
+    // Leave the row out, rather than have a list with no skip for it.
+    list->len = old_len;
+    list->last_row = old_last_row;
+    list->num_rows--;
+    return -1;
+  }
+  return 0;
+}
+
+// The slow path for a row that belongs before the end of the list:
+// decode the rows, and write them back out with the new one in place.
+static int InsertRow(PostingList list, Arena arena, uint32_t row) {
+  uint32_t num_rows = list->num_rows;
+  uint32_t *rows = (uint32_t*)malloc(num_rows * sizeof(uint32_t));
+  if (rows == NULL) {
+    printf("Couldn't malloc to insert into a posting list\n");
+    return -1;
+  }
+  unsigned char *data = Data(list);
+  uint32_t pos = 0;
+  uint32_t prev = 0;
+  for (uint32_t i = 0; i < num_rows; i++) {
+    prev = (i == 0) ? GetVarint(data, &pos) : prev + GetVarint(data, &pos);
+    rows[i] = prev;
+  }
+
+  FreeSkips(list, arena);
+  list->len = 0;
+  list->num_rows = 0;
+  int result = 0;
+  int inserted = 0;
+  for (uint32_t i = 0; i < num_rows && result == 0; i++) {
+    if (!inserted && row <= rows[i]) {
+      if (row < rows[i]) {
+        result = AppendRow(list, arena, row);
+      }
+      inserted = 1;
+    }
+    if (result == 0) {
+      result = AppendRow(list, arena, rows[i]);
+    }
+  }
+  free(rows);
+  return result;
+}
+
+PostingList CreatePostingList(Arena arena) {
+  PostingList list;
+  if (arena != NULL) {
+    list = (PostingList)ArenaAlloc(arena, sizeof(struct postingList));
+  } else {
+    list = (PostingList)malloc(sizeof(struct postingList));
+  }
+  if (list == NULL) {
+    printf("Couldn't allocate a posting list\n");
+    return NULL;
+  }
+  list->num_rows = 0;
+  list->last_row = 0;
+  list->len = 0;
+  list->capacity = POSTING_INLINE_BYTES;
+  list->skips = NULL;
+  return list;
+}
+
+int AddToPostingList(PostingList list, Arena arena, uint32_t row) {
+  Assert007(list != NULL);
+  if (list->num_rows == 0 || row > list->last_row) {
+    return AppendRow(list, arena, row);
+  }
+  if (row == list->last_row) {
+    return 0;
+  }
+  return InsertRow(list, arena, row);
+}
+
+PostingList MergePostingLists(PostingList a, PostingList b, Arena arena) {
+  PostingList merged = CreatePostingList(arena);
+  if (merged == NULL) {
+    return NULL;
+  }
+  PostingListIter iter_a, iter_b;
+  PostingListIterInit(&iter_a, a);
+  PostingListIterInit(&iter_b, b);
+  int more_a = 1;
+  int more_b = 1;
+  while (more_a || more_b) {
+    // Take the smaller row next, so every add is an append.
+    PostingListIter *next;
+    if (!more_b || (more_a &&
+        PostingListIterGet(&iter_a) <= PostingListIterGet(&iter_b))) {
+      next = &iter_a;
+    } else {
+      next = &iter_b;
+    }
+    if (AddToPostingList(merged, arena, PostingListIterGet(next)) != 0) {
+      DestroyPostingList(merged, arena);
+      return NULL;
+    }
+    if (next == &iter_a) {
+      more_a = PostingListIterNext(&iter_a) == 0;
+    } else {
+      more_b = PostingListIterNext(&iter_b) == 0;
+    }
+  }
+  return merged;
+}
+
+PostingList CopyPostingList(PostingList list, Arena arena) {
+  PostingList copy = CreatePostingList(arena);
+  if (copy == NULL) {
+    return NULL;
+  }
+  if (list->len > POSTING_INLINE_BYTES) {
+    copy->bytes.data = AllocData(arena, list->len);
+    if (copy->bytes.data == NULL) {
+      printf("Couldn't allocate to copy a posting list\n");
+      DestroyPostingList(copy, arena);
+      return NULL;
+    }
+    copy->capacity = list->len;
+  }
+  memcpy(Data(copy), Data(list), list->len);
+  copy->len = list->len;
+  copy->num_rows = list->num_rows;
+  copy->last_row = list->last_row;
+
+  // The skips keep their block bounds. The table is sized the way
+  // AddSkip would have grown it, so it can be grown and freed the same.
+  uint32_t num_skips = NumSkips(list);
+  if (num_skips > 0) {
+    copy->skips = (PostingSkip*)AllocData(
+        arena, SkipCapacity(num_skips) * sizeof(PostingSkip));
+    if (copy->skips == NULL) {
+      printf("Couldn't allocate to copy a posting list's skips\n");
+      DestroyPostingList(copy, arena);
+      return NULL;
+    }
+    memcpy(copy->skips, list->skips, num_skips * sizeof(PostingSkip));
+  }
+  return copy;
+}
+
+int NumRowsInPostingList(PostingList list) {
+  return list->num_rows;
+}
+
+void DestroyPostingList(PostingList list, Arena arena) {
+  FreeSkips(list, arena);
+  if (list->capacity > POSTING_INLINE_BYTES) {
+    FreeData(arena, list->bytes.data, list->capacity);
+  }
+  if (arena != NULL) {
+    ArenaFree(arena, list, sizeof(struct postingList));
+  } else {
+    free(list);
+  }
+}
+
+void PostingListIterInit(PostingListIter *iter, PostingList list) {
+  Assert007(list->num_rows > 0);
+  iter->list = list;
+  iter->index = 0;
+  iter->next_byte = 0;
+  iter->row = GetVarint(Data(list), &iter->next_byte);
+}
+
+uint32_t PostingListIterGet(PostingListIter *iter) {
+  return iter->row;
+}
+
+int PostingListIterHasNext(PostingListIter *iter) {
+  return iter->index + 1 < iter->list->num_rows;
+}
+
+int PostingListIterNext(PostingListIter *iter) {
+  if (!PostingListIterHasNext(iter)) {
+    return 1;
+  }
+  iter->row += GetVarint(Data(iter->list), &iter->next_byte);
+  iter->index++;
+  return 0;
+}
+
+int PostingListIterSkipTo(PostingListIter *iter, uint32_t target) {
+  if (iter->row >= target) {
+    return 0;
+  }
+  PostingList list = iter->list;
+  uint32_t num_skips = NumSkips(list);
+  // The first skip past where the iterator is.
+  uint32_t low = iter->index / POSTING_SKIP_ROWS;
+  if (low < num_skips && list->skips[low].row <= target) {
+    // Gallop to a skip past target, then search back between the two
+    // for the last skip at or before it.
+    uint32_t step = 1;
+    while (low + step < num_skips && list->skips[low + step].row <= target) {
+      low += step;
+      step *= 2;
+    }
+    uint32_t high = low + step < num_skips ? low + step : num_skips;
+    while (high - low > 1) {
+      uint32_t mid = low + (high - low) / 2;
+      if (list->skips[mid].row <= target) {
+        low = mid;
+      } else {
+        high = mid;
+      }
+    }
+    iter->row = list->skips[low].row;
+    iter->index = list->skips[low].index;
+    iter->next_byte = list->skips[low].next_byte;
+  }
+  while (iter->row < target) {
+    if (PostingListIterNext(iter) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+PostingSkip *PostingListFindBlock(PostingList list, uint32_t row,
+                                  uint32_t *end) {
+  uint32_t num_skips = NumSkips(list);
+  if (num_skips == 0 || list->skips[0].row > row) {
+    *end = num_skips == 0 ? UINT32_MAX : list->skips[0].row;
+    return NULL;
+  }
+  // The last skip at or before row.
+  uint32_t low = 0;
+  uint32_t high = num_skips;
+  while (high - low > 1) {
+    uint32_t mid = low + (high - low) / 2;
+    if (list->skips[mid].row <= row) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  *end = low + 1 < num_skips ? list->skips[low + 1].row : UINT32_MAX;
+  return &list->skips[low];
+}
@@ -21,8 +21,11 @@
 #include <string.h>
 
 #include "QueryProcessor.h"
+#include "BooleanQuery.h"
+#include "RankedQuery.h"
 #include "MovieIndex.h"
-#include "htll/LinkedList.h"
+#include "PostingList.h"
+#include "RowTable.h"
 #include "htll/Hashtable.h"
 
 SearchResultIter CreateSearchResultIter(MovieSet set) {
@@ -33,12 +36,14 @@ SearchResultIter CreateSearchResultIter(MovieSet set) {
     printf("Couldn't malloc for an iter in CreateSearchResultIter\n");
     return NULL;
   }
+  iter->owned_set = NULL;
 
   // Initialize doc_iter
   iter->doc_iter = CreateHashtableIterator((Hashtable)set->doc_index);
 
   if (iter->doc_iter == NULL) {
     printf("Couldn't create an iterator; or iterator was empty (no docs)\n");
+    return iter;
   }
 
   // Initialize offset_iter
@@ -48,19 +53,19 @@ SearchResultIter CreateSearchResultIter(MovieSet set) {
   // key is docid
   iter->cur_doc_id = kvp.key;
   // value is offset list
-  iter->offset_iter = CreateLLIter((LinkedList)kvp.value);
+  PostingListIterInit(&iter->offset_iter, (PostingList)kvp.value);
 
   return iter;
 }
 
 void DestroySearchResultIter(SearchResultIter iter) {
-  // Destroy LLIter
-  if (iter->offset_iter != NULL) {
-    DestroyLLIter(iter->offset_iter);
-  }
-
   // Destroy doc_iter
-  DestroyHashtableIterator(iter->doc_iter);
+  if (iter->doc_iter != NULL) {
+    DestroyHashtableIterator(iter->doc_iter);
+  }
+  if (iter->owned_set != NULL) {
+    DestroyMovieSet(iter->owned_set);
+  }
 
   free(iter);
 }
@@ -68,31 +73,35 @@ void DestroySearchResultIter(SearchResultIter iter) {
 
 
 SearchResultIter FindMovies(Index index, char *term) {
-  MovieSet set = GetMovieSet(index, term);
+  int owned;
+  MovieSet set = FindQueryMovies(index, term, &owned);
   if (set == NULL) {
     return NULL;
   }
   printf("Getting docs for movieset term: \"%s\"\n", set->desc);
   SearchResultIter iter = CreateSearchResultIter(set);
+  if (iter == NULL) {
+    if (owned) {
+      DestroyMovieSet(set);
+    }
+    return NULL;
+  }
+  if (owned) {
+    iter->owned_set = set;
+  }
   return iter;
 }
 
 
 int SearchResultGet(SearchResultIter iter, SearchResult output) {
-  void *payload;
-  LLIterGetPayload(iter->offset_iter, &payload);
-  int row_id = *((int*)payload);
   output->doc_id = iter->cur_doc_id;
-  output->row_id = row_id;
+  output->row_id = PostingListIterGet(&iter->offset_iter);
   return 0;
 }
 
 int SearchResultNext(SearchResultIter iter) {
   // If there are no more offsets for this doc
-  if (LLIterHasNext(iter->offset_iter) == 0) {
-    // destroy LLIter, get next docid, create new offset_iter.
-    DestroyLLIter(iter->offset_iter);
-
+  if (PostingListIterHasNext(&iter->offset_iter) == 0) {
     // Get next document
     if (HTIteratorHasMore(iter->doc_iter)) {
       HTKeyValue kvp;
@@ -101,14 +110,14 @@ int SearchResultNext(SearchResultIter iter) {
       // key is docid
       iter->cur_doc_id = kvp.key;
       // value is offset list
-      iter->offset_iter = CreateLLIter((LinkedList)kvp.value);
+      PostingListIterInit(&iter->offset_iter, (PostingList)kvp.value);
     } else {
-      iter->offset_iter = NULL;
+      DestroyHashtableIterator(iter->doc_iter);
       iter->doc_iter = NULL;
       return -1;
     }
   } else {
-    LLIterNext(iter->offset_iter);
+    PostingListIterNext(&iter->offset_iter);
   }
   return 0;
 }
@@ -118,14 +127,231 @@ int SearchResultIterHasMore(SearchResultIter iter) {
   if (iter->doc_iter == NULL) {
     return 0;
   }
-  if (LLIterHasNext(iter->offset_iter) == 0) {
+  if (PostingListIterHasNext(&iter->offset_iter) == 0) {
     return (HTIteratorHasMore(iter->doc_iter));
   }
 
   return 1;
 }
 
+int CopyRowFromIndex(Index index, SearchResult result,
+                     char *dest, int dest_size) {
+  if (index->rows == NULL) {
+    return -1;
+  }
+  if (CopyRowFromTable(index->rows, result->doc_id, result->row_id,
+                       dest, dest_size) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int CompareDocIds(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Points each result's row into the buffer the rows were read into,
+// once they've all been read and it won't move again, and hands the
+// buffer over to the batch.
+static void FinishBatchRows(SearchResultBatch batch, RowBuffer *buffer,
+                            const RowSpan *spans) {
+  for (int i = 0; i < batch->num_results; i++) {
+    batch->results[i].row.start = buffer->data + spans[i].start;
+    batch->results[i].row.len = spans[i].len;
+  }
+  batch->rows = buffer->data;
+}
+
+SearchResultBatch FetchMovieSetRows(Index index, MovieSet set) {
+  if (index->rows == NULL) {
+    return NULL;
+  }
+  int num_docs = NumElemsInHashtable(set->doc_index);
+  SearchResultBatch batch =
+      (SearchResultBatch)malloc(sizeof(struct searchResultBatch));
+  uint64_t *doc_ids = (uint64_t*)malloc((num_docs + 1) * sizeof(uint64_t));
+  if (batch == NULL || doc_ids == NULL) {
+    printf("Couldn't malloc for a SearchResultBatch\n");
+    free(batch);
+    free(doc_ids);
+    return NULL;
+  }
+  batch->rows = NULL;
+
+  // Go through the files in order, so the rows come out in order.
+  int num_results = 0;
+  int max_rows = 0;
+  HTKeyValue kvp;
+  HTIter iter = CreateHashtableIterator(set->doc_index);
+  for (int i = 0; i < num_docs; i++) {
+    HTIteratorGet(iter, &kvp);
+    doc_ids[i] = kvp.key;
+    int rows = NumRowsInPostingList((PostingList)kvp.value);
+    num_results += rows;
+    if (rows > max_rows) {
+      max_rows = rows;
+    }
+    HTIteratorNext(iter);
+  }
+  if (iter != NULL) {
+    DestroyHashtableIterator(iter);
+  }
+  qsort(doc_ids, num_docs, sizeof(uint64_t), &CompareDocIds);
 
+  batch->num_results = 0;
+  batch->results = (SearchResultRow*)malloc(
+      (num_results + 1) * sizeof(SearchResultRow));
+  uint32_t *row_ids = (uint32_t*)malloc((max_rows + 1) * sizeof(uint32_t));
+  RowSpan *rows = (RowSpan*)malloc((max_rows + 1) * sizeof(RowSpan));
+  RowSpan *spans = (RowSpan*)malloc((num_results + 1) * sizeof(RowSpan));
+  RowBuffer buffer = {NULL, 0, 0};
+  int result = 0;
+  if (batch->results == NULL || row_ids == NULL || rows == NULL ||
+      spans == NULL) {
+    printf("Couldn't malloc for a SearchResultBatch\n");
+    result = -1;
+  }
 
+  for (int i = 0; result == 0 && i < num_docs; i++) {
+    LookupInHashtable(set->doc_index, doc_ids[i], &kvp);
+    // A PostingList is already in increasing row order.
+    PostingListIter rows_iter;
+    PostingListIterInit(&rows_iter, (PostingList)kvp.value);
+    int num_rows = 0;
+    do {
+      row_ids[num_rows++] = PostingListIterGet(&rows_iter);
+    } while (PostingListIterNext(&rows_iter) == 0);
 
+    result = GetRowsFromTable(index->rows, doc_ids[i], row_ids, num_rows,
+                              &buffer, rows);
+    for (int j = 0; result == 0 && j < num_rows; j++) {
+      if (rows[j].start < 0) {
+        continue;
+      }
+      SearchResultRow *next = &batch->results[batch->num_results];
+      next->doc_id = doc_ids[i];
+      next->row_id = row_ids[j];
+      next->score = 0;
+      spans[batch->num_results++] = rows[j];
+    }
+  }
 
+  if (result == 0) {
+    FinishBatchRows(batch, &buffer, spans);
+  } else {
+    free(buffer.data);
+  }
+  free(spans);
+  free(row_ids);
+  free(rows);
+  free(doc_ids);
+  if (result != 0) {
+    DestroySearchResultBatch(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+// A ranked result, and where it ranked, for reading the rows of each
+// file together.
+typedef struct rankedRow {
+  uint64_t doc_id;
+  uint32_t row_id;
+  int rank;
+} RankedRow;
+
+static int CompareRankedRows(const void *a, const void *b) {
+  const RankedRow *x = (const RankedRow*)a;
+  const RankedRow *y = (const RankedRow*)b;
+  if (x->doc_id != y->doc_id) {
+    return (x->doc_id > y->doc_id) - (x->doc_id < y->doc_id);
+  }
+  return (x->row_id > y->row_id) - (x->row_id < y->row_id);
+}
+
+SearchResultBatch FindTopMovies(Index index, const char *query, int k) {
+  if (index->rows == NULL || k < 0) {
+    return NULL;
+  }
+  SearchResultBatch batch =
+      (SearchResultBatch)malloc(sizeof(struct searchResultBatch));
+  RankedResult *ranked = (RankedResult*)malloc(
+      (k + 1) * sizeof(RankedResult));
+  if (batch == NULL || ranked == NULL) {
+    printf("Couldn't malloc for a SearchResultBatch\n");
+    free(batch);
+    free(ranked);
+    return NULL;
+  }
+  batch->rows = NULL;
+  int num_ranked = RankMovies(index, query, k, ranked);
+  batch->num_results = 0;
+  batch->results = (SearchResultRow*)malloc(
+      (k + 1) * sizeof(SearchResultRow));
+  RankedRow *order = (RankedRow*)malloc((k + 1) * sizeof(RankedRow));
+  uint32_t *row_ids = (uint32_t*)malloc((k + 1) * sizeof(uint32_t));
+  RowSpan *rows = (RowSpan*)malloc((k + 1) * sizeof(RowSpan));
+  RowSpan *spans = (RowSpan*)malloc((k + 1) * sizeof(RowSpan));
+  RowBuffer buffer = {NULL, 0, 0};
+  int result = num_ranked < 0 || batch->results == NULL || order == NULL ||
+      row_ids == NULL || rows == NULL || spans == NULL ? -1 : 0;
+
+  // Read the rows a file at a time, in row order, like FetchMovieSetRows
+  // does, putting each where it ranked.
+  for (int i = 0; result == 0 && i < num_ranked; i++) {
+    order[i].doc_id = ranked[i].doc_id;
+    order[i].row_id = ranked[i].row_id;
+    order[i].rank = i;
+  }
+  if (result == 0) {
+    qsort(order, num_ranked, sizeof(RankedRow), &CompareRankedRows);
+  }
+  for (int i = 0; result == 0 && i < num_ranked;) {
+    int first = i;
+    int num_rows = 0;
+    while (i < num_ranked && order[i].doc_id == order[first].doc_id) {
+      row_ids[num_rows++] = order[i++].row_id;
+    }
+    result = GetRowsFromTable(index->rows, order[first].doc_id, row_ids,
+                              num_rows, &buffer, rows);
+    for (int j = 0; result == 0 && j < num_rows; j++) {
+      spans[order[first + j].rank] = rows[j];
+    }
+  }
+
+  // Then hand them out in rank order, leaving out rows that are gone.
+  for (int i = 0; result == 0 && i < num_ranked; i++) {
+    if (spans[i].start < 0) {
+      continue;
+    }
+    spans[batch->num_results] = spans[i];
+    SearchResultRow *next = &batch->results[batch->num_results++];
+    next->doc_id = ranked[i].doc_id;
+    next->row_id = ranked[i].row_id;
+    next->score = ranked[i].score;
+  }
+
+  if (result == 0) {
+    FinishBatchRows(batch, &buffer, spans);
+  } else {
+    free(buffer.data);
+  }
+  free(spans);
+  free(rows);
+  free(row_ids);
+  free(order);
+  free(ranked);
+  if (result != 0) {
+    DestroySearchResultBatch(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+void DestroySearchResultBatch(SearchResultBatch batch) {
+  free(batch->rows);
+  free(batch->results);
+  free(batch);
+}
@@ -0,0 +1,464 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RankedQuery.h"
+#include "MovieIndex.h"
+#include "MovieSet.h"
+#include "PostingList.h"
+#include "RowTable.h"
+#include "htll/Hashtable.h"
+
+// Scores that are this close are taken to be equal when pruning, so
+// rounding can't cost a row that ties on score but wins on year.
+#define RANK_EPSILON 1e-9
+
+// What a row gets for having a word, given how many words its title has.
+static double WordScore(double idf, int title_words, double avg_words) {
+  if (title_words < 1) {
+    title_words = 1;
+  }
+  return idf * (RANK_K1 + 1) /
+      (1 + RANK_K1 * (1 - RANK_B + RANK_B * title_words / avg_words));
+}
+
+// Sets the block_words and block_year of every skip of a list of a
+// file's rows.
+static void BoundBlocks(PostingList list, const RowStats *stats,
+                        int num_stats) {
+  if (list->skips == NULL) {
+    return;
+  }
+  PostingListIter iter;
+  PostingListIterInit(&iter, list);
+  uint32_t index = 0;
+  do {
+    if (index >= POSTING_SKIP_ROWS) {
+      PostingSkip *skip = &list->skips[index / POSTING_SKIP_ROWS - 1];
+      uint32_t row = PostingListIterGet(&iter);
+      RowStats row_stats = {1, UINT16_MAX};
+      if (row < (uint32_t)num_stats) {
+        row_stats = stats[row];
+      }
+      if (row_stats.title_words < 1) {
+        row_stats.title_words = 1;
+      }
+      if (index % POSTING_SKIP_ROWS == 0) {
+        skip->block_words = row_stats.title_words;
+        skip->block_year = row_stats.year;
+      } else {
+        if (row_stats.title_words < skip->block_words) {
+          skip->block_words = row_stats.title_words;
+        }
+        if (row_stats.year > skip->block_year) {
+          skip->block_year = row_stats.year;
+        }
+      }
+    }
+    index++;
+  } while (PostingListIterNext(&iter) == 0);
+}
+
+int ComputeBlockBounds(Index index) {
+  if (index->rows == NULL) {
+    return -1;
+  }
+  HTIter sets = CreateHashtableIterator(index->ht);
+  if (sets == NULL) {
+    return 0;
+  }
+  HTKeyValue set_kvp;
+  do {
+    HTIteratorGet(sets, &set_kvp);
+    MovieSet set = (MovieSet)set_kvp.value;
+    HTIter docs = CreateHashtableIterator(set->doc_index);
+    if (docs == NULL) {
+      continue;
+    }
+    HTKeyValue doc_kvp;
+    do {
+      HTIteratorGet(docs, &doc_kvp);
+      int num_stats;
+      const RowStats *stats = GetRowStats(index->rows, doc_kvp.key,
+                                          &num_stats);
+      BoundBlocks((PostingList)doc_kvp.value, stats, num_stats);
+    } while (HTIteratorNext(docs) == 0);
+    DestroyHashtableIterator(docs);
+  } while (HTIteratorNext(sets) == 0);
+  DestroyHashtableIterator(sets);
+  return 0;
+}
+
+// One word of a ranked query.
+typedef struct {
+  MovieSet set;
+  double idf;
+  double bound;  // the most a row can get for it
+} RankTerm;
+
+// Where one word is in the rows of the file being ranked.
+typedef struct {
+  RankTerm *term;
+  PostingList list;
+  PostingListIter iter;
+  uint32_t row;
+  // The block of the list row was last looked up in: its rows from
+  // block_start up to block_end, and their bounds.
+  uint32_t block_start;
+  uint32_t block_end;
+  int block_words;
+  int block_year;
+} Cursor;
+
+// What the ranking keeps track of.
+typedef struct {
+  RankedResult *heap;  // the best so far, the worst of them on top
+  int size;
+  int k;
+  double avg_words;
+} Ranking;
+
+// Whether a is a better result than b.
+static int Better(const RankedResult *a, const RankedResult *b) {
+  if (a->score != b->score) {
+    return a->score > b->score;
+  }
+  if (a->year != b->year) {
+    return a->year > b->year;
+  }
+  if (a->doc_id != b->doc_id) {
+    return a->doc_id < b->doc_id;
+  }
+  return a->row_id < b->row_id;
+}
+
+static int CompareResults(const void *a, const void *b) {
+  return Better((const RankedResult*)b, (const RankedResult*)a) -
+      Better((const RankedResult*)a, (const RankedResult*)b);
+}
+
+// The score a row needs to be in the running, or -INFINITY while
+// there are fewer than k results.
+static double Threshold(Ranking *ranking) {
+  return ranking->size < ranking->k ? -INFINITY : ranking->heap[0].score;
+}
+
+// Whether no row of some blocks can make it, if the best any of them
+// could score is score, and the newest is from year. One that ties
+// on score and year comes after the k'th best so far, so it loses.
+static int CantMakeIt(Ranking *ranking, double score, int year) {
+  double threshold = Threshold(ranking);
+  return score < threshold - RANK_EPSILON ||
+      (score <= threshold + RANK_EPSILON && year <= ranking->heap[0].year);
+}
+
+// Adds a result if it's one of the k best so far.
+static void Offer(Ranking *ranking, const RankedResult *result) {
+  RankedResult *heap = ranking->heap;
+  int i;
+  if (ranking->size < ranking->k) {
+    // Sift up from the bottom.
+    i = ranking->size++;
+    while (i > 0 && Better(&heap[(i - 1) / 2], result)) {
+      heap[i] = heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    heap[i] = *result;
+    return;
+  }
+  if (!Better(result, &heap[0])) {
+    return;
+  }
+  // Replace the worst, and sift it down.
+  i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= ranking->size) {
+      break;
+    }
+    if (child + 1 < ranking->size && Better(&heap[child], &heap[child + 1])) {
+      child++;
+    }
+    if (!Better(result, &heap[child])) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = *result;
+}
+
+// Looks up the block of a cursor's list that row is in, unless it's
+// the one looked up last time.
+static void FindCursorBlock(Cursor *cursor, uint32_t row) {
+  if (row >= cursor->block_start && row < cursor->block_end) {
+    return;
+  }
+  PostingSkip *skip = PostingListFindBlock(cursor->list, row,
+                                           &cursor->block_end);
+  cursor->block_words = 1;
+  cursor->block_year = INT32_MAX;
+  cursor->block_start = 0;
+  if (skip != NULL) {
+    cursor->block_start = skip->row;
+    if (skip->block_words > 0) {
+      cursor->block_words = skip->block_words;
+      cursor->block_year = skip->block_year;
+    }
+  }
+}
+
+// Puts the cursors in order of the row they're at.
+static void SortCursors(Cursor *cursors, int num_cursors) {
+  for (int i = 1; i < num_cursors; i++) {
+    Cursor cursor = cursors[i];
+    int j = i;
+    while (j > 0 && cursors[j - 1].row > cursor.row) {
+      cursors[j] = cursors[j - 1];
+      j--;
+    }
+    cursors[j] = cursor;
+  }
+}
+
+// Moves a cursor to its first row at or after target. Returns 0, or
+// -1 if it has no more rows.
+static int MoveCursor(Cursor *cursor, uint32_t target) {
+  if (PostingListIterSkipTo(&cursor->iter, target) != 0) {
+    return -1;
+  }
+  cursor->row = PostingListIterGet(&cursor->iter);
+  return 0;
+}
+
+// Takes the cursors that ran out of rows out of the list.
+static int DropFinished(Cursor *cursors, int num_cursors, int *finished) {
+  int kept = 0;
+  for (int i = 0; i < num_cursors; i++) {
+    if (!finished[i]) {
+      cursors[kept++] = cursors[i];
+    }
+    finished[i] = 0;
+  }
+  return kept;
+}
+
+// Ranks the rows of one file.
+static void RankFile(Ranking *ranking, uint64_t doc_id, Cursor *cursors,
+                     int num_cursors, const RowStats *stats, int num_stats) {
+  int finished[RANK_MAX_TERMS] = {0};
+  while (num_cursors > 0) {
+    SortCursors(cursors, num_cursors);
+    double threshold = Threshold(ranking) - RANK_EPSILON;
+
+    // The pivot is the first cursor where the words so far could add
+    // up to enough; no row before its row can.
+    double sum = 0;
+    int pivot = -1;
+    for (int i = 0; i < num_cursors; i++) {
+      sum += cursors[i].term->bound;
+      if (sum >= threshold) {
+        pivot = i;
+        break;
+      }
+    }
+    if (pivot < 0) {
+      return;
+    }
+    uint32_t row = cursors[pivot].row;
+    while (pivot + 1 < num_cursors && cursors[pivot + 1].row == row) {
+      pivot++;
+    }
+
+    // Can the blocks those words' rows would be in get there?
+    double block_sum = 0;
+    int block_year = 0;
+    uint32_t block_end = pivot + 1 < num_cursors ?
+        cursors[pivot + 1].row : UINT32_MAX;
+    for (int i = 0; i <= pivot; i++) {
+      FindCursorBlock(&cursors[i], row);
+      block_sum += WordScore(cursors[i].term->idf, cursors[i].block_words,
+                             ranking->avg_words);
+      if (cursors[i].block_year > block_year) {
+        block_year = cursors[i].block_year;
+      }
+      if (cursors[i].block_end < block_end) {
+        block_end = cursors[i].block_end;
+      }
+    }
+    if (ranking->size == ranking->k &&
+        CantMakeIt(ranking, block_sum, block_year)) {
+      // None of the rows up to where one of the blocks ends, or
+      // another word starts, can.
+      for (int i = 0; i <= pivot; i++) {
+        finished[i] = MoveCursor(&cursors[i], block_end) != 0;
+      }
+      num_cursors = DropFinished(cursors, num_cursors, finished);
+      continue;
+    }
+
+    if (cursors[0].row != row) {
+      // Catch the words before the pivot up to it.
+      for (int i = 0; i < pivot && cursors[i].row < row; i++) {
+        finished[i] = MoveCursor(&cursors[i], row) != 0;
+      }
+      num_cursors = DropFinished(cursors, num_cursors, finished);
+      continue;
+    }
+
+    // Every word up to the pivot is in the row; score it. The words
+    // are added up in the query's order, not the cursors', so titles
+    // with the same words score exactly the same and the year breaks
+    // the tie.
+    RankTerm *matched[RANK_MAX_TERMS];
+    for (int i = 0; i <= pivot; i++) {
+      int j = i;
+      while (j > 0 && matched[j - 1] > cursors[i].term) {
+        matched[j] = matched[j - 1];
+        j--;
+      }
+      matched[j] = cursors[i].term;
+    }
+    RankedResult result = {doc_id, (int)row, 0, 0};
+    int words = row < (uint32_t)num_stats ? stats[row].title_words : 1;
+    result.year = row < (uint32_t)num_stats ? stats[row].year : 0;
+    for (int i = 0; i <= pivot; i++) {
+      result.score += WordScore(matched[i]->idf, words, ranking->avg_words);
+    }
+    Offer(ranking, &result);
+    for (int i = 0; i <= pivot; i++) {
+      finished[i] = PostingListIterNext(&cursors[i].iter) != 0;
+      cursors[i].row = PostingListIterGet(&cursors[i].iter);
+    }
+    num_cursors = DropFinished(cursors, num_cursors, finished);
+  }
+}
+
+static int CompareDocIds(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Finds the query's words in the index.
+static int FindTerms(Index index, const char *query, long num_rows,
+                     double avg_words, RankTerm *terms) {
+  char *words = strdup(query);
+  if (words == NULL) {
+    return -1;
+  }
+  int num_terms = 0;
+  char *save;
+  for (char *word = strtok_r(words, " \t\r\n", &save);
+       word != NULL && num_terms < RANK_MAX_TERMS;
+       word = strtok_r(NULL, " \t\r\n", &save)) {
+    MovieSet set = GetMovieSet(index, word);
+    int seen = set == NULL;
+    for (int i = 0; i < num_terms && !seen; i++) {
+      seen = terms[i].set == set;
+    }
+    if (seen) {
+      continue;
+    }
+    double df = NumMoviesInSet(set);
+    terms[num_terms].set = set;
+    terms[num_terms].idf = log(1 + (num_rows - df + 0.5) / (df + 0.5));
+    terms[num_terms].bound = WordScore(terms[num_terms].idf, 1, avg_words);
+    num_terms++;
+  }
+  free(words);
+  return num_terms;
+}
+
+int RankMovies(Index index, const char *query, int k,
+               RankedResult *results) {
+  long num_rows, num_words;
+  if (index->rows == NULL || k <= 0) {
+    return 0;
+  }
+  CountTitleWords(index->rows, &num_rows, &num_words);
+  if (num_rows == 0) {
+    return 0;
+  }
+  Ranking ranking = {results, 0, k, (double)num_words / num_rows};
+
+  RankTerm terms[RANK_MAX_TERMS];
+  int num_terms = FindTerms(index, query, num_rows, ranking.avg_words,
+                            terms);
+  if (num_terms <= 0) {
+    return num_terms;
+  }
+
+  // Every file any of the words is in, in order.
+  int num_docs = 0;
+  for (int i = 0; i < num_terms; i++) {
+    num_docs += NumElemsInHashtable(terms[i].set->doc_index);
+  }
+  uint64_t *doc_ids = (uint64_t*)malloc((num_docs + 1) * sizeof(uint64_t));
+  if (doc_ids == NULL) {
+    printf("Couldn't malloc for a ranked query's files\n");
+    return -1;
+  }
+  num_docs = 0;
+  for (int i = 0; i < num_terms; i++) {
+    HTIter iter = CreateHashtableIterator(terms[i].set->doc_index);
+    if (iter == NULL) {
+      continue;
+    }
+    HTKeyValue kvp;
+    do {
+      HTIteratorGet(iter, &kvp);
+      doc_ids[num_docs++] = kvp.key;
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+  qsort(doc_ids, num_docs, sizeof(uint64_t), &CompareDocIds);
+
+  Cursor cursors[RANK_MAX_TERMS];
+  for (int i = 0; i < num_docs; i++) {
+    if (i > 0 && doc_ids[i] == doc_ids[i - 1]) {
+      continue;
+    }
+    int num_cursors = 0;
+    for (int j = 0; j < num_terms; j++) {
+      HTKeyValue kvp;
+      if (LookupInHashtable(terms[j].set->doc_index, doc_ids[i], &kvp) != 0) {
+        continue;
+      }
+      Cursor *cursor = &cursors[num_cursors++];
+      cursor->term = &terms[j];
+      cursor->list = (PostingList)kvp.value;
+      PostingListIterInit(&cursor->iter, cursor->list);
+      cursor->row = PostingListIterGet(&cursor->iter);
+      cursor->block_start = 1;
+      cursor->block_end = 0;
+    }
+    int num_stats;
+    const RowStats *stats = GetRowStats(index->rows, doc_ids[i], &num_stats);
+    RankFile(&ranking, doc_ids[i], cursors, num_cursors, stats, num_stats);
+  }
+  free(doc_ids);
+
+  qsort(results, ranking.size, sizeof(RankedResult), &CompareResults);
+  return ranking.size;
+}
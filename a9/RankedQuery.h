@@ -0,0 +1,90 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#ifndef RANKEDQUERY_H
+#define RANKEDQUERY_H
+
+#include <stdint.h>
+
+#include "MovieIndex.h"
+
+/**
+ * BM25's k1: how quickly a title's score stops growing with how often
+ * a word is in it.
+ */
+#define RANK_K1 1.2
+
+/**
+ * BM25's b: how much a long title counts against a match.
+ */
+#define RANK_B 0.75
+
+/**
+ * A ranked query looks at this many of its words at most.
+ */
+#define RANK_MAX_TERMS 32
+
+/**
+ * One result of a ranked query.
+ */
+typedef struct rankedResult {
+  uint64_t doc_id;
+  int row_id;
+  double score; /*!< Its BM25 score */
+  int year; /*!< The year it came out, or 0; breaks ties */
+} RankedResult;
+
+/**
+ * Works out, for every block of the skip table of every offset list
+ * in an index, the fewest title words and latest year of any row in
+ * it, so ranking can tell a block can't do well enough without looking
+ * in it.
+ * The parser does this once it's built the index; lists changed after
+ * that are still ranked right, just without skipping.
+ *
+ * \param index the offset index, with its RowTable.
+ *
+ * \return 0 if successful, -1 if the index has no RowTable.
+ */
+int ComputeBlockBounds(Index index);
+
+/**
+ * Finds the k best movies for the words of a query, by BM25 over
+ * their titles: a title scores more for having rarer words of the
+ * query, and for being shorter. Ties go to the newer movie, then to
+ * the earlier file and row.
+ *
+ * Only the k best so far are kept, in a heap. Words' rows are gone
+ * through together, WAND-style: a row only gets scored if the best
+ * scores its words could add up to would beat the k'th best so far,
+ * and a block of rows is skipped over, without being decoded, if the
+ * best its words could score there won't (see ComputeBlockBounds).
+ * The year counts too: most titles with a common word tie with lots
+ * of others, and only the newest of those can make it.
+ *
+ * \param index the offset index.
+ * \param query the words, separated by whitespace; a title with any of
+ *   them can match.
+ * \param k how many results to find.
+ * \param results where to put them; room for k. They're best first.
+ *
+ * \return how many results there are, up to k, or -1 if out of memory.
+ */
+int RankMovies(Index index, const char *query, int k,
+               RankedResult *results);
+
+#endif  // RANKEDQUERY_H
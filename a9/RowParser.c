@@ -0,0 +1,375 @@
+/*
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROW_HAVE_X86 1
+#endif
+
+#include "RowParser.h"
+
+// ======================
+// Delimiter scanners.
+//
+// Each one sets a bit for every '|', ',', ' ' and '\n' in a block. The
+// vector ones compare 16 or 32 bytes with each delimiter at once, and
+// squash the byte results down to one bit each with movemask.
+
+static void ScanDelimitersScalar(const char *block, DelimiterMasks *masks) {
+  uint64_t pipe = 0, comma = 0, space = 0, newline = 0;
+  for (int i = 0; i < ROW_BLOCK_BYTES; i++) {
+    uint64_t bit = (uint64_t)1 << i;
+    switch (block[i]) {
+      case '|':
+        pipe |= bit;
+        break;
+      case ',':
+        comma |= bit;
+        break;
+      case ' ':
+        space |= bit;
+        break;
+      case '\n':
+        newline |= bit;
+        break;
+    }
+  }
+  masks->pipe = pipe;
+  masks->comma = comma;
+  masks->space = space;
+  masks->newline = newline;
+}
+
+#ifdef ROW_HAVE_X86
+__attribute__((target("sse2")))
+static void ScanDelimitersSSE2(const char *block, DelimiterMasks *masks) {
+  const __m128i pipe = _mm_set1_epi8('|');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i newline = _mm_set1_epi8('\n');
+  uint64_t p = 0, c = 0, s = 0, n = 0;
+  for (int i = 0; i < ROW_BLOCK_BYTES / 16; i++) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+    int shift = 16 * i;
+    p |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(bytes, pipe)) << shift;
+    c |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(bytes, comma)) << shift;
+    s |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(bytes, space)) << shift;
+    n |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(bytes, newline)) << shift;
+  }
+  masks->pipe = p;
+  masks->comma = c;
+  masks->space = s;
+  masks->newline = n;
+}
+
+__attribute__((target("avx2")))
+static void ScanDelimitersAVX2(const char *block, DelimiterMasks *masks) {
+  const __m256i pipe = _mm256_set1_epi8('|');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+  __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+#define ROW_MASK64(delim) \
+  ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, delim)) | \
+   (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, delim)) \
+       << 32)
+  masks->pipe = ROW_MASK64(pipe);
+  masks->comma = ROW_MASK64(comma);
+  masks->space = ROW_MASK64(space);
+  masks->newline = ROW_MASK64(newline);
+#undef ROW_MASK64
+}
+#endif  // ROW_HAVE_X86
+
+typedef void (*DelimiterScanner)(const char *block, DelimiterMasks *masks);
+
+static DelimiterScanner scanner = &ScanDelimitersScalar;
+static const char *scanner_name = "scalar";
+
+// Picks the fastest scanner once, before main runs, so parsing threads
+// never race to pick one.
+__attribute__((constructor))
+static void PickDelimiterScanner() {
+  if (SelectDelimiterScanner("avx2") != 0) {
+    SelectDelimiterScanner("sse2");
+  }
+}
+
+int SelectDelimiterScanner(const char *name) {
+#ifdef ROW_HAVE_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    scanner = &ScanDelimitersAVX2;
+    scanner_name = "avx2";
+    return 0;
+  }
+  if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    scanner = &ScanDelimitersSSE2;
+    scanner_name = "sse2";
+    return 0;
+  }
+#endif
+  if (strcmp(name, "scalar") == 0) {
+    scanner = &ScanDelimitersScalar;
+    scanner_name = "scalar";
+    return 0;
+  }
+  return -1;
+}
+
+const char *DelimiterScannerName() {
+  return scanner_name;
+}
+
+void ScanDelimiters(const char *block, DelimiterMasks *masks) {
+  scanner(block, masks);
+}
+
+// ======================
+// Walking the rows.
+
+int MapFile(const char *file, MappedFile *mapped) {
+  mapped->data = NULL;
+  mapped->size = 0;
+  memset(&mapped->stat, 0, sizeof(mapped->stat));
+
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return -1;
+  }
+  mapped->stat.size = file_stat.st_size;
+  mapped->stat.mtime_sec = file_stat.st_mtim.tv_sec;
+  mapped->stat.mtime_nsec = file_stat.st_mtim.tv_nsec;
+  mapped->stat.inode = file_stat.st_ino;
+  // mmap won't map nothing; an empty file just has no rows.
+  if (file_stat.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+  // The file is read front to back, so have the kernel read ahead.
+  madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+  mapped->data = (const char*)data;
+  mapped->size = file_stat.st_size;
+  return 0;
+}
+
+void UnmapFile(MappedFile *mapped) {
+  if (mapped->data != NULL) {
+    munmap((void*)mapped->data, mapped->size);
+  }
+  mapped->data = NULL;
+  mapped->size = 0;
+  memset(&mapped->stat, 0, sizeof(mapped->stat));
+}
+
+void InitRowParser(RowParser *parser, MappedFile *mapped,
+                   long start, long end) {
+  if (end < 0 || end > mapped->size) {
+    end = mapped->size;
+  }
+  if (start > end) {
+    start = end;
+  }
+  parser->data = mapped->data;
+  parser->next = mapped->data + start;
+  parser->stop = mapped->data + end;
+  parser->end = mapped->data + mapped->size;
+  parser->block = NULL;
+}
+
+int NextRow(RowParser *parser, FieldView *row) {
+  if (parser->next >= parser->stop) {
+    return 0;
+  }
+  const char *newline = (const char*)memchr(parser->next, '\n',
+                                            parser->end - parser->next);
+  if (newline == NULL) {
+    newline = parser->end;
+  }
+  row->start = parser->next;
+  row->len = newline - parser->next;
+  parser->next = newline < parser->end ? newline + 1 : parser->end;
+  return 1;
+}
+
+long RowParserOffset(RowParser *parser) {
+  return parser->next - parser->data;
+}
+
+// Makes sure the parser has the masks for the block holding p. Blocks
+// are counted from the start of the file, so each byte is in just one.
+static void LoadBlock(RowParser *parser, const char *p) {
+  const char *block = parser->data +
+      ((p - parser->data) & ~(long)(ROW_BLOCK_BYTES - 1));
+  if (block == parser->block) {
+    return;
+  }
+  parser->block = block;
+  if (parser->end - block >= ROW_BLOCK_BYTES) {
+    ScanDelimiters(block, &parser->masks);
+  } else {
+    // Scan a copy of the file's last few bytes, padded out with NULs,
+    // so the scanner never reads past the end of the mapping.
+    char padded[ROW_BLOCK_BYTES];
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, block, parser->end - block);
+    ScanDelimiters(padded, &parser->masks);
+  }
+}
+
+// Adds the piece between two delimiters to a list, if it isn't empty.
+// Sets *num to -1 if the list has no room for it.
+static void AddPiece(FieldView *pieces, int *num, int max,
+                     const char *after, const char *before) {
+  if (before <= after + 1 || *num < 0) {
+    return;
+  }
+  if (*num == max) {
+    *num = -1;
+    return;
+  }
+  pieces[*num].start = after + 1;
+  pieces[*num].len = before - (after + 1);
+  (*num)++;
+}
+
+// Ends the field that runs from just after field_sep to just before
+// end, if it isn't empty, along with its last title word or genre.
+static void EndField(MovieRowIndex *index, int *num_fields,
+                     const char *field_sep, const char *piece_sep,
+                     const char *end) {
+  if (end <= field_sep + 1) {
+    return;
+  }
+  if (*num_fields == MOVIE_ROW_TITLE) {
+    AddPiece(index->title_words, &index->num_title_words,
+             ROW_MAX_TITLE_WORDS, piece_sep, end);
+  } else if (*num_fields == MOVIE_ROW_GENRES) {
+    int num_genres = index->num_genres;
+    AddPiece(index->genres, &num_genres, ROW_MAX_GENRES, piece_sep, end);
+    if (num_genres >= 0) {
+      index->num_genres = num_genres;
+    }
+  }
+  index->fields[*num_fields].start = field_sep + 1;
+  index->fields[*num_fields].len = end - (field_sep + 1);
+  if (*num_fields == MOVIE_ROW_TITLE && end == field_sep + 2 &&
+      field_sep[1] == '-') {
+    // A title of "-" means there isn't one.
+    index->num_title_words = 0;
+  }
+  (*num_fields)++;
+}
+
+int NextMovieRow(RowParser *parser, FieldView *row, MovieRowIndex *index) {
+  if (parser->next >= parser->stop) {
+    return 0;
+  }
+  const char *start = parser->next;
+  const char *row_end = parser->end;
+  // The last '|' before the field we're in, and the last ' ' or ','
+  // splitting it. Both start out just before the row.
+  const char *field_sep = start - 1;
+  const char *piece_sep = start - 1;
+  int num_fields = 0;
+  index->num_title_words = 0;
+  index->num_genres = 0;
+
+  const char *p = start;
+  while (p < parser->end) {
+    LoadBlock(parser, p);
+    const char *block = parser->block;
+    DelimiterMasks *masks = &parser->masks;
+    // Only the bits at or past p are still to be looked at.
+    uint64_t unseen = ~(uint64_t)0 << (p - block);
+
+    for (;;) {
+      // Spaces only matter in the title, and commas in the genres, so
+      // skip over the rest without looking at them.
+      uint64_t bits = masks->newline;
+      if (num_fields < MOVIE_ROW_FIELDS) {
+        bits |= masks->pipe;
+      }
+      if (num_fields == MOVIE_ROW_TITLE) {
+        bits |= masks->space;
+      } else if (num_fields == MOVIE_ROW_GENRES) {
+        bits |= masks->comma;
+      }
+      bits &= unseen;
+      if (bits == 0) {
+        break;
+      }
+      int bit = __builtin_ctzll(bits);
+      unseen = bit == ROW_BLOCK_BYTES - 1 ? 0 : ~(uint64_t)0 << (bit + 1);
+      const char *d = block + bit;
+      char c = *d;
+
+      if (c == '\n') {
+        row_end = d;
+        goto row_done;
+      }
+      if (c == '|') {
+        EndField(index, &num_fields, field_sep, piece_sep, d);
+        field_sep = d;
+        piece_sep = d;
+      } else if (c == ' ') {
+        AddPiece(index->title_words, &index->num_title_words,
+                 ROW_MAX_TITLE_WORDS, piece_sep, d);
+        piece_sep = d;
+      } else {
+        int num_genres = index->num_genres;
+        AddPiece(index->genres, &num_genres, ROW_MAX_GENRES, piece_sep, d);
+        if (num_genres >= 0) {
+          index->num_genres = num_genres;
+        }
+        piece_sep = d;
+      }
+    }
+    p = block + ROW_BLOCK_BYTES;
+  }
+
+row_done:
+  if (num_fields < MOVIE_ROW_FIELDS) {
+    EndField(index, &num_fields, field_sep, piece_sep, row_end);
+  }
+  index->is_movie = (num_fields == MOVIE_ROW_FIELDS);
+  row->start = start;
+  row->len = row_end - start;
+  parser->next = row_end < parser->end ? row_end + 1 : parser->end;
+  return 1;
+}
@@ -0,0 +1,211 @@
+/*
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROWPARSER_H
+#define ROWPARSER_H
+
+#include <stdint.h>
+
+/**
+ * How many fields a row needs to hold a movie.
+ */
+#define MOVIE_ROW_FIELDS 9
+
+/**
+ * Which of a movie row's fields is the title.
+ */
+#define MOVIE_ROW_TITLE 2
+
+/**
+ * Which of a movie row's fields is the year it came out.
+ */
+#define MOVIE_ROW_YEAR 5
+
+/**
+ * Which of a movie row's fields is the comma-separated list of genres.
+ */
+#define MOVIE_ROW_GENRES 8
+
+/**
+ * A MovieRowIndex has room for this many title words; longer titles
+ * have to be split some other way.
+ */
+#define ROW_MAX_TITLE_WORDS 64
+
+/**
+ * A MovieRowIndex has room for this many genres; any more are dropped,
+ * just as CreateMovieFromRow drops them.
+ */
+#define ROW_MAX_GENRES 10
+
+/**
+ * Rows are scanned for delimiters this many bytes at a time.
+ */
+#define ROW_BLOCK_BYTES 64
+
+/**
+ * A FieldView is a piece of a mapped file: it points straight into
+ * the file's bytes, and isn't NUL-terminated.
+ */
+typedef struct fieldView {
+  const char *start;
+  int len;
+} FieldView;
+
+/**
+ * What fstat said about a file when it was read, to tell later whether
+ * it has changed since.
+ */
+typedef struct fileStat {
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode; /*!< 0 if the file hasn't been read */
+} FileStat;
+
+/**
+ * A data file mapped into memory, read-only.
+ */
+typedef struct mappedFile {
+  const char *data; /*!< The file's bytes, or NULL if it's empty */
+  long size; /*!< How many bytes there are */
+  FileStat stat; /*!< The file as it was when it was mapped */
+} MappedFile;
+
+/**
+ * Where the delimiters are in a block of ROW_BLOCK_BYTES bytes:
+ * bit i of a mask is set if byte i of the block is that delimiter.
+ */
+typedef struct delimiterMasks {
+  uint64_t pipe;
+  uint64_t comma;
+  uint64_t space;
+  uint64_t newline;
+} DelimiterMasks;
+
+/**
+ * Walks the rows of a MappedFile. It only points into the file, so it
+ * can live on the stack and doesn't need to be destroyed.
+ *
+ * It finds every delimiter in a block of the file in one pass, and
+ * keeps the masks of the block it's in, so each byte is scanned once
+ * no matter how rows, fields and words fall across blocks.
+ */
+typedef struct rowParser {
+  const char *data; /*!< The start of the file */
+  const char *next; /*!< Where the next row starts */
+  const char *stop; /*!< No row starts at or after here */
+  const char *end; /*!< The end of the file */
+  const char *block; /*!< The block masks is for, or NULL */
+  DelimiterMasks masks;
+} RowParser;
+
+/**
+ * The pieces of a movie row, found in one pass over it.
+ */
+typedef struct movieRowIndex {
+  int is_movie; /*!< 1 if the row has MOVIE_ROW_FIELDS fields */
+  FieldView fields[MOVIE_ROW_FIELDS];
+  /**
+   * How many words are in the title, or -1 if there are more than
+   * ROW_MAX_TITLE_WORDS. Words are separated by spaces, and a title
+   * of "-" has none.
+   */
+  int num_title_words;
+  FieldView title_words[ROW_MAX_TITLE_WORDS];
+  int num_genres; /*!< How many genres the genre field lists */
+  FieldView genres[ROW_MAX_GENRES];
+} MovieRowIndex;
+
+/**
+ * Maps a file into memory.
+ *
+ * \param file the name of the file.
+ * \param mapped set to the mapping.
+ *
+ * \return 0 if successful, -1 if the file couldn't be opened or mapped.
+ */
+int MapFile(const char *file, MappedFile *mapped);
+
+/**
+ * Unmaps a file mapped with MapFile. Views into it can't be used after.
+ */
+void UnmapFile(MappedFile *mapped);
+
+/**
+ * Points a RowParser at the rows of a file that start from byte start
+ * up to byte end. A row that starts in the range is read to its end,
+ * even past end.
+ *
+ * \param parser the parser to set up.
+ * \param mapped the file.
+ * \param start where the first row starts.
+ * \param end the end of the range, or -1 for the end of the file.
+ */
+void InitRowParser(RowParser *parser, MappedFile *mapped,
+                   long start, long end);
+
+/**
+ * Gets the next row, without its newline. Rows can be any length.
+ *
+ * \param parser the parser.
+ * \param row set to the row.
+ *
+ * \return 1 if there was a row, 0 at the end of the range.
+ */
+int NextRow(RowParser *parser, FieldView *row);
+
+/**
+ * Gets the next row, and splits it the way CreateMovieFromRow does:
+ * fields are separated by '|', empty fields are skipped, and a row
+ * needs MOVIE_ROW_FIELDS of them to be a movie. The title is split
+ * into words on spaces, and the genres on commas, skipping empty ones.
+ *
+ * \param parser the parser.
+ * \param row set to the row, without its newline.
+ * \param index set to the pieces of the row.
+ *
+ * \return 1 if there was a row, 0 at the end of the range.
+ */
+int NextMovieRow(RowParser *parser, FieldView *row, MovieRowIndex *index);
+
+/**
+ * Gets the byte offset, in the file, of the next row the parser will give.
+ */
+long RowParserOffset(RowParser *parser);
+
+/**
+ * Finds the delimiters in ROW_BLOCK_BYTES bytes, with the fastest
+ * scanner the CPU has.
+ */
+void ScanDelimiters(const char *block, DelimiterMasks *masks);
+
+/**
+ * Picks which delimiter scanner to use: "avx2", "sse2" or "scalar".
+ * They all give the same masks; this is for comparing their speed.
+ * By default the fastest one the CPU has is used.
+ *
+ * \return 0 if successful, -1 if the CPU (or build) doesn't have it.
+ */
+int SelectDelimiterScanner(const char *name);
+
+/**
+ * Gets the name of the delimiter scanner in use.
+ */
+const char *DelimiterScannerName();
+
+#endif  // ROWPARSER_H
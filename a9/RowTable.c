@@ -0,0 +1,622 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RowTable.h"
+#include "RowParser.h"
+
+#define ROW_TABLE_INITIAL_ROWS 64
+
+// Rows closer together than this are asked for with one request, along
+// with whatever is between them; one bigger read beats two seeks.
+#define ROW_TABLE_READ_GAP (64 * 1024)
+
+// How much of a row is read at a time, looking for its newline.
+#define ROW_TABLE_READ_SIZE 512
+
+// What the table knows about one file.
+struct docRows {
+  char *file;  // NULL if there's no file with this id
+  long *offsets;  // where each movie row starts
+  RowStats *stats;  // and what ranking needs to know about it
+  long num_title_words;  // in all the rows
+  int num_rows;
+  int capacity;
+  FileStat stat;  // the file as it was when its rows were read
+  int fd;  // open on file from the first time a row is read; -1 till then
+};
+
+// A table's docRows are kept in chunks of this many, by doc id. Chunks
+// never move once they're made, so files can be added while other
+// threads read the table.
+#define ROW_TABLE_CHUNK_DOCS 256
+
+// The chunks, by number; a chunk is NULL until it has a file. When it
+// fills up, a bigger one replaces it, and the old one is kept, for
+// threads that may still be reading it, until the table goes.
+struct chunkDir {
+  uint64_t num_chunks;
+  struct chunkDir *older;
+  struct docRows *chunks[];
+};
+
+struct rowTable {
+  struct chunkDir *dir;  // ids are small and dense, so chunks are full
+  // Held to add a file.
+  pthread_mutex_t add_lock;
+  // 1 if the docs' offsets and stats are the table's own to free, 0 if
+  // they were saved and belong to someone else.
+  int owns_rows;
+  // The tables a joined table looks files up in, and what it counts
+  // of their rows (see JoinRowTables); NULL and 0 for any other table.
+  RowTable *parts;
+  int num_parts;
+  long num_rows;
+  long num_title_words;
+};
+
+// Makes a chunk directory with room for num_chunks, holding the chunks
+// of older, if it isn't NULL.
+static struct chunkDir *CreateChunkDir(uint64_t num_chunks,
+                                       struct chunkDir *older) {
+  struct chunkDir *dir = (struct chunkDir*)calloc(
+      1, sizeof(struct chunkDir) + num_chunks * sizeof(struct docRows*));
+  if (dir == NULL) {
+    return NULL;
+  }
+  dir->num_chunks = num_chunks;
+  dir->older = older;
+  if (older != NULL) {
+    memcpy(dir->chunks, older->chunks,
+           older->num_chunks * sizeof(struct docRows*));
+  }
+  return dir;
+}
+
+// Gets where a doc id's docRows are, or NULL if there's no chunk for it.
+static struct docRows *DocAt(RowTable table, uint64_t doc_id) {
+  struct chunkDir *dir = __atomic_load_n(&table->dir, __ATOMIC_ACQUIRE);
+  uint64_t chunk_id = doc_id / ROW_TABLE_CHUNK_DOCS;
+  if (chunk_id >= dir->num_chunks) {
+    return NULL;
+  }
+  struct docRows *chunk = __atomic_load_n(&dir->chunks[chunk_id],
+                                          __ATOMIC_ACQUIRE);
+  return chunk == NULL ? NULL : &chunk[doc_id % ROW_TABLE_CHUNK_DOCS];
+}
+
+// Gets where a doc id's docRows are, making room for them if there
+// isn't any. Only called with add_lock held, or before anyone else has
+// the table.
+static struct docRows *MakeDocAt(RowTable table, uint64_t doc_id) {
+  struct chunkDir *dir = table->dir;
+  uint64_t chunk_id = doc_id / ROW_TABLE_CHUNK_DOCS;
+  if (chunk_id >= dir->num_chunks) {
+    uint64_t num_chunks = dir->num_chunks * 2;
+    if (num_chunks <= chunk_id) {
+      num_chunks = chunk_id + 1;
+    }
+    dir = CreateChunkDir(num_chunks, dir);
+    if (dir == NULL) {
+      return NULL;
+    }
+    __atomic_store_n(&table->dir, dir, __ATOMIC_RELEASE);
+  }
+  struct docRows *chunk = dir->chunks[chunk_id];
+  if (chunk == NULL) {
+    chunk = (struct docRows*)calloc(ROW_TABLE_CHUNK_DOCS,
+                                    sizeof(struct docRows));
+    if (chunk == NULL) {
+      return NULL;
+    }
+    for (int i = 0; i < ROW_TABLE_CHUNK_DOCS; i++) {
+      chunk[i].fd = -1;
+    }
+    __atomic_store_n(&dir->chunks[chunk_id], chunk, __ATOMIC_RELEASE);
+  }
+  return &chunk[doc_id % ROW_TABLE_CHUNK_DOCS];
+}
+
+RowTable CreateRowTable(DocIdMap docs) {
+  RowTable table = (RowTable)malloc(sizeof(struct rowTable));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  uint64_t max_id = 0;
+  HTKeyValue kv;
+  HTIter iter = CreateHashtableIterator(docs);
+  if (iter != NULL) {
+    do {
+      HTIteratorGet(iter, &kv);
+      if (kv.key > max_id) {
+        max_id = kv.key;
+      }
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+
+  table->dir = CreateChunkDir(max_id / ROW_TABLE_CHUNK_DOCS + 1, NULL);
+  if (table->dir == NULL) {
+    free(table);
+    return NULL;
+  }
+  pthread_mutex_init(&table->add_lock, NULL);
+  table->owns_rows = 1;
+  table->parts = NULL;
+  table->num_parts = 0;
+  table->num_rows = 0;
+  table->num_title_words = 0;
+  iter = CreateHashtableIterator(docs);
+  if (iter != NULL) {
+    do {
+      HTIteratorGet(iter, &kv);
+      struct docRows *doc = MakeDocAt(table, kv.key);
+      if (doc == NULL) {
+        DestroyHashtableIterator(iter);
+        DestroyRowTable(table);
+        return NULL;
+      }
+      doc->file = (char*)kv.value;
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+  return table;
+}
+
+int AddFileToRowTable(RowTable table, uint64_t doc_id, char *file) {
+  if (table->parts != NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&table->add_lock);
+  struct docRows *doc = MakeDocAt(table, doc_id);
+  int result = -1;
+  if (doc != NULL && doc->file == NULL) {
+    doc->file = file;
+    result = 0;
+  }
+  pthread_mutex_unlock(&table->add_lock);
+  return result;
+}
+
+RowTable CreateSavedRowTable(DocIdMap docs, const SavedRows *saved,
+                             uint64_t num_docs) {
+  RowTable table = CreateRowTable(docs);
+  if (table == NULL) {
+    return NULL;
+  }
+  table->owns_rows = 0;
+  for (uint64_t i = 0; i < num_docs; i++) {
+    struct docRows *doc = DocAt(table, i);
+    if (doc == NULL || doc->file == NULL) {
+      continue;
+    }
+    // Nothing is ever added, so the saved arrays are used as they are.
+    doc->offsets = (long*)saved[i].offsets;
+    doc->stats = (RowStats*)saved[i].stats;
+    doc->num_title_words = saved[i].num_title_words;
+    doc->num_rows = saved[i].num_rows;
+    doc->capacity = saved[i].num_rows;
+    doc->stat = saved[i].stat;
+  }
+  return table;
+}
+
+RowTable JoinRowTables(RowTable *tables, int num_tables, long num_rows,
+                       long num_title_words) {
+  RowTable table = (RowTable)malloc(sizeof(struct rowTable));
+  RowTable *parts = (RowTable*)malloc((num_tables + 1) * sizeof(RowTable));
+  struct chunkDir *dir = CreateChunkDir(1, NULL);
+  if (table == NULL || parts == NULL || dir == NULL) {
+    free(table);
+    free(parts);
+    free(dir);
+    return NULL;
+  }
+  memcpy(parts, tables, num_tables * sizeof(RowTable));
+  table->dir = dir;
+  pthread_mutex_init(&table->add_lock, NULL);
+  table->owns_rows = 0;
+  table->parts = parts;
+  table->num_parts = num_tables;
+  table->num_rows = num_rows;
+  table->num_title_words = num_title_words;
+  return table;
+}
+
+void DestroyRowTable(RowTable table) {
+  struct chunkDir *dir = table->dir;
+  for (uint64_t i = 0; i < dir->num_chunks; i++) {
+    struct docRows *chunk = dir->chunks[i];
+    for (int j = 0; chunk != NULL && j < ROW_TABLE_CHUNK_DOCS; j++) {
+      if (table->owns_rows) {
+        free(chunk[j].offsets);
+        free(chunk[j].stats);
+      }
+      if (chunk[j].fd >= 0) {
+        close(chunk[j].fd);
+      }
+    }
+    free(chunk);
+  }
+  while (dir != NULL) {
+    struct chunkDir *older = dir->older;
+    free(dir);
+    dir = older;
+  }
+  pthread_mutex_destroy(&table->add_lock);
+  free(table->parts);
+  free(table);
+}
+
+static struct docRows *DocRows(RowTable table, uint64_t doc_id) {
+  for (int i = 0; i < table->num_parts; i++) {
+    struct docRows *doc = DocRows(table->parts[i], doc_id);
+    if (doc != NULL) {
+      return doc;
+    }
+  }
+  struct docRows *doc = DocAt(table, doc_id);
+  if (doc == NULL || doc->file == NULL) {
+    return NULL;
+  }
+  return doc;
+}
+
+// Works out the RowStats of a row.
+static void MakeRowStats(const MovieRowIndex *pieces, RowStats *stats) {
+  int words = pieces->num_title_words;
+  if (words < 0) {
+    // Too many to have been split up; count them.
+    FieldView title = pieces->fields[MOVIE_ROW_TITLE];
+    words = 0;
+    for (int i = 0; i < title.len; i++) {
+      if (title.start[i] != ' ' && (i == 0 || title.start[i - 1] == ' ')) {
+        words++;
+      }
+    }
+  }
+  stats->title_words = words > UINT8_MAX ? UINT8_MAX : words;
+
+  // A year is four digits; anything else ("-", "\N") means no year.
+  FieldView year = pieces->fields[MOVIE_ROW_YEAR];
+  stats->year = 0;
+  for (int i = 0; i < year.len && i < 4; i++) {
+    if (year.start[i] < '0' || year.start[i] > '9') {
+      stats->year = 0;
+      break;
+    }
+    stats->year = stats->year * 10 + year.start[i] - '0';
+  }
+}
+
+int AddRowOffset(RowTable table, uint64_t doc_id, long offset,
+                 const MovieRowIndex *pieces) {
+  struct docRows *doc = DocRows(table, doc_id);
+  if (doc == NULL || !table->owns_rows) {
+    return -1;
+  }
+  if (doc->num_rows == doc->capacity) {
+    int capacity = doc->capacity == 0 ?
+        ROW_TABLE_INITIAL_ROWS : doc->capacity * 2;
+    long *offsets = (long*)realloc(doc->offsets, capacity * sizeof(long));
+    if (offsets == NULL) {
+      return -1;
+    }
+    doc->offsets = offsets;
+    RowStats *stats = (RowStats*)realloc(doc->stats,
+                                         capacity * sizeof(RowStats));
+    if (stats == NULL) {
+      return -1;
+    }
+    doc->stats = stats;
+    doc->capacity = capacity;
+  }
+  MakeRowStats(pieces, &doc->stats[doc->num_rows]);
+  doc->num_title_words += doc->stats[doc->num_rows].title_words;
+  doc->offsets[doc->num_rows++] = offset;
+  return 0;
+}
+
+int SetFileStat(RowTable table, uint64_t doc_id, const FileStat *stat) {
+  struct docRows *doc = DocRows(table, doc_id);
+  if (doc == NULL || !table->owns_rows) {
+    return -1;
+  }
+  doc->stat = *stat;
+  return 0;
+}
+
+int CopySavedRows(RowTable table, uint64_t doc_id, const SavedRows *saved) {
+  struct docRows *doc = DocRows(table, doc_id);
+  if (doc == NULL || !table->owns_rows || doc->num_rows != 0) {
+    return -1;
+  }
+  doc->stat = saved->stat;
+  if (saved->num_rows == 0) {
+    return 0;
+  }
+  long *offsets = (long*)malloc(saved->num_rows * sizeof(long));
+  RowStats *stats = (RowStats*)malloc(saved->num_rows * sizeof(RowStats));
+  if (offsets == NULL || stats == NULL) {
+    free(offsets);
+    free(stats);
+    return -1;
+  }
+  memcpy(offsets, saved->offsets, saved->num_rows * sizeof(long));
+  memcpy(stats, saved->stats, saved->num_rows * sizeof(RowStats));
+  free(doc->offsets);
+  free(doc->stats);
+  doc->offsets = offsets;
+  doc->stats = stats;
+  doc->num_title_words = saved->num_title_words;
+  doc->num_rows = saved->num_rows;
+  doc->capacity = saved->num_rows;
+  return 0;
+}
+
+int NumRowsInTable(RowTable table, uint64_t doc_id) {
+  struct docRows *doc = DocRows(table, doc_id);
+  return doc == NULL ? 0 : doc->num_rows;
+}
+
+const RowStats *GetRowStats(RowTable table, uint64_t doc_id, int *num_rows) {
+  struct docRows *doc = DocRows(table, doc_id);
+  *num_rows = doc == NULL ? 0 : doc->num_rows;
+  return *num_rows == 0 ? NULL : doc->stats;
+}
+
+int GetSavedRows(RowTable table, uint64_t doc_id, SavedRows *saved) {
+  struct docRows *doc = DocRows(table, doc_id);
+  if (doc == NULL) {
+    return -1;
+  }
+  saved->offsets = doc->offsets;
+  saved->stats = doc->stats;
+  saved->num_title_words = doc->num_title_words;
+  saved->num_rows = doc->num_rows;
+  saved->stat = doc->stat;
+  return 0;
+}
+
+void CountTitleWords(RowTable table, long *num_rows, long *num_words) {
+  *num_rows = table->num_rows;
+  *num_words = table->num_title_words;
+  if (table->parts != NULL) {
+    return;
+  }
+  struct chunkDir *dir = __atomic_load_n(&table->dir, __ATOMIC_ACQUIRE);
+  for (uint64_t i = 0; i < dir->num_chunks; i++) {
+    struct docRows *chunk = __atomic_load_n(&dir->chunks[i],
+                                            __ATOMIC_ACQUIRE);
+    for (int j = 0; chunk != NULL && j < ROW_TABLE_CHUNK_DOCS; j++) {
+      *num_rows += chunk[j].num_rows;
+      *num_words += chunk[j].num_title_words;
+    }
+  }
+}
+
+// Gets the file to read rows from, and finds out how big it is now.
+// The file is opened the first time any of its rows is read, and kept
+// open until the table goes, so every read after that is just a pread.
+// Its size is looked at again every time, so a file that's been cut
+// short since it was indexed is only ever read as far as it goes.
+static int OpenDocRows(struct docRows *doc, long *size) {
+  int fd = __atomic_load_n(&doc->fd, __ATOMIC_ACQUIRE);
+  if (fd < 0) {
+    fd = open(doc->file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      printf("File could not be opened\n");
+      return -1;
+    }
+    // Another thread may have opened it first; use theirs.
+    int none = -1;
+    if (!__atomic_compare_exchange_n(&doc->fd, &none, fd, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      close(fd);
+      fd = none;
+    }
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return -1;
+  }
+  *size = st.st_size;
+  return fd;
+}
+
+// Where a row ends, at the latest: the next movie row's start, or the
+// end of the file.
+static long RowLimit(struct docRows *doc, uint32_t row_id, long size) {
+  if (row_id + 1 < (uint32_t)doc->num_rows &&
+      doc->offsets[row_id + 1] <= size) {
+    return doc->offsets[row_id + 1];
+  }
+  return size;
+}
+
+// Reads up to len bytes at offset, going on after a read that's cut
+// short. Returns how many bytes there were, which is fewer than len if
+// the file ends first, or -1 if it can't be read.
+static long ReadAt(int fd, char *dest, long len, long offset) {
+  long done = 0;
+  while (done < len) {
+    ssize_t got = pread(fd, dest + done, len - done, offset + done);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    done += got;
+  }
+  return done;
+}
+
+// Makes room for len more bytes at the end of a RowBuffer.
+static int GrowRowBuffer(RowBuffer *buffer, long len) {
+  if (buffer->len + len <= buffer->capacity) {
+    return 0;
+  }
+  long capacity = buffer->capacity == 0 ? 4096 : buffer->capacity * 2;
+  while (capacity < buffer->len + len) {
+    capacity *= 2;
+  }
+  char *data = (char*)realloc(buffer->data, capacity);
+  if (data == NULL) {
+    return -1;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+// Reads the row at offset onto the end of a RowBuffer, without its
+// newline, a piece at a time until the newline or limit is reached.
+// Returns the row's length, -1 if the file doesn't have the whole row
+// any more, or -2 if out of memory.
+static long ReadRow(int fd, long offset, long limit, RowBuffer *buffer) {
+  long len = 0;
+  while (offset + len < limit) {
+    long want = limit - offset - len;
+    if (want > ROW_TABLE_READ_SIZE) {
+      want = ROW_TABLE_READ_SIZE;
+    }
+    if (GrowRowBuffer(buffer, len + want) != 0) {
+      return -2;
+    }
+    char *dest = buffer->data + buffer->len + len;
+    long got = ReadAt(fd, dest, want, offset + len);
+    if (got < 0) {
+      return -1;
+    }
+    const char *newline = (const char*)memchr(dest, '\n', got);
+    if (newline != NULL) {
+      return len + (newline - dest);
+    }
+    len += got;
+    if (got < want) {
+      // The file ended before the row did; it's changed since.
+      return -1;
+    }
+  }
+  return len;
+}
+
+int CopyRowFromTable(RowTable table, uint64_t doc_id, int row_id,
+                     char *dest, int dest_size) {
+  struct docRows *doc = DocRows(table, doc_id);
+  if (doc == NULL || row_id < 0 || row_id >= doc->num_rows ||
+      dest_size <= 0) {
+    return -1;
+  }
+  long size;
+  int fd = OpenDocRows(doc, &size);
+  if (fd < 0) {
+    return -1;
+  }
+
+  long offset = doc->offsets[row_id];
+  long len = RowLimit(doc, row_id, size) - offset;
+  if (len > dest_size - 1) {
+    len = dest_size - 1;
+  }
+  long got = len <= 0 ? 0 : ReadAt(fd, dest, len, offset);
+  if (got <= 0) {
+    // The file shrank since it was indexed.
+    return -1;
+  }
+  const char *newline = (const char*)memchr(dest, '\n', got);
+  if (newline != NULL) {
+    got = newline - dest;
+  }
+  dest[got] = '\0';
+  return got;
+}
+
+int GetRowsFromTable(RowTable table, uint64_t doc_id,
+                     const uint32_t *row_ids, int num_rows,
+                     RowBuffer *buffer, RowSpan *rows) {
+  struct docRows *doc = DocRows(table, doc_id);
+  if (doc == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < num_rows; i++) {
+    if (row_ids[i] >= (uint32_t)doc->num_rows) {
+      return -1;
+    }
+  }
+  if (num_rows == 0) {
+    return 0;
+  }
+  long size;
+  int fd = OpenDocRows(doc, &size);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // Merge the rows into runs and start reading them all in, before
+  // waiting on any of them.
+  long run_start = doc->offsets[row_ids[0]];
+  long run_end = RowLimit(doc, row_ids[0], size);
+  for (int i = 1; i < num_rows; i++) {
+    long start = doc->offsets[row_ids[i]];
+    if (start - run_end > ROW_TABLE_READ_GAP) {
+      if (run_start < run_end) {
+        posix_fadvise(fd, run_start, run_end - run_start,
+                      POSIX_FADV_WILLNEED);
+      }
+      run_start = start;
+    }
+    run_end = RowLimit(doc, row_ids[i], size);
+  }
+  if (run_start < run_end) {
+    posix_fadvise(fd, run_start, run_end - run_start, POSIX_FADV_WILLNEED);
+  }
+
+  int result = 0;
+  for (int i = 0; i < num_rows; i++) {
+    long offset = doc->offsets[row_ids[i]];
+    long len = ReadRow(fd, offset, RowLimit(doc, row_ids[i], size), buffer);
+    if (len == -2) {
+      result = -1;
+      break;
+    }
+    if (len < 0 || offset >= size) {
+      // The file shrank since it was indexed.
+      rows[i].start = -1;
+      rows[i].len = 0;
+      continue;
+    }
+    rows[i].start = buffer->len;
+    rows[i].len = len;
+    buffer->len += len;
+  }
+  return result;
+}
@@ -0,0 +1,255 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROWTABLE_H
+#define ROWTABLE_H
+
+#include <stdint.h>
+
+#include "DocIdMap.h"
+#include "RowParser.h"
+
+/**
+ * A RowTable remembers where every movie row of every file in a
+ * DocIdMap starts, so a search result's row can be read straight out
+ * of its file instead of by reading through every row before it.
+ *
+ * The parser fills it in as it indexes, from the offsets it's already
+ * at. Rows are read with pread into memory the caller owns, never
+ * handed out as pointers into the file, so a file that's changed or
+ * cut short while it's being served only loses the rows it no longer
+ * has. A file is opened the first time a row is read from it, and
+ * kept open for every read after that, until the table is destroyed.
+ */
+typedef struct rowTable *RowTable;
+
+/**
+ * What ranking needs to know about a movie row, kept by the RowTable
+ * so it doesn't have to read the row.
+ */
+typedef struct rowStats {
+  uint8_t title_words; /*!< How many words the title has, up to 255 */
+  uint16_t year; /*!< The year it came out, or 0 if it doesn't say */
+} RowStats;
+
+/**
+ * The rows of one file, as an index file keeps them (see IndexFile.h).
+ */
+typedef struct savedRows {
+  const long *offsets; /*!< Where each movie row starts */
+  const RowStats *stats; /*!< And its RowStats */
+  long num_title_words; /*!< The words in all the rows' titles */
+  int num_rows;
+  FileStat stat; /*!< The file as it was when its rows were read */
+} SavedRows;
+
+/**
+ * Where GetRowsFromTable copies rows to. Start it out zeroed, keep
+ * using it for as many files as needed, and free data when done with
+ * the rows.
+ */
+typedef struct rowBuffer {
+  char *data;
+  long len; /*!< How many bytes of data the rows take up */
+  long capacity; /*!< How many bytes data has room for */
+} RowBuffer;
+
+/**
+ * Where GetRowsFromTable put a row in a RowBuffer.
+ */
+typedef struct rowSpan {
+  long start; /*!< Offset of the row in the buffer's data, or -1 if
+                   the file doesn't have it any more */
+  int len; /*!< How long it is, without its newline */
+} RowSpan;
+
+/**
+ * Creates an empty RowTable for the files in a DocIdMap.
+ *
+ * \param docs the files; they must outlive the table.
+ *
+ * \return the table, or NULL if out of memory.
+ */
+RowTable CreateRowTable(DocIdMap docs);
+
+/**
+ * Adds a file to a RowTable, as it's put in the DocIdMap. Other threads
+ * can go on using the table while files are added.
+ *
+ * \param table the table.
+ * \param doc_id the id the file was given in the DocIdMap.
+ * \param file the file's name; it must outlive the table.
+ *
+ * \return 0 if successful, -1 if doc_id is already in the table or out
+ *   of memory.
+ */
+int AddFileToRowTable(RowTable table, uint64_t doc_id, char *file);
+
+/**
+ * Creates a RowTable over rows that were saved before, without copying
+ * them. No rows can be added to it.
+ *
+ * \param docs the files; they must outlive the table.
+ * \param saved the rows of each file, by doc id; they must outlive the
+ *   table too. Ids that aren't in docs are ignored.
+ * \param num_docs how many entries saved has.
+ *
+ * \return the table, or NULL if out of memory.
+ */
+RowTable CreateSavedRowTable(DocIdMap docs, const SavedRows *saved,
+                             uint64_t num_docs);
+
+/**
+ * Creates a RowTable that finds each file's rows in whichever of some
+ * other tables has them, without copying anything. No rows can be
+ * added to it. A file should be in only one of the tables.
+ *
+ * \param tables the tables; they must outlive this one.
+ * \param num_tables how many there are.
+ * \param num_rows what CountTitleWords is to give for the table's rows,
+ *   which can leave out the rows of files that shouldn't be counted.
+ * \param num_title_words and for the words in their titles.
+ *
+ * \return the table, or NULL if out of memory.
+ */
+RowTable JoinRowTables(RowTable *tables, int num_tables, long num_rows,
+                       long num_title_words);
+
+/**
+ * Gets the rows of a file, to be saved.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param saved set to the file's rows. They can be used until more
+ *   rows are added to the file.
+ *
+ * \return 0 if successful, -1 if doc_id isn't in the table.
+ */
+int GetSavedRows(RowTable table, uint64_t doc_id, SavedRows *saved);
+
+/**
+ * Destroys a RowTable, closing any of its files it has open. The files
+ * themselves are untouched.
+ */
+void DestroyRowTable(RowTable table);
+
+/**
+ * Records where the next movie row of a file starts, and its RowStats.
+ * Rows have to be added in order, and only one thread may add to any
+ * one file, but threads can add to different files at once.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param offset the byte offset the row starts at.
+ * \param pieces the row, split up by NextMovieRow.
+ *
+ * \return 0 if successful, -1 if doc_id isn't in the table or out of memory.
+ */
+int AddRowOffset(RowTable table, uint64_t doc_id, long offset,
+                 const MovieRowIndex *pieces);
+
+/**
+ * Records what the file was like when its rows were read, as MapFile
+ * found it, so whoever saves or watches the rows can tell later whether
+ * the file has changed since they were read from it.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param stat the file's FileStat.
+ *
+ * \return 0 if successful, -1 if doc_id isn't in the table or no rows
+ *   can be added to it.
+ */
+int SetFileStat(RowTable table, uint64_t doc_id, const FileStat *stat);
+
+/**
+ * Records all the rows of a file at once, copying rows saved from
+ * another table, along with their FileStat. The file must have no rows
+ * yet.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param saved the rows, as GetSavedRows gave them.
+ *
+ * \return 0 if successful, -1 if doc_id isn't in the table or out of memory.
+ */
+int CopySavedRows(RowTable table, uint64_t doc_id, const SavedRows *saved);
+
+/**
+ * Gets how many movie rows have been recorded for a file.
+ */
+int NumRowsInTable(RowTable table, uint64_t doc_id);
+
+/**
+ * Gets the RowStats of every movie row of a file, by row id.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param num_rows set to how many rows there are.
+ *
+ * \return the stats, or NULL if there are no rows. They can be used
+ *   until more rows are added to the file.
+ */
+const RowStats *GetRowStats(RowTable table, uint64_t doc_id, int *num_rows);
+
+/**
+ * Counts the movie rows in every file, and the words in their titles.
+ * A table made by JoinRowTables gives the counts it was made with.
+ */
+void CountTitleWords(RowTable table, long *num_rows, long *num_words);
+
+/**
+ * Copies a movie row, without its newline, into dest. A row that
+ * doesn't fit is cut short. It's safe to call from many threads.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param row_id the row id the index gave the row.
+ * \param dest where to write the row.
+ * \param dest_size how many bytes dest has room for, including the NUL.
+ *
+ * \return the length of the row copied, or -1 if there's no such row
+ *   or the file couldn't be read, or doesn't have the row any more.
+ */
+int CopyRowFromTable(RowTable table, uint64_t doc_id, int row_id,
+                     char *dest, int dest_size);
+
+/**
+ * Reads many rows of one file at once. Before reading any of them, it
+ * asks the kernel to read in every part of the file they're in, in as
+ * few runs as it can, so a file that isn't cached is read once rather
+ * than a row at a time.
+ *
+ * \param table the table.
+ * \param doc_id the id of the file in the DocIdMap.
+ * \param row_ids the row ids, in increasing order.
+ * \param num_rows how many row ids there are.
+ * \param buffer the rows are added to the end of it, each without its
+ *   newline.
+ * \param rows set to where each row is in the buffer. A row the file
+ *   no longer has, because it's been cut short since it was indexed,
+ *   gets a start of -1, and is left out of the buffer.
+ *
+ * \return 0 if successful, -1 if any row isn't known, the file couldn't
+ *   be opened, or out of memory.
+ */
+int GetRowsFromTable(RowTable table, uint64_t doc_id,
+                     const uint32_t *row_ids, int num_rows,
+                     RowBuffer *buffer, RowSpan *rows);
+
+#endif  // ROWTABLE_H
@@ -0,0 +1,29 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+/**
+ * Gets the time, in seconds, on a clock that only goes forward, for
+ * timing things. It's not the time of day; only the difference between
+ * two readings means anything.
+ */
+double WallSeconds();
+
+#endif  // WALLCLOCK_H
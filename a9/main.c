@@ -23,25 +23,20 @@ Index docIndex;
 
 
 /**
- * Open the specified file, read the specified row into the
- * provided pointer to the movie.
+ * Read the specified row of the specified file into the
+ * provided pointer to the movie, straight from where the
+ * index recorded that the row starts.
  */
-int CreateMovieFromFileRow(char *file, long rowId, Movie** movie) {
-  FILE *fp;
+int CreateMovieFromFileRow(uint64_t docId, long rowId, Movie** movie) {
   char buffer[1000];
 
-  fp = fopen(file, "r");
-
-  int i = 0;
-  while (i <= rowId) {
-    fgets(buffer, 1000, fp);
-    i++;
+  if (CopyRowFromTable(docIndex->rows, docId, rowId,
+                       buffer, sizeof(buffer)) < 0) {
+    *movie = NULL;
+    return -1;
   }
-  // taking \n out of the row
-  buffer[strlen(buffer)-1] = ' ';
   // Create movie from row
   *movie = CreateMovieFromRow(buffer);
-  fclose(fp);
   return 0;
 }
 
@@ -78,14 +73,12 @@ void runQuery(char *term) {
       return;
     }
     int result;
-    char *filename;
 
     // Get the last
     SearchResultGet(results, sr);
-    filename = GetFileFromId(docs, sr->doc_id);
 
     Movie *movie;
-    CreateMovieFromFileRow(filename, sr->row_id, &movie);
+    CreateMovieFromFileRow(sr->doc_id, sr->row_id, &movie);
     InsertLinkedList(movies, movie);
 
     // Check if there are more
@@ -96,10 +89,9 @@ void runQuery(char *term) {
         break;
       }
       SearchResultGet(results, sr);
-      char *filename = GetFileFromId(docs, sr->doc_id);
 
       Movie *movie;
-      CreateMovieFromFileRow(filename, sr->row_id, &movie);
+      CreateMovieFromFileRow(sr->doc_id, sr->row_id, &movie);
       InsertLinkedList(movies, movie);
     }
 
@@ -117,7 +109,11 @@ void runQueries() {
   char input[1000];
   while (1) {
     printf("\nEnter a term to search for, or q to quit: ");
-    scanf("%s", input);
+    // A whole line, so queries can have more than one word.
+    if (fgets(input, sizeof(input), stdin) == NULL) {
+      return;
+    }
+    input[strcspn(input, "\n")] = '\0';
 
     if (strlen(input) == 1 &&
         (input[0] == 'q')) {
@@ -0,0 +1,215 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for parsing boolean queries, and for running them against an
+// index with the posting lists' skips.
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "BooleanQuery.h"
+}
+
+TEST(BooleanQuery, ParseWords) {
+  QueryNode query = ParseQuery("love");
+  ASSERT_FALSE(query == NULL);
+  EXPECT_EQ(QUERY_TERM, query->type);
+  EXPECT_STREQ("love", query->term);
+  DestroyQuery(query);
+
+  // Words next to each other, or joined with AND, are one AND.
+  query = ParseQuery("star AND wars  night");
+  ASSERT_FALSE(query == NULL);
+  EXPECT_EQ(QUERY_AND, query->type);
+  ASSERT_EQ(3, query->num_children);
+  EXPECT_STREQ("star", query->children[0]->term);
+  EXPECT_STREQ("wars", query->children[1]->term);
+  EXPECT_STREQ("night", query->children[2]->term);
+  DestroyQuery(query);
+
+  // Operators have to be in capitals.
+  query = ParseQuery("war and peace");
+  ASSERT_FALSE(query == NULL);
+  ASSERT_EQ(3, query->num_children);
+  EXPECT_STREQ("and", query->children[1]->term);
+  DestroyQuery(query);
+}
+
+TEST(BooleanQuery, ParseOperators) {
+  // AND binds tighter than OR.
+  QueryNode query = ParseQuery("a b OR c OR d NOT e");
+  ASSERT_FALSE(query == NULL);
+  ASSERT_EQ(QUERY_OR, query->type);
+  ASSERT_EQ(3, query->num_children);
+  EXPECT_EQ(QUERY_AND, query->children[0]->type);
+  EXPECT_EQ(2, query->children[0]->num_children);
+  EXPECT_EQ(QUERY_TERM, query->children[1]->type);
+  ASSERT_EQ(QUERY_AND, query->children[2]->type);
+  ASSERT_EQ(2, query->children[2]->num_children);
+  EXPECT_EQ(QUERY_NOT, query->children[2]->children[1]->type);
+  DestroyQuery(query);
+
+  query = ParseQuery("(a OR b) (c OR (d e))");
+  ASSERT_FALSE(query == NULL);
+  ASSERT_EQ(QUERY_AND, query->type);
+  ASSERT_EQ(2, query->num_children);
+  EXPECT_EQ(QUERY_OR, query->children[0]->type);
+  ASSERT_EQ(QUERY_OR, query->children[1]->type);
+  EXPECT_EQ(QUERY_AND, query->children[1]->children[1]->type);
+  DestroyQuery(query);
+
+  query = ParseQuery("\"the dark knight\" OR \"  king \"");
+  ASSERT_FALSE(query == NULL);
+  ASSERT_EQ(QUERY_OR, query->type);
+  ASSERT_EQ(QUERY_PHRASE, query->children[0]->type);
+  ASSERT_EQ(3, query->children[0]->num_children);
+  EXPECT_STREQ("knight", query->children[0]->children[2]->term);
+  // A phrase of one word is just the word.
+  EXPECT_EQ(QUERY_TERM, query->children[1]->type);
+  EXPECT_STREQ("king", query->children[1]->term);
+  DestroyQuery(query);
+}
+
+TEST(BooleanQuery, ParseBad) {
+  const char *bad[] = {
+    "", "   ", "AND", "a AND", "OR b", "a OR", "NOT", "(a", "a)", "()",
+    "(a OR)", "\"a b", "\"\"", "\"   \"", "a NOT"
+  };
+  for (const char *query : bad) {
+    QueryNode node = ParseQuery(query);
+    EXPECT_TRUE(node == NULL) << query;
+    DestroyQuery(node);
+  }
+
+  // Parentheses can only be nested so deep.
+  std::string deep = "a";
+  for (int i = 0; i < QUERY_MAX_DEPTH; i++) {
+    deep = "(" + deep + ")";
+  }
+  QueryNode query = ParseQuery(deep.c_str());
+  ASSERT_FALSE(query == NULL);
+  EXPECT_EQ(QUERY_TERM, query->type);
+  DestroyQuery(query);
+  deep = "(" + deep + ")";
+  EXPECT_TRUE(ParseQuery(deep.c_str()) == NULL);
+}
+
+// Runs queries against an index of made-up movies, and checks each one
+// finds exactly the rows a look through every title does.
+class BooleanQueryRun : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    // Enough rows in each file that the common words' lists have skips.
+    rows_ = WriteMovies(dir_, 7, 900, 5007);
+    docs_ = CreateDocIdMap();
+    index_ = IndexDataDir(dir_, docs_, 0);
+  }
+
+  void TearDown() override {
+    DestroyOffsetIndex(index_);
+    DestroyDocIdMap(docs_);
+    RemoveDataDir(dir_);
+  }
+
+  void ExpectMatches(const std::string &query,
+                     std::function<bool(const std::set<std::string>&)> match) {
+    std::multiset<std::string> expected;
+    for (const std::string &row : rows_) {
+      std::vector<std::string> words = TitleWords(row);
+      if (match(std::set<std::string>(words.begin(), words.end()))) {
+        expected.insert(row);
+      }
+    }
+    std::multiset<std::string> found = QueryRows(index_, query);
+    EXPECT_EQ(expected.size(), found.size()) << query;
+    EXPECT_TRUE(expected == found) << query;
+  }
+
+  std::string dir_;
+  std::vector<std::string> rows_;
+  DocIdMap docs_;
+  Index index_;
+};
+
+typedef const std::set<std::string> &Words;
+
+static bool Has(Words words, const char *word) {
+  return words.count(word) > 0;
+}
+
+TEST_F(BooleanQueryRun, Words) {
+  ExpectMatches("love", [](Words w) { return Has(w, "love"); });
+  ExpectMatches("nosuchword", [](Words w) { return false; });
+  ExpectMatches("the love", [](Words w) {
+    return Has(w, "the") && Has(w, "love");
+  });
+  ExpectMatches("the AND of AND day", [](Words w) {
+    return Has(w, "the") && Has(w, "of") && Has(w, "day");
+  });
+  ExpectMatches("love nosuchword", [](Words w) { return false; });
+}
+
+TEST_F(BooleanQueryRun, Or) {
+  ExpectMatches("star OR ship", [](Words w) {
+    return Has(w, "star") || Has(w, "ship");
+  });
+  ExpectMatches("star OR nosuchword", [](Words w) {
+    return Has(w, "star");
+  });
+  ExpectMatches("river blue OR dark city OR game", [](Words w) {
+    return (Has(w, "river") && Has(w, "blue")) ||
+        (Has(w, "dark") && Has(w, "city")) || Has(w, "game");
+  });
+}
+
+TEST_F(BooleanQueryRun, Not) {
+  ExpectMatches("war NOT love", [](Words w) {
+    return Has(w, "war") && !Has(w, "love");
+  });
+  ExpectMatches("NOT love war NOT the NOT nosuchword", [](Words w) {
+    return Has(w, "war") && !Has(w, "love") && !Has(w, "the");
+  });
+  ExpectMatches("the NOT (king OR day)", [](Words w) {
+    return Has(w, "the") && !Has(w, "king") && !Has(w, "day");
+  });
+  // NOT only narrows down what it's ANDed with.
+  ExpectMatches("NOT love", [](Words w) { return false; });
+  ExpectMatches("NOT love OR king", [](Words w) { return Has(w, "king"); });
+}
+
+TEST_F(BooleanQueryRun, Nested) {
+  ExpectMatches("(star OR night) (man OR king) NOT (the OR of)",
+                [](Words w) {
+    return (Has(w, "star") || Has(w, "night")) &&
+        (Has(w, "man") || Has(w, "king")) && !Has(w, "the") &&
+        !Has(w, "of");
+  });
+  ExpectMatches("((last day) OR (blue (river OR game))) the", [](Words w) {
+    return ((Has(w, "last") && Has(w, "day")) ||
+            (Has(w, "blue") && (Has(w, "river") || Has(w, "game")))) &&
+        Has(w, "the");
+  });
+}
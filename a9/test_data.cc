@@ -0,0 +1,203 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "BooleanQuery.h"
+  #include "FileCrawler.h"
+  #include "FileParser.h"
+}
+
+static const char *kWords[] = {
+  "the", "of", "love", "war", "star", "night", "man", "dark", "city",
+  "king", "ship", "day", "river", "blue", "last", "game"
+};
+static const int kNumWords = sizeof(kWords) / sizeof(kWords[0]);
+
+std::string MovieRow(int id, const std::string &title, int year) {
+  char row[2048];
+  snprintf(row, sizeof(row), "tt%07d|movie|%s|%s|0|%d|-|90|Drama",
+           id, title.c_str(), title.c_str(), year);
+  return row;
+}
+
+std::vector<std::string> TitleWords(const std::string &row) {
+  // The title is the third field.
+  size_t start = row.find('|', row.find('|') + 1) + 1;
+  std::string title = row.substr(start, row.find('|', start) - start);
+  std::vector<std::string> words;
+  size_t at = 0;
+  while (at < title.size()) {
+    size_t end = title.find(' ', at);
+    if (end == std::string::npos) {
+      end = title.size();
+    }
+    if (end > at) {
+      words.push_back(title.substr(at, end - at));
+    }
+    at = end + 1;
+  }
+  return words;
+}
+
+std::string MakeDataDir() {
+  char dir[] = "/tmp/a9_testXXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    ADD_FAILURE() << "Couldn't make a directory under /tmp";
+    return "/tmp/";
+  }
+  return std::string(dir) + "/";
+}
+
+void RemoveDataDir(const std::string &dir) {
+  std::string command = "rm -rf '" + dir + "'";
+  if (system(command.c_str()) != 0) {
+    ADD_FAILURE() << "Couldn't remove " << dir;
+  }
+}
+
+void WriteDataFile(const std::string &dir, const std::string &name,
+                   const std::vector<std::string> &rows) {
+  std::string path = dir + name;
+  size_t slash = path.rfind('/');
+  std::string command = "mkdir -p '" + path.substr(0, slash) + "'";
+  ASSERT_EQ(0, system(command.c_str()));
+  // Written to the side and renamed, so it's a new file every time.
+  std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "w");
+  ASSERT_FALSE(file == NULL) << tmp;
+  for (const std::string &row : rows) {
+    fprintf(file, "%s\n", row.c_str());
+  }
+  fclose(file);
+  ASSERT_EQ(0, rename(tmp.c_str(), path.c_str()));
+}
+
+std::vector<std::string> WriteMovies(const std::string &dir, int num_files,
+                                     int rows_per_file, unsigned seed) {
+  std::vector<std::string> all;
+  for (int f = 0; f < num_files; f++) {
+    std::vector<std::string> rows;
+    for (int r = 0; r < rows_per_file; r++) {
+      seed = seed * 1103515245 + 12345;
+      int num_words = 1 + (seed >> 16) % 5;
+      std::string title;
+      for (int w = 0; w < num_words; w++) {
+        seed = seed * 1103515245 + 12345;
+        if (w > 0) {
+          title += " ";
+        }
+        title += kWords[(seed >> 16) % kNumWords];
+      }
+      int id = (f + 1) * 100000 + r;
+      rows.push_back(MovieRow(id, title, 1950 + (seed >> 8) % 70));
+    }
+    char name[64];
+    snprintf(name, sizeof(name), f % 3 == 2 ? "sub/movies%03d" : "movies%03d",
+             f);
+    WriteDataFile(dir, name, rows);
+    all.insert(all.end(), rows.begin(), rows.end());
+  }
+  return all;
+}
+
+Index IndexDataDir(const std::string &dir, DocIdMap docs,
+                   int keep_positions) {
+  CrawlFilesToMap(dir.c_str(), docs);
+  Index index = CreateIndex();
+  index->keep_positions = keep_positions;
+  ParseTheFiles(docs, index);
+  return index;
+}
+
+std::multiset<std::string> BatchRows(SearchResultBatch batch) {
+  std::multiset<std::string> rows;
+  if (batch == NULL) {
+    return rows;
+  }
+  for (int i = 0; i < batch->num_results; i++) {
+    rows.insert(std::string(batch->results[i].row.start,
+                            batch->results[i].row.len));
+  }
+  DestroySearchResultBatch(batch);
+  return rows;
+}
+
+std::multiset<std::string> QueryRows(Index index, const std::string &query) {
+  int owned;
+  MovieSet set = FindQueryMovies(index, query.c_str(), &owned);
+  if (set == NULL) {
+    return std::multiset<std::string>();
+  }
+  std::multiset<std::string> rows = BatchRows(FetchMovieSetRows(index, set));
+  if (owned) {
+    DestroyMovieSet(set);
+  }
+  return rows;
+}
+
+std::vector<uint32_t> PostingListRows(PostingList list) {
+  std::vector<uint32_t> rows;
+  if (NumRowsInPostingList(list) == 0) {
+    return rows;
+  }
+  PostingListIter iter;
+  PostingListIterInit(&iter, list);
+  do {
+    rows.push_back(PostingListIterGet(&iter));
+  } while (PostingListIterNext(&iter) == 0);
+  return rows;
+}
+
+// The rows a ranked query finds, all of them, with their scores.
+static std::multiset<std::pair<std::string, double>> RankedRows(
+    Index index, const std::string &query) {
+  std::multiset<std::pair<std::string, double>> rows;
+  SearchResultBatch batch = FindTopMovies(index, query.c_str(), 100000);
+  if (batch == NULL) {
+    ADD_FAILURE() << "FindTopMovies failed for " << query;
+    return rows;
+  }
+  for (int i = 0; i < batch->num_results; i++) {
+    rows.insert(std::make_pair(std::string(batch->results[i].row.start,
+                                           batch->results[i].row.len),
+                               batch->results[i].score));
+  }
+  DestroySearchResultBatch(batch);
+  return rows;
+}
+
+void ExpectSameMovies(Index expected, Index index,
+                      const std::vector<std::string> &queries) {
+  for (const std::string &query : queries) {
+    std::multiset<std::string> expected_rows = QueryRows(expected, query);
+    std::multiset<std::string> rows = QueryRows(index, query);
+    EXPECT_EQ(expected_rows.size(), rows.size()) << query;
+    EXPECT_TRUE(expected_rows == rows) << query;
+    EXPECT_TRUE(RankedRows(expected, query) == RankedRows(index, query))
+        << query;
+  }
+}
@@ -0,0 +1,80 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// What the a9 tests share: small directories of made-up movies to
+// index, and ways to see which rows an index finds.
+
+#ifndef TEST_DATA_H
+#define TEST_DATA_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "DocIdMap.h"
+  #include "MovieIndex.h"
+  #include "PostingList.h"
+  #include "QueryProcessor.h"
+}
+
+// A movie's row, with the given title and year.
+std::string MovieRow(int id, const std::string &title, int year);
+
+// The words of a row's title, the way the index splits them.
+std::vector<std::string> TitleWords(const std::string &row);
+
+// Makes an empty directory under /tmp; its path ends in '/'.
+std::string MakeDataDir();
+
+// Removes a directory made by MakeDataDir, and everything in it.
+void RemoveDataDir(const std::string &dir);
+
+// Writes rows to dir + name, replacing the file if it's there.
+void WriteDataFile(const std::string &dir, const std::string &name,
+                   const std::vector<std::string> &rows);
+
+// Writes num_files files of made-up movies to dir, every third one in
+// a subdirectory. The titles are a few words from a small vocabulary,
+// so most words are in lots of titles. The same seed gives the same
+// movies.
+//
+// Returns every row written.
+std::vector<std::string> WriteMovies(const std::string &dir, int num_files,
+                                     int rows_per_file, unsigned seed);
+
+// Crawls dir into docs and indexes it with ParseTheFiles.
+Index IndexDataDir(const std::string &dir, DocIdMap docs,
+                   int keep_positions);
+
+// The rows in a batch, and destroys it.
+std::multiset<std::string> BatchRows(SearchResultBatch batch);
+
+// The rows an index finds for a query (see FindQueryMovies).
+std::multiset<std::string> QueryRows(Index index, const std::string &query);
+
+// Every row of a posting list, in order.
+std::vector<uint32_t> PostingListRows(PostingList list);
+
+// Checks index finds the same rows for each query as expected does, and
+// ranks them with the same scores. The files can have different doc
+// ids in each.
+void ExpectSameMovies(Index expected, Index index,
+                      const std::vector<std::string> &queries);
+
+#endif  // TEST_DATA_H
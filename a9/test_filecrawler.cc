@@ -0,0 +1,106 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for crawling on many threads: the ids it gives the files have
+// to be the ones CrawlFilesToMap gives, and crawling while parsing has
+// to build the index ParseTheFiles does.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "FileCrawler.h"
+  #include "FileParser.h"
+}
+
+static const std::vector<std::string> kQueries = {
+  "love", "the", "star night", "war OR ship", "king NOT the",
+  "(dark OR blue) city NOT of", "\"the love\"", "\"of the king\"",
+  "\"last game\" OR \"blue river\"", "nosuchword"
+};
+
+class FileCrawlerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    // A few levels of directories, every third file a level deeper.
+    WriteMovies(dir_, 9, 150, 24);
+    WriteMovies(dir_ + "a/", 7, 150, 25);
+    WriteMovies(dir_ + "a/b/c/", 5, 150, 26);
+    WriteMovies(dir_ + "d/", 4, 150, 27);
+  }
+
+  void TearDown() override {
+    RemoveDataDir(dir_);
+  }
+
+  std::string dir_;
+};
+
+TEST_F(FileCrawlerTest, ParallelCrawlGivesSameIds) {
+  DocIdMap expected = CreateDocIdMap();
+  CrawlFilesToMap(dir_.c_str(), expected);
+  ASSERT_EQ(25, NumElemsInHashtable(expected));
+  for (int num_threads : {1, 3, 8}) {
+    SCOPED_TRACE(num_threads);
+    DocIdMap docs = CreateDocIdMap();
+    CrawlFilesToMap_Parallel(dir_.c_str(), docs, num_threads);
+    ASSERT_EQ(NumElemsInHashtable(expected), NumElemsInHashtable(docs));
+    for (uint64_t id = 1; id <= (uint64_t)NumElemsInHashtable(expected);
+         id++) {
+      char *file = GetFileFromId(docs, id);
+      ASSERT_TRUE(file != NULL) << id;
+      EXPECT_STREQ(GetFileFromId(expected, id), file) << id;
+    }
+    DestroyDocIdMap(docs);
+  }
+  DestroyDocIdMap(expected);
+}
+
+// Runs with and without positions.
+class CrawlAndParseTest : public FileCrawlerTest,
+                          public ::testing::WithParamInterface<int> {
+};
+
+TEST_P(CrawlAndParseTest, SameAsSequential) {
+  DocIdMap expected_docs = CreateDocIdMap();
+  Index expected = IndexDataDir(dir_, expected_docs, GetParam());
+  for (int num_threads : {1, 3, 8}) {
+    SCOPED_TRACE(num_threads);
+    DocIdMap docs = CreateDocIdMap();
+    Index index = CreateIndex();
+    index->keep_positions = GetParam();
+    ASSERT_EQ(0, CrawlAndParseFiles(dir_.c_str(), docs, index,
+                                    num_threads));
+    EXPECT_EQ(NumElemsInHashtable(expected_docs), NumElemsInHashtable(docs));
+    EXPECT_EQ(NumElemsInHashtable(expected->ht),
+              NumElemsInHashtable(index->ht));
+    ExpectSameMovies(expected, index, kQueries);
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+  }
+  DestroyOffsetIndex(expected);
+  DestroyDocIdMap(expected_docs);
+}
+
+INSTANTIATE_TEST_CASE_P(Positions, CrawlAndParseTest, ::testing::Values(0, 1));
@@ -0,0 +1,95 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for parsing on many threads: however many workers the pool or
+// the shards have, they have to build the index ParseTheFiles does.
+
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "FileCrawler.h"
+  #include "FileParser.h"
+}
+
+static const std::vector<std::string> kQueries = {
+  "love", "the", "star night", "war OR ship", "king NOT the",
+  "(dark OR blue) city NOT of", "\"the love\"", "\"of the king\"",
+  "\"last game\" OR \"blue river\"", "nosuchword"
+};
+
+typedef int (*ParseFn)(DocIdMap docs, Index index, int num_threads);
+
+// Runs with and without positions.
+class FileParserTest : public ::testing::TestWithParam<int> {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    WriteMovies(dir_, 12, 200, 7);
+    // One file big enough to be split into chunks.
+    WriteMovies(dir_ + "big/", 1, 18000, 8);
+    struct stat st;
+    ASSERT_EQ(0, stat((dir_ + "big/movies000").c_str(), &st));
+    ASSERT_GT(st.st_size, 1 << 20);
+    expected_docs_ = CreateDocIdMap();
+    expected_ = IndexDataDir(dir_, expected_docs_, GetParam());
+  }
+
+  void TearDown() override {
+    DestroyOffsetIndex(expected_);
+    DestroyDocIdMap(expected_docs_);
+    RemoveDataDir(dir_);
+  }
+
+  // Parses the directory with parse on 1, 3 and 8 threads, and checks
+  // each index against ParseTheFiles's.
+  void ExpectSameAsSequential(ParseFn parse) {
+    for (int num_threads : {1, 3, 8}) {
+      SCOPED_TRACE(num_threads);
+      DocIdMap docs = CreateDocIdMap();
+      CrawlFilesToMap(dir_.c_str(), docs);
+      Index index = CreateIndex();
+      index->keep_positions = GetParam();
+      ASSERT_EQ(0, parse(docs, index, num_threads));
+      EXPECT_EQ(NumElemsInHashtable(expected_->ht),
+                NumElemsInHashtable(index->ht));
+      ExpectSameMovies(expected_, index, kQueries);
+      DestroyOffsetIndex(index);
+      DestroyDocIdMap(docs);
+    }
+  }
+
+  std::string dir_;
+  DocIdMap expected_docs_;
+  Index expected_;
+};
+
+TEST_P(FileParserTest, Pool) {
+  ExpectSameAsSequential(&ParseTheFiles_Pool);
+}
+
+TEST_P(FileParserTest, Sharded) {
+  ExpectSameAsSequential(&ParseTheFiles_Sharded);
+}
+
+INSTANTIATE_TEST_CASE_P(Positions, FileParserTest, ::testing::Values(0, 1));
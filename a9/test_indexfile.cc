@@ -0,0 +1,257 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for saving an index to a file and loading it back: it has to
+// answer queries as the index it was saved from did, and be turned
+// away if it's been damaged or its files have changed.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "IndexFile.h"
+}
+
+static const char *kQueries[] = {
+  "love", "the of", "star OR ship", "war NOT love", "\"the king\"",
+  "(dark OR blue) city NOT \"city of\"", "nosuchword"
+};
+
+class IndexFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    WriteMovies(dir_, 6, 500, 7);
+    path_ = dir_ + "saved.idx";
+    // The index file isn't in the data, so it's kept out of the crawl.
+    data_ = dir_ + "data/";
+    ASSERT_EQ(0, system(("mkdir " + data_ + " && mv " + dir_ + "movies* " +
+                         dir_ + "sub " + data_).c_str()));
+  }
+
+  void TearDown() override {
+    RemoveDataDir(dir_);
+  }
+
+  // Builds an index of the data and saves it.
+  void Save(int keep_positions) {
+    DocIdMap docs = CreateDocIdMap();
+    Index index = IndexDataDir(data_, docs, keep_positions);
+    ASSERT_EQ(0, WriteIndexFile(index, docs, path_.c_str()));
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+  }
+
+  // Checks a loaded index finds what one built from the data now does.
+  void ExpectSameAsBuilt(Index loaded, int keep_positions) {
+    DocIdMap docs = CreateDocIdMap();
+    Index built = IndexDataDir(data_, docs, keep_positions);
+    EXPECT_EQ(keep_positions, loaded->keep_positions);
+    for (const char *query : kQueries) {
+      std::multiset<std::string> expected = QueryRows(built, query);
+      EXPECT_TRUE(expected == QueryRows(loaded, query)) << query;
+      SearchResultBatch expected_top = FindTopMovies(built, query, 20);
+      SearchResultBatch loaded_top = FindTopMovies(loaded, query, 20);
+      ASSERT_FALSE(expected_top == NULL || loaded_top == NULL);
+      ASSERT_EQ(expected_top->num_results, loaded_top->num_results);
+      for (int i = 0; i < loaded_top->num_results; i++) {
+        EXPECT_EQ(expected_top->results[i].doc_id,
+                  loaded_top->results[i].doc_id) << query;
+        EXPECT_EQ(expected_top->results[i].row_id,
+                  loaded_top->results[i].row_id) << query;
+        EXPECT_EQ(expected_top->results[i].score,
+                  loaded_top->results[i].score) << query;
+      }
+      DestroySearchResultBatch(expected_top);
+      DestroySearchResultBatch(loaded_top);
+    }
+    DestroyOffsetIndex(built);
+    DestroyDocIdMap(docs);
+  }
+
+  // Whether the saved index loads.
+  bool Loads() {
+    DocIdMap docs;
+    Index index = LoadIndexFile(path_.c_str(), &docs);
+    if (index == NULL) {
+      return false;
+    }
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+    return true;
+  }
+
+  // Overwrites a byte of a file, in place.
+  void Corrupt(const std::string &path, off_t offset) {
+    int fd = open(path.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    unsigned char byte;
+    ASSERT_EQ(1, pread(fd, &byte, 1, offset));
+    byte ^= 0x5a;
+    ASSERT_EQ(1, pwrite(fd, &byte, 1, offset));
+    close(fd);
+  }
+
+  off_t SavedSize() {
+    struct stat st;
+    EXPECT_EQ(0, stat(path_.c_str(), &st));
+    return st.st_size;
+  }
+
+  std::string dir_;
+  std::string data_;
+  std::string path_;
+};
+
+TEST_F(IndexFileTest, RoundTrip) {
+  for (int keep_positions = 0; keep_positions <= 1; keep_positions++) {
+    Save(keep_positions);
+    DocIdMap docs;
+    Index index = LoadIndexFile(path_.c_str(), &docs);
+    ASSERT_FALSE(index == NULL);
+    EXPECT_EQ((void*)INDEX_FILE_BASE, index->mapping);
+    ExpectSameAsBuilt(index, keep_positions);
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+  }
+}
+
+TEST_F(IndexFileTest, Relocated) {
+  Save(1);
+  // With the first one where they expect to be, the second has to be
+  // moved.
+  DocIdMap first_docs;
+  Index first = LoadIndexFile(path_.c_str(), &first_docs);
+  ASSERT_FALSE(first == NULL);
+  DocIdMap docs;
+  Index index = LoadIndexFile(path_.c_str(), &docs);
+  ASSERT_FALSE(index == NULL);
+  EXPECT_NE(first->mapping, index->mapping);
+  ExpectSameAsBuilt(index, 1);
+  DestroyOffsetIndex(first);
+  DestroyDocIdMap(first_docs);
+  ExpectSameAsBuilt(index, 1);
+  DestroyOffsetIndex(index);
+  DestroyDocIdMap(docs);
+
+  // Or anything else could be there.
+  void *taken = mmap((void*)INDEX_FILE_BASE, 1 << 20, PROT_READ,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  ASSERT_EQ((void*)INDEX_FILE_BASE, taken);
+  index = LoadIndexFile(path_.c_str(), &docs);
+  ASSERT_FALSE(index == NULL);
+  EXPECT_NE((void*)INDEX_FILE_BASE, index->mapping);
+  ExpectSameAsBuilt(index, 1);
+  DestroyOffsetIndex(index);
+  DestroyDocIdMap(docs);
+  munmap(taken, 1 << 20);
+}
+
+TEST_F(IndexFileTest, Damaged) {
+  EXPECT_FALSE(Loads());
+
+  Save(0);
+  ASSERT_TRUE(Loads());
+  off_t size = SavedSize();
+  // The header starts with the magic, the version and layout, where
+  // the image goes, and how big it is.
+  uint64_t image_size;
+  int fd = open(path_.c_str(), O_RDONLY);
+  ASSERT_EQ((ssize_t)sizeof(image_size),
+            pread(fd, &image_size, sizeof(image_size), 24));
+  close(fd);
+  off_t image_end = INDEX_FILE_HEADER_SIZE + image_size;
+  ASSERT_LT(image_end, size);
+  for (off_t offset : {(off_t)0, (off_t)8, (off_t)24, (off_t)100,
+                       (off_t)INDEX_FILE_HEADER_SIZE,
+                       INDEX_FILE_HEADER_SIZE + (off_t)image_size / 2,
+                       image_end - 1}) {
+    Corrupt(path_, offset);
+    EXPECT_FALSE(Loads()) << offset;
+    Corrupt(path_, offset);
+    EXPECT_TRUE(Loads()) << offset;
+  }
+
+  // The list of where the pointers are is only needed to move the
+  // image, so it's only checked then.
+  DocIdMap docs;
+  Index first = LoadIndexFile(path_.c_str(), &docs);
+  ASSERT_FALSE(first == NULL);
+  for (off_t offset : {image_end, size - 1}) {
+    Corrupt(path_, offset);
+    EXPECT_FALSE(Loads()) << offset;
+    Corrupt(path_, offset);
+    EXPECT_TRUE(Loads()) << offset;
+  }
+  DestroyOffsetIndex(first);
+  DestroyDocIdMap(docs);
+
+  ASSERT_EQ(0, truncate(path_.c_str(), size - 1));
+  EXPECT_FALSE(Loads());
+  ASSERT_EQ(0, truncate(path_.c_str(), INDEX_FILE_HEADER_SIZE / 2));
+  EXPECT_FALSE(Loads());
+  ASSERT_EQ(0, truncate(path_.c_str(), 0));
+  EXPECT_FALSE(Loads());
+}
+
+TEST_F(IndexFileTest, FilesChanged) {
+  std::string file = data_ + "movies001";
+  struct stat st;
+
+  // The same file and size, but written since.
+  Save(0);
+  Corrupt(file, 3);
+  EXPECT_FALSE(Loads());
+
+  // Longer.
+  Save(0);
+  ASSERT_EQ(0, system(("echo '" + MovieRow(1, "new one", 2020) + "' >> " +
+                       data_ + "sub/movies002").c_str()));
+  EXPECT_FALSE(Loads());
+
+  // Swapped for a copy that looks the same, even down to when it was
+  // written.
+  Save(0);
+  ASSERT_TRUE(Loads());
+  ASSERT_EQ(0, stat(file.c_str(), &st));
+  ASSERT_EQ(0, system(("cp -p " + file + " " + file + ".copy && mv " +
+                       file + ".copy " + file).c_str()));
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  ASSERT_EQ(0, utimensat(AT_FDCWD, file.c_str(), times, 0));
+  EXPECT_FALSE(Loads());
+
+  // Gone.
+  Save(0);
+  ASSERT_EQ(0, unlink((data_ + "movies000").c_str()));
+  EXPECT_FALSE(Loads());
+
+  // A new file doesn't matter; the index just doesn't have it.
+  Save(0);
+  WriteDataFile(data_, "movies999", {MovieRow(2, "newer one", 2021)});
+  EXPECT_TRUE(Loads());
+}
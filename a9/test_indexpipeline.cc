@@ -0,0 +1,146 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for building an index through the pipeline: whatever size its
+// stages and queues, it has to build the index ParseTheFiles does.
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "FileParser.h"
+  #include "IndexPipeline.h"
+}
+
+static const std::vector<std::string> kQueries = {
+  "love", "the", "star night", "war OR ship", "king NOT the",
+  "(dark OR blue) city NOT of", "\"the love\"", "\"of the king\"",
+  "\"last game\" OR \"blue river\"", "nosuchword"
+};
+
+TEST(IndexPipeline, ParseConfig) {
+  PipelineConfig config;
+  ASSERT_EQ(0, ParsePipelineConfig("1,2,3,4,5", &config));
+  EXPECT_EQ(1, config.crawl_threads);
+  EXPECT_EQ(2, config.read_threads);
+  EXPECT_EQ(3, config.parse_threads);
+  EXPECT_EQ(4, config.tokenize_threads);
+  EXPECT_EQ(5, config.insert_threads);
+  EXPECT_EQ(0, config.queue_capacity);
+  ASSERT_EQ(0, ParsePipelineConfig("0,0,0,0,0,16", &config));
+  EXPECT_EQ(0, config.parse_threads);
+  EXPECT_EQ(16, config.queue_capacity);
+
+  const char *bad[] = {
+    "", "1,2,3,4", "1,2,3,4,5,6,7", "1,2,x,4,5", "1,,3,4,5", "1,2,3,4,5,"
+  };
+  for (const char *spec : bad) {
+    EXPECT_EQ(-1, ParsePipelineConfig(spec, &config)) << spec;
+  }
+}
+
+// Runs with and without positions.
+class IndexPipelineTest : public ::testing::TestWithParam<int> {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+  }
+
+  void TearDown() override {
+    RemoveDataDir(dir_);
+  }
+
+  // Builds an index of the directory through a pipeline made to spec,
+  // or the default one, and checks it against ParseTheFiles's.
+  void ExpectSameAsSequential(const char *spec) {
+    PipelineConfig config;
+    if (spec != NULL) {
+      ASSERT_EQ(0, ParsePipelineConfig(spec, &config)) << spec;
+    }
+    DocIdMap docs = CreateDocIdMap();
+    Index index = CreateIndex();
+    index->keep_positions = GetParam();
+    PipelineStats stats;
+    ASSERT_EQ(0, BuildIndexPipelined(dir_.c_str(), docs, index,
+                                     spec == NULL ? NULL : &config, &stats));
+
+    DocIdMap sequential_docs = CreateDocIdMap();
+    Index sequential = IndexDataDir(dir_, sequential_docs, GetParam());
+    EXPECT_EQ(NumElemsInHashtable(sequential_docs), NumElemsInHashtable(docs));
+    EXPECT_EQ(NumElemsInHashtable(sequential->ht),
+              NumElemsInHashtable(index->ht));
+    ExpectSameMovies(sequential, index, kQueries);
+
+    // Every file is crawled, and every one with anything in it is read
+    // and parsed, once.
+    EXPECT_EQ(NumElemsInHashtable(docs), stats.stages[0].items);
+    EXPECT_EQ(stats.stages[1].items, stats.stages[2].items);
+    EXPECT_EQ(stats.stages[1].bytes, stats.stages[2].bytes);
+
+    DestroyOffsetIndex(sequential);
+    DestroyDocIdMap(sequential_docs);
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+  }
+
+  std::string dir_;
+};
+
+TEST_P(IndexPipelineTest, Configs) {
+  WriteMovies(dir_, 24, 400, 25);
+  ExpectSameAsSequential(NULL);
+  ExpectSameAsSequential("1,1,1,1,1");
+  // Queues of one item, so every stage keeps waiting on the next.
+  ExpectSameAsSequential("1,1,1,1,1,1");
+  ExpectSameAsSequential("2,3,2,4,3,2");
+  ExpectSameAsSequential("4,1,4,1,8");
+  ExpectSameAsSequential("1,4,1,6,1,3");
+}
+
+TEST_P(IndexPipelineTest, ManySmallFiles) {
+  WriteMovies(dir_, 120, 3, 250);
+  ExpectSameAsSequential("2,2,2,2,2,2");
+  ExpectSameAsSequential("3,1,3,2,4");
+}
+
+TEST_P(IndexPipelineTest, OddFiles) {
+  WriteMovies(dir_, 4, 200, 2500);
+  WriteDataFile(dir_, "empty", {});
+  WriteDataFile(dir_, "notitle", {MovieRow(1, "-", 2001)});
+  // A last row without a newline, and a row that isn't a movie.
+  FILE *file = fopen((dir_ + "nonewline").c_str(), "w");
+  ASSERT_FALSE(file == NULL);
+  fprintf(file, "%s\n", MovieRow(2, "night of the day", 2002).c_str());
+  fprintf(file, "not a movie\n");
+  fprintf(file, "%s", MovieRow(3, "the last night", 2003).c_str());
+  fclose(file);
+  ExpectSameAsSequential(NULL);
+  ExpectSameAsSequential("1,2,2,2,2,1");
+}
+
+TEST_P(IndexPipelineTest, EmptyDirectory) {
+  ExpectSameAsSequential(NULL);
+  ExpectSameAsSequential("2,2,2,2,2,1");
+}
+
+INSTANTIATE_TEST_CASE_P(Positions, IndexPipelineTest, ::testing::Values(0, 1));
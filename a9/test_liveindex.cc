@@ -0,0 +1,316 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for LiveIndex: after every update it has to find what an index
+// built from scratch from the directory as it is then would.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "IndexFile.h"
+  #include "LiveIndex.h"
+}
+
+static const std::vector<std::string> kQueries = {
+  "love", "the", "star night", "war OR ship", "king NOT the",
+  "(dark OR blue) city NOT of", "\"the love\"", "\"of the king\"",
+  "zebra", "zebra OR love", "\"zebra crossing\"", "nosuchword"
+};
+
+// Runs with and without positions.
+class LiveIndexTest : public ::testing::TestWithParam<int> {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    WriteMovies(dir_, 6, 300, 22);
+    DocIdMap docs = CreateDocIdMap();
+    Index index = IndexDataDir(dir_, docs, GetParam());
+    live_ = CreateLiveIndex(dir_.c_str(), index, docs);
+    ASSERT_FALSE(live_ == NULL);
+  }
+
+  void TearDown() override {
+    DestroyLiveIndex(live_);
+    RemoveDataDir(dir_);
+  }
+
+  // Checks the current version finds what a fresh index would.
+  void ExpectUpToDate() {
+    DocIdMap docs = CreateDocIdMap();
+    Index fresh = IndexDataDir(dir_, docs, GetParam());
+    Index version = AcquireIndex(live_);
+    ExpectSameMovies(fresh, version, kQueries);
+    ReleaseIndex(live_, version);
+    DestroyOffsetIndex(fresh);
+    DestroyDocIdMap(docs);
+  }
+
+  // Some rows that only new files have.
+  std::vector<std::string> NewRows(int id, int num_rows) {
+    std::vector<std::string> rows;
+    for (int i = 0; i < num_rows; i++) {
+      rows.push_back(MovieRow(id + i, i % 2 ? "zebra crossing" :
+                              "the love zebra", 1990 + i % 30));
+    }
+    return rows;
+  }
+
+  void Run(const std::string &command) {
+    ASSERT_EQ(0, system(("cd " + dir_ + " && " + command).c_str()))
+        << command;
+  }
+
+  std::string dir_;
+  LiveIndex live_;
+};
+
+TEST_P(LiveIndexTest, NoChanges) {
+  EXPECT_EQ(0, UpdateLiveIndex(live_));
+  EXPECT_EQ(1, NumSegmentsInLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, Updates) {
+  // One file changed, one gone and one new.
+  Run("head -100 movies001 > changed && mv changed movies001");
+  Run("rm sub/movies002");
+  WriteDataFile(dir_, "added", NewRows(800000, 50));
+  EXPECT_EQ(3, UpdateLiveIndex(live_));
+  ExpectUpToDate();
+  EXPECT_EQ(0, UpdateLiveIndex(live_));
+
+  // The new file changed again, and a new directory.
+  WriteDataFile(dir_, "added", NewRows(810000, 80));
+  WriteDataFile(dir_, "more/one", NewRows(820000, 10));
+  WriteDataFile(dir_, "more/two", NewRows(830000, 10));
+  EXPECT_EQ(3, UpdateLiveIndex(live_));
+  ExpectUpToDate();
+
+  // All of that gone, and a file from the start too.
+  Run("rm -r more added movies000");
+  EXPECT_EQ(4, UpdateLiveIndex(live_));
+  ExpectUpToDate();
+
+  // Back again, under the same names.
+  WriteDataFile(dir_, "added", NewRows(840000, 30));
+  Run("cp movies003 movies000");
+  EXPECT_EQ(2, UpdateLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, ChangedInPlace) {
+  // The same file, the same size, just written since: the first
+  // letter of the first title is changed.
+  FILE *file = fopen((dir_ + "movies003").c_str(), "r+");
+  ASSERT_FALSE(file == NULL);
+  char row[256];
+  ASSERT_FALSE(fgets(row, sizeof(row), file) == NULL);
+  std::string first = row;
+  size_t title = first.find('|', first.find('|') + 1) + 1;
+  ASSERT_EQ(0, fseek(file, title, SEEK_SET));
+  fputc('q', file);
+  fclose(file);
+  EXPECT_EQ(1, UpdateLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, ManyUpdates) {
+  for (int i = 0; i < 12; i++) {
+    WriteDataFile(dir_, "grows", NewRows(850000, 10 + i * 10));
+    if (i % 4 == 3) {
+      Run("head -" + std::to_string(50 * i) + " movies004 > cut && " +
+          "mv cut movies004");
+    }
+    ASSERT_LT(0, UpdateLiveIndex(live_));
+  }
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, OldVersionsStayTheSame) {
+  Index before = AcquireIndex(live_);
+  std::multiset<std::string> love = QueryRows(before, "love");
+  WriteDataFile(dir_, "added", NewRows(860000, 40));
+  EXPECT_EQ(1, UpdateLiveIndex(live_));
+
+  // A query that already had the index carries on with it.
+  EXPECT_TRUE(love == QueryRows(before, "love"));
+  EXPECT_TRUE(QueryRows(before, "zebra").empty());
+  ReleaseIndex(live_, before);
+
+  Index after = AcquireIndex(live_);
+  EXPECT_EQ(love.size() + 20, QueryRows(after, "love").size());
+  EXPECT_EQ(40u, QueryRows(after, "zebra").size());
+  ReleaseIndex(live_, after);
+}
+
+TEST_P(LiveIndexTest, MergeSmallSegments) {
+  EXPECT_EQ(0, MergeLiveIndex(live_));
+  for (int i = 0; i < 3; i++) {
+    WriteDataFile(dir_, "small" + std::to_string(i), NewRows(900000 + i * 100,
+                                                             20));
+    EXPECT_EQ(1, UpdateLiveIndex(live_));
+  }
+  // The index it started with is small enough to be merged with them.
+  EXPECT_EQ(4, NumSegmentsInLiveIndex(live_));
+  Run("rm small1 && head -150 movies001 > cut && mv cut movies001");
+  EXPECT_EQ(2, UpdateLiveIndex(live_));
+  // small1's segment has nothing left in it, so it's dropped.
+  EXPECT_EQ(4, NumSegmentsInLiveIndex(live_));
+  EXPECT_EQ(4, MergeLiveIndex(live_));
+  EXPECT_EQ(1, NumSegmentsInLiveIndex(live_));
+  EXPECT_EQ(0, MergeLiveIndex(live_));
+  ExpectUpToDate();
+
+  // Files in the merged segment can still change and go.
+  WriteDataFile(dir_, "small0", NewRows(910000, 5));
+  Run("rm small2 movies003");
+  EXPECT_EQ(3, UpdateLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, MergeBySize) {
+  // A segment four times the smallest tier's size isn't merged with
+  // the small ones.
+  std::vector<std::string> big;
+  for (int i = 0; i < 4 * 4 * 1024 / 100 + 1; i++) {
+    std::vector<std::string> rows = NewRows(1000000 + i * 100, 100);
+    big.insert(big.end(), rows.begin(), rows.end());
+  }
+  WriteDataFile(dir_, "big", big);
+  EXPECT_EQ(1, UpdateLiveIndex(live_));
+  for (int i = 0; i < 2; i++) {
+    WriteDataFile(dir_, "small" + std::to_string(i), NewRows(920000 + i * 100,
+                                                             20));
+    EXPECT_EQ(1, UpdateLiveIndex(live_));
+  }
+  EXPECT_EQ(4, NumSegmentsInLiveIndex(live_));
+  EXPECT_EQ(0, MergeLiveIndex(live_));
+
+  WriteDataFile(dir_, "small2", NewRows(930000, 20));
+  EXPECT_EQ(1, UpdateLiveIndex(live_));
+  EXPECT_EQ(4, MergeLiveIndex(live_));
+  EXPECT_EQ(2, NumSegmentsInLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, MergeMostlyGone) {
+  // A segment that's mostly files that have gone is copied without
+  // them, on its own.
+  WriteDataFile(dir_, "small", NewRows(940000, 20));
+  EXPECT_EQ(1, UpdateLiveIndex(live_));
+  Run("rm movies000 movies001 movies003 sub/movies002");
+  EXPECT_EQ(4, UpdateLiveIndex(live_));
+  EXPECT_EQ(2, NumSegmentsInLiveIndex(live_));
+  EXPECT_EQ(1, MergeLiveIndex(live_));
+  EXPECT_EQ(2, NumSegmentsInLiveIndex(live_));
+  EXPECT_EQ(0, MergeLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, MergeInBackground) {
+  ASSERT_EQ(0, StartMerging(live_));
+  for (int i = 0; i < 30; i++) {
+    WriteDataFile(dir_, "small" + std::to_string(i % 11),
+                  NewRows(950000 + i * 100, 10 + i));
+    EXPECT_EQ(1, UpdateLiveIndex(live_));
+    if (i % 10 == 9) {
+      ExpectUpToDate();
+    }
+  }
+  // Thirty updates, and never more than a few segments of each size
+  // once the merges catch up.
+  for (int tries = 0; tries < 100 && NumSegmentsInLiveIndex(live_) > 4;
+       tries++) {
+    usleep(50000);
+  }
+  EXPECT_GE(4, NumSegmentsInLiveIndex(live_));
+  ExpectUpToDate();
+}
+
+struct Reader {
+  LiveIndex live;
+  volatile int stop;
+  int queries;
+};
+
+static void *RunQueries(void *arg) {
+  Reader *reader = (Reader*)arg;
+  while (!reader->stop) {
+    Index index = AcquireIndex(reader->live);
+    const std::string &query = kQueries[reader->queries % kQueries.size()];
+    QueryRows(index, query);
+    SearchResultBatch top = FindTopMovies(index, query.c_str(), 5);
+    if (top != NULL) {
+      DestroySearchResultBatch(top);
+    }
+    ReleaseIndex(reader->live, index);
+    reader->queries++;
+  }
+  return NULL;
+}
+
+TEST_P(LiveIndexTest, QueriesDuringUpdates) {
+  Reader readers[3];
+  pthread_t threads[3];
+  for (int i = 0; i < 3; i++) {
+    readers[i] = {live_, 0, 0};
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, RunQueries, &readers[i]));
+  }
+  for (int i = 0; i < 10; i++) {
+    WriteDataFile(dir_, "new" + std::to_string(i % 4),
+                  NewRows(870000 + i * 100, 20 + i));
+    EXPECT_LT(0, UpdateLiveIndex(live_));
+  }
+  for (int i = 0; i < 3; i++) {
+    readers[i].stop = 1;
+    pthread_join(threads[i], NULL);
+    EXPECT_LT(0, readers[i].queries);
+  }
+  ExpectUpToDate();
+}
+
+TEST_P(LiveIndexTest, Save) {
+  WriteDataFile(dir_, "added", NewRows(880000, 60));
+  Run("rm movies001");
+  EXPECT_EQ(2, UpdateLiveIndex(live_));
+  std::string path = dir_.substr(0, dir_.size() - 1) + ".idx";
+  ASSERT_EQ(0, SaveLiveIndex(live_, path.c_str()));
+
+  DocIdMap saved_docs;
+  Index saved = LoadIndexFile(path.c_str(), &saved_docs);
+  unlink(path.c_str());
+  ASSERT_FALSE(saved == NULL);
+  DocIdMap docs = CreateDocIdMap();
+  Index fresh = IndexDataDir(dir_, docs, GetParam());
+  ExpectSameMovies(fresh, saved, kQueries);
+  DestroyOffsetIndex(saved);
+  DestroyDocIdMap(saved_docs);
+  DestroyOffsetIndex(fresh);
+  DestroyDocIdMap(docs);
+}
+
+INSTANTIATE_TEST_CASE_P(Positions, LiveIndexTest, ::testing::Values(0, 1));
@@ -0,0 +1,202 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for phrase queries, which match with the positions of each
+// word in a title instead of reading the rows.
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "BooleanQuery.h"
+  #include "MovieSet.h"
+}
+
+// Whether a title has the phrase's words in order, next to each other,
+// with all of them at positions the index keeps.
+static bool HasPhrase(const std::vector<std::string> &words,
+                      const std::vector<std::string> &phrase) {
+  for (size_t start = 0; start + phrase.size() <= words.size() &&
+           start + phrase.size() - 1 <= TITLE_MAX_POSITION; start++) {
+    bool found = true;
+    for (size_t i = 0; found && i < phrase.size(); i++) {
+      found = words[start + i] == phrase[i];
+    }
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool HasWords(const std::vector<std::string> &words,
+                     const std::vector<std::string> &phrase) {
+  std::set<std::string> title(words.begin(), words.end());
+  for (const std::string &word : phrase) {
+    if (title.count(word) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string Quote(const std::vector<std::string> &phrase) {
+  std::string query = "\"";
+  for (const std::string &word : phrase) {
+    query += word + " ";
+  }
+  return query + "\"";
+}
+
+TEST(PhraseQuery, Positions) {
+  MovieSet set = CreateMovieSet((char*)"the");
+  ASSERT_FALSE(set == NULL);
+  EXPECT_TRUE(set->doc_positions == NULL);
+  ASSERT_EQ(0, AddMovieWordToSet(set, 3, 10, 0));
+  ASSERT_EQ(0, AddMovieWordToSet(set, 3, 10, 4));
+  ASSERT_EQ(0, AddMovieWordToSet(set, 3, 12, TITLE_MAX_POSITION));
+  // Too far into the title to be kept, though the row still is.
+  ASSERT_EQ(0, AddMovieWordToSet(set, 3, 13, TITLE_MAX_POSITION + 1));
+  ASSERT_FALSE(set->doc_positions == NULL);
+  EXPECT_EQ(3, NumMoviesInSet(set));
+
+  HTKeyValue kvp;
+  ASSERT_EQ(0, LookupInHashtable(set->doc_positions, 3, &kvp));
+  PostingList positions = (PostingList)kvp.value;
+  std::vector<uint32_t> expected = {
+    10 << TITLE_POSITION_BITS, 10 << TITLE_POSITION_BITS | 4,
+    12 << TITLE_POSITION_BITS | TITLE_MAX_POSITION
+  };
+  std::vector<uint32_t> found;
+  PostingListIter iter;
+  PostingListIterInit(&iter, positions);
+  do {
+    found.push_back(PostingListIterGet(&iter));
+  } while (PostingListIterNext(&iter) == 0);
+  EXPECT_EQ(expected, found);
+  DestroyMovieSet(set);
+}
+
+class PhraseQueryRun : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    rows_ = WriteMovies(dir_, 5, 700, 19);
+    // Some titles of our own, with words repeated, and a long one with
+    // words past the last position kept.
+    std::string long_title;
+    for (int i = 0; i < TITLE_MAX_POSITION + 10; i++) {
+      long_title += i % 2 ? "war " : "love ";
+    }
+    long_title += "dark city";
+    std::vector<std::string> own = {
+      MovieRow(1, "the the the", 2001),
+      MovieRow(2, "the king of the night", 2002),
+      MovieRow(3, "night of the king", 2003),
+      MovieRow(4, "of the of the king", 2004),
+      MovieRow(5, long_title, 2005),
+      MovieRow(6, "-", 2006),
+    };
+    WriteDataFile(dir_, "own", own);
+    rows_.insert(rows_.end(), own.begin(), own.end());
+  }
+
+  void TearDown() override {
+    RemoveDataDir(dir_);
+  }
+
+  // Checks every phrase against an index with positions, and one
+  // without.
+  void ExpectPhrases(const std::vector<std::vector<std::string>> &phrases) {
+    for (int keep_positions = 0; keep_positions <= 1; keep_positions++) {
+      DocIdMap docs = CreateDocIdMap();
+      Index index = IndexDataDir(dir_, docs, keep_positions);
+      for (const std::vector<std::string> &phrase : phrases) {
+        std::multiset<std::string> expected;
+        for (const std::string &row : rows_) {
+          std::vector<std::string> words = TitleWords(row);
+          if (keep_positions ? HasPhrase(words, phrase)
+                             : HasWords(words, phrase)) {
+            expected.insert(row);
+          }
+        }
+        std::multiset<std::string> found = QueryRows(index, Quote(phrase));
+        EXPECT_EQ(expected.size(), found.size())
+            << Quote(phrase) << " keep_positions " << keep_positions;
+        EXPECT_TRUE(expected == found)
+            << Quote(phrase) << " keep_positions " << keep_positions;
+      }
+      DestroyOffsetIndex(index);
+      DestroyDocIdMap(docs);
+    }
+  }
+
+  std::string dir_;
+  std::vector<std::string> rows_;
+};
+
+TEST_F(PhraseQueryRun, MadeUpTitles) {
+  ExpectPhrases({
+    {"the", "love"}, {"love", "the"}, {"of", "the", "king"},
+    {"star", "star"}, {"dark", "night", "city"}, {"the", "nosuchword"},
+    {"game", "of", "the", "last", "day"}
+  });
+}
+
+TEST_F(PhraseQueryRun, OwnTitles) {
+  ExpectPhrases({
+    {"the", "the"}, {"the", "the", "the"}, {"the", "the", "the", "the"},
+    {"the", "king"}, {"of", "the", "king"}, {"the", "king", "of"},
+    {"of", "the", "of", "the"}, {"love", "war", "love"},
+    // Only these are further in than the last position kept.
+    {"war", "dark"}, {"dark", "city"}
+  });
+}
+
+TEST_F(PhraseQueryRun, WithOperators) {
+  DocIdMap docs = CreateDocIdMap();
+  Index index = IndexDataDir(dir_, docs, 1);
+  std::multiset<std::string> expected;
+  for (const std::string &row : rows_) {
+    std::vector<std::string> words = TitleWords(row);
+    std::set<std::string> title(words.begin(), words.end());
+    if ((HasPhrase(words, {"the", "king"}) ||
+         HasPhrase(words, {"star", "night"})) && title.count("of") == 0) {
+      expected.insert(row);
+    }
+  }
+  EXPECT_FALSE(expected.empty());
+  EXPECT_TRUE(expected ==
+              QueryRows(index, "(\"the king\" OR \"star night\") NOT of"));
+
+  expected.clear();
+  for (const std::string &row : rows_) {
+    std::vector<std::string> words = TitleWords(row);
+    if (HasPhrase(words, {"love", "war"}) &&
+        !HasPhrase(words, {"war", "love"})) {
+      expected.insert(row);
+    }
+  }
+  EXPECT_TRUE(expected == QueryRows(index, "\"love war\" NOT \"war love\""));
+  DestroyOffsetIndex(index);
+  DestroyDocIdMap(docs);
+}
@@ -0,0 +1,74 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for how PostingLists encode rows: gaps as varints, appended in
+// order, and rows that come out of order or more than once.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "PostingList.h"
+  #include "htll/Arena.h"
+}
+
+TEST(PostingList, Varints) {
+  PostingList list = CreatePostingList(NULL);
+  ASSERT_FALSE(list == NULL);
+  EXPECT_EQ(0, NumRowsInPostingList(list));
+
+  // The first row is written as it is, and every other one as the gap
+  // from the one before, 7 bits to a byte.
+  ASSERT_EQ(0, AddToPostingList(list, NULL, 5));
+  EXPECT_EQ(1u, list->len);
+  ASSERT_EQ(0, AddToPostingList(list, NULL, 5 + 127));
+  EXPECT_EQ(2u, list->len);
+  ASSERT_EQ(0, AddToPostingList(list, NULL, 5 + 127 + 128));
+  EXPECT_EQ(4u, list->len);
+  ASSERT_EQ(0, AddToPostingList(list, NULL, UINT32_MAX));
+  EXPECT_EQ(9u, list->len);
+  EXPECT_EQ(UINT32_MAX, list->last_row);
+
+  // Up to here it fit inside the struct; now it has to grow.
+  EXPECT_GT(list->capacity, (uint32_t)POSTING_INLINE_BYTES);
+  std::vector<uint32_t> expected = {5, 132, 260, UINT32_MAX};
+  EXPECT_EQ(expected, PostingListRows(list));
+  DestroyPostingList(list, NULL);
+}
+
+TEST(PostingList, OutOfOrderAndRepeated) {
+  Arena arena = CreateArena();
+  PostingList list = CreatePostingList(arena);
+  uint32_t rows[] = {40, 10, 30, 10, 20, 40, 0};
+  for (uint32_t row : rows) {
+    ASSERT_EQ(0, AddToPostingList(list, arena, row));
+  }
+  std::vector<uint32_t> expected = {0, 10, 20, 30, 40};
+  EXPECT_EQ(expected, PostingListRows(list));
+  EXPECT_EQ(5, NumRowsInPostingList(list));
+  DestroyArena(arena);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,136 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for a PostingList's skip table, and iterating over and skipping
+// through a list with it, whether it was built a row at a time, merged
+// or copied.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "PostingList.h"
+  #include "htll/Arena.h"
+}
+
+TEST(PostingList, SkipTable) {
+  PostingList list = CreatePostingList(NULL);
+  for (uint32_t i = 0; i <= POSTING_SKIP_ROWS; i++) {
+    ASSERT_EQ(0, AddToPostingList(list, NULL, i * 3));
+  }
+  // The row after the first POSTING_SKIP_ROWS gets the first skip.
+  ASSERT_EQ(1u, NumSkipsInPostingList(list));
+  EXPECT_EQ((uint32_t)POSTING_SKIP_ROWS * 3, list->skips[0].row);
+  EXPECT_EQ((uint32_t)POSTING_SKIP_ROWS, list->skips[0].index);
+
+  for (uint32_t i = POSTING_SKIP_ROWS + 1; i < 1000; i++) {
+    ASSERT_EQ(0, AddToPostingList(list, NULL, i * 3));
+  }
+  EXPECT_EQ(999u / POSTING_SKIP_ROWS, NumSkipsInPostingList(list));
+  for (uint32_t i = 0; i < NumSkipsInPostingList(list); i++) {
+    EXPECT_EQ((i + 1) * POSTING_SKIP_ROWS * 3, list->skips[i].row);
+  }
+
+  // Each block runs from one skip to the next.
+  uint32_t end;
+  EXPECT_TRUE(PostingListFindBlock(list, 5, &end) == NULL);
+  PostingSkip *skip = PostingListFindBlock(list, POSTING_SKIP_ROWS * 3 + 1,
+                                           &end);
+  ASSERT_FALSE(skip == NULL);
+  EXPECT_EQ(&list->skips[0], skip);
+  EXPECT_EQ(list->skips[1].row, end);
+  skip = PostingListFindBlock(list, 999 * 3, &end);
+  EXPECT_EQ(&list->skips[NumSkipsInPostingList(list) - 1], skip);
+  EXPECT_EQ(UINT32_MAX, end);
+
+  // Putting a row in the middle re-encodes the list, skips and all.
+  ASSERT_EQ(0, AddToPostingList(list, NULL, 4));
+  EXPECT_EQ(1001, NumRowsInPostingList(list));
+  EXPECT_EQ((uint32_t)(POSTING_SKIP_ROWS - 1) * 3, list->skips[0].row);
+  DestroyPostingList(list, NULL);
+}
+
+TEST(PostingList, SkipTo) {
+  PostingList list = CreatePostingList(NULL);
+  std::vector<uint32_t> rows;
+  for (uint32_t i = 0; i < 5000; i++) {
+    rows.push_back(i * 7 + (i % 5));
+    ASSERT_EQ(0, AddToPostingList(list, NULL, rows.back()));
+  }
+
+  // Every target lands on the first row at least that big, whether it's
+  // in the same block or many blocks on.
+  PostingListIter iter;
+  PostingListIterInit(&iter, list);
+  for (uint32_t target = 0; target <= rows.back(); target += 97) {
+    ASSERT_EQ(0, PostingListIterSkipTo(&iter, target));
+    EXPECT_EQ(*std::lower_bound(rows.begin(), rows.end(), target),
+              PostingListIterGet(&iter));
+  }
+
+  // A target it's already past leaves it where it is.
+  uint32_t at = PostingListIterGet(&iter);
+  ASSERT_EQ(0, PostingListIterSkipTo(&iter, 3));
+  EXPECT_EQ(at, PostingListIterGet(&iter));
+
+  // Past the end, it stops at the last row.
+  EXPECT_EQ(1, PostingListIterSkipTo(&iter, rows.back() + 1));
+  EXPECT_EQ(rows.back(), PostingListIterGet(&iter));
+  EXPECT_FALSE(PostingListIterHasNext(&iter));
+
+  // One long jump from the start.
+  PostingListIterInit(&iter, list);
+  ASSERT_EQ(0, PostingListIterSkipTo(&iter, rows[4321]));
+  EXPECT_EQ(rows[4321], PostingListIterGet(&iter));
+  ASSERT_EQ(0, PostingListIterNext(&iter));
+  EXPECT_EQ(rows[4322], PostingListIterGet(&iter));
+  DestroyPostingList(list, NULL);
+}
+
+TEST(PostingList, MergeAndCopy) {
+  Arena arena = CreateArena();
+  PostingList evens = CreatePostingList(arena);
+  PostingList odds = CreatePostingList(arena);
+  std::vector<uint32_t> all;
+  for (uint32_t i = 0; i < 300; i++) {
+    ASSERT_EQ(0, AddToPostingList(i % 2 ? odds : evens, arena, i));
+    all.push_back(i);
+  }
+  PostingList merged = MergePostingLists(evens, odds, arena);
+  ASSERT_FALSE(merged == NULL);
+  EXPECT_EQ(all, PostingListRows(merged));
+  EXPECT_EQ(299u / POSTING_SKIP_ROWS, NumSkipsInPostingList(merged));
+  EXPECT_EQ(150, NumRowsInPostingList(evens));
+
+  PostingList copy = CopyPostingList(merged, NULL);
+  ASSERT_FALSE(copy == NULL);
+  EXPECT_EQ(all, PostingListRows(copy));
+  EXPECT_EQ(merged->len, copy->len);
+  EXPECT_EQ(NumSkipsInPostingList(merged), NumSkipsInPostingList(copy));
+  PostingListIter iter;
+  PostingListIterInit(&iter, copy);
+  ASSERT_EQ(0, PostingListIterSkipTo(&iter, 250));
+  EXPECT_EQ(250u, PostingListIterGet(&iter));
+  DestroyPostingList(copy, NULL);
+  DestroyArena(arena);
+}
@@ -0,0 +1,254 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for ranked queries: BM25 scores, and that pruning with WAND
+// and the skips' block bounds never changes which movies come out on
+// top.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "RankedQuery.h"
+}
+
+// One ranked row, as FindTopMovies gives it.
+struct Ranked {
+  std::string row;
+  double score;
+  uint64_t doc_id;
+  int row_id;
+};
+
+static std::vector<Ranked> TopMovies(Index index, const std::string &query,
+                                     int k) {
+  std::vector<Ranked> ranked;
+  SearchResultBatch batch = FindTopMovies(index, query.c_str(), k);
+  if (batch == NULL) {
+    ADD_FAILURE() << "FindTopMovies failed for " << query;
+    return ranked;
+  }
+  for (int i = 0; i < batch->num_results; i++) {
+    SearchResultRow *result = &batch->results[i];
+    ranked.push_back({std::string(result->row.start, result->row.len),
+                      result->score, result->doc_id, result->row_id});
+  }
+  DestroySearchResultBatch(batch);
+  return ranked;
+}
+
+// The year field of a row.
+static int RowYear(const std::string &row) {
+  size_t field = 0;
+  for (int i = 0; i < 5; i++) {
+    field = row.find('|', field) + 1;
+  }
+  return atoi(row.c_str() + field);
+}
+
+class RankedQueryRun : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = MakeDataDir();
+    rows_ = WriteMovies(dir_, 7, 900, 2019);
+    // The same title over and over, so the year and then where it is
+    // have to break ties.
+    std::vector<std::string> same;
+    for (int i = 0; i < 200; i++) {
+      same.push_back(MovieRow(900000 + i, "bright star", 1900 + i * 7 % 120));
+    }
+    WriteDataFile(dir_, "same", same);
+    rows_.insert(rows_.end(), same.begin(), same.end());
+    docs_ = CreateDocIdMap();
+    index_ = IndexDataDir(dir_, docs_, 0);
+  }
+
+  void TearDown() override {
+    DestroyOffsetIndex(index_);
+    DestroyDocIdMap(docs_);
+    RemoveDataDir(dir_);
+  }
+
+  // Scores every row for a query with BM25, the slow way, and sets
+  // query_words_.
+  std::map<std::string, double> Scores(const std::string &query) {
+    query_words_.clear();
+    for (const std::string &word : TitleWords(MovieRow(0, query, 0))) {
+      query_words_.insert(word);
+    }
+    std::map<std::string, int> df;
+    long num_words = 0;
+    for (const std::string &row : rows_) {
+      std::vector<std::string> words = TitleWords(row);
+      num_words += words.size();
+      for (const std::string &word : std::set<std::string>(words.begin(),
+                                                           words.end())) {
+        df[word]++;
+      }
+    }
+    double num_rows = rows_.size();
+    double avg_words = num_words / num_rows;
+    std::map<std::string, double> scores;
+    for (const std::string &row : rows_) {
+      std::vector<std::string> words = TitleWords(row);
+      std::set<std::string> title(words.begin(), words.end());
+      double score = 0;
+      bool matched = false;
+      for (const std::string &word : query_words_) {
+        if (title.count(word) == 0) {
+          continue;
+        }
+        double idf = log(1 + (num_rows - df[word] + 0.5) / (df[word] + 0.5));
+        score += idf * (RANK_K1 + 1) /
+            (1 + RANK_K1 * (1 - RANK_B + RANK_B * words.size() / avg_words));
+        matched = true;
+      }
+      if (matched) {
+        scores[row] = score;
+      }
+    }
+    return scores;
+  }
+
+  // Checks a query ranks every row that has any of its words, with the
+  // right score and in order, and that asking for only the top k gives
+  // the first k of them.
+  void ExpectRanked(const std::string &query) {
+    std::map<std::string, double> scores = Scores(query);
+    std::vector<Ranked> all = TopMovies(index_, query, rows_.size());
+    ASSERT_EQ(scores.size(), all.size()) << query;
+    for (size_t i = 0; i < all.size(); i++) {
+      ASSERT_EQ(1u, scores.count(all[i].row)) << query;
+      EXPECT_NEAR(scores[all[i].row], all[i].score, 1e-9) << query;
+      if (i == 0) {
+        continue;
+      }
+      // Best first; ties go to the newer movie, then the earlier row.
+      const Ranked &before = all[i - 1];
+      ASSERT_GE(before.score + 1e-9, all[i].score) << query << " " << i;
+      if (before.score == all[i].score) {
+        int year = RowYear(all[i].row);
+        ASSERT_GE(RowYear(before.row), year) << query << " " << i;
+        if (RowYear(before.row) == year) {
+          EXPECT_TRUE(before.doc_id < all[i].doc_id ||
+                      (before.doc_id == all[i].doc_id &&
+                       before.row_id < all[i].row_id)) << query << " " << i;
+        }
+      }
+    }
+
+    // Titles as long as each other, with the same words of the query,
+    // score exactly the same, whatever order the words are in.
+    std::map<std::string, double> same_words;
+    for (const Ranked &ranked : all) {
+      std::vector<std::string> words = TitleWords(ranked.row);
+      std::string key = std::to_string(words.size());
+      for (const std::string &word :
+               std::set<std::string>(words.begin(), words.end())) {
+        if (query_words_.count(word) > 0) {
+          key += " " + word;
+        }
+      }
+      if (same_words.count(key) == 0) {
+        same_words[key] = ranked.score;
+      }
+      EXPECT_EQ(same_words[key], ranked.score) << query << " " << key;
+    }
+
+    for (int k : {1, 2, 5, 10, 64, 100, 333}) {
+      std::vector<Ranked> top = TopMovies(index_, query, k);
+      ASSERT_EQ(std::min((size_t)k, all.size()), top.size())
+          << query << " k " << k;
+      for (size_t i = 0; i < top.size(); i++) {
+        EXPECT_EQ(all[i].row, top[i].row) << query << " k " << k;
+        EXPECT_EQ(all[i].score, top[i].score) << query << " k " << k;
+      }
+    }
+  }
+
+  std::string dir_;
+  std::vector<std::string> rows_;
+  std::set<std::string> query_words_;  // the last query's, for Scores
+  DocIdMap docs_;
+  Index index_;
+};
+
+TEST_F(RankedQueryRun, OneWord) {
+  ExpectRanked("love");
+  ExpectRanked("the");
+  ExpectRanked("bright");
+}
+
+TEST_F(RankedQueryRun, ManyWords) {
+  ExpectRanked("star night");
+  ExpectRanked("the of love war");
+  ExpectRanked("dark river king blue game last day");
+  // Every word in the data.
+  ExpectRanked("the of love war star night man dark city king ship day "
+               "river blue last game bright");
+}
+
+TEST_F(RankedQueryRun, RepeatedAndMissingWords) {
+  ExpectRanked("love love love");
+  ExpectRanked("nosuchword city");
+  EXPECT_TRUE(TopMovies(index_, "nosuchword", 10).empty());
+  EXPECT_TRUE(TopMovies(index_, "", 10).empty());
+
+  std::vector<Ranked> once = TopMovies(index_, "ship", 20);
+  std::vector<Ranked> twice = TopMovies(index_, "ship ship", 20);
+  ASSERT_EQ(once.size(), twice.size());
+  for (size_t i = 0; i < once.size(); i++) {
+    EXPECT_EQ(once[i].row, twice[i].row);
+    EXPECT_EQ(once[i].score, twice[i].score);
+  }
+}
+
+TEST_F(RankedQueryRun, Ties) {
+  // All 200 "bright star"s score the same, so the newest come first.
+  std::vector<Ranked> top = TopMovies(index_, "bright", 30);
+  ASSERT_EQ(30u, top.size());
+  std::multiset<int> years;
+  for (const std::string &row : rows_) {
+    if (TitleWords(row)[0] == "bright") {
+      years.insert(RowYear(row));
+    }
+  }
+  std::multiset<int>::reverse_iterator year = years.rbegin();
+  for (const Ranked &ranked : top) {
+    EXPECT_EQ(*year++, RowYear(ranked.row));
+    EXPECT_EQ(top[0].score, ranked.score);
+  }
+}
+
+TEST_F(RankedQueryRun, RankMovies) {
+  RankedResult results[10];
+  EXPECT_EQ(0, RankMovies(index_, "love", 0, results));
+  EXPECT_EQ(0, RankMovies(index_, "nosuchword", 10, results));
+  ASSERT_EQ(10, RankMovies(index_, "love war", 10, results));
+  for (int i = 1; i < 10; i++) {
+    EXPECT_GE(results[i - 1].score, results[i].score);
+  }
+}
@@ -0,0 +1,186 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+// Tests for the delimiter scanners: each one the CPU has must find the
+// same delimiters as the plain loop, in any block, and so build the
+// same index.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_data.h"
+
+extern "C" {
+  #include "RowParser.h"
+}
+
+static const char *kScanners[] = {"avx2", "sse2", "scalar"};
+
+// Puts back whichever scanner was in use before each test.
+class RowParserTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    default_ = DelimiterScannerName();
+  }
+
+  void TearDown() override {
+    ASSERT_EQ(0, SelectDelimiterScanner(default_.c_str()));
+  }
+
+  // Checks every scanner the CPU has finds the same delimiters in a
+  // block as the scalar one.
+  void ExpectSameMasks(const char *block) {
+    ASSERT_EQ(0, SelectDelimiterScanner("scalar"));
+    DelimiterMasks expected;
+    ScanDelimiters(block, &expected);
+    for (const char *name : kScanners) {
+      if (SelectDelimiterScanner(name) != 0) {
+        continue;
+      }
+      DelimiterMasks masks;
+      memset(&masks, 0xAB, sizeof(masks));
+      ScanDelimiters(block, &masks);
+      EXPECT_EQ(expected.pipe, masks.pipe) << name;
+      EXPECT_EQ(expected.comma, masks.comma) << name;
+      EXPECT_EQ(expected.space, masks.space) << name;
+      EXPECT_EQ(expected.newline, masks.newline) << name;
+    }
+  }
+
+  std::string default_;
+};
+
+TEST_F(RowParserTest, SelectScanner) {
+  ASSERT_EQ(0, SelectDelimiterScanner("scalar"));
+  EXPECT_STREQ("scalar", DelimiterScannerName());
+  EXPECT_EQ(-1, SelectDelimiterScanner("nosuchscanner"));
+  EXPECT_STREQ("scalar", DelimiterScannerName());
+  for (const char *name : kScanners) {
+    if (SelectDelimiterScanner(name) == 0) {
+      EXPECT_STREQ(name, DelimiterScannerName());
+    }
+  }
+}
+
+TEST_F(RowParserTest, EdgeBlocks) {
+  // One byte extra, so blocks can start off alignment too.
+  char buffer[ROW_BLOCK_BYTES + 1];
+  const char delimiters[] = {'|', ',', ' ', '\n'};
+  for (int start = 0; start <= 1; start++) {
+    char *block = buffer + start;
+    memset(buffer, 0, sizeof(buffer));
+    ExpectSameMasks(block);
+    for (char delimiter : delimiters) {
+      // Just the first byte, just the last, and every byte.
+      memset(buffer, 'a', sizeof(buffer));
+      block[0] = delimiter;
+      ExpectSameMasks(block);
+      memset(buffer, 'a', sizeof(buffer));
+      block[ROW_BLOCK_BYTES - 1] = delimiter;
+      ExpectSameMasks(block);
+      memset(buffer, delimiter, sizeof(buffer));
+      ExpectSameMasks(block);
+    }
+    // Bytes with the top bit set, which a signed compare could trip on.
+    memset(buffer, 0xFF, sizeof(buffer));
+    block[ROW_BLOCK_BYTES - 1] = '\n';
+    ExpectSameMasks(block);
+    for (int i = 0; i < ROW_BLOCK_BYTES; i++) {
+      block[i] = (char)(0x80 | delimiters[i % 4]);
+    }
+    ExpectSameMasks(block);
+    // A short row, then the NULs a final block is padded out with.
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(block, "tt1|movie|A B|A B|0|1999|-|90|Drama,War\n", 40);
+    ExpectSameMasks(block);
+  }
+}
+
+TEST_F(RowParserTest, RandomBlocks) {
+  std::mt19937 rng(10);
+  char buffer[ROW_BLOCK_BYTES + 1];
+  for (int i = 0; i < 2000; i++) {
+    // Half the blocks are mostly delimiters; the rest are any bytes.
+    bool any = i % 2 == 1;
+    for (size_t j = 0; j < sizeof(buffer); j++) {
+      buffer[j] = any ? (char)(rng() & 0xFF) : "|, \nab"[rng() % 6];
+    }
+    ExpectSameMasks(buffer + i % 2);
+  }
+}
+
+TEST_F(RowParserTest, IndexWithEachScanner) {
+  std::string dir = MakeDataDir();
+  WriteMovies(dir, 6, 300, 10);
+
+  // Rows of every length from a few bytes to a few blocks, so each
+  // delimiter lands at every bit of a block, and the last one has no
+  // newline and ends partway into a block.
+  static const char *kWords[] = {"star", "night", "river", "of", "the"};
+  std::mt19937 rng(11);
+  std::vector<std::string> rows;
+  for (int i = 0; i < 400; i++) {
+    std::string title;
+    for (int words = 1 + rng() % 6; words > 0; words--) {
+      title += std::string(title.empty() ? "" : " ") + kWords[rng() % 5];
+    }
+    std::string row = MovieRow(i, title, 1950 + i % 70);
+    row += std::string(rng() % 150, 'x');
+    if (i % 4 == 0) {
+      row += ",Comedy";
+    }
+    rows.push_back(row);
+  }
+  rows.push_back("tt9|short|row");
+  WriteDataFile(dir, "edges", rows);
+  FILE *f = fopen((dir + "edges").c_str(), "a");
+  ASSERT_TRUE(f != NULL);
+  fputs("tt0000999|movie|star of the river|x|0|2001|-|90|Drama", f);
+  fclose(f);
+
+  const std::vector<std::string> queries = {
+    "star", "night", "river", "of", "the", "star night", "the OR river",
+    "\"of the\"", "\"star of the river\"", "nosuchword"
+  };
+  ASSERT_EQ(0, SelectDelimiterScanner("scalar"));
+  DocIdMap expected_docs = CreateDocIdMap();
+  Index expected = IndexDataDir(dir, expected_docs, 1);
+  EXPECT_FALSE(QueryRows(expected, "\"star of the river\"").empty());
+  for (const char *name : kScanners) {
+    if (SelectDelimiterScanner(name) != 0) {
+      continue;
+    }
+    SCOPED_TRACE(name);
+    DocIdMap docs = CreateDocIdMap();
+    Index index = IndexDataDir(dir, docs, 1);
+    EXPECT_EQ(NumElemsInHashtable(expected->ht),
+              NumElemsInHashtable(index->ht));
+    ExpectSameMovies(expected, index, queries);
+    DestroyOffsetIndex(index);
+    DestroyDocIdMap(docs);
+  }
+  DestroyOffsetIndex(expected);
+  DestroyDocIdMap(expected_docs);
+  RemoveDataDir(dir);
+}
@@ -0,0 +1,160 @@
+// Measures how many query sessions a server can take a second.
+//
+// Usage: ./connbench <host> <port> <sessions> <clients> [term]
+//
+// Each of clients threads runs sessions / clients sessions, one after
+// another: connect, run the whole query protocol for term, and close.
+// A new connection every time is what makes the server's way of
+// handing out connections (fork per connection, prefork, threads,
+// event loops) show up in the numbers.
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "QueryProtocol.h"
+#include "WallClock.h"
+
+#define BUFFER_SIZE 1500
+
+typedef struct {
+  char *host;
+  char *port;
+  char *term;
+  int sessions;
+  int failed;
+  double seconds;  // added up over this thread's sessions
+} BenchArgs;
+
+// Same as open_clientfd in QueryClient.c, without the printing.
+static int Connect(char *host, char *port) {
+  struct addrinfo hints, *listp, *p;
+  int clientfd = -1;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if (getaddrinfo(host, port, &hints, &listp) != 0) {
+    return -1;
+  }
+  for (p = listp; p; p = p->ai_next) {
+    if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
+      continue;
+    }
+    if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) {
+      break;
+    }
+    close(clientfd);
+  }
+  freeaddrinfo(listp);
+  return p == NULL ? -1 : clientfd;
+}
+
+// Reads one message, as the client does. Returns its length, or -1.
+static int ReadMessage(int fd, char *buffer) {
+  int len = read(fd, buffer, BUFFER_SIZE - 1);
+  if (len <= 0) {
+    return -1;
+  }
+  buffer[len] = '\0';
+  return len;
+}
+
+// Runs the query protocol on a connection. Returns 0 if the server
+// kept to it.
+static int RunProtocol(int fd, char *term) {
+  char buffer[BUFFER_SIZE];
+  if (ReadMessage(fd, buffer) < 0 || CheckAck(buffer) != 0) {
+    return -1;
+  }
+  write(fd, term, strlen(term));
+  if (ReadMessage(fd, buffer) < 0 || SendAck(fd) != 0) {
+    return -1;
+  }
+  int num_results = atoi(buffer);
+  for (int i = 0; i < num_results; i++) {
+    if (ReadMessage(fd, buffer) < 0 || SendAck(fd) != 0) {
+      return -1;
+    }
+  }
+  if (ReadMessage(fd, buffer) < 0 || CheckGoodbye(buffer) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// Runs one query session. Returns 0 if it went by the protocol.
+static int RunSession(BenchArgs *args) {
+  int fd = Connect(args->host, args->port);
+  if (fd < 0) {
+    return -1;
+  }
+  int result = RunProtocol(fd, args->term);
+  close(fd);
+  return result;
+}
+
+static void *BenchClient(void *arg) {
+  BenchArgs *args = (BenchArgs*)arg;
+  for (int i = 0; i < args->sessions; i++) {
+    double start = WallSeconds();
+    if (RunSession(args) != 0) {
+      args->failed++;
+    }
+    args->seconds += WallSeconds() - start;
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 5 || argc > 6) {
+    printf("Usage: connbench <host> <port> <sessions> <clients> [term]\n");
+    return 0;
+  }
+  int sessions = atoi(argv[3]);
+  int clients = atoi(argv[4]);
+  if (sessions <= 0 || clients <= 0) {
+    printf("sessions and clients have to be positive.\n");
+    return 0;
+  }
+
+  pthread_t *threads = (pthread_t*)malloc(clients * sizeof(pthread_t));
+  BenchArgs *args = (BenchArgs*)malloc(clients * sizeof(BenchArgs));
+  if (threads == NULL || args == NULL) {
+    printf("Couldn't malloc for the clients\n");
+    return 1;
+  }
+
+  double start = WallSeconds();
+  for (int i = 0; i < clients; i++) {
+    args[i].host = argv[1];
+    args[i].port = argv[2];
+    args[i].term = argc > 5 ? argv[5] : "seattle";
+    // Spread the remainder over the first few clients.
+    args[i].sessions = sessions / clients + (i < sessions % clients);
+    args[i].failed = 0;
+    args[i].seconds = 0;
+    pthread_create(&threads[i], NULL, &BenchClient, &args[i]);
+  }
+  int failed = 0;
+  double session_seconds = 0;
+  for (int i = 0; i < clients; i++) {
+    pthread_join(threads[i], NULL);
+    failed += args[i].failed;
+    session_seconds += args[i].seconds;
+  }
+  double seconds = WallSeconds() - start;
+
+  printf("%d sessions from %d clients in %f s: %.0f sessions/s, "
+         "%.3f ms each, %d failed\n",
+         sessions, clients, seconds, sessions / seconds,
+         1000 * session_seconds / sessions, failed);
+  free(args);
+  free(threads);
+  return 0;
+}
@@ -0,0 +1,588 @@
+// An event-driven QueryServer: one thread per event loop, each with its
+// own listening socket and epoll set, and every client a small state
+// machine instead of a blocked thread or a forked process.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+
+#include "QueryProtocol.h"
+#include "MovieSet.h"
+#include "MovieIndex.h"
+#include "DocIdMap.h"
+#include "htll/Hashtable.h"
+#include "QueryProcessor.h"
+#include "BooleanQuery.h"
+#include "FileParser.h"
+#include "IndexFile.h"
+#include "IndexPipeline.h"
+#include "FileCrawler.h"
+
+#define SEARCH_RESULT_LENGTH 1500
+#define QUERY_LENGTH 100
+#define MAX_EVENTS 256
+// Results' rows are read this many at a time, at most.
+#define ROW_BATCH 64
+
+DocIdMap docs;
+Index docIndex;
+int keepPositions = 0;
+// The index file to load the index from, or save it to once it's
+// built, if there is one.
+char *indexFile = NULL;
+// How big to make each stage of the indexing pipeline; 0 for defaults.
+PipelineConfig pipelineConfig;
+
+int Cleanup();
+
+// Where a client is in the protocol; each state waits for the client.
+enum connState {
+  READ_QUERY,    // ACK sent, waiting for the query
+  READ_COUNT_ACK,  // number of results sent, waiting for its ACK
+  READ_ROW_ACK,  // a result sent, waiting for its ACK
+  CLOSING        // GOODBYE being sent; close once it's out
+};
+
+// One client. It only holds what it needs between messages, so an idle
+// client costs a few dozen bytes; output that the socket won't take
+// right away is the only thing that gets buffered.
+typedef struct connection {
+  int fd;
+  enum connState state;
+  SearchResultIter results;  // the results left to send, or NULL
+  int results_left;
+  int results_unread;  // how many of them haven't been read into rows
+  // The rows of the next few results, read together, and which of them
+  // is next; NULL until there are results to send.
+  RowBuffer rows;
+  RowSpan *spans;
+  int batch_len;
+  int batch_next;
+  char *pending;  // bytes still to write, or NULL
+  int pending_len;
+  int pending_sent;
+} Connection;
+
+// What one event loop thread works with.
+typedef struct eventLoop {
+  int listen_fd;
+  int epoll_fd;
+  pthread_t thread;
+} EventLoop;
+
+void sigint_handler(int sig) {
+  write(0, "Exit signal sent. Cleaning up...\n", 34);
+  Cleanup();
+  exit(0);
+}
+
+void Setup(char *dir) {
+  if (indexFile != NULL) {
+    docIndex = LoadIndexFile(indexFile, &docs);
+    if (docIndex != NULL && docIndex->keep_positions == keepPositions) {
+      printf("Loaded the index from %s: %d entries.\n", indexFile,
+             NumElemsInHashtable(docIndex->ht));
+      return;
+    }
+    if (docIndex != NULL) {
+      // It was saved with or without positions, and -p says otherwise.
+      Cleanup();
+    }
+    printf("Building the index instead.\n");
+  }
+
+  printf("Crawling and indexing the directory tree at: %s\n", dir);
+  docs = CreateDocIdMap();
+  docIndex = CreateIndex();
+  docIndex->keep_positions = keepPositions;
+
+  // Crawl, parse and index all at once
+  PipelineStats stats;
+  if (BuildIndexPipelined(dir, docs, docIndex, &pipelineConfig,
+                          &stats) != 0) {
+    printf("Couldn't build the index\n");
+    exit(1);
+  }
+  PrintPipelineStats(&stats);
+  printf("Indexed %d files.\n", NumElemsInHashtable(docs));
+  printf("%d entries in the index.\n", NumElemsInHashtable(docIndex->ht));
+  if (indexFile != NULL && WriteIndexFile(docIndex, docs, indexFile) == 0) {
+    printf("Saved the index to %s.\n", indexFile);
+  }
+}
+
+int Cleanup() {
+  DestroyOffsetIndex(docIndex);
+  DestroyDocIdMap(docs);
+  return 0;
+}
+
+// Prints an error message
+void ProtocolError() {
+  printf("Protocol Error: Please try again.\n");
+}
+
+static int SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) {
+    return -1;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Same as open_listenfd in QueryServer.c, but the socket doesn't block,
+ * has the biggest backlog the system allows, and sets SO_REUSEPORT, so
+ * each event loop can have its own socket on the same port and the
+ * kernel spreads new connections over them.
+ *
+ * Returns a socket file descriptor on success, -1 on failure.
+ */
+int open_listenfd_reuseport(char* port) {
+  struct addrinfo hints, *listp, *p;
+  int listenfd, optval = 1;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+  if (getaddrinfo(NULL, port, &hints, &listp) != 0) {
+    puts("Couldn't find a socket");
+    return -1;
+  }
+
+  for (p = listp; p; p = p->ai_next) {
+    if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
+      continue;
+    }
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+               (const void*)&optval, sizeof(optval));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+               (const void*)&optval, sizeof(optval));
+    if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) {
+      break;
+    }
+    close(listenfd);
+  }
+
+  freeaddrinfo(listp);
+  if (!p) {
+    puts("Couldn't find a socket");
+    return -1;
+  }
+
+  if (SetNonBlocking(listenfd) < 0 || listen(listenfd, SOMAXCONN) < 0) {
+    close(listenfd);
+    puts("Fail on listen()");
+    return -1;
+  }
+  return listenfd;
+}
+
+// Lets the process have as many connections open as it's allowed to.
+static void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+static void CloseConnection(EventLoop *loop, Connection *conn) {
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  if (conn->results != NULL) {
+    DestroySearchResultIter(conn->results);
+  }
+  free(conn->rows.data);
+  free(conn->spans);
+  free(conn->pending);
+  free(conn);
+}
+
+// Waits for the client to be readable, or writable if there's output
+// it hasn't taken yet.
+static void WatchConnection(EventLoop *loop, Connection *conn) {
+  struct epoll_event event;
+  event.events = conn->pending != NULL ? EPOLLOUT : EPOLLIN;
+  event.data.ptr = conn;
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+// Writes what it can of the pending output.
+// Returns 0 if it's all written, 1 if some is left, -1 on error.
+static int FlushConnection(Connection *conn) {
+  while (conn->pending_sent < conn->pending_len) {
+    ssize_t sent = write(conn->fd, conn->pending + conn->pending_sent,
+                         conn->pending_len - conn->pending_sent);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+    }
+    conn->pending_sent += sent;
+  }
+  free(conn->pending);
+  conn->pending = NULL;
+  return 0;
+}
+
+// Sends one message. Whatever the socket won't take now is copied and
+// sent when it's writable again. Returns 0, or -1 on error.
+static int SendMessage(Connection *conn, const char *message, int len) {
+  int sent = 0;
+  while (sent < len) {
+    ssize_t n = write(conn->fd, message + sent, len - sent);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+      }
+      break;
+    }
+    sent += n;
+  }
+  if (sent < len) {
+    conn->pending = (char*)malloc(len - sent);
+    if (conn->pending == NULL) {
+      return -1;
+    }
+    memcpy(conn->pending, message + sent, len - sent);
+    conn->pending_len = len - sent;
+    conn->pending_sent = 0;
+  }
+  return 0;
+}
+
+// Reads the rows of the next few results, up to ROW_BATCH of them, all
+// from one file, with one GetRowsFromTable. The loop then only stops
+// for a file once every so many results, not for every row.
+// Returns 0, or -1 if the rows couldn't be read.
+static int ReadRowBatch(Connection *conn) {
+  if (docIndex->rows == NULL) {
+    return -1;
+  }
+  if (conn->spans == NULL) {
+    conn->spans = (RowSpan*)malloc(ROW_BATCH * sizeof(RowSpan));
+    if (conn->spans == NULL) {
+      return -1;
+    }
+  }
+  uint32_t row_ids[ROW_BATCH];
+  uint64_t doc_id = 0;
+  int num_rows = 0;
+  // A file's results come out together, in row order.
+  while (num_rows < ROW_BATCH && conn->results_unread > 0) {
+    struct searchResult result;
+    SearchResultGet(conn->results, &result);
+    if (num_rows > 0 && result.doc_id != doc_id) {
+      break;
+    }
+    doc_id = result.doc_id;
+    row_ids[num_rows++] = result.row_id;
+    if (--conn->results_unread > 0) {
+      SearchResultNext(conn->results);
+    }
+  }
+  conn->rows.len = 0;
+  conn->batch_len = num_rows;
+  conn->batch_next = 0;
+  return GetRowsFromTable(docIndex->rows, doc_id, row_ids, num_rows,
+                          &conn->rows, conn->spans);
+}
+
+// Sends the next result, or the GOODBYE if there are no more.
+static int SendNextResult(Connection *conn) {
+  if (conn->results_left == 0) {
+    conn->state = CLOSING;
+    return SendMessage(conn, GOODBYE, strlen(GOODBYE));
+  }
+
+  if (conn->batch_next == conn->batch_len && ReadRowBatch(conn) != 0) {
+    return -1;
+  }
+  RowSpan row = conn->spans[conn->batch_next++];
+  if (row.start < 0) {
+    // The file doesn't have the row any more.
+    return -1;
+  }
+  if (row.len > SEARCH_RESULT_LENGTH - 1) {
+    row.len = SEARCH_RESULT_LENGTH - 1;
+  }
+  conn->results_left--;
+  conn->state = READ_ROW_ACK;
+  return SendMessage(conn, conn->rows.data + row.start, row.len);
+}
+
+// Answers one message from a client, by the state it's in.
+// Returns 0 to keep going, -1 to close the connection.
+static int HandleMessage(Connection *conn, char *message) {
+  char count[16];
+  switch (conn->state) {
+    case READ_QUERY: {
+      int owned;
+      MovieSet set = FindQueryMovies(docIndex, message, &owned);
+      conn->results_left = set == NULL ? 0 : NumMoviesInSet(set);
+      conn->results_unread = conn->results_left;
+      if (conn->results_left > 0) {
+        conn->results = CreateSearchResultIter(set);
+      }
+      if (owned) {
+        // The iterator has it from here on.
+        if (conn->results != NULL) {
+          conn->results->owned_set = set;
+        } else {
+          DestroyMovieSet(set);
+        }
+      }
+      if (conn->results_left > 0 && conn->results == NULL) {
+        return -1;
+      }
+      snprintf(count, sizeof(count), "%d", conn->results_left);
+      conn->state = READ_COUNT_ACK;
+      return SendMessage(conn, count, strlen(count));
+    }
+    case READ_COUNT_ACK:
+      if (CheckAck(message) == -1) {
+        ProtocolError();
+        return -1;
+      }
+      return SendNextResult(conn);
+    case READ_ROW_ACK:
+      if (CheckAck(message) == -1) {
+        ProtocolError();
+        conn->state = CLOSING;
+        return SendMessage(conn, GOODBYE, strlen(GOODBYE));
+      }
+      return SendNextResult(conn);
+    case CLOSING:
+      // Nothing more to say; anything the client sends now is ignored.
+      return 0;
+  }
+  return -1;
+}
+
+static void AcceptConnections(EventLoop *loop) {
+  while (1) {
+    int fd = accept(loop->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // EAGAIN once they're all accepted; on EMFILE and the like, the
+      // rest wait in the backlog until a client leaves.
+      return;
+    }
+    Connection *conn = (Connection*)calloc(1, sizeof(Connection));
+    if (conn == NULL || SetNonBlocking(fd) < 0) {
+      free(conn);
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->state = READ_QUERY;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      free(conn);
+      close(fd);
+      continue;
+    }
+    // Send connection ACK
+    if (SendMessage(conn, ACK, strlen(ACK)) != 0) {
+      CloseConnection(loop, conn);
+      continue;
+    }
+    WatchConnection(loop, conn);
+  }
+}
+
+static void HandleConnection(EventLoop *loop, Connection *conn) {
+  if (conn->pending != NULL) {
+    // Only writable events are asked for while output is pending.
+    int flushed = FlushConnection(conn);
+    if (flushed < 0 || (flushed == 0 && conn->state == CLOSING)) {
+      CloseConnection(loop, conn);
+    } else if (flushed == 0) {
+      WatchConnection(loop, conn);
+    }
+    return;
+  }
+
+  // Each message is whatever one read gets, as in ReadAddNull.
+  char message[QUERY_LENGTH + 1];
+  ssize_t len = read(conn->fd, message, QUERY_LENGTH);
+  if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                  errno == EINTR)) {
+    return;
+  }
+  if (len <= 0) {
+    // The client hung up.
+    CloseConnection(loop, conn);
+    return;
+  }
+  message[len] = '\0';
+
+  if (HandleMessage(conn, message) != 0) {
+    CloseConnection(loop, conn);
+  } else if (conn->state == CLOSING && conn->pending == NULL) {
+    // Step 6: Close the socket
+    CloseConnection(loop, conn);
+  } else if (conn->pending != NULL) {
+    WatchConnection(loop, conn);
+  }
+}
+
+static void *RunEventLoop(void *arg) {
+  EventLoop *loop = (EventLoop*)arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (1) {
+    int num_events = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+    if (num_events < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return NULL;
+    }
+    for (int i = 0; i < num_events; i++) {
+      if (events[i].data.ptr == NULL) {
+        AcceptConnections(loop);
+      } else {
+        HandleConnection(loop, (Connection*)events[i].data.ptr);
+      }
+    }
+  }
+  return NULL;
+}
+
+static int StartEventLoop(EventLoop *loop, char *port) {
+  loop->listen_fd = open_listenfd_reuseport(port);
+  if (loop->listen_fd < 0) {
+    return -1;
+  }
+  loop->epoll_fd = epoll_create1(0);
+  if (loop->epoll_fd < 0) {
+    perror("epoll_create1");
+    close(loop->listen_fd);
+    return -1;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;  // marks the listening socket
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &event);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  // Get args
+  while (argc > 1 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-p") == 0) {
+      // Keep title word positions, for phrase queries
+      keepPositions = 1;
+    } else if (strcmp(argv[1], "-i") == 0 && argc > 2) {
+      indexFile = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-s") == 0 && argc > 2) {
+      // Threads for each stage of the indexing pipeline
+      if (ParsePipelineConfig(argv[2], &pipelineConfig) != 0) {
+        printf("-s takes crawl,read,parse,tokenize,insert threads, "
+               "and then queue capacity if you like.\n");
+        return 0;
+      }
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc != 3 && argc != 4) {
+    printf("Must have two or three arguments.\n");
+    printf("Usage: epollserver [-p] [-i <index file>] [-s <threads>]\n"
+           "                   <directory to crawl> <port number> "
+           "[event loops]\n");
+    return 0;
+  }
+
+  // Setup graceful exit
+  struct sigaction kill;
+  kill.sa_handler = sigint_handler;
+  kill.sa_flags = 0;
+  sigemptyset(&kill.sa_mask);
+  if (sigaction(SIGINT, &kill, NULL) == -1) {
+    perror("sigaction");
+    exit(1);
+  }
+  // A client that hangs up mid-write shouldn't take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  int num_loops = 1;
+  if (argc == 4) {
+    num_loops = atoi(argv[3]);
+    if (num_loops <= 0) {
+      // One per core
+      num_loops = sysconf(_SC_NPROCESSORS_ONLN);
+      if (num_loops <= 0) {
+        num_loops = 1;
+      }
+    }
+  }
+
+  RaiseFileLimit();
+  Setup(argv[1]);
+
+  EventLoop *loops = (EventLoop*)malloc(num_loops * sizeof(EventLoop));
+  if (loops == NULL) {
+    printf("Couldn't malloc for the event loops\n");
+    Cleanup();
+    return 1;
+  }
+  for (int i = 0; i < num_loops; i++) {
+    if (StartEventLoop(&loops[i], argv[2]) != 0) {
+      Cleanup();
+      return 1;
+    }
+  }
+
+  // The first loop runs on the main thread.
+  int running = 1;
+  for (int i = 1; i < num_loops; i++) {
+    if (pthread_create(&loops[i].thread, NULL, &RunEventLoop,
+                       &loops[i]) != 0) {
+      // Nothing would accept on the rest's sockets; close them, so the
+      // kernel stops giving them connections.
+      printf("Couldn't start event loop %d\n", i);
+      for (int j = i; j < num_loops; j++) {
+        close(loops[j].epoll_fd);
+        close(loops[j].listen_fd);
+      }
+      break;
+    }
+    running++;
+  }
+  printf("Serving on port %s with %d event loop(s)\n", argv[2], running);
+  RunEventLoop(&loops[0]);
+
+  Cleanup();
+  return 0;
+}
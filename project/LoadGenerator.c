@@ -0,0 +1,608 @@
+// A closed-loop load generator for the query servers.
+//
+// Usage: ./loadgen [options] <host> <port>
+//
+//   -d <dir>     draw terms from the index of the data in dir, by a
+//                Zipf distribution over how many movies each term finds
+//   -s <s>       the Zipf exponent (default 1.0)
+//   -r <file>    replay the terms in file, one a line, instead
+//   -c <n>       how many clients to run at once (default 8)
+//   -t <secs>    how long to measure for (default 10)
+//   -w <secs>    how long to warm up for first, unmeasured (default 1)
+//   -o <file>    write the latency histogram's percentile distribution
+//   -1           speak version 1 of the protocol even if the server
+//                speaks version 2
+//
+// Each client sends a query, waits for every row of the answer, and
+// only then sends the next, so the load is what the server can keep up
+// with. Latencies go into an HDR histogram: a fixed number of buckets
+// that grow with the value, so every latency from a microsecond to
+// minutes is kept to within 0.1% without storing them all.
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "QueryProtocol.h"
+#include "QueryProtocolV2.h"
+#include "MovieSet.h"
+#include "MovieIndex.h"
+#include "DocIdMap.h"
+#include "htll/Hashtable.h"
+#include "FileParser.h"
+#include "FileCrawler.h"
+#include "WallClock.h"
+
+#define BUFFER_SIZE 1500
+
+// Values below HDR_SUB_BUCKETS microseconds are counted exactly; above
+// that, each power of two is split into HDR_SUB_BUCKETS / 2 buckets.
+#define HDR_SUB_BUCKET_BITS 11
+#define HDR_SUB_BUCKETS (1 << HDR_SUB_BUCKET_BITS)
+#define HDR_HALF (HDR_SUB_BUCKETS / 2)
+// Enough powers of two for latencies of days.
+#define HDR_MAX_SHIFT 28
+#define HDR_COUNTS (HDR_SUB_BUCKETS + HDR_MAX_SHIFT * HDR_HALF)
+
+typedef struct {
+  uint64_t counts[HDR_COUNTS];
+  uint64_t total;
+  uint64_t max;
+  double sum;
+  double sum_squares;
+} Histogram;
+
+// The terms to query for, and how to pick them.
+typedef struct {
+  char **terms;
+  int num_terms;
+  double *cdf;  // Zipf: the chance of picking a term up to each rank
+  int replay;  // Replay the terms in order instead
+} TermSource;
+
+typedef struct {
+  char *host;
+  char *port;
+  int version;
+  TermSource *source;
+  uint64_t rng;
+  Histogram *histogram;
+  long queries;
+  long rows;
+  long failed;
+} Client;
+
+static double warm_until;
+static double stop_at;
+
+// Which bucket a value goes in.
+static int HdrIndex(uint64_t value) {
+  if (value < HDR_SUB_BUCKETS) {
+    return (int)value;
+  }
+  // Shift the value down into [HDR_HALF, HDR_SUB_BUCKETS).
+  int shift = 63 - __builtin_clzll(value) - (HDR_SUB_BUCKET_BITS - 1);
+  if (shift > HDR_MAX_SHIFT) {
+    shift = HDR_MAX_SHIFT;
+    value = (uint64_t)(HDR_SUB_BUCKETS - 1) << shift;
+  }
+  return HDR_SUB_BUCKETS + (shift - 1) * HDR_HALF +
+      (int)((value >> shift) - HDR_HALF);
+}
+
+// The biggest value that goes in a bucket.
+static uint64_t HdrHighestValue(int index) {
+  if (index < HDR_SUB_BUCKETS) {
+    return index;
+  }
+  int shift = (index - HDR_SUB_BUCKETS) / HDR_HALF + 1;
+  uint64_t sub = (index - HDR_SUB_BUCKETS) % HDR_HALF + HDR_HALF;
+  return (sub << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+static void RecordLatency(Histogram *h, double seconds) {
+  uint64_t us = (uint64_t)(seconds * 1e6);
+  h->counts[HdrIndex(us)]++;
+  h->total++;
+  if (us > h->max) {
+    h->max = us;
+  }
+  h->sum += us;
+  h->sum_squares += (double)us * us;
+}
+
+static void AddHistogram(Histogram *to, Histogram *from) {
+  for (int i = 0; i < HDR_COUNTS; i++) {
+    to->counts[i] += from->counts[i];
+  }
+  to->total += from->total;
+  if (from->max > to->max) {
+    to->max = from->max;
+  }
+  to->sum += from->sum;
+  to->sum_squares += from->sum_squares;
+}
+
+// The p'th percentile, in ms.
+static double HdrPercentile(Histogram *h, double p) {
+  uint64_t target = (uint64_t)ceil(p / 100 * h->total);
+  if (target == 0) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < HDR_COUNTS; i++) {
+    seen += h->counts[i];
+    if (seen >= target) {
+      uint64_t value = HdrHighestValue(i);
+      return (value < h->max ? value : h->max) / 1000.0;
+    }
+  }
+  return h->max / 1000.0;
+}
+
+/**
+ * Writes the histogram the way HdrHistogram prints a percentile
+ * distribution, one row per bucket used, so its plotting tools can read
+ * it. Values are in ms.
+ */
+static int WriteHistogram(Histogram *h, char *file) {
+  FILE *out = fopen(file, "w");
+  if (out == NULL) {
+    return -1;
+  }
+  fprintf(out, "%12s %14s %10s %14s\n\n",
+          "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+  uint64_t seen = 0;
+  int buckets = 0;
+  for (int i = 0; i < HDR_COUNTS; i++) {
+    if (h->counts[i] == 0) {
+      continue;
+    }
+    buckets++;
+    seen += h->counts[i];
+    double percentile = (double)seen / h->total;
+    uint64_t value = HdrHighestValue(i);
+    fprintf(out, "%12.3f %14.12f %10lu", (value < h->max ? value : h->max)
+            / 1000.0, percentile, (unsigned long)seen);
+    if (seen < h->total) {
+      fprintf(out, " %14.2f", 1 / (1 - percentile));
+    }
+    fprintf(out, "\n");
+  }
+  double mean = h->total ? h->sum / h->total : 0;
+  double variance = h->total ? h->sum_squares / h->total - mean * mean : 0;
+  fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+          mean / 1000, sqrt(variance > 0 ? variance : 0) / 1000);
+  fprintf(out, "#[Max     = %12.3f, Total count    = %12lu]\n",
+          h->max / 1000.0, (unsigned long)h->total);
+  fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n",
+          buckets, HDR_SUB_BUCKETS);
+  fclose(out);
+  return 0;
+}
+
+// xorshift64*: each client has its own, so there's no lock.
+static uint64_t NextRandom(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Picks the next term for a client to query.
+static char *NextTerm(Client *client) {
+  TermSource *source = client->source;
+  if (source->replay) {
+    // Each client starts at its own place in the log.
+    return source->terms[client->rng++ % source->num_terms];
+  }
+  double u = (NextRandom(&client->rng) >> 11) * (1.0 / (1ULL << 53));
+  int low = 0, high = source->num_terms - 1;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (source->cdf[mid] < u) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return source->terms[low];
+}
+
+typedef struct {
+  char *term;
+  int num_results;
+} TermCount;
+
+static int CompareTermCounts(const void *a, const void *b) {
+  return ((const TermCount*)b)->num_results -
+      ((const TermCount*)a)->num_results;
+}
+
+/**
+ * Indexes the data in dir the way the servers do, and ranks its terms
+ * by how many movies they find, so the most common term is the most
+ * likely to be queried.
+ */
+static int LoadIndexTerms(char *dir, double exponent, TermSource *source) {
+  DocIdMap docs = CreateDocIdMap();
+  CrawlFilesToMap(dir, docs);
+  Index index = CreateIndex();
+  ParseTheFiles(docs, index);
+
+  int num_terms = NumElemsInHashtable(index->ht);
+  TermCount *counts = (TermCount*)malloc(num_terms * sizeof(TermCount));
+  HTIter iter = num_terms > 0 ? CreateHashtableIterator(index->ht) : NULL;
+  int n = 0;
+  if (counts != NULL && iter != NULL) {
+    HTKeyValue kvp;
+    do {
+      HTIteratorGet(iter, &kvp);
+      MovieSet set = (MovieSet)kvp.value;
+      counts[n].term = strdup(set->desc);
+      counts[n].num_results = NumMoviesInSet(set);
+      n++;
+    } while (HTIteratorNext(iter) == 0);
+    DestroyHashtableIterator(iter);
+  }
+  DestroyOffsetIndex(index);
+  DestroyDocIdMap(docs);
+  if (n == 0) {
+    free(counts);
+    return -1;
+  }
+  qsort(counts, n, sizeof(TermCount), &CompareTermCounts);
+
+  source->terms = (char**)malloc(n * sizeof(char*));
+  source->cdf = (double*)malloc(n * sizeof(double));
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    source->terms[i] = counts[i].term;
+    total += 1 / pow(i + 1, exponent);
+    source->cdf[i] = total;
+  }
+  for (int i = 0; i < n; i++) {
+    source->cdf[i] /= total;
+  }
+  source->num_terms = n;
+  source->replay = 0;
+  printf("%d terms from %s; the most common is \"%s\" (%d movies)\n",
+         n, dir, counts[0].term, counts[0].num_results);
+  free(counts);
+  return 0;
+}
+
+// Reads the terms to replay, one a line.
+static int LoadTermLog(char *file, TermSource *source) {
+  FILE *in = fopen(file, "r");
+  if (in == NULL) {
+    return -1;
+  }
+  int capacity = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  source->terms = NULL;
+  source->num_terms = 0;
+  while ((len = getline(&line, &line_size, in)) >= 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0) {
+      continue;
+    }
+    if (source->num_terms == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      source->terms = (char**)realloc(source->terms,
+                                      capacity * sizeof(char*));
+    }
+    source->terms[source->num_terms++] = strdup(line);
+  }
+  free(line);
+  fclose(in);
+  source->cdf = NULL;
+  source->replay = 1;
+  return source->num_terms > 0 ? 0 : -1;
+}
+
+// Same as open_clientfd in QueryClient.c, without the printing.
+static int Connect(char *host, char *port) {
+  struct addrinfo hints, *listp, *p;
+  int clientfd = -1;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if (getaddrinfo(host, port, &hints, &listp) != 0) {
+    return -1;
+  }
+  for (p = listp; p; p = p->ai_next) {
+    if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
+      continue;
+    }
+    if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) {
+      break;
+    }
+    close(clientfd);
+  }
+  freeaddrinfo(listp);
+  return p == NULL ? -1 : clientfd;
+}
+
+// Reads one version 1 message. Returns its length, or -1.
+static int ReadMessage(int fd, char *buffer) {
+  int len = read(fd, buffer, BUFFER_SIZE - 1);
+  if (len <= 0) {
+    return -1;
+  }
+  buffer[len] = '\0';
+  return len;
+}
+
+/**
+ * Connects, and if version 2 is wanted, asks for it.
+ *
+ * Returns the connection, or -1. Sets version to what was agreed.
+ */
+static int OpenSession(char *host, char *port, int *version) {
+  int fd = Connect(host, port);
+  char buffer[BUFFER_SIZE];
+  if (fd < 0) {
+    return -1;
+  }
+  if (ReadMessage(fd, buffer) < 0 || CheckAck(buffer) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (*version == 1) {
+    return fd;
+  }
+  int agreed = NegotiateV2(fd);
+  if (agreed != 2) {
+    close(fd);
+    if (agreed == 1) {
+      *version = 1;
+    }
+    return -1;
+  }
+  int nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  return fd;
+}
+
+// Runs a query with version 1 on a connection of its own. Returns how
+// many rows it found, or -1.
+static int RunQueryV1(Client *client, char *term) {
+  char buffer[BUFFER_SIZE];
+  int version = 1;
+  int fd = OpenSession(client->host, client->port, &version);
+  if (fd < 0) {
+    return -1;
+  }
+  write(fd, term, strlen(term));
+  int result = -1;
+  if (ReadMessage(fd, buffer) >= 0 && SendAck(fd) == 0) {
+    int num_results = atoi(buffer);
+    int i;
+    for (i = 0; i < num_results; i++) {
+      if (ReadMessage(fd, buffer) < 0 || SendAck(fd) != 0) {
+        break;
+      }
+    }
+    if (i == num_results && ReadMessage(fd, buffer) >= 0 &&
+        CheckGoodbye(buffer) == 0) {
+      result = num_results;
+    }
+  }
+  close(fd);
+  return result;
+}
+
+// Runs a query on a version 2 connection. Returns how many rows it
+// found, or -1.
+static int RunQueryV2(int fd, Frame *frame, char *term) {
+  uint32_t num_results;
+  if (SendFrame(fd, V2_QUERY, term, strlen(term)) != 0 ||
+      ReadFrame(fd, frame) != 0 || frame->type != V2_COUNT ||
+      frame->len != sizeof(num_results)) {
+    return -1;
+  }
+  memcpy(&num_results, frame->payload, sizeof(num_results));
+  num_results = ntohl(num_results);
+  uint32_t seen = 0;
+  while (seen < num_results) {
+    if (ReadFrame(fd, frame) != 0 || frame->type != V2_ROWS) {
+      return -1;
+    }
+    for (uint32_t offset = 0; offset + sizeof(uint32_t) <= frame->len;
+         seen++) {
+      uint32_t len;
+      memcpy(&len, frame->payload + offset, sizeof(len));
+      offset += sizeof(len) + ntohl(len);
+    }
+  }
+  return (int)num_results;
+}
+
+static void *RunClient(void *arg) {
+  Client *client = (Client*)arg;
+  Frame frame = {0, 0, NULL, 0};
+  int fd = -1;
+  while (WallSeconds() < stop_at) {
+    if (client->version == 2 && fd < 0) {
+      fd = OpenSession(client->host, client->port, &client->version);
+      if (fd < 0) {
+        client->failed++;
+        continue;
+      }
+    }
+    char *term = NextTerm(client);
+    // Timed from here, so reconnecting isn't counted against the query.
+    double start = WallSeconds();
+    int rows = client->version == 2 ?
+        RunQueryV2(fd, &frame, term) : RunQueryV1(client, term);
+    double now = WallSeconds();
+    if (rows < 0 && fd >= 0) {
+      // Start over with a new session, warmed up or not.
+      close(fd);
+      fd = -1;
+    }
+    // Only queries that ran entirely between the warm-up and the end
+    // are counted.
+    if (start < warm_until || now > stop_at) {
+      continue;
+    }
+    if (rows < 0) {
+      client->failed++;
+      continue;
+    }
+    RecordLatency(client->histogram, now - start);
+    client->queries++;
+    client->rows += rows;
+  }
+  if (fd >= 0) {
+    if (SendFrame(fd, V2_BYE, NULL, 0) == 0) {
+      ReadFrame(fd, &frame);
+    }
+    close(fd);
+  }
+  free(frame.payload);
+  return NULL;
+}
+
+static void Usage() {
+  printf("Usage: loadgen [-d <data dir> [-s <zipf exponent>] | "
+         "-r <term log>]\n"
+         "               [-c <clients>] [-t <seconds>] [-w <seconds>] "
+         "[-o <histogram file>] [-1]\n"
+         "               <host> <port>\n");
+}
+
+int main(int argc, char **argv) {
+  char *dir = NULL, *log = NULL, *histogram_file = NULL;
+  double exponent = 1.0, seconds = 10, warmup = 1;
+  int num_clients = 8, version = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:r:c:t:w:o:1")) != -1) {
+    switch (opt) {
+      case 'd': dir = optarg; break;
+      case 's': exponent = atof(optarg); break;
+      case 'r': log = optarg; break;
+      case 'c': num_clients = atoi(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      case 'w': warmup = atof(optarg); break;
+      case 'o': histogram_file = optarg; break;
+      case '1': version = 1; break;
+      default: Usage(); return 0;
+    }
+  }
+  if (argc - optind != 2 || (dir == NULL) == (log == NULL) ||
+      num_clients <= 0 || seconds <= 0 || warmup < 0) {
+    Usage();
+    return 0;
+  }
+
+  TermSource source;
+  if (dir != NULL ? LoadIndexTerms(dir, exponent, &source) != 0 :
+      LoadTermLog(log, &source) != 0) {
+    printf("Couldn't get any terms from %s\n", dir != NULL ? dir : log);
+    return 1;
+  }
+
+  // Find out which version the server speaks before starting the clock.
+  if (version == 2) {
+    Frame frame = {0, 0, NULL, 0};
+    int fd = OpenSession(argv[optind], argv[optind + 1], &version);
+    if (fd >= 0) {
+      if (SendFrame(fd, V2_BYE, NULL, 0) == 0) {
+        ReadFrame(fd, &frame);
+      }
+      free(frame.payload);
+      close(fd);
+    } else if (version == 2) {
+      printf("Couldn't connect to %s:%s\n", argv[optind], argv[optind + 1]);
+      return 1;
+    }
+  }
+
+  pthread_t *threads = (pthread_t*)malloc(num_clients * sizeof(pthread_t));
+  Client *clients = (Client*)calloc(num_clients, sizeof(Client));
+  Histogram *total = (Histogram*)calloc(1, sizeof(Histogram));
+  if (threads == NULL || clients == NULL || total == NULL) {
+    printf("Couldn't malloc for the clients\n");
+    return 1;
+  }
+  double start = WallSeconds();
+  warm_until = start + warmup;
+  stop_at = warm_until + seconds;
+  int num_started = 0;
+  for (int i = 0; i < num_clients; i++) {
+    clients[i].host = argv[optind];
+    clients[i].port = argv[optind + 1];
+    clients[i].version = version;
+    clients[i].source = &source;
+    clients[i].rng = source.replay ?
+        (uint64_t)i * source.num_terms / num_clients :
+        0x9E3779B97F4A7C15ULL * (i + 1);
+    clients[i].histogram = (Histogram*)calloc(1, sizeof(Histogram));
+    if (clients[i].histogram == NULL) {
+      printf("Couldn't malloc for the clients\n");
+      return 1;
+    }
+    if (pthread_create(&threads[i], NULL, &RunClient, &clients[i]) != 0) {
+      printf("Couldn't start client %d\n", i);
+      free(clients[i].histogram);
+      break;
+    }
+    num_started++;
+  }
+  if (num_started == 0) {
+    return 1;
+  }
+
+  // Only the clients that started are waited on and counted.
+  long queries = 0, rows = 0, failed = 0;
+  for (int i = 0; i < num_started; i++) {
+    pthread_join(threads[i], NULL);
+    AddHistogram(total, clients[i].histogram);
+    queries += clients[i].queries;
+    rows += clients[i].rows;
+    failed += clients[i].failed;
+    free(clients[i].histogram);
+  }
+
+  printf("%d clients, version %d, %.1f s after %.1f s warm-up: "
+         "%ld queries, %.0f queries/s, %.0f rows/s, %ld failed\n",
+         num_started, version, seconds, warmup, queries,
+         queries / seconds, rows / seconds, failed);
+  if (total->total > 0) {
+    printf("latency ms: p50 %.3f  p95 %.3f  p99 %.3f  p99.9 %.3f  "
+           "max %.3f\n",
+           HdrPercentile(total, 50), HdrPercentile(total, 95),
+           HdrPercentile(total, 99), HdrPercentile(total, 99.9),
+           total->max / 1000.0);
+  }
+  if (histogram_file != NULL && WriteHistogram(total, histogram_file) != 0) {
+    printf("Couldn't write %s\n", histogram_file);
+  }
+
+  for (int i = 0; i < source.num_terms; i++) {
+    free(source.terms[i]);
+  }
+  free(source.terms);
+  free(source.cdf);
+  free(total);
+  free(clients);
+  free(threads);
+  return 0;
+}
@@ -8,31 +8,48 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <errno.h>
+#include <pthread.h>
 
 
 #include "QueryProtocol.h"
+#include "QueryProtocolV2.h"
+#include "QueryService.h"
 #include "MovieSet.h"
 #include "MovieIndex.h"
 #include "DocIdMap.h"
 #include "htll/Hashtable.h"
 #include "QueryProcessor.h"
+#include "BooleanQuery.h"
 #include "FileParser.h"
+#include "IndexFile.h"
+#include "IndexPipeline.h"
 #include "FileCrawler.h"
+#include "LiveIndex.h"
 
 #define BUFFER_SIZE 1000
 
 int Cleanup();
 
-DocIdMap docs;
-Index docIndex;
+// The index. With -u, a thread keeps it up with the data directory
+// while queries run against it.
+LiveIndex liveIndex;
+int keepPositions = 0;
+// The index file to load the index from, or save it to once it's
+// built, if there is one.
+char *indexFile = NULL;
+// Seconds between looks at the data directory for changed files, or 0
+// to only index it once.
+int updateSeconds = 0;
+// How big to make each stage of the indexing pipeline; 0 for defaults.
+PipelineConfig pipelineConfig;
 
 #define SEARCH_RESULT_LENGTH 1500
 
-char movieSearchResult[SEARCH_RESULT_LENGTH];
-
 void sigchld_handler(int s) {
   write(0, "Handling zombies...\n", 20);
   // waitpid() might overwrite errno, so we save and restore it:
@@ -66,7 +83,7 @@ int open_listenfd(char* port) {
   // Accept connections on any IP address
   hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
   // ... using a port number
-  hints.ai_flags = AI_NUMERICSERV;
+  hints.ai_flags |= AI_NUMERICSERV;
   getaddrinfo(NULL, port, &hints, &listp);
 
   // Search list for a port we can bind to
@@ -100,8 +117,9 @@ int open_listenfd(char* port) {
     return -1;
   }
 
-  // Turn successful socket into a listening socket
-  if (listen(listenfd, 10) < 0) {
+  // Turn successful socket into a listening socket. Clients wait in the
+  // backlog while every worker is busy, so let it be as long as it can.
+  if (listen(listenfd, SOMAXCONN) < 0) {
     // Failure
     close(listenfd);
     puts("Fail on listen()");
@@ -111,11 +129,6 @@ int open_listenfd(char* port) {
   return listenfd;
 }
 
-// Prints an error message
-void ProtocolError() {
-  printf("Protocol Error: Please try again.\n");
-}
-
 // Reads from a socket and adds a null terminator to the buffer
 // buffLen should be one less than the size of the buffer to avoid
 // overwriting any part of the response.
@@ -126,18 +139,134 @@ int ReadAddNull(int socket, char* buffer, int buffLen) {
   return len;
 }
 
+void Setup(char *dir) {
+  struct sigaction kill;
+
+  kill.sa_handler = sigint_handler;
+  kill.sa_flags = 0;  // or SA_RESTART
+  sigemptyset(&kill.sa_mask);
+
+  if (sigaction(SIGINT, &kill, NULL) == -1) {
+    perror("sigaction");
+    exit(1);
+  }
+
+  liveIndex = SetupLiveIndex(dir, indexFile, keepPositions,
+                             &pipelineConfig);
+  if (liveIndex == NULL) {
+    exit(1);
+  }
+}
+
+int Cleanup() {
+  DestroyLiveIndex(liveIndex);
+  return 0;
+}
+
 /**
- *  Provides a multi-process solution to serving clients
+ * Runs the query protocol with one connected client, then closes the
+ * connection.
  */
-int HandleConnections(int sock_fd,
-                      struct sockaddr_storage their_addr,
-                      char* response) {
-  // Step 5: Accept connection
-  // Fork on every connection.
-  return 0;
+void ServeClient(int conn_fd) {
+  char response[101];
+  printf("Connected on socket %d\n", conn_fd);
+
+  // Send connection ACK
+  if (SendAck(conn_fd) == -1) {
+    // Close connection and accept next on fail
+    ProtocolError();
+    close(conn_fd);
+    return;
+  }
+
+  // A version 2 client answers the ACK with a HELLO, not a query
+  if (ClientSpeaksV2(conn_fd) == 1) {
+    ServeClientV2(liveIndex, conn_fd);
+    return;
+  }
+
+  // Get query
+  SearchResultBatch batch = NULL;
+  ReadAddNull(conn_fd, response, 100);
+  Index index = AcquireIndex(liveIndex);
+  int owned;
+  MovieSet set = FindQueryMovies(index, response, &owned);
+  if (set != NULL) {
+    // Read every result's row up front, a file at a time.
+    batch = FetchMovieSetRows(index, set);
+    if (owned) {
+      DestroyMovieSet(set);
+    }
+  }
+  if (batch != NULL) {
+    // Send number of results
+    snprintf(response, sizeof(response), "%d", batch->num_results);
+    write(conn_fd, response, strlen(response));
+
+    // Get ACK
+    ReadAddNull(conn_fd, response, 100);
+    if (CheckAck(response) == -1) {
+      ProtocolError();
+      DestroySearchResultBatch(batch);
+      ReleaseIndex(liveIndex, index);
+      close(conn_fd);
+      return;
+    }
+
+    // Give results to client
+    for (int i = 0; i < batch->num_results; i++) {
+      FieldView row = batch->results[i].row;
+      if (row.len > SEARCH_RESULT_LENGTH - 1) {
+        row.len = SEARCH_RESULT_LENGTH - 1;
+      }
+      write(conn_fd, row.start, row.len);
+
+      // Check for ACK
+      ReadAddNull(conn_fd, response, 100);
+      if (CheckAck(response) == -1) {
+        ProtocolError();
+        break;
+      }
+    }
+    DestroySearchResultBatch(batch);
+    ReleaseIndex(liveIndex, index);
+  } else {
+    ReleaseIndex(liveIndex, index);
+    // No search results
+    write(conn_fd, "0", 1);
+
+    // Get ACK
+    ReadAddNull(conn_fd, response, 100);
+    if (CheckAck(response) == -1) {
+      ProtocolError();
+      close(conn_fd);
+      return;
+    }
+  }
+  // Step 6: Close the socket
+  SendGoodbye(conn_fd);
+  close(conn_fd);
 }
 
-void Setup(char *dir) {
+// Accepts and serves clients one after another, forever.
+void AcceptLoop(int listen_fd) {
+  struct sockaddr_storage their_addr;
+  socklen_t addr_size;
+  while (1) {
+    addr_size = sizeof(their_addr);
+    int conn_fd = accept(listen_fd, (struct sockaddr*)&their_addr,
+                         &addr_size);
+    if (conn_fd < 0) {
+      continue;
+    }
+    ServeClient(conn_fd);
+  }
+}
+
+/**
+ * Forks a new process for every client, as soon as it connects.
+ */
+void ServeForkPerConnection(int listen_fd) {
   struct sigaction sa;
 
   sa.sa_handler = sigchld_handler;  // reap all dead processes
@@ -148,48 +277,143 @@ void Setup(char *dir) {
     exit(1);
   }
 
-  struct sigaction kill;
-
-  kill.sa_handler = sigint_handler;
-  kill.sa_flags = 0;  // or SA_RESTART
-  sigemptyset(&kill.sa_mask);
-
-  if (sigaction(SIGINT, &kill, NULL) == -1) {
-    perror("sigaction");
-    exit(1);
+  struct sockaddr_storage their_addr;
+  socklen_t addr_size;
+  int conn_fd;
+  while (1) {
+    // Make connection
+    puts("Waiting for connection...");
+    addr_size = sizeof(their_addr);
+    conn_fd = accept(listen_fd, (struct sockaddr*)&their_addr, &addr_size);
+    if (conn_fd < 0) {
+      continue;
+    }
+    if (fork() == 0) {
+      close(listen_fd);
+      ServeClient(conn_fd);  // Child
+      exit(0);
+    }
+    close(conn_fd);  // Parent
   }
+}
 
-  printf("Crawling directory tree starting at: %s\n", dir);
-  // Create a DocIdMap
-  docs = CreateDocIdMap();
-  CrawlFilesToMap(dir, docs);
-  printf("Crawled %d files.\n", NumElemsInHashtable(docs));
-
-  // Create the index
-  docIndex = CreateIndex();
+/**
+ * Forks num_workers processes up front, which each inherit the index
+ * already built, and take turns accepting clients on the one listening
+ * socket. A worker that dies is replaced.
+ */
+void ServePrefork(int listen_fd, int num_workers) {
+  for (int i = 0; i < num_workers; i++) {
+    if (fork() == 0) {
+      AcceptLoop(listen_fd);
+    }
+  }
+  while (1) {
+    if (wait(NULL) > 0 && fork() == 0) {
+      AcceptLoop(listen_fd);
+    }
+  }
+}
 
-  // Index the files
-  printf("Parsing and indexing files...\n");
-  ParseTheFiles(docs, docIndex);
-  printf("%d entries in the index.\n", NumElemsInHashtable(docIndex->ht));
+static void *WorkerThread(void *arg) {
+  AcceptLoop(*(int*)arg);
+  return NULL;
 }
 
-int Cleanup() {
-  DestroyOffsetIndex(docIndex);
-  DestroyDocIdMap(docs);
-  return 0;
+/**
+ * Starts num_workers threads, which share the one index, read-only,
+ * and take turns accepting clients on the one listening socket. If
+ * none of them can be started, this thread accepts clients instead.
+ */
+void ServeThreads(int listen_fd, int num_workers) {
+  // A client that hangs up mid-write would otherwise take every
+  // worker, and the index, with it.
+  signal(SIGPIPE, SIG_IGN);
+  pthread_t *threads = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+  if (threads == NULL) {
+    printf("Couldn't malloc for the worker threads\n");
+    return;
+  }
+  int started = 0;
+  for (int i = 0; i < num_workers; i++) {
+    if (pthread_create(&threads[started], NULL, &WorkerThread,
+                       &listen_fd) != 0) {
+      printf("Couldn't start worker thread %d\n", i);
+      continue;
+    }
+    started++;
+  }
+  if (started == 0) {
+    AcceptLoop(listen_fd);
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
 }
 
 int main(int argc, char **argv) {
   // Get args
-  if (argc != 3) {
-    printf("Must have two arguments.\n");
-    printf("Usage: queryserver <directory to crawl> <port number>\n");
+  while (argc > 1 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-p") == 0) {
+      // Keep title word positions, for phrase queries
+      keepPositions = 1;
+    } else if (strcmp(argv[1], "-i") == 0 && argc > 2) {
+      indexFile = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-s") == 0 && argc > 2) {
+      // Threads for each stage of the indexing pipeline
+      if (ParsePipelineConfig(argv[2], &pipelineConfig) != 0) {
+        printf("-s takes crawl,read,parse,tokenize,insert threads, "
+               "and then queue capacity if you like.\n");
+        return 0;
+      }
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-u") == 0 && argc > 2) {
+      // Look for changed data files every so many seconds
+      updateSeconds = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 3 || argc > 5) {
+    printf("Must have two to four arguments.\n");
+    printf("Usage: multiserver [-p] [-i <index file>] [-u <seconds>] "
+           "[-s <threads>]\n"
+           "                   <directory to crawl> <port number> "
+           "[fork|prefork|threads] [workers]\n");
+    return 0;
+  }
+  char *mode = argc > 3 ? argv[3] : "fork";
+  int num_workers = argc > 4 ? atoi(argv[4]) : 0;
+  if (num_workers <= 0) {
+    // One per core
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers <= 0) {
+      num_workers = 1;
+    }
+  }
+  if (strcmp(mode, "fork") != 0 && strcmp(mode, "prefork") != 0 &&
+      strcmp(mode, "threads") != 0) {
+    printf("Unknown mode %s; use fork, prefork or threads.\n", mode);
+    return 0;
+  }
+  if (updateSeconds > 0 && strcmp(mode, "threads") != 0) {
+    // Forked workers would each have a copy of the index that the
+    // updater thread, left behind in the parent, never changes.
+    printf("-u only works with threads.\n");
     return 0;
   }
 
   char* dir_to_crawl = argv[1];
   Setup(dir_to_crawl);
+  StartUpdates(liveIndex, updateSeconds, indexFile);
 
   // Step 1: get address/port info to open
   char* port = argv[2];
@@ -199,91 +423,20 @@ int main(int argc, char **argv) {
   // Step 3: Bind socket
   // Step 4: Listen on the socket
   int listen_fd = open_listenfd(port);
+  if (listen_fd < 0) {
+    Cleanup();
+    return 1;
+  }
 
   // Step 5: Handle clients that connect
-  struct sockaddr_storage their_addr;
-  socklen_t addr_size;
-  char response[101];
-  int conn_fd;
-  while (1) {
-    // Make connection
-    puts("Waiting for connection...");
-    addr_size = sizeof(their_addr);
-    conn_fd = accept(listen_fd, (struct sockaddr*)&their_addr, &addr_size);
-    if (fork() == 0) {
-      close(listen_fd);
-      printf("Connected on socket %d\n", conn_fd);
-
-      // Send connection ACK
-      if (SendAck(conn_fd) == -1) {
-        // Close connection and accept next on fail
-        ProtocolError();
-        close(conn_fd);
-        continue;
-      }
-
-      // Get query
-      SearchResultIter iter;
-      ReadAddNull(conn_fd, response, 100);
-      iter = FindMovies(docIndex, response);
-      if (iter != NULL) {
-        // Send number of results
-        int numResults = NumResultsInIter(iter);
-        snprintf(response, sizeof(response), "%d", numResults);
-        write(conn_fd, response, strlen(response));
-
-        // Get ACK
-        ReadAddNull(conn_fd, response, 100);
-        if (CheckAck(response) == -1) {
-          ProtocolError();
-          close(conn_fd);
-          continue;
-        }
-
-        // Give results to client
-        while (1) {
-          if (numResults == 0) {
-            break;
-          }
-
-          // Get and write to client
-          struct searchResult movieID;
-          SearchResultGet(iter, &movieID);
-          CopyRowFromFile(&movieID, docs, movieSearchResult);
-          write(conn_fd, movieSearchResult, strlen(movieSearchResult));
-
-          // Check for ACK
-          ReadAddNull(conn_fd, response, 100);
-          if (CheckAck(response) == -1) {
-            ProtocolError();
-            break;
-          }
-
-          // Check for more results
-          if (SearchResultIterHasMore(iter)) {
-            SearchResultNext(iter);
-          } else {
-            DestroySearchResultIter(iter);
-            break;
-          }
-        } 
-      } else {
-        // No search results
-        write(conn_fd, "0", 1);
-
-        // Get ACK
-        ReadAddNull(conn_fd, response, 100);
-        if (CheckAck(response) == -1) {
-          ProtocolError();
-          close(conn_fd);
-        }
-      }
-      // Step 6: Close the socket
-      SendGoodbye(conn_fd);
-      close(conn_fd);  // Child
-      exit(0);
-    }
-    close(conn_fd);  // Parent
+  if (strcmp(mode, "prefork") == 0) {
+    printf("Serving with %d worker processes\n", num_workers);
+    ServePrefork(listen_fd, num_workers);
+  } else if (strcmp(mode, "threads") == 0) {
+    printf("Serving with %d worker threads\n", num_workers);
+    ServeThreads(listen_fd, num_workers);
+  } else {
+    ServeForkPerConnection(listen_fd);
   }
 
   // Got Kill signal
@@ -8,14 +8,31 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "QueryProtocol.h"
+#include "QueryProtocolV2.h"
 #include "queryclient.h"
+#include "WallClock.h"
 
 char *port_string;
 unsigned short int port;
 char *ip;
 
+// The version 2 connection queries go over, or -1 if the server only
+// speaks version 1, and each query gets a connection of its own.
+int session_fd = -1;
+
+// Whether to say so every time a connection is made.
+int announce_connections = 1;
+
+// How many of the best matches ranked queries ask for, or -1 to run
+// queries as boolean ones and get every match.
+int top_k = -1;
+
 #define BUFFER_SIZE 1500
 #define MAX_QUERY_LEN 100
 
@@ -76,7 +93,9 @@ int open_clientfd(char* hostname, char* port) {
     return -1;
   } else {
     // Success, return socket file descriptor
-    printf("Connected to %s\n\n", hostname);
+    if (announce_connections) {
+      printf("Connected to %s\n\n", hostname);
+    }
     return clientfd;
   }
 }
@@ -96,9 +115,18 @@ int ReadAddNull(int socket, char* buffer, int buffLen) {
   return len;
 }
 
-void RunQuery(char *query) {
+/**
+ * Runs one query with version 1 of the protocol, on a connection of its
+ * own, and prints the results to out, unless out is NULL.
+ *
+ * Returns 0 if successful, -1 if the connection or protocol failed.
+ */
+int RunQuery(char *query, FILE *out) {
   // Connect to the server
   int sockfd = open_clientfd(ip, port_string);
+  if (sockfd < 0) {
+    return -1;
+  }
 
   /*
    * Do the query-protocol
@@ -111,7 +139,7 @@ void RunQuery(char *query) {
   if (CheckAck(result) == -1) {
     ProtocolError();
     close(sockfd);
-    return;
+    return -1;
   }
 
   int numResponses;
@@ -122,21 +150,23 @@ void RunQuery(char *query) {
   if (SendAck(sockfd) == -1) {
     ProtocolError();
     close(sockfd);
-    return;
+    return -1;
   }
   numResponses = atoi(result);
-  if (numResponses == 0) {
-    puts("No results");
+  if (numResponses == 0 && out != NULL) {
+    fputs("No results\n", out);
   }
 
   // Get all the search results
   for (int i = 0; i < numResponses; i++) {
     ReadAddNull(sockfd, result, BUFFER_SIZE-1);
-    printf("%s\n\n", result);
+    if (out != NULL) {
+      fprintf(out, "%s\n\n", result);
+    }
     if (SendAck(sockfd) == -1) {
       ProtocolError();
       close(sockfd);
-      return;
+      return -1;
     }
   }
 
@@ -145,11 +175,407 @@ void RunQuery(char *query) {
   if (CheckGoodbye(result) == -1) {
     ProtocolError();
     close(sockfd);
-    return;
+    return -1;
   }
 
   // Close the connection at end of search
   close(sockfd);
+  return 0;
+}
+
+/**
+ * Connects to the server and asks for version 2 of the protocol.
+ *
+ * Returns the connection if the server speaks it, or -1 if it only
+ * speaks version 1 or something went wrong.
+ */
+int OpenSessionV2() {
+  int sockfd = open_clientfd(ip, port_string);
+  if (sockfd < 0) {
+    return -1;
+  }
+  char result[BUFFER_SIZE];
+  // Server sends ACK after connection
+  ReadAddNull(sockfd, result, BUFFER_SIZE-1);
+  if (CheckAck(result) == -1 || NegotiateV2(sockfd) != 2) {
+    close(sockfd);
+    return -1;
+  }
+  // Queries are sent a frame at a time, so don't hold them back.
+  int nodelay = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  return sockfd;
+}
+
+/**
+ * Sends a query on a version 2 connection: a RANKED one asking for the
+ * top_k best matches, or a plain QUERY if there's no top_k.
+ *
+ * Returns 0 if successful, -1 on error.
+ */
+int SendQueryV2(int sockfd, const char *query) {
+  if (top_k < 0) {
+    return SendFrame(sockfd, V2_QUERY, query, strlen(query));
+  }
+  char payload[sizeof(uint32_t) + V2_MAX_QUERY];
+  uint32_t len = strlen(query);
+  if (len > V2_MAX_QUERY) {
+    return -1;
+  }
+  uint32_t k = htonl(top_k);
+  memcpy(payload, &k, sizeof(k));
+  memcpy(payload + sizeof(k), query, len);
+  return SendFrame(sockfd, V2_RANKED, payload, sizeof(k) + len);
+}
+
+/**
+ * Reads one query's answer, the COUNT frame and then ROWS frames until
+ * every row has come, and prints it to out, unless out is NULL.
+ *
+ * Returns 0 if successful, -1 on a protocol error.
+ */
+int ReadResultsV2(int sockfd, Frame *frame, FILE *out) {
+  uint32_t num_results;
+  if (ReadFrame(sockfd, frame) != 0 || frame->type != V2_COUNT ||
+      frame->len != sizeof(num_results)) {
+    return -1;
+  }
+  memcpy(&num_results, frame->payload, sizeof(num_results));
+  num_results = ntohl(num_results);
+  if (num_results == 0 && out != NULL) {
+    fputs("No results\n", out);
+  }
+
+  uint32_t printed = 0;
+  while (printed < num_results) {
+    if (ReadFrame(sockfd, frame) != 0 || frame->type != V2_ROWS) {
+      return -1;
+    }
+    // Each row is its length, then its bytes.
+    uint32_t offset = 0;
+    while (offset + sizeof(uint32_t) <= frame->len) {
+      uint32_t len;
+      memcpy(&len, frame->payload + offset, sizeof(len));
+      len = ntohl(len);
+      offset += sizeof(len);
+      if (len > frame->len - offset) {
+        return -1;
+      }
+      if (out != NULL) {
+        fprintf(out, "%.*s\n\n", (int)len, frame->payload + offset);
+      }
+      offset += len;
+      printed++;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Runs queries over the version 2 connection. They're all sent before
+ * any answer is read, so however many there are, and however many rows
+ * they find, they take one round trip.
+ *
+ * Returns 0 if successful, -1 on a protocol error.
+ */
+int RunQueriesV2(char **queries, int num_queries) {
+  for (int i = 0; i < num_queries; i++) {
+    if (SendQueryV2(session_fd, queries[i]) != 0) {
+      ProtocolError();
+      return -1;
+    }
+  }
+
+  Frame frame = {0, 0, NULL, 0};
+  int result = 0;
+  for (int i = 0; i < num_queries; i++) {
+    if (num_queries > 1) {
+      printf("Results for %s:\n\n", queries[i]);
+    }
+    if (ReadResultsV2(session_fd, &frame, stdout) != 0) {
+      ProtocolError();
+      result = -1;
+      break;
+    }
+  }
+  free(frame.payload);
+  return result;
+}
+
+// Says BYE on a version 2 connection, and closes it.
+void CloseSessionV2(int sockfd) {
+  Frame frame = {0, 0, NULL, 0};
+  if (SendFrame(sockfd, V2_BYE, NULL, 0) != 0 ||
+      ReadFrame(sockfd, &frame) != 0 || frame.type != V2_BYE) {
+    ProtocolError();
+  }
+  free(frame.payload);
+  close(sockfd);
+}
+
+/**
+ * A file of queries, run over a pool of connections (see RunBatch).
+ */
+typedef struct {
+  char **queries;
+  int num_queries;
+  int next;  // The next query to hand out
+  double *latencies;  // How long each query took, or -1 if it failed
+  int version;  // Which version of the protocol the server speaks
+  int depth;  // How many queries each connection has in flight
+  int quiet;  // Don't print the results
+  pthread_mutex_t lock;
+} QueryBatch;
+
+// Hands out the next query to run, or -1 once they've all been.
+static int NextBatchQuery(QueryBatch *batch) {
+  pthread_mutex_lock(&batch->lock);
+  int query = batch->next < batch->num_queries ? batch->next++ : -1;
+  pthread_mutex_unlock(&batch->lock);
+  return query;
+}
+
+/**
+ * Gets one query's answer: with version 1 by running the query on a
+ * connection of its own, with version 2 by reading the next answer on
+ * sockfd. Unless the results are quiet, they're gathered up and then
+ * printed all at once, so answers from different connections don't get
+ * mixed up.
+ *
+ * Returns 0 if successful, -1 if not.
+ */
+static int RunBatchQuery(QueryBatch *batch, int query, int sockfd,
+                         Frame *frame) {
+  char *text = NULL;
+  size_t len = 0;
+  FILE *out = NULL;
+  if (!batch->quiet) {
+    out = open_memstream(&text, &len);
+    if (out == NULL) {
+      return -1;
+    }
+    fprintf(out, "Results for %s:\n\n", batch->queries[query]);
+  }
+  int result = batch->version == 1 ?
+      RunQuery(batch->queries[query], out) :
+      ReadResultsV2(sockfd, frame, out);
+  if (out != NULL) {
+    fclose(out);
+    if (result == 0) {
+      pthread_mutex_lock(&batch->lock);
+      fwrite(text, 1, len, stdout);
+      pthread_mutex_unlock(&batch->lock);
+    }
+    free(text);
+  }
+  return result;
+}
+
+/**
+ * Runs queries from the batch until there are none left. With version 2
+ * it keeps one connection open the whole time, and batch->depth queries
+ * sent on it ahead of the answer it's waiting for.
+ */
+static void *BatchWorker(void *arg) {
+  QueryBatch *batch = (QueryBatch*)arg;
+  int query;
+  if (batch->version == 1) {
+    while ((query = NextBatchQuery(batch)) >= 0) {
+      double start = WallSeconds();
+      if (RunBatchQuery(batch, query, -1, NULL) == 0) {
+        batch->latencies[query] = WallSeconds() - start;
+      }
+    }
+    return NULL;
+  }
+
+  int sockfd = OpenSessionV2();
+  if (sockfd < 0) {
+    return NULL;
+  }
+  // The queries in flight, oldest first, in a ring.
+  int *in_flight = (int*)malloc(batch->depth * sizeof(int));
+  double *sent_at = (double*)malloc(batch->depth * sizeof(double));
+  int oldest = 0, num_in_flight = 0;
+  Frame frame = {0, 0, NULL, 0};
+  while (in_flight != NULL && sent_at != NULL) {
+    while (num_in_flight < batch->depth &&
+           (query = NextBatchQuery(batch)) >= 0) {
+      int slot = (oldest + num_in_flight) % batch->depth;
+      in_flight[slot] = query;
+      sent_at[slot] = WallSeconds();
+      num_in_flight++;
+      if (SendQueryV2(sockfd, batch->queries[query]) != 0) {
+        break;
+      }
+    }
+    if (num_in_flight == 0) {
+      CloseSessionV2(sockfd);
+      sockfd = -1;
+      break;
+    }
+    if (RunBatchQuery(batch, in_flight[oldest], sockfd, &frame) != 0) {
+      ProtocolError();
+      break;
+    }
+    batch->latencies[in_flight[oldest]] = WallSeconds() - sent_at[oldest];
+    oldest = (oldest + 1) % batch->depth;
+    num_in_flight--;
+  }
+  // Anything still in flight has failed; its latency stays -1.
+  if (sockfd >= 0) {
+    close(sockfd);
+  }
+  free(frame.payload);
+  free(in_flight);
+  free(sent_at);
+  return NULL;
+}
+
+// Compares latencies, for qsort.
+static int CompareLatencies(const void *a, const void *b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Gets the p'th percentile, in ms, of n sorted latencies.
+static double Percentile(double *sorted, int n, double p) {
+  int i = (int)ceil(p / 100 * n) - 1;
+  return 1000 * sorted[i < 0 ? 0 : i];
+}
+
+static void FreeBatchQueries(QueryBatch *batch) {
+  for (int i = 0; i < batch->num_queries; i++) {
+    free(batch->queries[i]);
+  }
+  free(batch->queries);
+}
+
+/**
+ * Reads queries from a file, one a line, and runs them all over a pool
+ * of num_connections connections, each with up to depth queries in
+ * flight, using the given version of the protocol. Prints the results,
+ * unless quiet, then how fast it went.
+ *
+ * Answers are printed in the order they come back, which is only the
+ * order of the file if there's one connection.
+ *
+ * Returns 0 if every query was answered, -1 if not.
+ */
+int RunBatch(char *file, int version, int num_connections, int depth,
+             int quiet) {
+  FILE *in = fopen(file, "r");
+  if (in == NULL) {
+    fprintf(stderr, "Couldn't open %s\n", file);
+    return -1;
+  }
+  QueryBatch batch = {NULL, 0, 0, NULL, version, depth, quiet,
+                      PTHREAD_MUTEX_INITIALIZER};
+  int capacity = 0;
+  int out_of_memory = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_size, in)) >= 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0 || len > MAX_QUERY_LEN) {
+      continue;
+    }
+    if (batch.num_queries == capacity) {
+      int new_capacity = capacity ? 2 * capacity : 1024;
+      char **queries = (char**)realloc(batch.queries,
+                                       new_capacity * sizeof(char*));
+      if (queries == NULL) {
+        out_of_memory = 1;
+        break;
+      }
+      batch.queries = queries;
+      capacity = new_capacity;
+    }
+    char *query = strdup(line);
+    if (query == NULL) {
+      out_of_memory = 1;
+      break;
+    }
+    batch.queries[batch.num_queries++] = query;
+  }
+  free(line);
+  fclose(in);
+  if (out_of_memory) {
+    fprintf(stderr, "Couldn't malloc for the queries in %s\n", file);
+    FreeBatchQueries(&batch);
+    return -1;
+  }
+  if (batch.num_queries == 0) {
+    fprintf(stderr, "No queries in %s\n", file);
+    free(batch.queries);
+    return -1;
+  }
+  batch.latencies = (double*)malloc(batch.num_queries * sizeof(double));
+  pthread_t *workers = (pthread_t*)malloc(num_connections *
+                                          sizeof(pthread_t));
+  if (batch.latencies == NULL || workers == NULL) {
+    fprintf(stderr, "Couldn't malloc to run the queries\n");
+    free(batch.latencies);
+    free(workers);
+    FreeBatchQueries(&batch);
+    return -1;
+  }
+  for (int i = 0; i < batch.num_queries; i++) {
+    batch.latencies[i] = -1;
+  }
+
+  announce_connections = 0;
+  double start = WallSeconds();
+  int started = 0;
+  for (int i = 0; i < num_connections; i++) {
+    if (pthread_create(&workers[started], NULL, &BatchWorker,
+                       &batch) != 0) {
+      fprintf(stderr, "Couldn't start connection %d\n", i);
+      break;
+    }
+    started++;
+  }
+  if (started == 0) {
+    // Run them all on one connection, on this thread.
+    BatchWorker(&batch);
+    started = 1;
+  } else {
+    for (int i = 0; i < started; i++) {
+      pthread_join(workers[i], NULL);
+    }
+  }
+  double seconds = WallSeconds() - start;
+
+  // Sort the latencies of the queries that were answered.
+  int answered = 0;
+  for (int i = 0; i < batch.num_queries; i++) {
+    if (batch.latencies[i] >= 0) {
+      batch.latencies[answered++] = batch.latencies[i];
+    }
+  }
+  qsort(batch.latencies, answered, sizeof(double), &CompareLatencies);
+  fprintf(stderr, "%d queries over %d connections (version %d, %d in "
+          "flight each) in %f s: %.0f queries/s, %d failed\n",
+          batch.num_queries, started, batch.version,
+          batch.version == 2 ? depth : 1, seconds,
+          answered / seconds, batch.num_queries - answered);
+  if (answered > 0) {
+    fprintf(stderr, "latency ms: p50 %.3f  p90 %.3f  p99 %.3f  "
+            "p99.9 %.3f  max %.3f\n",
+            Percentile(batch.latencies, answered, 50),
+            Percentile(batch.latencies, answered, 90),
+            Percentile(batch.latencies, answered, 99),
+            Percentile(batch.latencies, answered, 99.9),
+            1000 * batch.latencies[answered - 1]);
+  }
+
+  FreeBatchQueries(&batch);
+  free(batch.latencies);
+  free(workers);
+  return answered == batch.num_queries ? 0 : -1;
 }
 
 void RunPrompt() {
@@ -157,7 +583,11 @@ void RunPrompt() {
 
   while (1) {
     printf("Enter a term to search for, or q to quit: ");
-    scanf("%s", input);
+    // A whole line, so queries can have more than one word.
+    if (fgets(input, sizeof(input), stdin) == NULL) {
+      return;
+    }
+    input[strcspn(input, "\n")] = '\0';
 
     printf("input was: %s\n", input);
 
@@ -168,23 +598,88 @@ void RunPrompt() {
       }
     }
     printf("\n\n");
-    RunQuery(input);
+    if (session_fd >= 0) {
+      char *queries[] = {input};
+      if (RunQueriesV2(queries, 1) != 0) {
+        // Don't use a connection that's out of step; go back to
+        // version 1 for the rest.
+        close(session_fd);
+        session_fd = -1;
+      }
+    } else {
+      RunQuery(input, stdout);
+    }
   }
 }
 
 int main(int argc, char **argv) {
+  char *file = NULL;
+  int num_connections = 1;
+  int depth = 1;
+  int quiet = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:c:d:qk:")) != -1) {
+    switch (opt) {
+      case 'f': file = optarg; break;
+      case 'c': num_connections = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 'q': quiet = 1; break;
+      case 'k': top_k = atoi(optarg); break;
+      default: argc = 0;  // Print the usage
+    }
+  }
+
   // Check/get arguments
-  if (argc != 3) {
-    printf("Must have two arguments.\n");
-    printf("Usage: queryclient <IP address/hostname> <port number>\n");
+  if (argc - optind < 2 || num_connections <= 0 || depth <= 0 ||
+      (top_k < 0 && top_k != -1)) {
+    printf("Must have at least two arguments.\n");
+    printf("Usage: queryclient [-k <top K>] [-f <query file> "
+           "[-c <connections>] [-d <depth>] [-q]]\n"
+           "                   <IP address/hostname> <port number> "
+           "[term ...]\n");
     return 0;
   }
-  ip = argv[1];
-  port_string = argv[2];
+  ip = argv[optind];
+  port_string = argv[optind + 1];
+  char **terms = argv + optind + 2;
+  int num_terms = argc - optind - 2;
 
-  // Get info from user
-  // function runs query from within
-  RunPrompt();
+  // Use version 2 of the protocol if the server speaks it.
+  session_fd = OpenSessionV2();
+  if (top_k >= 0 && session_fd < 0) {
+    fprintf(stderr, "Ranked queries need a server that speaks version 2 "
+            "of the protocol.\n");
+    return 1;
+  }
 
-  return 0;
+  int result = 0;
+  if (file != NULL) {
+    // The pool opens connections of its own. Say BYE on this one first,
+    // or a server that serves one connection at a time would never get
+    // to them.
+    int version = session_fd >= 0 ? 2 : 1;
+    if (session_fd >= 0) {
+      CloseSessionV2(session_fd);
+      session_fd = -1;
+    }
+    result = RunBatch(file, version, num_connections, depth, quiet);
+  } else if (num_terms > 0) {
+    // Run the terms given, all at once if the server speaks version 2.
+    if (session_fd >= 0) {
+      result = RunQueriesV2(terms, num_terms);
+    } else {
+      for (int i = 0; i < num_terms; i++) {
+        result |= RunQuery(terms[i], stdout);
+      }
+    }
+  } else {
+    // Get info from user
+    // function runs query from within
+    RunPrompt();
+  }
+
+  if (session_fd >= 0) {
+    CloseSessionV2(session_fd);
+  }
+  return result == 0 ? 0 : 1;
 }
@@ -0,0 +1,255 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "QueryProtocol.h"
+#include "QueryProtocolV2.h"
+
+// How many bytes a frame's length and type take up.
+#define FRAME_HEADER 5
+
+// Version 1 messages are never longer than this.
+#define V1_MESSAGE_SIZE 1500
+
+int WriteFully(int fd, const void *buffer, int len) {
+  const char *next = (const char*)buffer;
+  while (len > 0) {
+    int written = write(fd, next, len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    next += written;
+    len -= written;
+  }
+  return 0;
+}
+
+int ReadFully(int fd, void *buffer, int len) {
+  char *next = (char*)buffer;
+  while (len > 0) {
+    int got = read(fd, next, len);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return -1;
+    }
+    next += got;
+    len -= got;
+  }
+  return 0;
+}
+
+// Fills in a frame's length and type.
+static void PutFrameHeader(char *header, char type, uint32_t payload_len) {
+  uint32_t len = htonl(payload_len + 1);
+  memcpy(header, &len, sizeof(len));
+  header[4] = type;
+}
+
+int SendFrame(int fd, char type, const void *payload, uint32_t len) {
+  char header[FRAME_HEADER];
+  PutFrameHeader(header, type, len);
+  if (len == 0) {
+    return WriteFully(fd, header, FRAME_HEADER);
+  }
+
+  // Header and payload in one write, so they go out in one segment.
+  struct iovec parts[2];
+  parts[0].iov_base = header;
+  parts[0].iov_len = FRAME_HEADER;
+  parts[1].iov_base = (void*)payload;
+  parts[1].iov_len = len;
+  int total = FRAME_HEADER + len;
+  int written = writev(fd, parts, 2);
+  while (written < 0 && errno == EINTR) {
+    written = writev(fd, parts, 2);
+  }
+  if (written < 0) {
+    return -1;
+  }
+  // Finish off whatever writev didn't get to.
+  if (written < FRAME_HEADER) {
+    if (WriteFully(fd, header + written, FRAME_HEADER - written) != 0) {
+      return -1;
+    }
+    written = FRAME_HEADER;
+  }
+  return WriteFully(fd, (const char*)payload + written - FRAME_HEADER,
+                    total - written);
+}
+
+int ReadFrame(int fd, Frame *frame) {
+  char header[FRAME_HEADER];
+  if (ReadFully(fd, header, FRAME_HEADER) != 0) {
+    return -1;
+  }
+  uint32_t len;
+  memcpy(&len, header, sizeof(len));
+  len = ntohl(len);
+  if (len < 1 || len > V2_MAX_FRAME) {
+    return -1;
+  }
+  frame->type = header[4];
+  frame->len = len - 1;
+
+  if (frame->payload == NULL || frame->capacity < frame->len + 1) {
+    char *payload = (char*)realloc(frame->payload, frame->len + 1);
+    if (payload == NULL) {
+      return -1;
+    }
+    frame->payload = payload;
+    frame->capacity = frame->len + 1;
+  }
+  if (ReadFully(fd, frame->payload, frame->len) != 0) {
+    return -1;
+  }
+  frame->payload[frame->len] = '\0';
+  return 0;
+}
+
+int ClientSpeaksV2(int fd) {
+  char first;
+  int got = recv(fd, &first, 1, MSG_PEEK);
+  while (got < 0 && errno == EINTR) {
+    got = recv(fd, &first, 1, MSG_PEEK);
+  }
+  if (got <= 0) {
+    return -1;
+  }
+  // A frame's length is never more than V2_MAX_FRAME, so its first
+  // byte is always 0; a query's never is.
+  return first == 0;
+}
+
+// Winds up the version 1 exchange a HELLO starts with a server that
+// took it for a query: ACKs the count, and any rows, and reads the
+// GOODBYE. got bytes of the count are in count.
+static int FinishV1Exchange(int fd, const char *count, int got) {
+  char buffer[V1_MESSAGE_SIZE];
+  memcpy(buffer, count, got);
+  buffer[got] = '\0';
+  int num_results = atoi(buffer);
+  for (int i = 0; i <= num_results; i++) {
+    if (SendAck(fd) != 0 || read(fd, buffer, sizeof(buffer) - 1) <= 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int NegotiateV2(int fd) {
+  char version = PROTOCOL_V2;
+  if (SendFrame(fd, V2_HELLO, &version, 1) != 0) {
+    return -1;
+  }
+
+  // A version 1 server sends back how many results the "query" had,
+  // then waits for an ACK, so don't wait for more than it sent unless
+  // it looks like a frame.
+  char hello[FRAME_HEADER + 1];
+  int got = read(fd, hello, sizeof(hello));
+  if (got <= 0) {
+    return -1;
+  }
+  if (hello[0] != 0) {
+    return FinishV1Exchange(fd, hello, got) == 0 ? 1 : -1;
+  }
+  if (ReadFully(fd, hello + got, sizeof(hello) - got) != 0) {
+    return -1;
+  }
+  uint32_t len;
+  memcpy(&len, hello, sizeof(len));
+  if (ntohl(len) != 2 || hello[4] != V2_HELLO ||
+      hello[5] != PROTOCOL_V2) {
+    return -1;
+  }
+  return 2;
+}
+
+int StartResults(ResultsWriter *writer, int fd, uint32_t num_results) {
+  writer->fd = fd;
+  writer->buffer = (char*)malloc(V2_RESULTS_BUFFER);
+  if (writer->buffer == NULL) {
+    return -1;
+  }
+  uint32_t count = htonl(num_results);
+  PutFrameHeader(writer->buffer, V2_COUNT, sizeof(count));
+  memcpy(writer->buffer + FRAME_HEADER, &count, sizeof(count));
+  writer->len = FRAME_HEADER + sizeof(count);
+  writer->rows_frame = -1;
+  return 0;
+}
+
+// Fills in the header of the ROWS frame being built, now that it's
+// known how long it is.
+static void CloseRowsFrame(ResultsWriter *writer) {
+  if (writer->rows_frame >= 0) {
+    PutFrameHeader(writer->buffer + writer->rows_frame, V2_ROWS,
+                   writer->len - writer->rows_frame - FRAME_HEADER);
+    writer->rows_frame = -1;
+  }
+}
+
+// Writes out everything in the buffer.
+static int FlushResults(ResultsWriter *writer) {
+  CloseRowsFrame(writer);
+  int result = WriteFully(writer->fd, writer->buffer, writer->len);
+  writer->len = 0;
+  return result;
+}
+
+int AddResultRow(ResultsWriter *writer, const char *row, uint32_t len) {
+  // A row never needs a frame bigger than V2_MAX_FRAME.
+  if (len > V2_MAX_FRAME - 1 - FRAME_HEADER - sizeof(uint32_t)) {
+    len = V2_MAX_FRAME - 1 - FRAME_HEADER - sizeof(uint32_t);
+  }
+  uint32_t needed = sizeof(uint32_t) + len;
+  if (writer->rows_frame < 0) {
+    needed += FRAME_HEADER;
+  }
+  if (writer->len + needed > V2_RESULTS_BUFFER) {
+    if (FlushResults(writer) != 0) {
+      return -1;
+    }
+    needed = FRAME_HEADER + sizeof(uint32_t) + len;
+  }
+
+  if (needed > V2_RESULTS_BUFFER) {
+    // Too big for the buffer, so it gets a frame of its own, written
+    // straight from the row.
+    char prefix[FRAME_HEADER + sizeof(uint32_t)];
+    uint32_t net_len = htonl(len);
+    PutFrameHeader(prefix, V2_ROWS, sizeof(net_len) + len);
+    memcpy(prefix + FRAME_HEADER, &net_len, sizeof(net_len));
+    if (WriteFully(writer->fd, prefix, sizeof(prefix)) != 0) {
+      return -1;
+    }
+    return WriteFully(writer->fd, row, len);
+  }
+
+  if (writer->rows_frame < 0) {
+    writer->rows_frame = writer->len;
+    writer->len += FRAME_HEADER;
+  }
+  uint32_t net_len = htonl(len);
+  memcpy(writer->buffer + writer->len, &net_len, sizeof(net_len));
+  memcpy(writer->buffer + writer->len + sizeof(net_len), row, len);
+  writer->len += sizeof(net_len) + len;
+  return 0;
+}
+
+int FinishResults(ResultsWriter *writer) {
+  int result = FlushResults(writer);
+  free(writer->buffer);
+  writer->buffer = NULL;
+  return result;
+}
@@ -8,24 +8,42 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
+#include <pthread.h>
 
 
 #include "QueryProtocol.h"
+#include "QueryProtocolV2.h"
+#include "QueryService.h"
 #include "MovieSet.h"
 #include "MovieIndex.h"
 #include "DocIdMap.h"
 #include "QueryProcessor.h"
+#include "BooleanQuery.h"
 #include "FileParser.h"
+#include "IndexFile.h"
+#include "IndexPipeline.h"
 #include "FileCrawler.h"
+#include "LiveIndex.h"
 #include "htll/Hashtable.h"
 
-DocIdMap docs;
-Index docIndex;
+// The index. With -u, a thread keeps it up with the data directory
+// while queries run against it.
+LiveIndex liveIndex;
+int keepPositions = 0;
+// The index file to load the index from, or save it to once it's
+// built, if there is one.
+char *indexFile = NULL;
+// Seconds between looks at the data directory for changed files, or 0
+// to only index it once.
+int updateSeconds = 0;
+// How big to make each stage of the indexing pipeline; 0 for defaults.
+PipelineConfig pipelineConfig;
 
 #define BUFFER_SIZE 1000
 #define SEARCH_RESULT_LENGTH 1500
-char movieSearchResult[SEARCH_RESULT_LENGTH];
 
 int Cleanup();
 
@@ -37,24 +55,15 @@ void sigint_handler(int sig) {
 
 
 void Setup(char *dir) {
-  printf("Crawling directory tree starting at: %s\n", dir);
-  // Create a DocIdMap
-  docs = CreateDocIdMap();
-  CrawlFilesToMap(dir, docs);
-  printf("Crawled %d files.\n", NumElemsInHashtable(docs));
-
-  // Create the index
-  docIndex = CreateIndex();
-
-  // Index the files
-  printf("Parsing and indexing files...\n");
-  ParseTheFiles(docs, docIndex);
-  printf("%d entries in the index.\n", NumElemsInHashtable(docIndex->ht));
+  liveIndex = SetupLiveIndex(dir, indexFile, keepPositions,
+                             &pipelineConfig);
+  if (liveIndex == NULL) {
+    exit(1);
+  }
 }
 
 int Cleanup() {
-  DestroyOffsetIndex(docIndex);
-  DestroyDocIdMap(docs);
+  DestroyLiveIndex(liveIndex);
 
   return 0;
 }
@@ -120,11 +129,6 @@ int open_listenfd(char* port) {
   return listenfd;
 }
 
-// Prints an error message
-void ProtocolError() {
-  printf("Protocol Error: Please try again.\n");
-}
-
 // Reads from a socket and adds a null terminator to the buffer
 // buffLen should be one less than the size of the buffer to avoid
 // overwriting any part of the response.
@@ -137,9 +141,37 @@ int ReadAddNull(int socket, char* buffer, int buffLen) {
 
 int main(int argc, char **argv) {
   // Get args
+  while (argc > 1 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-p") == 0) {
+      // Keep title word positions, for phrase queries
+      keepPositions = 1;
+    } else if (strcmp(argv[1], "-i") == 0 && argc > 2) {
+      indexFile = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-s") == 0 && argc > 2) {
+      // Threads for each stage of the indexing pipeline
+      if (ParsePipelineConfig(argv[2], &pipelineConfig) != 0) {
+        printf("-s takes crawl,read,parse,tokenize,insert threads, "
+               "and then queue capacity if you like.\n");
+        return 0;
+      }
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-u") == 0 && argc > 2) {
+      // Look for changed data files every so many seconds
+      updateSeconds = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
   if (argc != 3) {
     printf("Must have two arguments.\n");
-    printf("Usage: queryserver <directory to crawl> <port number>\n");
+    printf("Usage: queryserver [-p] [-i <index file>] [-u <seconds>] [-s <threads>] <directory to crawl> <port number>\n");
     return 0;
   }
 
@@ -157,6 +189,7 @@ int main(int argc, char **argv) {
 
   char* dir_to_crawl = argv[1];
   Setup(dir_to_crawl);
+  StartUpdates(liveIndex, updateSeconds, indexFile);
 
   // Step 1: get address/port info to open
   char* port = argv[2];
@@ -187,31 +220,47 @@ int main(int argc, char **argv) {
       continue;
     }
 
+    // A version 2 client answers the ACK with a HELLO, not a query
+    if (ClientSpeaksV2(conn_fd) == 1) {
+      ServeClientV2(liveIndex, conn_fd);
+      continue;
+    }
+
     // Get query
-    SearchResultIter iter;
+    SearchResultBatch batch = NULL;
     ReadAddNull(conn_fd, response, 100);
-    iter = FindMovies(docIndex, response);
-    if (iter != NULL) {
+    Index index = AcquireIndex(liveIndex);
+    int owned;
+    MovieSet set = FindQueryMovies(index, response, &owned);
+    if (set != NULL) {
+      // Read every result's row up front, a file at a time.
+      batch = FetchMovieSetRows(index, set);
+      if (owned) {
+        DestroyMovieSet(set);
+      }
+    }
+    if (batch != NULL) {
       // Send number of results
-      int numResults = NumResultsInIter(iter);
-      snprintf(response, sizeof(response), "%d", numResults);
+      snprintf(response, sizeof(response), "%d", batch->num_results);
       write(conn_fd, response, strlen(response));
 
       // Get ACK
       ReadAddNull(conn_fd, response, 100);
       if (CheckAck(response) == -1) {
         ProtocolError();
+        DestroySearchResultBatch(batch);
+        ReleaseIndex(liveIndex, index);
         close(conn_fd);
         continue;
       }
 
       // Give results to client
-      while (1) {
-        // Get and write to client
-        struct searchResult movieID;
-        SearchResultGet(iter, &movieID);
-        CopyRowFromFile(&movieID, docs, movieSearchResult);
-        write(conn_fd, movieSearchResult, strlen(movieSearchResult));
+      for (int i = 0; i < batch->num_results; i++) {
+        FieldView row = batch->results[i].row;
+        if (row.len > SEARCH_RESULT_LENGTH - 1) {
+          row.len = SEARCH_RESULT_LENGTH - 1;
+        }
+        write(conn_fd, row.start, row.len);
 
         // Check for ACK
         ReadAddNull(conn_fd, response, 100);
@@ -219,16 +268,11 @@ int main(int argc, char **argv) {
           ProtocolError();
           break;
         }
-
-        // Check for more results
-        if (SearchResultIterHasMore(iter)) {
-          SearchResultNext(iter);
-        } else {
-          DestroySearchResultIter(iter);
-          break;
-        }
       }
+      DestroySearchResultBatch(batch);
+      ReleaseIndex(liveIndex, index);
     } else {
+      ReleaseIndex(liveIndex, index);
       // There were no matching terms
       // Send number of results
       write(conn_fd, "0", 1);
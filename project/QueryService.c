@@ -0,0 +1,202 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "QueryService.h"
+#include "QueryProtocolV2.h"
+#include "MovieSet.h"
+#include "MovieIndex.h"
+#include "DocIdMap.h"
+#include "QueryProcessor.h"
+#include "BooleanQuery.h"
+#include "IndexFile.h"
+#include "htll/Hashtable.h"
+
+void ProtocolError() {
+  printf("Protocol Error: Please try again.\n");
+}
+
+LiveIndex SetupLiveIndex(char *dir, char *index_file, int keep_positions,
+                         PipelineConfig *config) {
+  DocIdMap docs = NULL;
+  Index index = NULL;
+  if (index_file != NULL) {
+    index = LoadIndexFile(index_file, &docs);
+    if (index != NULL && index->keep_positions != keep_positions) {
+      // It was saved with or without positions, and -p says otherwise.
+      DestroyOffsetIndex(index);
+      DestroyDocIdMap(docs);
+      index = NULL;
+    }
+    if (index != NULL) {
+      printf("Loaded the index from %s: %d entries.\n", index_file,
+             NumElemsInHashtable(index->ht));
+    } else {
+      printf("Building the index instead.\n");
+    }
+  }
+
+  if (index == NULL) {
+    printf("Crawling and indexing the directory tree at: %s\n", dir);
+    docs = CreateDocIdMap();
+    index = CreateIndex();
+    index->keep_positions = keep_positions;
+
+    // Crawl, parse and index all at once
+    PipelineStats stats;
+    if (BuildIndexPipelined(dir, docs, index, config, &stats) != 0) {
+      printf("Couldn't build the index\n");
+      return NULL;
+    }
+    PrintPipelineStats(&stats);
+    printf("Indexed %d files.\n", NumElemsInHashtable(docs));
+    printf("%d entries in the index.\n", NumElemsInHashtable(index->ht));
+    if (index_file != NULL && WriteIndexFile(index, docs, index_file) == 0) {
+      printf("Saved the index to %s.\n", index_file);
+    }
+  }
+
+  LiveIndex live = CreateLiveIndex(dir, index, docs);
+  if (live == NULL) {
+    printf("Couldn't allocate for the index\n");
+  }
+  return live;
+}
+
+// What the update thread works on. There's only ever one.
+static struct {
+  LiveIndex live;
+  int seconds;
+  char *index_file;
+} updates;
+
+// Runs in a thread of its own: every so often, indexes the data files
+// that are new or have changed, and drops the ones that have gone,
+// without stopping queries.
+static void *UpdateIndex(void *arg) {
+  while (1) {
+    sleep(updates.seconds);
+    int changes = UpdateLiveIndex(updates.live);
+    if (changes <= 0) {
+      continue;
+    }
+    printf("Updated the index: %d files new, changed or gone; "
+           "%d segments.\n", changes, NumSegmentsInLiveIndex(updates.live));
+    if (updates.index_file != NULL &&
+        SaveLiveIndex(updates.live, updates.index_file) == 0) {
+      printf("Saved the index to %s.\n", updates.index_file);
+    }
+  }
+  return NULL;
+}
+
+void StartUpdates(LiveIndex live, int seconds, char *index_file) {
+  pthread_t thread;
+  if (seconds <= 0) {
+    return;
+  }
+  updates.live = live;
+  updates.seconds = seconds;
+  updates.index_file = index_file;
+  if (pthread_create(&thread, NULL, &UpdateIndex, NULL) != 0) {
+    perror("pthread_create");
+    return;
+  }
+  pthread_detach(thread);
+  printf("Looking for changed files every %d seconds\n", seconds);
+  if (StartMerging(live) != 0) {
+    printf("Couldn't start merging segments\n");
+  }
+}
+
+int SendResultsV2(LiveIndex live, int conn_fd, const char *query, int k) {
+  // The rows point into the index's files, so it's held until they've
+  // been sent.
+  Index index = AcquireIndex(live);
+  SearchResultBatch batch = NULL;
+  if (k >= 0) {
+    batch = FindTopMovies(index, query, k);
+  } else {
+    int owned;
+    MovieSet set = FindQueryMovies(index, query, &owned);
+    if (set != NULL) {
+      batch = FetchMovieSetRows(index, set);
+      if (owned) {
+        DestroyMovieSet(set);
+      }
+    }
+  }
+  ResultsWriter writer;
+  if (StartResults(&writer, conn_fd,
+                   batch == NULL ? 0 : batch->num_results) != 0) {
+    if (batch != NULL) {
+      DestroySearchResultBatch(batch);
+    }
+    ReleaseIndex(live, index);
+    return -1;
+  }
+  int result = 0;
+  for (int i = 0; batch != NULL && i < batch->num_results; i++) {
+    FieldView row = batch->results[i].row;
+    if (AddResultRow(&writer, row.start, row.len) != 0) {
+      result = -1;
+      break;
+    }
+  }
+  if (FinishResults(&writer) != 0) {
+    result = -1;
+  }
+  if (batch != NULL) {
+    DestroySearchResultBatch(batch);
+  }
+  ReleaseIndex(live, index);
+  return result;
+}
+
+void ServeClientV2(LiveIndex live, int conn_fd) {
+  Frame frame = {0, 0, NULL, 0};
+  char version = PROTOCOL_V2;
+  if (ReadFrame(conn_fd, &frame) != 0 || frame.type != V2_HELLO ||
+      SendFrame(conn_fd, V2_HELLO, &version, 1) != 0) {
+    ProtocolError();
+    free(frame.payload);
+    close(conn_fd);
+    return;
+  }
+  // Every answer goes out in whole buffers already, so don't let them
+  // wait on the client's ACKs.
+  int nodelay = 1;
+  setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  while (ReadFrame(conn_fd, &frame) == 0) {
+    if (frame.type == V2_BYE) {
+      SendFrame(conn_fd, V2_BYE, NULL, 0);
+      break;
+    }
+    if (frame.type == V2_RANKED && frame.len >= sizeof(uint32_t) &&
+        frame.len <= V2_MAX_QUERY + sizeof(uint32_t)) {
+      uint32_t k;
+      memcpy(&k, frame.payload, sizeof(k));
+      k = ntohl(k);
+      if (SendResultsV2(live, conn_fd, frame.payload + sizeof(k),
+                        k > V2_MAX_K ? V2_MAX_K : k) != 0) {
+        ProtocolError();
+        break;
+      }
+      continue;
+    }
+    if (frame.type != V2_QUERY || frame.len > V2_MAX_QUERY ||
+        SendResultsV2(live, conn_fd, frame.payload, -1) != 0) {
+      ProtocolError();
+      break;
+    }
+  }
+  free(frame.payload);
+  close(conn_fd);
+}
@@ -19,7 +19,11 @@
 #define FILECRAWLER_H
 
 
+#include <stdint.h>
+
 #include "DocIdMap.h"
+#include "RowTable.h"
+#include "htll/Hashtable.h"
 #include "htll/LinkedList.h"
 
 
@@ -36,5 +40,105 @@
  */
 void CrawlFilesToMap(const char *dir, DocIdMap map);
 
+/**
+ * Called with each file CrawlFiles finds, given its path to keep or
+ * free. It's called from the crawl's threads, several at once.
+ */
+typedef void (*CrawlFileFn)(char *path, void *arg);
+
+/**
+ * Crawls a directory tree on several threads, calling found with every
+ * file, in no particular order. The threads take directories from a
+ * bounded queue; a thread that finds one when the queue is full crawls
+ * it itself. Only links, and files whose directory entries don't say
+ * what they are, are stat'd.
+ *
+ * \param dir which directory to crawl, ending in '/'.
+ * \param num_threads how many threads to crawl on; 0 for one per core.
+ * \param found called with each file.
+ * \param arg passed to found.
+ *
+ * \return 0 if successful, -1 if out of memory.
+ */
+int CrawlFiles(const char *dir, int num_threads, CrawlFileFn found,
+               void *arg);
+
+/**
+ * Does what CrawlFilesToMap does, crawling with CrawlFiles. The files
+ * are given the same ids CrawlFilesToMap would give them.
+ *
+ * \param dir which directory to crawl
+ * \param map the DocIdMap to put the filenames in.
+ * \param num_threads how many threads to crawl on; 0 for one per core.
+ */
+void CrawlFilesToMap_Parallel(const char *dir, DocIdMap map,
+                              int num_threads);
+
+/**
+ * What a crawl last saw of a file, to tell whether it has changed by
+ * the next one.
+ */
+typedef struct fileState {
+  char *path;
+  uint64_t doc_id; /*!< The file's id in the DocIdMap */
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode;
+} FileState;
+
+/**
+ * The files a crawl found: a Hashtable of their FileStates, keyed by a
+ * hash of each file's path. Paths whose hashes collide go under the
+ * next free key, and are told apart by comparing the paths.
+ */
+typedef Hashtable CrawlState;
+
+/**
+ * Makes a CrawlState of the files crawled into a DocIdMap, as they
+ * were when their rows were read.
+ *
+ * \param docs the files.
+ * \param rows the RowTable they were indexed into.
+ *
+ * \return the CrawlState, to be destroyed with DestroyCrawlState, or
+ *   NULL if out of memory.
+ */
+CrawlState CreateCrawlState(DocIdMap docs, RowTable rows);
+
+/**
+ * Destroys a CrawlState.
+ */
+void DestroyCrawlState(CrawlState state);
+
+/**
+ * Crawls a directory again, and works out which files are new, have
+ * changed or have gone since the crawl a CrawlState has, going by
+ * their size, mtime and inode. The CrawlState is left as it is, and a
+ * new one of the files as they are now is made, so it can take the old
+ * one's place once the changes have been dealt with, or be thrown away
+ * if they couldn't be.
+ *
+ * A changed file is treated as one that's gone and a new one, so
+ * whatever was indexed from it can be left as it was while the new
+ * file is indexed.
+ *
+ * \param dir the directory crawled before.
+ * \param state what the crawl before saw.
+ * \param next_doc_id the id to give the next new file; it's moved on
+ *   past the ids given out.
+ * \param changed a DocIdMap to put the new and changed files in, under
+ *   their new ids.
+ * \param removed a Hashtable to put the old ids of the changed and
+ *   gone files in, as keys.
+ * \param next set to the new CrawlState, to be destroyed with
+ *   DestroyCrawlState, or NULL if out of memory.
+ *
+ * \return how many files are new, changed or gone, or -1 if out of
+ *   memory.
+ */
+int CrawlChangedFiles(const char *dir, CrawlState state, uint64_t *next_doc_id,
+                      DocIdMap changed, Hashtable removed, CrawlState *next);
+
 
 #endif  // FILECRAWLER_H
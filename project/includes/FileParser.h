@@ -40,6 +40,58 @@ LinkedList ReadFile(const char* filename);
 
 Index BuildMovieIndex(LinkedList movies, enum IndexField field_to_index);
 
+/**
+ * Same as ParseTheFiles_Sharded, with one worker thread per core.
+ */
 int ParseTheFiles_MT(DocIdMap docs, Index index);
 
+/**
+ * Same as ParseTheFiles, but spread over a pool of worker threads.
+ * Workers that run out of files steal them from the others, and
+ * files bigger than a megabyte are split into chunks so one huge
+ * file doesn't keep a single thread busy after the rest are done.
+ *
+ * \param docs the DocIdMap that contains all the files we want to parse.
+ * \param index the index to hold all the indexed docs.
+ * \param num_threads how many workers to use; 0 for one per core.
+ *
+ * \return 0 if successful.
+ */
+int ParseTheFiles_Pool(DocIdMap docs, Index index, int num_threads);
+
+/**
+ * Same as ParseTheFiles_Pool, but instead of every worker adding to
+ * index under one lock, each builds a private shard of the index,
+ * and the shards are merged into index at the end.
+ * The result is the same index ParseTheFiles builds.
+ *
+ * \param docs the DocIdMap that contains all the files we want to parse.
+ * \param index the index to hold all the indexed docs.
+ * \param num_threads how many workers to use; 0 for one per core.
+ *
+ * \return 0 if successful.
+ */
+int ParseTheFiles_Sharded(DocIdMap docs, Index index, int num_threads);
+
+/**
+ * Crawls a directory and parses the files in it at the same time: the
+ * crawl runs on several threads, and hands each file to the pool of
+ * ParseTheFiles_Sharded as soon as it finds it, so parsing starts before
+ * the crawl is done.
+ *
+ * Files are given ids in the order they're found, which isn't the same
+ * from one run to the next; use CrawlFilesToMap_Parallel and then
+ * ParseTheFiles_Sharded for the ids CrawlFilesToMap gives.
+ *
+ * \param dir the directory to crawl, ending in '/'.
+ * \param docs an empty DocIdMap to put the files in.
+ * \param index the index to hold all the indexed docs.
+ * \param num_threads how many threads to crawl on, and how many workers
+ *   to parse with; 0 for one per core.
+ *
+ * \return 0 if successful.
+ */
+int CrawlAndParseFiles(const char *dir, DocIdMap docs, Index index,
+                       int num_threads);
+
 #endif
@@ -0,0 +1,86 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include <stdint.h>
+
+#include "MovieIndex.h"
+#include "DocIdMap.h"
+
+/**
+ * The version of the index file format this code writes and reads.
+ * Bump it whenever the layout of anything saved changes.
+ */
+#define INDEX_FILE_VERSION 2
+
+/**
+ * Where an index file's image expects to be mapped. The pointers in it
+ * are already the ones it has when it's mapped here, so a loaded index
+ * needs no fixing up, and every server process shares the same pages.
+ */
+#define INDEX_FILE_BASE 0x200000000000ULL
+
+/**
+ * How many bytes of an index file come before its image. It's a
+ * multiple of any page size, so the image can be mapped on its own.
+ */
+#define INDEX_FILE_HEADER_SIZE (64 * 1024)
+
+/**
+ * Saves an offset index, and the files it was built from, to an index
+ * file that LoadIndexFile can serve queries from straight away.
+ *
+ * The file is a header, then an image of the term table, the MovieSets
+ * with their PostingLists, the DocIdMap and the RowTable, laid out as
+ * they are in memory, then a list of where the image holds pointers.
+ * The header has a checksum of each. The file is written under a
+ * temporary name and renamed into place, so a reader never sees half
+ * of one.
+ *
+ * \param index the offset index, with its RowTable.
+ * \param docs the files it was built from.
+ * \param path where to save it.
+ *
+ * \return 0 if successful, -1 if it couldn't be written.
+ */
+int WriteIndexFile(Index index, DocIdMap docs, const char *path);
+
+/**
+ * Loads an index saved by WriteIndexFile, by mapping it read-only. The
+ * image is mapped at INDEX_FILE_BASE, where its pointers are right as
+ * they are, so nothing is parsed or copied. If something else is
+ * already mapped there, it's mapped privately wherever it fits and
+ * its pointers are moved over instead.
+ *
+ * Files the index was built from that have changed size, been
+ * modified or been replaced since their rows were read are taken to
+ * mean the index is out of date, and it isn't loaded.
+ *
+ * \param path the index file.
+ * \param docs set to a new DocIdMap of the files it was built from, to
+ *   be destroyed with DestroyDocIdMap after the index.
+ *
+ * \return the index, to be destroyed with DestroyOffsetIndex, or NULL
+ *   if the file is missing, isn't an index file of this version, fails
+ *   its checksums or is out of date.
+ */
+Index LoadIndexFile(const char *path, DocIdMap *docs);
+
+#endif  // INDEXFILE_H
@@ -0,0 +1,123 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDEXPIPELINE_H
+#define INDEXPIPELINE_H
+
+#include <stdint.h>
+
+#include "MovieIndex.h"
+#include "DocIdMap.h"
+
+/**
+ * Builds an offset index from a directory as a pipeline of stages, each
+ * on threads of its own, with a bounded queue in front of each one:
+ *
+ * - crawl: walks the directory with CrawlFiles, giving files ids;
+ * - read: maps each file and reads it into memory ahead of the parser;
+ * - parse: finds the movie rows, records them in the RowTable, and
+ *   passes them on in batches;
+ * - tokenize: splits titles into lowercase words and hashes them;
+ * - insert: adds the words to the index, each inserter to a shard that
+ *   holds the terms whose hash falls to it.
+ *
+ * A stage that gets ahead fills the queue after it and then waits, so
+ * no more of the corpus is in memory at once than the queues hold, and
+ * once the pipeline is full it runs about as fast as its slowest stage.
+ * Each file's batches reach the inserters in the order they were
+ * parsed, so rows are only ever appended to posting lists.
+ */
+
+/** How many stages there are. */
+#define PIPELINE_STAGES 5
+
+/**
+ * How many threads each stage gets, and how many items each queue can
+ * hold. 0 means the default.
+ */
+typedef struct pipelineConfig {
+  int crawl_threads;
+  int read_threads;
+  int parse_threads;
+  int tokenize_threads;
+  int insert_threads;
+  int queue_capacity; /*!< Items in each queue: files, or batches of rows */
+} PipelineConfig;
+
+/**
+ * What one stage did.
+ */
+typedef struct stageStats {
+  const char *name;
+  int threads;
+  long items; /*!< Files crawled, read or parsed; batches tokenized or inserted */
+  long bytes; /*!< Bytes read or parsed; 0 for other stages */
+  double busy_seconds; /*!< Working, added up over the stage's threads */
+  double wait_in_seconds; /*!< Waiting on an empty input queue */
+  double wait_out_seconds; /*!< Waiting on a full output queue */
+  int queue_capacity; /*!< Of the stage's input queue; 0 for crawl */
+  int max_depth; /*!< The most items there were in it at once */
+  double mean_depth; /*!< How many were in it when one was added */
+} StageStats;
+
+/**
+ * What a pipeline did, stage by stage.
+ */
+typedef struct pipelineStats {
+  StageStats stages[PIPELINE_STAGES];
+  double seconds; /*!< From start to finish, wall clock */
+} PipelineStats;
+
+/**
+ * Reads how big to make each stage from a string such as "1,1,2,4,2":
+ * the threads for crawl, read, parse, tokenize and insert, then,
+ * optionally, the queue capacity. 0 means the default.
+ *
+ * \param spec the string.
+ * \param config set to the sizes.
+ *
+ * \return 0 if successful, -1 if spec isn't five or six numbers.
+ */
+int ParsePipelineConfig(const char *spec, PipelineConfig *config);
+
+/**
+ * Crawls a directory and builds an offset index of the files in it,
+ * through the pipeline.
+ *
+ * Files are given ids in the order they're found, which isn't the same
+ * from one run to the next.
+ *
+ * \param dir the directory to crawl, ending in '/'.
+ * \param docs an empty DocIdMap to put the files in.
+ * \param index an empty offset index to build.
+ * \param config how big to make each stage, or NULL for the defaults.
+ * \param stats set to what each stage did, if it isn't NULL.
+ *
+ * \return 0 if successful, -1 if out of memory or its threads couldn't
+ *         all be started.
+ */
+int BuildIndexPipelined(const char *dir, DocIdMap docs, Index index,
+                        const PipelineConfig *config, PipelineStats *stats);
+
+/**
+ * Prints a line for each stage of a pipeline: its threads, how much it
+ * did and how fast, and how full the queue in front of it got.
+ */
+void PrintPipelineStats(const PipelineStats *stats);
+
+#endif  // INDEXPIPELINE_H
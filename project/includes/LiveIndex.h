@@ -0,0 +1,129 @@
+/*
+ *  Created by Adrienne Slaughter
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIVEINDEX_H
+#define LIVEINDEX_H
+
+#include "MovieIndex.h"
+#include "DocIdMap.h"
+
+/**
+ * An offset index that keeps up with its data directory while queries
+ * run against it.
+ *
+ * It's made of segments, which never change once they're made: the
+ * index it started with, and then one more for each update, holding
+ * just the files that were new or changed. Queries see a version of the
+ * index: the segments, less the files that have changed or gone since.
+ * Nothing is copied out of the segments to make a version, so an update
+ * takes about as long however big the index is. A version looks each
+ * term up in every segment as a query asks for it. Only terms that are
+ * in more than one segment, or that a changed or removed file was in,
+ * get a MovieSet of the version's own, made the first time they're
+ * asked for, and even then it shares the segments' PostingLists.
+ *
+ * So that there don't get to be too many segments, segments of about
+ * the same size are merged into one, LIVE_MERGE_FACTOR at a time, and
+ * the merged segments are merged in turn once there are enough of them,
+ * the way an LSM tree does it. A segment that's mostly files that have
+ * changed or gone is copied without them.
+ *
+ * An update builds a new version beside the current one and swaps it
+ * in at once. Queries that already have the old version carry on with
+ * it, and it's freed when the last of them lets it go, much as RCU
+ * does it.
+ */
+typedef struct liveIndex *LiveIndex;
+
+/**
+ * Makes a LiveIndex out of an index that has been built, or loaded,
+ * from a directory.
+ *
+ * \param dir the directory the index was built from.
+ * \param index the index; the LiveIndex takes it over.
+ * \param docs the files it was built from; taken over too.
+ *
+ * \return the LiveIndex, or NULL if out of memory.
+ */
+LiveIndex CreateLiveIndex(const char *dir, Index index, DocIdMap docs);
+
+/**
+ * Destroys a LiveIndex, and every segment, after stopping the merge
+ * thread if there is one. No query may still have a version of it.
+ */
+void DestroyLiveIndex(LiveIndex live);
+
+/**
+ * Gets the current version of the index, to run a query against. It
+ * stays as it is, whatever updates happen, until it's released.
+ *
+ * \return the index. Don't destroy it; hand it to ReleaseIndex.
+ */
+Index AcquireIndex(LiveIndex live);
+
+/**
+ * Lets go of a version of the index that AcquireIndex gave.
+ */
+void ReleaseIndex(LiveIndex live, Index index);
+
+/**
+ * Crawls the directory again, indexes the files that are new or have
+ * changed since the last crawl into a new segment, and swaps in a
+ * version of the index with them, and without the files that changed
+ * or have gone. Queries carry on meanwhile. Only one update runs at a
+ * time.
+ *
+ * \return how many files were new, changed or gone, or -1 if out of
+ *   memory or the changed files couldn't be indexed. The index and
+ *   what the last crawl saw are then left as they were, so the next
+ *   update picks the same changes up again.
+ */
+int UpdateLiveIndex(LiveIndex live);
+
+/**
+ * Merges one lot of segments that are due to be merged, if there are
+ * any, and swaps in a version with the merged segment instead. Queries
+ * and updates carry on while the merged segment is made.
+ *
+ * \return how many segments were merged, 0 if none were due, or -1 if
+ *   out of memory.
+ */
+int MergeLiveIndex(LiveIndex live);
+
+/**
+ * Starts a thread that merges segments whenever an update leaves some
+ * due to be merged. DestroyLiveIndex stops it.
+ *
+ * \return 0 if successful, -1 if the thread couldn't be started.
+ */
+int StartMerging(LiveIndex live);
+
+/**
+ * Gets how many segments the current version of the index is made of.
+ */
+int NumSegmentsInLiveIndex(LiveIndex live);
+
+/**
+ * Saves the current version of the index with WriteIndexFile, putting
+ * its segments together into one to do it.
+ *
+ * \return 0 if successful, -1 if not.
+ */
+int SaveLiveIndex(LiveIndex live, const char *path);
+
+#endif  // LIVEINDEX_H
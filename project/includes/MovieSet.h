@@ -20,22 +20,45 @@
 #define MOVIESET_H
 
 #include "htll/Hashtable.h"
+#include "htll/Arena.h"
+#include "PostingList.h"
 #include "Movie.h"
 
 /**
  * A MovieSet is a set of movies.
  *
  * doc_index is a hashtable where the key is a doc_id,
- * and the value is a linked list. The payloads in the linked
- * list is a row_id that indicates which row in the specified file
- * has the info about the movie that belongs in this set.
+ * and the value is a PostingList of the row_ids that indicate
+ * which rows in the specified file have the info about the
+ * movies that belong in this set.
  */
 typedef struct movieSet {
   char *desc; /*!< A string describing the movie set. */
   Hashtable doc_index; /*!< A hashtable that holds the info about which doc each movie is in*/
   int num_movies;
+  Arena arena; /*!< Where the set, its offset lists and row ids are
+                 allocated from, or NULL if they are malloc'd */
+  Hashtable doc_positions; /*!< Where in the title the word is, for
+                             each row, if the index keeps positions;
+                             NULL if it doesn't */
 } *MovieSet;
 
+/**
+ * How many bits of a doc_positions entry are the word's position.
+ */
+#define TITLE_POSITION_BITS 6
+
+/**
+ * Words further into a title than this have no position kept.
+ */
+#define TITLE_MAX_POSITION ((1 << TITLE_POSITION_BITS) - 1)
+
+/**
+ * Rows from here on have no positions kept, since they don't fit in
+ * an entry alongside one.
+ */
+#define TITLE_MAX_POSITION_ROW (UINT32_MAX >> TITLE_POSITION_BITS)
+
 /**
  * A SetOfMovies is a set of movies.
  *
@@ -74,9 +97,28 @@ void DestroySetOfMovies(SetOfMovies set);
  * The offset list is the row IDs for each movie in the set.
  * Helpful for debugging.
  *
- * \param list A linkedlist of row Ids (the value of the doc_index)
+ * \param list A PostingList of row Ids (the value of the doc_index)
+ */
+void PrintOffsetList(PostingList list);
+
+/**
+ * Adds a Movie to the set, along with where the set's word is in its
+ * title. The position goes into doc_positions, which is made the
+ * first time, as an entry of row_id << TITLE_POSITION_BITS | position
+ * in the doc's PostingList, so a row's positions are next to each
+ * other and mostly take a byte each.
+ *
+ * \param set The MovieSet to add the movie to
+ * \param doc_id Which document/file the movie is stored in
+ * \param row_id Which row in the file the movie can be found.
+ * \param position Which word of the title it is, from 0; positions
+ * past TITLE_MAX_POSITION aren't kept, nor are any for rows past
+ * TITLE_MAX_POSITION_ROW.
+ *
+ * \return 0 if successful.
  */
-void PrintOffsetList(LinkedList list);
+int AddMovieWordToSet(MovieSet set, uint64_t doc_id, int row_id,
+                      int position);
 
 /**
  * Determines if a MovieSet contains movies from a specifid
@@ -98,6 +140,35 @@ int MovieSetContainsDoc(MovieSet set, uint64_t doc_id);
  */
 MovieSet CreateMovieSet(char *desc);
 
+/**
+ * Creates a new, empty MovieSet whose memory, including the offset
+ * lists and row ids added to it later, comes from the given Arena.
+ * Destroying the Arena frees all of it at once, so an index full of
+ * these sets doesn't have to free every row id one by one.
+ *
+ * \param desc the description of what relates the movies that will be in this MovieSet
+ * \param arena the Arena to allocate from
+ *
+ * \return A pointer to the new MovieSet.
+ */
+MovieSet CreateMovieSetInArena(char *desc, Arena arena);
+
+/**
+ * Moves the docs and rows of one MovieSet into another with the same
+ * description. Where both sets have rows for a doc, the rows are
+ * merged into a new PostingList allocated from arena; so are their
+ * positions, if they have any.
+ * The source set is left empty, with its doc_index destroyed.
+ * Both sets should allocate the same way: from arenas, or with malloc.
+ *
+ * \param into the MovieSet to add to.
+ * \param from the MovieSet to take the docs from.
+ * \param arena where to allocate merged offset lists, or NULL for malloc.
+ *
+ * \return 0 if successful.
+ */
+int MergeMovieSets(MovieSet into, MovieSet from, Arena arena);
+
 /**
  * Destroys the offset lists that are the values
  * of the hashtable.
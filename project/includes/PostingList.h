@@ -0,0 +1,201 @@
+/*
+ *  CS 5007 Spring 2019
+ *  Northeastern University, Seattle
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSTINGLIST_H
+#define POSTINGLIST_H
+
+#include <stdint.h>
+
+#include "htll/Arena.h"
+
+/**
+ * Lists of up to this many bytes are stored inside the PostingList
+ * struct itself, with no separate allocation.
+ */
+#define POSTING_INLINE_BYTES 8
+
+/**
+ * Every POSTING_SKIP_ROWS'th row of a list is also kept in a skip
+ * table, so an iterator can jump ahead without decoding every row on
+ * the way.
+ */
+#define POSTING_SKIP_ROWS 64
+
+/**
+ * Where an iterator would be at one of a list's skip rows.
+ */
+typedef struct postingSkip {
+  uint32_t row; /*!< The row */
+  uint32_t index; /*!< Which row of the list it is */
+  uint32_t next_byte; /*!< Where the gap to the row after it starts */
+  /**
+   * The fewest title words of any row from this one up to the next
+   * skip, for ranking to bound scores by (see ComputeBlockBounds), or
+   * 0 if that hasn't been worked out.
+   */
+  uint16_t block_words;
+  uint16_t block_year; /*!< And the latest year of any of them */
+} PostingSkip;
+
+/**
+ * A PostingList is the sorted set of row ids in one file that hold
+ * movies for one MovieSet.
+ *
+ * The rows are stored as the gap from the previous row, each gap
+ * written as a varint: 7 bits per byte, with the high bit set on
+ * every byte but the last. Rows in a file are mostly close together,
+ * so a row usually takes a single byte.
+ *
+ * Lists of more than POSTING_SKIP_ROWS rows also have a skip table,
+ * with an entry for every POSTING_SKIP_ROWS'th row.
+ */
+typedef struct postingList {
+  uint32_t num_rows; /*!< How many rows are in the list */
+  uint32_t last_row; /*!< The biggest row in the list */
+  uint32_t len; /*!< How many bytes of data are used */
+  uint32_t capacity; /*!< How many bytes of data there's room for */
+  union {
+    unsigned char inline_data[POSTING_INLINE_BYTES];
+    unsigned char *data;
+  } bytes; /*!< inline_data if capacity fits, else a pointer to it */
+  PostingSkip *skips; /*!< The skip table, or NULL if there are no skips */
+} *PostingList;
+
+/**
+ * Walks the rows of a PostingList from smallest to biggest.
+ * It's small enough to live on the stack or inside another iterator,
+ * and doesn't need to be destroyed.
+ */
+typedef struct postingListIter {
+  PostingList list;
+  uint32_t index; /*!< Which row we're at */
+  uint32_t next_byte; /*!< Where the gap to the next row starts */
+  uint32_t row; /*!< The row we're at */
+} PostingListIter;
+
+/**
+ * Gets how many entries a PostingList's skip table has.
+ */
+uint32_t NumSkipsInPostingList(PostingList list);
+
+/**
+ * Creates an empty PostingList.
+ *
+ * \param arena where to allocate the list from, or NULL to use malloc.
+ *
+ * \return the new PostingList, or NULL if out of memory.
+ */
+PostingList CreatePostingList(Arena arena);
+
+/**
+ * Adds a row to a PostingList. Adding rows in increasing order, as a
+ * file is read, is cheap; adding a smaller row than the last re-encodes
+ * the list. A row that's already in the list isn't added again.
+ *
+ * \param list the list to add to.
+ * \param arena the Arena the list was created with, or NULL.
+ * \param row the row id.
+ *
+ * \return 0 if successful, -1 if out of memory.
+ */
+int AddToPostingList(PostingList list, Arena arena, uint32_t row);
+
+/**
+ * Makes a new PostingList holding the rows of two others, which are
+ * left as they were.
+ *
+ * \param a one list.
+ * \param b the other list.
+ * \param arena where to allocate the new list from, or NULL to use malloc.
+ *
+ * \return the new PostingList, or NULL if out of memory.
+ */
+PostingList MergePostingLists(PostingList a, PostingList b, Arena arena);
+
+/**
+ * Makes a copy of a PostingList, skip table and all, with no room to
+ * spare.
+ *
+ * \param list the list to copy.
+ * \param arena where to allocate the copy from, or NULL to use malloc.
+ *
+ * \return the copy, or NULL if out of memory.
+ */
+PostingList CopyPostingList(PostingList list, Arena arena);
+
+/**
+ * Gets how many rows are in the list.
+ */
+int NumRowsInPostingList(PostingList list);
+
+/**
+ * Destroys a PostingList.
+ *
+ * \param list the list to destroy.
+ * \param arena the Arena the list was created with, or NULL.
+ */
+void DestroyPostingList(PostingList list, Arena arena);
+
+/**
+ * Points an iterator at the first row of a non-empty PostingList.
+ */
+void PostingListIterInit(PostingListIter *iter, PostingList list);
+
+/**
+ * Returns the row the iterator is at.
+ */
+uint32_t PostingListIterGet(PostingListIter *iter);
+
+/**
+ * Returns 1 if there is a row after the one the iterator is at, 0 if not.
+ */
+int PostingListIterHasNext(PostingListIter *iter);
+
+/**
+ * Moves the iterator to the next row.
+ *
+ * \return 0 if successful, 1 if there was no next row.
+ */
+int PostingListIterNext(PostingListIter *iter);
+
+/**
+ * Moves the iterator forward to the first row that's at least target,
+ * or leaves it where it is if it's there already. It gallops through
+ * the skip table first, so skipping a long way doesn't mean decoding
+ * every row in between.
+ *
+ * \return 0 if successful, 1 if there's no such row; the iterator is
+ * then at the last row.
+ */
+int PostingListIterSkipTo(PostingListIter *iter, uint32_t target);
+
+/**
+ * Finds the block of a list's skip table that a row would be in: the
+ * rows from one skip up to the next.
+ *
+ * \param list the list.
+ * \param row the row.
+ * \param end set to the first row of the next block, or UINT32_MAX if
+ *   there isn't one.
+ *
+ * \return the skip the block starts at, or NULL if the row would be
+ *   before the first skip.
+ */
+PostingSkip *PostingListFindBlock(PostingList list, uint32_t row,
+                                  uint32_t *end);
+
+#endif  // POSTINGLIST_H
@@ -40,7 +40,8 @@ typedef struct searchResult {
 typedef struct searchResultIter {
   int cur_doc_id;
   HTIter doc_iter;
-  LLIter offset_iter;
+  PostingListIter offset_iter;
+  MovieSet owned_set; /*!< A set made for this query, destroyed with it */
   int numResults;
 } *SearchResultIter;
 
@@ -61,21 +62,84 @@ int SearchResultNext(SearchResultIter iter);
 
 int SearchResultIterHasMore(SearchResultIter iter);
 
+/**
+ * Finds the movies matching a query: one word, or words joined with
+ * AND, OR and NOT (see BooleanQuery.h).
+ *
+ * \return an iterator over them, or NULL if there aren't any.
+ */
 SearchResultIter FindMovies(Index index, char *term);
 
 /**
- * Opens the file specified by the SearchResult as named
- *  in the DocIdMap and writes the specified row to the dest.
+ * One result of a SearchResultBatch: where the movie is, and its row.
+ */
+typedef struct searchResultRow {
+  uint64_t doc_id;
+  int row_id;
+  FieldView row; /*!< The row, without its newline; not NUL-terminated */
+  double score; /*!< How it ranked, for FindTopMovies; 0 otherwise */
+} SearchResultRow;
+
+/**
+ * Every result for a MovieSet, with their rows, fetched in one go.
+ * The results are grouped by file, in increasing doc_id and row_id.
+ */
+typedef struct searchResultBatch {
+  int num_results;
+  SearchResultRow *results;
+  char *rows; /*!< The bytes of every row, which the batch owns */
+} *SearchResultBatch;
+
+/**
+ * Fetches the rows of every movie in a MovieSet at once. Each file is
+ * gone through once, with all of its rows asked for up front and then
+ * read in offset order, instead of one seek and read per result.
+ * The rows are copied into the batch, so they can be used until it's
+ * destroyed. Rows a file no longer has, because it's been cut short
+ * since it was indexed, are left out.
+ *
+ * \param index the offset index the set came from.
+ * \param set the MovieSet.
+ *
+ * \return the results, or NULL if out of memory or a file couldn't be
+ *   read.
+ */
+SearchResultBatch FetchMovieSetRows(Index index, MovieSet set);
+
+/**
+ * Finds the k movies that best match the words of a query, ranked
+ * with BM25 (see RankMovies), along with their rows.
+ *
+ * \param index the offset index.
+ * \param query the words.
+ * \param k at most how many results to find.
+ *
+ * \return the results, best first, or NULL if out of memory or a file
+ *   couldn't be read. There can be fewer than k, or none; rows a file
+ *   no longer has are left out.
+ */
+SearchResultBatch FindTopMovies(Index index, const char *query, int k);
+
+/**
+ * Destroys a SearchResultBatch and its rows; the index and its files
+ * are untouched.
+ */
+void DestroySearchResultBatch(SearchResultBatch batch);
+
+/**
+ * Copies the row a SearchResult is for into dest, without its newline.
+ * The row is read straight from where the index recorded it starts,
+ * with one pread, rather than by reading through the file.
  *
- * INPUT:
- *    result: A SearchResult that contains a docId and rowId
- *     docIds: The DocIdMap that contains the doc names specified in result.
- *     dest: A pointer to a char array where the row from the given file and row should be written.
+ * \param index the offset index the result came from.
+ * \param result the doc_id and row_id of the row.
+ * \param dest where to write the row; a row that doesn't fit is cut short.
+ * \param dest_size how many bytes dest has room for, including the NUL.
  *
- * RETURNS:
- *     0 if successful; Not 0 if failed.
+ * \return 0 if successful, -1 if there's no such row.
  */
-int CopyRowFromFile(SearchResult result, DocIdMap docIds, char *dest);
+int CopyRowFromIndex(Index index, SearchResult result,
+                     char *dest, int dest_size);
 
 
 #endif
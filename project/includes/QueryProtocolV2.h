@@ -0,0 +1,159 @@
+#ifndef QUERYPROTOCOLV2_H
+#define QUERYPROTOCOLV2_H
+
+#include <stdint.h>
+
+/**
+ * Version 2 of the query protocol.
+ *
+ * Every message is a frame: a 4-byte length, in network byte order,
+ * then that many bytes of body. The body is a 1-byte type and its
+ * payload. Frames say how long they are, so it doesn't matter how TCP
+ * splits or joins them.
+ *
+ * A connection starts the way version 1 does, with the server sending
+ * an ACK. A version 2 client answers with a HELLO frame. Its first byte
+ * is 0, which no version 1 query starts with, so the server can tell
+ * which version the client speaks. The server answers with a HELLO of
+ * its own. A server that only speaks version 1 takes the HELLO for a
+ * query with no results, and the client falls back to version 1.
+ *
+ * After that the client can send any number of QUERY frames without
+ * waiting. The server answers each, in order, with a COUNT frame and
+ * then as many ROWS frames as it takes to hold every row. Nothing is
+ * acknowledged. The client ends with a BYE, which the server answers
+ * with a BYE before closing.
+ *
+ * A RANKED frame is a query too, answered the same way, but with only
+ * the K titles that match its words best, best first. Its words don't
+ * all have to be in a title, and AND, OR and NOT are just words.
+ */
+
+#define V2_HELLO 'H'  /*!< payload: the 1-byte version */
+#define V2_QUERY 'Q'  /*!< payload: the term */
+#define V2_COUNT 'C'  /*!< payload: 4-byte number of results */
+#define V2_ROWS 'R'   /*!< payload: rows, each a 4-byte length and bytes */
+#define V2_BYE 'B'    /*!< no payload */
+#define V2_RANKED 'K' /*!< payload: 4-byte K, then the query */
+
+/**
+ * The version HELLO frames carry.
+ */
+#define PROTOCOL_V2 2
+
+/**
+ * Frames bigger than this are refused.
+ */
+#define V2_MAX_FRAME (1 << 20)
+
+/**
+ * Servers write answers out in pieces of about this many bytes.
+ */
+#define V2_RESULTS_BUFFER (64 * 1024)
+
+/**
+ * Queries longer than this are refused.
+ */
+#define V2_MAX_QUERY 1000
+
+/**
+ * RANKED queries asking for more results than this get this many.
+ */
+#define V2_MAX_K 10000
+
+/**
+ * A frame that has been read.
+ */
+typedef struct frame {
+  char type;
+  uint32_t len; /*!< How many bytes of payload there are */
+  char *payload; /*!< NUL-terminated, for convenience */
+  uint32_t capacity; /*!< How many bytes payload has room for */
+} Frame;
+
+/**
+ * Builds up the frames that answer one query, and writes them out a
+ * buffer at a time, so the COUNT and the first rows go out together.
+ */
+typedef struct resultsWriter {
+  int fd;
+  char *buffer;
+  uint32_t len; /*!< How many bytes of buffer are in use */
+  int32_t rows_frame; /*!< Where the ROWS frame being built starts, or -1 */
+} ResultsWriter;
+
+/**
+ * Writes a whole buffer, however many writes it takes.
+ *
+ * RETURNS: 0 if successful, -1 on error.
+ */
+int WriteFully(int fd, const void *buffer, int len);
+
+/**
+ * Reads exactly len bytes, however many reads it takes.
+ *
+ * RETURNS: 0 if successful, -1 on error or if the connection closed.
+ */
+int ReadFully(int fd, void *buffer, int len);
+
+/**
+ * Sends one frame.
+ *
+ * RETURNS: 0 if successful, -1 on error.
+ */
+int SendFrame(int fd, char type, const void *payload, uint32_t len);
+
+/**
+ * Reads the next frame into frame, growing its payload if need be.
+ * Set frame->payload to NULL and frame->capacity to 0 before the first
+ * read, and free frame->payload when done.
+ *
+ * RETURNS: 0 if successful, -1 on error, if the connection closed, or
+ *          if the frame is bigger than V2_MAX_FRAME.
+ */
+int ReadFrame(int fd, Frame *frame);
+
+/**
+ * Checks whether the client on a connection that's just been sent the
+ * ACK speaks version 2, without reading anything it would need.
+ *
+ * RETURNS: 1 if it does, 0 if not, -1 on error.
+ */
+int ClientSpeaksV2(int fd);
+
+/**
+ * Sends a HELLO, as a version 2 client does once it has the ACK, and
+ * reads the server's answer.
+ *
+ * RETURNS: 2 if the server speaks version 2;
+ *          1 if it only speaks version 1, in which case it took the
+ *            HELLO for a query; that exchange is wound up here, and
+ *            the server will close the connection, so make a new one;
+ *          -1 on error.
+ */
+int NegotiateV2(int fd);
+
+/**
+ * Starts the answer to a query: the COUNT frame, saying there are
+ * num_results rows to come.
+ *
+ * RETURNS: 0 if successful, -1 if out of memory.
+ */
+int StartResults(ResultsWriter *writer, int fd, uint32_t num_results);
+
+/**
+ * Adds a row to the answer, writing out what's been built if the
+ * buffer is full.
+ *
+ * RETURNS: 0 if successful, -1 on error.
+ */
+int AddResultRow(ResultsWriter *writer, const char *row, uint32_t len);
+
+/**
+ * Writes out the rest of the answer, and frees the writer.
+ *
+ * RETURNS: 0 if successful, -1 on error.
+ */
+int FinishResults(ResultsWriter *writer);
+
+#endif  // QUERYPROTOCOLV2_H
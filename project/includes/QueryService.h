@@ -0,0 +1,60 @@
+#ifndef QUERYSERVICE_H
+#define QUERYSERVICE_H
+
+#include "IndexPipeline.h"
+#include "LiveIndex.h"
+
+/**
+ * What queryserver and multiserver share: getting the index ready,
+ * keeping it up with the data directory, and answering version 2
+ * clients from it. How connections are accepted, and version 1, are
+ * left to each server.
+ */
+
+/**
+ * Prints that a client broke the protocol.
+ */
+void ProtocolError();
+
+/**
+ * Loads the index from index_file, if that isn't NULL and the file was
+ * saved with keep_positions the same, or else crawls dir and builds it
+ * with the pipeline, saving it to index_file if there is one.
+ *
+ * \param dir the directory the data files are in.
+ * \param index_file the index file, or NULL.
+ * \param keep_positions 1 to keep title word positions, for phrases.
+ * \param config how big to make each stage of the pipeline.
+ *
+ * \return the index, ready for queries, or NULL if it couldn't be made.
+ */
+LiveIndex SetupLiveIndex(char *dir, char *index_file, int keep_positions,
+                         PipelineConfig *config);
+
+/**
+ * Starts a thread that every so many seconds indexes the data files
+ * that are new or have changed, and drops the ones that have gone,
+ * saving the index to index_file again after each change if it isn't
+ * NULL. Starts the thread that merges the segments it adds, too.
+ *
+ * Does nothing if seconds isn't more than 0.
+ */
+void StartUpdates(LiveIndex live, int seconds, char *index_file);
+
+/**
+ * Sends the answer to one version 2 query: the COUNT frame, then the
+ * rows, with nothing to wait for in between. If k isn't negative, it's
+ * a RANKED query, and only the k best rows are sent, best first.
+ *
+ * \return 0 if successful, -1 on error.
+ */
+int SendResultsV2(LiveIndex live, int conn_fd, const char *query, int k);
+
+/**
+ * Runs version 2 of the query protocol with a client that's been sent
+ * the ACK and answered with a HELLO: answers its queries, in order, as
+ * fast as it sends them, until it says BYE. Then closes the connection.
+ */
+void ServeClientV2(LiveIndex live, int conn_fd);
+
+#endif  // QUERYSERVICE_H